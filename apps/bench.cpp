@@ -0,0 +1,270 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * @file bench.cpp
+ * @brief Headless benchmark: runs a config on a fixed number of frames and
+ * reports throughput, per-filter latencies and peak memory as JSON.
+ *
+ * Frames come from a recording (directory of .r/.rw files or a .trec
+ * file), which replaces the path of every capturer in the config, or from
+ * a synthetic scene (SyntheticCapturer) that replaces the capturers.
+ * Viewers are removed from the config.
+ *
+ * Example:
+ *   toffy_bench -c xml/p230_depth_ampl.xml --synthetic 160x120 -n 1000
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <set>
+
+#ifndef MSVC
+#include <sys/resource.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <toffy/capture/synthetic.hpp>
+#include <toffy/filterStats.hpp>
+#include <toffy/matPool.hpp>
+#include <toffy/parallelFilter.hpp>
+#include <toffy/pipeline.hpp>
+#include <toffy/player.hpp>
+#include <toffy/trace.hpp>
+
+using namespace std;
+using namespace toffy;
+namespace po = boost::program_options;
+using boost::property_tree::ptree;
+
+/** filters opening windows, never wanted in a benchmark */
+static const char* const viewers[] = {"imageview", "cloudviewpcl",
+                                      "cloudviewopencv", "videoout"};
+
+/** a node is a capturer if it has a connection or autoconnects */
+static bool isCapturer(const ptree& node)
+{
+    return node.get_child_optional("connection") ||
+           node.get_child_optional("autoconnect");
+}
+
+/**
+ * Remove the nodes of the types in @p strip, recursively, and point the
+ * capturers to @p recording or remove them if it is empty.
+ * @return number of capturers found
+ */
+static int prepare(ptree& pt, const set<string>& strip,
+                   const string& recording)
+{
+    int capturers = 0;
+    for (ptree::iterator it = pt.begin(); it != pt.end();) {
+        if (strip.count(it->first)) {
+            it = pt.erase(it);
+            continue;
+        }
+        if (isCapturer(it->second)) {
+            capturers++;
+            if (recording.empty()) {
+                it = pt.erase(it);
+                continue;
+            }
+            it->second.put("autoconnect", false);
+            it->second.put("playback", true);
+            it->second.put("options.loadPath", recording);
+            it->second.put("options.playback", true);
+        }
+        capturers += prepare(it->second, strip, recording);
+        ++it;
+    }
+    return capturers;
+}
+
+static long peakRssKb()
+{
+#ifndef MSVC
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) return ru.ru_maxrss;
+#endif
+    return -1;
+}
+
+int main(int argc, char* argv[])
+{
+    po::variables_map vm;
+    po::options_description desc("toffy_bench options");
+    desc.add_options()("help", "produce help message")(
+        "config,c", po::value<string>(), "Path to the config file")(
+        "frames,n", po::value<int>()->default_value(500),
+        "Frames to measure")(
+        "warmup,w", po::value<int>()->default_value(50),
+        "Frames to run before measuring")(
+        "recording,r", po::value<string>(),
+        "Directory of raw frames or .trec file for all capturers")(
+        "synthetic,s", po::value<string>(),
+        "Replace the capturers with a synthetic WxH depth/ampl scene")(
+        "objects", po::value<int>()->default_value(5),
+        "Boxes and people in the synthetic scene")(
+        "strip", po::value<string>()->default_value(""),
+        "Comma separated filter types to remove in addition to the viewers")(
+        "output,o", po::value<string>(),
+        "JSON result file, default stdout")(
+        "trace,t", po::value<string>(),
+        "Write a Chrome trace of the measured frames");
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+        po::notify(vm);
+    } catch (std::exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (vm.count("help") || !vm.count("config") ||
+        vm.count("recording") == vm.count("synthetic")) {
+        cerr << "Usage: toffy_bench -c config.xml (-r recording | -s WxH) "
+                "[options]\n"
+             << desc;
+        return vm.count("help") ? 0 : 1;
+    }
+    const string config = vm["config"].as<string>();
+    const int frames = vm["frames"].as<int>();
+    const int warmup = vm["warmup"].as<int>();
+    const string recording =
+        vm.count("recording") ? vm["recording"].as<string>() : "";
+
+    cv::Size size;
+    if (vm.count("synthetic") &&
+        sscanf(vm["synthetic"].as<string>().c_str(), "%dx%d", &size.width,
+               &size.height) != 2) {
+        cerr << "--synthetic expects WxH, e.g. 160x120" << endl;
+        return 1;
+    }
+
+    set<string> strip(viewers, viewers + sizeof(viewers) / sizeof(*viewers));
+    vector<string> extra;
+    boost::split(extra, vm["strip"].as<string>(), boost::is_any_of(","),
+                 boost::token_compress_on);
+    for (size_t i = 0; i < extra.size(); i++) {
+        if (!extra[i].empty()) strip.insert(extra[i]);
+    }
+
+    ptree pt;
+    try {
+        boost::property_tree::read_xml(config, pt);
+    } catch (boost::property_tree::xml_parser_error& e) {
+        cerr << "Could not read " << config << ": " << e.what() << endl;
+        return 1;
+    }
+    boost::optional<ptree&> root = pt.get_child_optional("toffy");
+    int capturers = root ? prepare(*root, strip, recording) : 0;
+    if (!recording.empty() && !capturers) {
+        cerr << "No capturer in " << config << " to play the recording."
+             << endl;
+        return 1;
+    }
+
+    Player p(boost::log::trivial::warning, false);
+    try {
+        if (p.loadConfig(pt, config) <= 0) {
+            cerr << "Could not load " << config << endl;
+            return 1;
+        }
+    } catch (std::exception& e) {
+        cerr << "Could not load " << config << ": " << e.what() << endl;
+        return 1;
+    }
+    FilterBank* fb = p.filterBank();
+    Frame& f = p.getFrame();
+
+    vector<Filter*> threaded;
+    fb->getFiltersByType(ParallelFilter::id_name, threaded);
+    fb->getFiltersByType(Pipeline::id_name, threaded);
+    for (size_t i = 0; i < threaded.size(); i++) {
+        threaded[i]->init();
+        threaded[i]->start();
+    }
+
+    // the synthetic scene loops over a few frames rendered up front, so
+    // that copying them stands in for the capturer
+    capturers::SyntheticCapturer synthetic;
+    if (size.area()) {
+        int objects = vm["objects"].as<int>();
+        ptree scene;
+        scene.put("options.width", size.width);
+        scene.put("options.height", size.height);
+        scene.put("options.boxes", objects / 2);
+        scene.put("options.people", objects - objects / 2);
+        scene.put("options.loop", 16);
+        synthetic.updateConfig(scene);
+    }
+
+    LatencyHistogram frameTimes;
+    int failures = 0;
+    chrono::steady_clock::time_point t0;
+    for (int n = 0; n < warmup + frames; n++) {
+        if (n == warmup) {
+            fb->resetFilterStats();
+            if (vm.count("trace")) Tracer::enable();
+            t0 = chrono::steady_clock::now();
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Tracer::setFrame(n);
+        if (size.area()) synthetic.filter(f, f);
+        bool ok = fb->filter(f, f);
+        if (n >= warmup) {
+            frameTimes.record(chrono::duration_cast<chrono::nanoseconds>(
+                                  chrono::steady_clock::now() - start)
+                                  .count());
+            if (!ok) failures++;
+        }
+    }
+    double wall =
+        chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    for (size_t i = 0; i < threaded.size(); i++) threaded[i]->stop();
+    if (vm.count("trace")) {
+        Tracer::disable();
+        Tracer::saveChromeTrace(vm["trace"].as<string>());
+    }
+
+    ptree res;
+    res.put("config", config);
+    res.put("source", recording.empty() ? "synthetic " +
+                                              vm["synthetic"].as<string>()
+                                        : recording);
+    res.put("warmup", warmup);
+    res.put("frames", frames);
+    res.put("failures", failures);
+    res.put("wallSeconds", wall);
+    res.put("fps", wall > 0 ? frames / wall : 0.0);
+    res.put("frameUs.mean", frameTimes.mean() / 1000);
+    res.put("frameUs.p50", frameTimes.percentile(50) / 1000);
+    res.put("frameUs.p95", frameTimes.percentile(95) / 1000);
+    res.put("frameUs.p99", frameTimes.percentile(99) / 1000);
+    res.put("frameUs.max", frameTimes.max() / 1000);
+    res.put("peakRssKb", peakRssKb());
+    res.add_child("matPool", MatPool::global().getStats());
+    res.add_child("filters", fb->getFilterStats().get_child("filters"));
+
+    if (vm.count("output")) {
+        boost::property_tree::write_json(vm["output"].as<string>(), res);
+    } else {
+        boost::property_tree::write_json(cout, res);
+    }
+    return failures == frames ? 2 : 0;
+}
@@ -11,6 +11,7 @@
 #include <opencv2/highgui.hpp>
 
 #include <toffy/player.hpp>
+#include <toffy/trace.hpp>
 
 #ifdef MSVC
 #define WIN32_LEAN_AND_MEAN
@@ -76,7 +77,14 @@ int main(int argc, char* argv[])
             "sleepDelay,s", po::value<int>()->default_value(30),
             "ms to wait between frames (0 for keypress)")(
             "output2File,f", po::value<bool>()->default_value(false),
-            "Set program output to a file, silence console")
+            "Set program output to a file, silence console")(
+            "stats,t",
+            po::value<std::string>()->default_value("filterStats.json"),
+            "JSON file for the filter statistics, written on 's' and on exit "
+            "if given")(
+            "trace,r", po::value<std::string>(),
+            "Record a timeline of the filter calls, written as Chrome trace "
+            "JSON to this file on 't' and on exit")
             //("extensions,e", po::value< std::vector<std::string> >(), "Extensions")
             ;
 
@@ -119,6 +127,7 @@ int main(int argc, char* argv[])
                         vm["output2File"].as<bool>());
 
         p.loadConfig(vm["config"].as<std::string>());
+        if (vm.count("trace")) toffy::Tracer::enable();
         std::cout << "Player done" << std::endl;
 
 #ifdef MSVC
@@ -144,8 +153,18 @@ int main(int argc, char* argv[])
             //boost::this_thread::sleep( boost::posix_time::milliseconds(30) );
             //cout << "KEY " << c << "\t" << (char)c << endl;
             keepRunning = c != 'q';
+            if (c == 's') p.saveFilterStats(vm["stats"].as<std::string>());
+            if (c == 't' && vm.count("trace")) {
+                toffy::Tracer::saveChromeTrace(vm["trace"].as<std::string>());
+            }
         } while (keepRunning);
         std::cout << "Stopped..." << std::endl;
+        if (!vm["stats"].defaulted()) {
+            p.saveFilterStats(vm["stats"].as<std::string>());
+        }
+        if (vm.count("trace")) {
+            toffy::Tracer::saveChromeTrace(vm["trace"].as<std::string>());
+        }
 
     } catch (std::exception& e) {
         std::cerr << "exception: " << e.what() << "\n";
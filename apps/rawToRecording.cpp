@@ -0,0 +1,39 @@
+/**
+ *
+ * @file rawToRecording.cpp
+ * @brief Convert a directory of numbered .r/.rw frame files into a single
+ * .trec recording that the bta filter can play back (options.loadPath).
+ *
+ */
+#include <iostream>
+
+#include <toffy/bta/recording.hpp>
+
+using namespace std;
+using namespace toffy::capturers;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " <frame directory> <file.trec>"
+             << endl;
+        return 1;
+    }
+    int n = convertRawDirectory(argv[1], argv[2]);
+    if (n < 0) {
+        cerr << "conversion failed" << endl;
+        return 1;
+    }
+
+    RecordingReader rec;
+    if (!rec.open(argv[2]) || rec.size() != (size_t)n) {
+        cerr << "could not read back " << argv[2] << endl;
+        return 1;
+    }
+    cout << n << " frames written to " << argv[2];
+    if (n) {
+        cout << " (" << rec.number(0) << " - " << rec.number(n - 1) << ")";
+    }
+    cout << endl;
+    return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ *
+ * @file yamlToSnapshot.cpp
+ * @brief Convert exportYaml dumps to snapshot files that importSnapshot
+ * plays back: a single file, or every .yaml file of a directory.
+ *
+ */
+#include <cstring>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+#include <toffy/import/snapshot.hpp>
+
+using namespace std;
+using namespace toffy;
+
+int main(int argc, char* argv[])
+{
+    bool compress = false;
+    int arg = 1;
+    if (arg < argc && !strcmp(argv[arg], "--compress")) {
+        compress = true;
+        arg++;
+    }
+    if (argc - arg < 1 || argc - arg > 2) {
+        cerr << "usage: " << argv[0]
+             << " [--compress] <file.yaml> [<file.tfs>] | <directory>" << endl;
+        return 1;
+    }
+
+    string in = argv[arg];
+    if (boost::filesystem::is_directory(in)) {
+        int n = snapshot::convertYamlDirectory(in, compress);
+        if (n < 0) {
+            cerr << "conversion failed" << endl;
+            return 1;
+        }
+        cout << n << " files converted in " << in << endl;
+        return 0;
+    }
+
+    string out = arg + 1 < argc
+                     ? argv[arg + 1]
+                     : boost::filesystem::path(in)
+                           .replace_extension(".tfs")
+                           .string();
+    if (!snapshot::fromYaml(in, out, compress)) {
+        cerr << "could not convert " << in << endl;
+        return 1;
+    }
+    cout << in << " -> " << out << endl;
+    return 0;
+}
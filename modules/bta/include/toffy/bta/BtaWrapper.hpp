@@ -28,11 +28,20 @@
 #define RAWFILE ".r"
 #endif
 
+#include <memory>
+
 #include <boost/thread.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <bta.h>
 #include <toffy/io/imagesensor.hpp>
+#include <toffy/bta/frameRing.hpp>
+
+namespace toffy {
+namespace capturers {
+class RecordingWriter;
+}
+}
 
 struct network
 {
@@ -107,6 +116,8 @@ class DLLExport BtaWrapper : public ImageSensor
 
     //void deserializeFrame(char *data, size_t &size);
     int saveRaw(std::string fileName, char *data);
+    /** append a frame to a recording instead of writing a .r file */
+    int saveRaw(toffy::capturers::RecordingWriter &rec, int number, char *data);
     char *loadRaw(std::string rawFile);
 
     std::string getBltstream() const;
@@ -116,10 +127,43 @@ class DLLExport BtaWrapper : public ImageSensor
     void setDeviceType(const BTA_DeviceType &value);
 
     bool isAsync() { return async; }
-    BTA_Frame *waitForNextFrame();  // wait for next frame to arrive....
+    /**
+     * wait for next frame to arrive....
+     * @return frame valid until the next call, NULL after disconnect()
+     */
+    BTA_Frame *waitForNextFrame();
+
+    /** shared ownership of a BTA_Frame, released by the matching deleter */
+    typedef BtaFrameRing::FramePtr FramePtr;
+
+    /**
+     * @brief Wait for the next frame and hand it over to the caller
+     *
+     * Unlike waitForNextFrame() the frame (and cv::Mat headers wrapping its
+     * channels) stays valid as long as a copy of the pointer is alive; its
+     * ring slot is reused after that.
+     */
+    FramePtr takeNextFrame();
+
+    /** @brief Take ownership of a frame returned by loadRaw() */
+    static FramePtr adoptLoadedFrame(char *data);
+
+    /** @brief Take ownership of a frame returned by capture() */
+    static FramePtr adoptCapturedFrame(char *data);
+
+    /**
+     * @brief Frame over a serialized frame (see loadFrame()) without copying
+     * the channel data
+     * @param data serialized frame, e.g. RecordingReader::payload()
+     * @param keep kept as long as the frame is, e.g. RecordingReader::mapping()
+     */
+    static FramePtr viewFrame(const char *data, std::shared_ptr<const void> keep);
 
     // queue handling:
-    void updateFrame(BTA_Frame *frame);  // update the
+    void updateFrame(BTA_Frame *frame);  // copy into the frame ring
+
+    /** @brief Frame ring of the async path, for its counters */
+    const BtaFrameRing &frameRing() const { return ring; }
 
     bool hasChannels =
         false;  ///< set to true if channels have been selected this way
@@ -168,15 +212,8 @@ class DLLExport BtaWrapper : public ImageSensor
 
     bool async;  //< set to true if frameArrived* callbacks are used.
 
-    boost::mutex frameMutex, fillFrameMutex;
-    boost::condition_variable newFrameCond;
-
-    BTA_Frame *frames
-        [3];  //< array of frames, one is filled by bta lib, the other in use
-    BTA_Frame *frameInUse;   // pointer to the current frame
-    BTA_Frame *frameToFill;  // pointer to the current frame
-    int toFillIndex;         // index of the current frame
-    bool hasBeenUpdated;     // do we have new data yet?
+    BtaFrameRing ring;      ///< frames copied by the callback, see updateFrame()
+    FramePtr current;       ///< frame returned by waitForNextFrame()
 
     int numChannels = 0;  // number of active channels
     BTA_ChannelSelection channels[MAX_CHANNEL_SELECTIONS];
@@ -185,11 +222,6 @@ class DLLExport BtaWrapper : public ImageSensor
         theChannels;  //< comma-separated list of channels as read by xml
     bool parseChannelSelection(const std::string &chans);
 
-    /** change frames, resets hasBeenUpdated
-     * @return the new frame to use for processing (frameInUse)
-    */
-    BTA_Frame *flipFrame();
-
     ConnState state;
 };
 
@@ -13,6 +13,8 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#pragma once
+
 //Keep for compatibility with old binary .r files.
 
 typedef struct {
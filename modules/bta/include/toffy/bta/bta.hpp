@@ -19,6 +19,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <toffy/capture/capturerFilter.hpp>
+#include <toffy/capture/prefetcher.hpp>
 #include <toffy/cam/cameraParams.hpp>
 
 class BtaWrapper; // forward declaration of the lower-layer sensor wrapper class
@@ -26,6 +27,8 @@ class BtaWrapper; // forward declaration of the lower-layer sensor wrapper class
 namespace toffy {
 namespace capturers {
 
+class RecordingReader;
+
 /**
  * @brief Bluetechnix BtaTofApi wrapper filter
  * @ingroup Capturers
@@ -74,6 +77,11 @@ public:
     virtual bool playback() const {return CapturerFilter::playback();}
     virtual void playback(const bool &pb);
 
+    /**
+     * @brief Set the playback source
+     * @param newPath .bltstream file, .trec recording or a directory of
+     * numbered .r/.rw files
+     */
     virtual int loadPath(const std::string &newPath);
     virtual void save(const bool &save);
     virtual void savePath(const std::string &newPath);
@@ -85,6 +93,19 @@ private:
     int distsSize = 0;
     int width = 0, height = 0;
     bool dynOutputs = true; // dynamically map output depending on channels present
+    bool zeroCopy = false; // wrap the channel buffers instead of copying them
+
+    /// playback from a .trec recording, see loadPath()
+    std::shared_ptr<RecordingReader> _recording;
+
+    /// owner of the BTA frame being imported, empty if it cannot be kept
+    std::shared_ptr<void> _frame;
+
+    /// _frame views a read only .trec mapping, its channels are never wrapped
+    bool _frameReadOnly = false;
+
+    /// reads .r/.rw files ahead in playback, see prefetch()
+    std::unique_ptr<Prefetcher<std::shared_ptr<void> > > _prefetcher;
 
     float globalOfs = 0.f;
 
@@ -105,6 +126,15 @@ private:
     std::string camType;
     toffy::cam::CameraPtr cam;
 
+    /** next frame of an async stream; taken over from the wrapper if zeroCopy */
+    char* nextFrame();
+
+    /** load the raw file number @p i of the playback directory */
+    std::shared_ptr<void> loadRawFrame(int i);
+
+    /** next raw file in playback order from the prefetcher */
+    char* nextPrefetched(bool backward);
+
     void setOutputsDynamic(const Frame &in, Frame& out, const boost::posix_time::ptime& start, char* data);
 
     void setOutputsClassic(const Frame &in, Frame& out, const boost::posix_time::ptime& start, char* data);
@@ -113,6 +143,24 @@ private:
     void setOutputsClassicXYZAmpl(const Frame &in, Frame& out, const boost::posix_time::ptime& start, char* data);
     void setOutputsClassicZAmpl(const Frame &in, Frame& out, const boost::posix_time::ptime& start, char* data);
     void setOutputsClassicRawPhases(const Frame &in, Frame& out, const boost::posix_time::ptime& start, char* data);
+    /** import the 16 bit @p channels of a frame into the slots @p names */
+    void setOutputsChannels(Frame& out, const boost::posix_time::ptime& start, char* data,
+                            const int* channels, const char* const* names, int n);
+
+    /**
+     * @brief Slot matrix for a channel buffer of the current frame
+     * @param data channel data
+     * @param rows, cols channel resolution
+     * @param type OpenCV type of the channel data
+     * @param dst current slot matrix, reused for copies if possible
+     * @param flipped apply the flip()/flip_x()/flip_y() settings
+     * @return header over data (zeroCopy, no flip, writable frame) or a copy
+     *
+     * Flipping is fused into the copy: one cv::flip() from the channel
+     * buffer into the slot, instead of memcpy and up to two in-place flips.
+     */
+    matPtr importChannel(void* data, int rows, int cols, int type,
+                         matPtr dst, bool flipped = true);
 };
 
 }}
@@ -0,0 +1,116 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <bta.h>
+
+/**
+ * @brief Pre-allocated frame slots between the BTA callback thread and the
+ * capture filter
+ *
+ * push() copies an arriving frame into a free slot, pop() hands the oldest
+ * or newest queued frame to the consumer. A popped frame goes back to the
+ * free slots when the last copy of its pointer is released. Slot buffers
+ * are reused, so once the frame format is stable there are no allocations
+ * per frame.
+ *
+ * What happens if the consumer is too slow depends on the Policy; every
+ * frame ends up either delivered or counted as dropped.
+ */
+class BtaFrameRing
+{
+   public:
+    typedef std::shared_ptr<BTA_Frame> FramePtr;
+
+    enum Policy
+    {
+        LatestOnly,  ///< pop() gets the newest frame, older ones are dropped
+        Block,       ///< push() waits for a free slot, nothing is dropped
+        Queue        ///< frames are delivered in order, new ones dropped if full
+    };
+
+    struct Stats {
+        uint64_t received;   ///< push() calls
+        uint64_t delivered;  ///< frames returned by pop()
+        uint64_t dropped;    ///< frames overwritten or rejected
+        size_t queued;       ///< frames waiting for pop()
+    };
+
+    /**
+     * @param slots number of frame buffers (at least 2), including the
+     * ones held by the consumer
+     */
+    explicit BtaFrameRing(size_t slots = 3, Policy policy = LatestOnly);
+    ~BtaFrameRing();
+
+    /**
+     * @brief Change slot count and policy
+     *
+     * Queued frames are dropped, frames held by the consumer stay valid.
+     */
+    void configure(size_t slots, Policy policy);
+
+    size_t slots() const;
+    Policy policy() const;
+
+    /**
+     * @brief Copy @p frame into the ring, called by the camera callback
+     * @return false if the frame was dropped
+     */
+    bool push(const BTA_Frame *frame);
+
+    /**
+     * @brief Next frame according to the policy
+     * @param timeoutMs maximum wait, negative waits until a frame arrives
+     * or close() is called
+     * @return empty pointer on timeout or if closed
+     */
+    FramePtr pop(int timeoutMs = -1);
+
+    /** @brief Wake up and reject pop() and push() callers */
+    void close();
+
+    /** @brief Accept frames again after close() */
+    void open();
+
+    Stats stats() const;
+
+    /** @brief stats() as received, delivered, dropped, queued */
+    boost::property_tree::ptree getStats() const;
+
+    void resetStats();
+
+    /** @brief Policy from "latest", "block" or "queue" */
+    static bool parsePolicy(const std::string &name, Policy &policy);
+    static std::string policyName(Policy policy);
+
+    /** @brief Deep copy, reusing the buffers of @p dst where possible */
+    static void copyFrame(BTA_Frame *dst, const BTA_Frame *src);
+
+    /** @brief Free a frame created with new and filled by copyFrame() */
+    static void freeFrame(BTA_Frame *frame);
+
+   private:
+    class Impl;
+    struct Release;
+    std::shared_ptr<Impl> _impl;
+};
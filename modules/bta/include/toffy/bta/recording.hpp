@@ -0,0 +1,176 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <toffy/bta/FrameHeader.hpp>
+
+namespace toffy {
+namespace capturers {
+
+/**
+ * @brief File header of a frame recording (.trec)
+ *
+ * A recording holds many raw frames in one file:
+ *
+ *     RecordingHeader
+ *     record*          RecordingRecord, FrameHeader, payload, 8 byte aligned
+ *     index            RecordingIndexEntry[frames]
+ *
+ * FrameHeader and payload are exactly the contents of a former .r/.rw
+ * file. frames and indexOffset are written on close; a recording that was
+ * not closed is indexed by scanning its records when opened.
+ */
+struct RecordingHeader {
+    char magic[8];          ///< "TOFFYREC"
+    uint32_t version;       ///< format version
+    uint32_t reserved;
+    uint64_t frames;        ///< number of index entries, 0 while writing
+    uint64_t indexOffset;   ///< file offset of the index, 0 while writing
+};
+
+/** @brief Prefix of every frame record */
+struct RecordingRecord {
+    uint32_t magic;  ///< RecordingRecord::tag
+    int32_t number;  ///< frame number, the file name of a former .r file
+
+    static const uint32_t tag = 0x43455254;  // "TREC"
+};
+
+/** @brief Index entry, one per frame */
+struct RecordingIndexEntry {
+    uint64_t offset;  ///< file offset of the FrameHeader
+    int32_t number;   ///< frame number
+    uint32_t length;  ///< FrameHeader and payload in bytes
+};
+
+/**
+ * @brief Appends frames to a recording file
+ *
+ * Not thread safe.
+ */
+class RecordingWriter
+{
+   public:
+    RecordingWriter();
+    ~RecordingWriter();
+
+    /**
+     * @brief Create (or truncate) a recording
+     * @return false if the file cannot be written
+     */
+    bool open(const std::string &path);
+
+    /**
+     * @brief Append a frame
+     * @param header FrameHeader of the frame, lenght is the payload size
+     * @param payload serialized frame
+     * @param number frame number used for playback (cnt)
+     */
+    bool append(const FrameHeader &header, const char *payload, int number);
+
+    /**
+     * @brief Append the contents of a .r/.rw file
+     * @param number frame number, usually the file name
+     */
+    bool appendFile(const std::string &rawFile, int number);
+
+    /** @brief Write the index and close the file */
+    bool close();
+
+    bool isOpen() const { return _file != NULL; }
+
+    /** @brief Number of frames written so far */
+    size_t size() const { return _index.size(); }
+
+   private:
+    FILE *_file;
+    uint64_t _pos;
+    std::vector<RecordingIndexEntry> _index;
+
+    bool write(const void *data, size_t len);
+};
+
+/**
+ * @brief Memory mapped, read only access to a recording
+ *
+ * Frames are served from the mapping, nothing is copied. Pointers stay
+ * valid as long as the reader is open or a reference from mapping() is
+ * held. Without mmap (MSVC) the file is read into memory once on open().
+ */
+class RecordingReader
+{
+   public:
+    RecordingReader();
+    ~RecordingReader();
+
+    /** @brief Map a recording, returns false if it is not a valid one */
+    bool open(const std::string &path);
+
+    void close();
+
+    bool isOpen() const { return _map.get() != NULL; }
+
+    /** @brief Number of frames */
+    size_t size() const { return _size; }
+
+    /** @brief Frame number of entry @p i */
+    int number(size_t i) const { return _index[i].number; }
+
+    /** @brief Entry of frame number @p number, -1 if not recorded */
+    long find(int number) const;
+
+    /**
+     * @brief Frame @p i
+     * @return FrameHeader in the mapping, the payload follows it
+     */
+    const FrameHeader *frame(size_t i) const;
+
+    /** @brief Payload of frame @p i, FrameHeader::lenght bytes */
+    const char *payload(size_t i) const
+    {
+        return (const char *)(frame(i) + 1);
+    }
+
+    /** @brief Reference to the mapping to keep frames valid */
+    std::shared_ptr<const void> mapping() const { return _map; }
+
+   private:
+    std::shared_ptr<const void> _map;
+    const char *_data;
+    size_t _length;
+
+    const RecordingIndexEntry *_index;
+    size_t _size;
+    bool _sorted;
+    std::vector<RecordingIndexEntry> _scanned;  ///< index of unclosed files
+
+    bool scan();
+};
+
+/**
+ * @brief Convert a directory of numbered .r/.rw files to a recording
+ * @return number of frames written, -1 on error
+ */
+int convertRawDirectory(const std::string &dir, const std::string &file);
+
+}  // namespace capturers
+}  // namespace toffy
@@ -15,12 +15,22 @@
    limitations under the License.
 */
 #pragma once
+#include <cfloat>
+#include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
 #include <boost/log/trivial.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <opencv2/calib3d.hpp>
 
@@ -50,6 +60,169 @@ static inline void pointTo3d(const cv::Mat& x, const cv::Mat& y, const cv::Mat&
 }
 
 
+/**
+ * @brief Viewing ray of every pixel of a pinhole camera
+ *
+ * Holds ((x - cx) / fx, (y - cy) / fy) per pixel, a distance d along the
+ * optical axis back-projects to d * (rx, ry, 1). The maps only depend on
+ * the camera matrix and the resolution; get() shares them between all
+ * filters using the same camera.
+ */
+class RayMap
+{
+   public:
+    cv::Size size;
+    double fx, fy, cx, cy;
+    cv::Mat rx, ry;  ///< CV_32F ray slopes per pixel
+
+    /**
+     * @param cameraMatrix the 3x3 double values camera matrix
+     * @param imgSize resolution of the depth images
+     */
+    RayMap(const cv::Mat& cameraMatrix, const cv::Size& imgSize)
+        : size(imgSize),
+          fx(cameraMatrix.at<double>(0, 0)),
+          fy(cameraMatrix.at<double>(1, 1)),
+          cx(cameraMatrix.at<double>(0, 2)),
+          cy(cameraMatrix.at<double>(1, 2)),
+          rx(imgSize, CV_32F),
+          ry(imgSize, CV_32F)
+    {
+        double fxr = 1. / fx, fyr = 1. / fy;
+        for (int y = 0; y < size.height; y++) {
+            float* px = rx.ptr<float>(y);
+            float* py = ry.ptr<float>(y);
+            for (int x = 0; x < size.width; x++) {
+                px[x] = (x - cx) * fxr;
+                py[x] = (y - cy) * fyr;
+            }
+        }
+    }
+
+    bool matches(const cv::Mat& cameraMatrix, const cv::Size& imgSize) const
+    {
+        return imgSize == size && cameraMatrix.at<double>(0, 0) == fx &&
+               cameraMatrix.at<double>(1, 1) == fy &&
+               cameraMatrix.at<double>(0, 2) == cx &&
+               cameraMatrix.at<double>(1, 2) == cy;
+    }
+
+    /**
+     * @brief Back-project a depth image into a CV_32FC3 point image
+     * @param depth distances along the optical axis, CV_32F or any single
+     * channel type convertTo() takes; roi views are fine
+     * @param xyz output, (re)allocated if needed
+     * @param minDepth depths <= minDepth become NaN points
+     * @param maxDepth depths > maxDepth become NaN points
+     */
+    void backProject(const cv::Mat& depth, cv::Mat& xyz,
+                     float minDepth = -FLT_MAX, float maxDepth = FLT_MAX) const
+    {
+        xyz.create(size, CV_32FC3);
+        backProjectRows(depth, xyz, 0, size.height, minDepth, maxDepth);
+    }
+
+    /**
+     * @brief backProject() for rows [rowBegin, rowEnd) only
+     *
+     * @p xyz must be allocated already. Rows outside the range are not
+     * touched, so bands of the same image can run concurrently. Depths
+     * of other types than CV_32F are converted band by band first.
+     */
+    void backProjectRows(const cv::Mat& depth, cv::Mat& xyz, int rowBegin,
+                         int rowEnd, float minDepth = -FLT_MAX,
+                         float maxDepth = FLT_MAX) const
+    {
+        CV_Assert(depth.size() == size && depth.channels() == 1);
+        CV_Assert(xyz.size() == size && xyz.type() == CV_32FC3);
+
+        cv::Mat band = depth.rowRange(rowBegin, rowEnd), converted;
+        if (band.type() != CV_32F) {
+            band.convertTo(converted, CV_32F);
+            band = converted;
+        }
+        cv::Mat out = xyz.rowRange(rowBegin, rowEnd);
+        if (band.isContinuous() && out.isContinuous()) {
+            projectRun(band.ptr<float>(), rx.ptr<float>(rowBegin),
+                       ry.ptr<float>(rowBegin), out.ptr<float>(),
+                       band.total(), minDepth, maxDepth);
+            return;
+        }
+        // depth or xyz is a view into a larger image: each row is still
+        // size.width contiguous pixels, and the full image row indexes rx/ry
+        for (int r = 0; r < band.rows; r++) {
+            projectRun(band.ptr<float>(r), rx.ptr<float>(rowBegin + r),
+                       ry.ptr<float>(rowBegin + r), out.ptr<float>(r),
+                       size.width, minDepth, maxDepth);
+        }
+    }
+
+    /**
+     * @brief Shared map for a camera matrix and resolution, built on first
+     * use. Users should keep the pointer and only call get() again when
+     * matches() fails.
+     */
+    static std::shared_ptr<const RayMap> get(const cv::Mat& cameraMatrix,
+                                             const cv::Size& imgSize)
+    {
+        static boost::mutex mtx;
+        static std::vector<std::weak_ptr<const RayMap> > cache;
+
+        boost::lock_guard<boost::mutex> lock(mtx);
+        for (size_t i = 0; i < cache.size();) {
+            std::shared_ptr<const RayMap> map = cache[i].lock();
+            if (!map) {
+                cache.erase(cache.begin() + i);  // nobody uses it any more
+                continue;
+            }
+            if (map->matches(cameraMatrix, imgSize)) return map;
+            i++;
+        }
+        BOOST_LOG_TRIVIAL(debug) << "RayMap: new map " << imgSize;
+        std::shared_ptr<const RayMap> map(new RayMap(cameraMatrix, imgSize));
+        cache.push_back(map);
+        return map;
+    }
+
+   private:
+    /** back-projects @p n pixels stored one after the other */
+    static void projectRun(const float* d, const float* px, const float* py,
+                           float* out, size_t n, float minDepth,
+                           float maxDepth)
+    {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128 lo = _mm_set1_ps(minDepth), hi = _mm_set1_ps(maxDepth);
+        const __m128 vnan = _mm_set1_ps(nan);
+        // each pixel is stored as 4 floats, the 4th is overwritten by the
+        // next pixel, so keep one pixel for the scalar loop
+        for (; i + 4 < n; i += 4) {
+            __m128 z = _mm_loadu_ps(d + i);
+            __m128 ok = _mm_and_ps(_mm_cmpgt_ps(z, lo), _mm_cmple_ps(z, hi));
+            z = _mm_or_ps(_mm_and_ps(ok, z), _mm_andnot_ps(ok, vnan));
+            __m128 x = _mm_mul_ps(_mm_loadu_ps(px + i), z);
+            __m128 y = _mm_mul_ps(_mm_loadu_ps(py + i), z);
+            __m128 w = z;
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_storeu_ps(out + 3 * i, x);
+            _mm_storeu_ps(out + 3 * i + 3, y);
+            _mm_storeu_ps(out + 3 * i + 6, z);
+            _mm_storeu_ps(out + 3 * i + 9, w);
+        }
+#endif
+        for (; i < n; i++) {
+            float z = (d[i] > minDepth && d[i] <= maxDepth) ? d[i] : nan;
+            out[3 * i] = px[i] * z;
+            out[3 * i + 1] = py[i] * z;
+            out[3 * i + 2] = z;
+        }
+    }
+};
+
+typedef std::shared_ptr<const RayMap> RayMapPtr;
+
 /**
  * @brief Camera geometry meta-data 
  * 
@@ -124,6 +297,12 @@ class Camera
         return pixSinAngle * distance;
     }
 
+    /**
+     * @brief Viewing rays of the camera, shared with all users of the same
+     * camera matrix and image size
+     */
+    RayMapPtr rays() const { return RayMap::get(cameraMatrix, imgSize); }
+
 };
 
 typedef std::shared_ptr<Camera> CameraPtr;
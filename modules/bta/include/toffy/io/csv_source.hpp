@@ -15,7 +15,10 @@
 */
 #pragma once
 
+#include <memory>
+
 #include <toffy/capture/capturerFilter.hpp>
+#include <toffy/capture/prefetcher.hpp>
 
 namespace toffy {
 namespace capturers {
@@ -53,17 +56,34 @@ public:
     static Filter* creator() { return new CSVSource();}
 
 private:
+    /** depth and amplitudes of one sequence number, empty if not loaded */
+    struct Loaded {
+        matPtr depth, ampl;
+    };
+
     // frame size data
     int width, height;
+    int _delay; ///< ms to wait before each frame
     std::string _amplPattern, _depthPattern, _out_depth, _out_ampl,
         _out_mf, _out_it,
         _out_fc, _out_ts,
         _out_mt, _out_lt, _out_gt;
 std::vector<int> fcs;
-int sequence; 
+int sequence; ///< next file number
 bool useSequence;
-  void loadDepth(Frame& frame, cv::Mat& depth);
-  void loadAmpl(Frame& frame, cv::Mat& ampl);
+bool _scanLast; ///< options.last not given, the sequence ends at a missing file
+  /// reads the following files ahead when useSequence is set
+  std::unique_ptr<Prefetcher<Loaded> > _prefetcher;
+
+  /** options.last, or the file before the first missing depth file */
+  void configureLast(const boost::property_tree::ptree& pt);
+  /** @p pattern with the sequence number filled in */
+  static std::string filePath(const std::string& pattern, int seq);
+
+  Loaded load(int seq) const;
+  bool loadDepth(int seq, cv::Mat& depth) const;
+  bool loadAmpl(int seq, cv::Mat& ampl) const;
+  bool loadMat(const char* path, cv::Mat& mat) const;
 };
 
 } // capturers
@@ -1,9 +1,11 @@
 #include <arpa/inet.h>  // inet_aton
 #include <string.h>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <vector>
 
 #include <bta.h>
 
@@ -15,6 +17,7 @@
 
 #include <toffy/bta/BtaWrapper.hpp>
 #include <toffy/bta/FrameHeader.hpp>
+#include <toffy/bta/recording.hpp>
 #include <toffy/filter_helpers.hpp>
 
 using namespace std;
@@ -94,13 +97,6 @@ BtaWrapper::BtaWrapper()
     // TODO is size really needed;
     // setSize(160, 120);
     // TODO create header with manufacturer codes
-    frames[0] = new BTA_Frame();
-    frames[1] = new BTA_Frame();
-    frames[2] = new BTA_Frame();
-    frameToFill = frames[0];
-    frameInUse = frames[1];
-    toFillIndex = 0;
-    hasBeenUpdated = false;
 
     manufacturer = 1;
 }
@@ -256,6 +252,19 @@ int BtaWrapper::parseConfig(const boost::property_tree::ptree pt)
     pt_optional_get<int32_t>(pt, "connection.deviceType", i32);
     config.deviceType = (BTA_DeviceType)i32;
 
+    // frames between the callback and the filter
+    unsigned int slots = ring.slots();
+    pt_optional_get<unsigned int>(pt, "connection.ringSlots", slots);
+    BtaFrameRing::Policy policy = ring.policy();
+    std::string policyName;
+    if (pt_optional_get<std::string>(pt, "connection.ringPolicy", policyName) &&
+        !BtaFrameRing::parsePolicy(policyName, policy)) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Unknown connection.ringPolicy " << policyName
+            << ", use latest, block or queue.";
+    }
+    ring.configure(slots, policy);
+
     return 0;
 }
 
@@ -283,6 +292,7 @@ int BtaWrapper::connect()
         return -1;
     }
     state = connecting;
+    ring.open();
 
     config.infoEventEx2 = infoEventCbEx2;
     config.frameArrivedEx2 = &frameArrivedEx2;
@@ -454,6 +464,8 @@ BTA_Status BtaWrapper::setChannels()
 
 int BtaWrapper::disconnect()
 {
+    // wake up a filter waiting for frames
+    ring.close();
     if (deviceInfo != NULL) {
         status = BTAfreeDeviceInfo(deviceInfo);
         if (status != BTA_StatusOk) {
@@ -557,7 +569,12 @@ int BtaWrapper::writeRegister(uint32_t reg, uint32_t data)
     return 0;
 }
 
-char *BtaWrapper::loadFrame(char *data, std::string /*ext*/)
+/**
+ * Deserialize a frame as written by serializeFrame(). The structs are
+ * malloc()ed; with copyData the channel buffers too, else they point
+ * into @p data.
+ */
+static BTA_Frame *parseFrame(const char *data, bool copyData)
 {
     BTA_Frame *frame = (BTA_Frame *)malloc(sizeof(BTA_Frame));
     memcpy(frame, data, sizeof(BTA_Frame));
@@ -583,14 +600,12 @@ char *BtaWrapper::loadFrame(char *data, std::string /*ext*/)
     BOOST_LOG_TRIVIAL(debug)
         << "frame->frameCounter " << (float)frame->frameCounter;
     BOOST_LOG_TRIVIAL(debug) << "frame->timeStamp " << (int)frame->timeStamp;
-    cout << endl;
 
     // if (UNIX && ext == ".rw")
     memcpy(&frame->channelsLen, data + 28, 1);
 
     BOOST_LOG_TRIVIAL(debug)
         << "frame->channelsLen: " << (int)frame->channelsLen;
-    cout << endl;
 
     // TODO channelsLen is nº of channels or the byte lenght??
     frame->channels =
@@ -628,7 +643,6 @@ char *BtaWrapper::loadFrame(char *data, std::string /*ext*/)
         BOOST_LOG_TRIVIAL(debug)
             << "frame->channels[i]->modulationFrequency: "
             << (int)frame->channels[i]->modulationFrequency;
-        cout << endl;
 
         // TEST
         // pos+=28;
@@ -648,13 +662,26 @@ char *BtaWrapper::loadFrame(char *data, std::string /*ext*/)
                      (frame->channels[i]->xRes * frame->channels[i]->yRes));
         dataSize *= frame->channels[i]->xRes * frame->channels[i]->yRes;
 
-        frame->channels[i]->data = (uint8_t *)malloc(dataSize);
-        memcpy(frame->channels[i]->data, data + pos, dataSize);
+        // the serialized struct holds stale pointers
+        frame->channels[i]->metadata = NULL;
+        frame->channels[i]->metadataLen = 0;
+        frame->channels[i]->dataLen = dataSize;
+        if (copyData) {
+            frame->channels[i]->data = (uint8_t *)malloc(dataSize);
+            memcpy(frame->channels[i]->data, data + pos, dataSize);
+        } else {
+            frame->channels[i]->data = (uint8_t *)(data + pos);
+        }
 
         pos += dataSize;
     }
     BOOST_LOG_TRIVIAL(debug) << "frame loaded.";
-    return (char *)frame;
+    return frame;
+}
+
+char *BtaWrapper::loadFrame(char *data, std::string /*ext*/)
+{
+    return (char *)parseFrame(data, true);
 }
 
 char *BtaWrapper::serializeFrame(char *data, size_t &size)
@@ -1107,6 +1134,21 @@ int BtaWrapper::saveRaw(string fileName, char *data)
     return 0;
 }
 
+int BtaWrapper::saveRaw(toffy::capturers::RecordingWriter &rec, int number,
+                        char *data)
+{
+    FrameHeader header;
+    header.manufacturer = manufacturer;
+    header.device = device;
+
+    size_t size;
+    char *serialized = serializeFrame(data, size);
+    header.lenght = static_cast<int>(size);
+    bool ok = rec.append(header, serialized, number);
+    free(serialized);
+    return ok ? 0 : -1;
+}
+
 char *BtaWrapper::loadRaw(string rawFile)
 {
     FILE *raw = fopen(rawFile.c_str(), "rb");
@@ -1171,44 +1213,6 @@ int BtaWrapper::setLibParam(int &param, float &data)
 
 using namespace std;
 
-static void freeMetaData(BTA_Channel *chan)
-{
-    for (uint32_t i = 0; i < chan->metadataLen; i++) {
-        delete chan->metadata[i];
-    }
-    delete chan->metadata;
-}
-
-static void freeChannel(BTA_Channel *chan)
-{
-    freeMetaData(chan);
-    delete chan->metadata;
-    delete chan->data;
-    delete chan;
-}
-
-static void freeChannels(BTA_Frame *frame)
-{
-    for (uint32_t i = 0; i < frame->channelsLen; i++) {
-        freeChannel(frame->channels[i]);
-    }
-    delete frame->channels;
-}
-
-static inline void cpyMetaData(BTA_Channel *dst, const BTA_Channel *src)
-{
-    for (uint32_t i = 0; i < src->metadataLen; i++) {
-        BTA_Metadata *s = src->metadata[i];
-        BTA_Metadata *d = dst->metadata[i];
-        if (d->dataLen != s->dataLen) {
-            free(d->data);
-            d->data = malloc(s->dataLen);
-            d->dataLen = s->dataLen;
-        }
-        memcpy(d->data, s->data, d->dataLen);
-    }
-}
-static bool debugCvt = false;
 
 std::string getChannelSelectionName(BTA_ChannelSelection sel)
 {
@@ -1313,145 +1317,60 @@ std::string getChannelTypeName(BTA_ChannelId cid)
     }
 }
 
-static void cpyChannel(BTA_Channel *dst, const BTA_Channel *src)
-{
-    dst->id = src->id;
-    dst->xRes = src->xRes;
-    dst->yRes = src->yRes;
-    dst->dataFormat = src->dataFormat;
-    dst->unit = src->unit;
-    dst->integrationTime = src->integrationTime;
-    dst->modulationFrequency = src->modulationFrequency;
-    dst->lensIndex = src->lensIndex;
-    dst->flags = src->flags;
-    dst->sequenceCounter = src->sequenceCounter;
-    dst->gain = src->gain;
-
-    // copy data
-    if (src->dataLen != dst->dataLen) {
-        delete[] dst->data;
-        dst->data = new uint8_t[src->dataLen];
-        dst->dataLen = src->dataLen;
-    }
-    memcpy(dst->data, src->data, dst->dataLen);
-
-    // copy metadata
-    if (src->metadataLen != dst->metadataLen) {
-        freeMetaData(dst);
-        dst->metadata = new BTA_Metadata *[src->metadataLen];
-        for (uint32_t i = 0; i < dst->metadataLen; i++) {
-            dst->metadata[i] = new BTA_Metadata;
-        }
-    }
-    cpyMetaData(dst, src);
-    if (debugCvt)
-        cout << "cpyChan sq " << dst->sequenceCounter << " it "
-             << dst->integrationTime << " mf " << dst->modulationFrequency
-             << " unit " << dst->unit << " df " << dst->dataFormat << "\t\t"
-             << getChannelTypeName(dst->id) << endl;
+// queue handling:
+void BtaWrapper::updateFrame(BTA_Frame *frame) { ring.push(frame); }
+
+BTA_Frame *BtaWrapper::waitForNextFrame()
+{  // wait for next frame to arrive....
+    // the previous frame goes back to the ring first
+    current.reset();
+    current = ring.pop();
+    return current.get();
 }
 
-static void cpyChannels(BTA_Frame *dst, const BTA_Frame *src)
+BtaWrapper::FramePtr BtaWrapper::takeNextFrame() { return ring.pop(); }
+
+/** frames built by loadFrame() are malloc()ed piece by piece */
+static void freeLoadedFrame(BTA_Frame *frame)
 {
-    if (debugCvt)
-        cout << "cpyChannels " << (int)dst->channelsLen << "-"
-             << (int)src->channelsLen << endl;
-    // num channels does not fit - create new channels array with dummies:
-    if (dst->channelsLen != src->channelsLen) {
-        freeChannels(dst);
-        if (debugCvt)
-            cout << "cpyChannels realloc" << (int)dst->channelsLen << "-"
-                 << (int)src->channelsLen << endl;
-        if (debugCvt)
-            cout << "cpyChannels realloc " << src->channelsLen << endl;
-
-        dst->channels = new BTA_Channel *[src->channelsLen];
-        dst->channelsLen = src->channelsLen;
-        for (int i = 0; i < dst->channelsLen; i++) {
-            dst->channels[i] = new BTA_Channel();
-        }
-    }
-    // walk over channels, compare contents and copy channel by channel
-    for (int i = 0; i < dst->channelsLen; i++) {
-        auto s = src->channels[i];
-        auto d = dst->channels[i];
-        if (!d) {
-            d = new BTA_Channel();
-            dst->channels[i] = d;
-        }
-        if (debugCvt) cout << "cpyChannels c " << i << endl;
-        cpyChannel(d, s);
+    for (int i = 0; i < frame->channelsLen; i++) {
+        free(frame->channels[i]->data);
+        free(frame->channels[i]);
     }
+    free(frame->channels);
+    free(frame);
 }
 
-static void cpyFrame(BTA_Frame *dst, const BTA_Frame *src)
+static void freeCapturedFrame(BTA_Frame *frame) { BTAfreeFrame(&frame); }
+
+BtaWrapper::FramePtr BtaWrapper::adoptLoadedFrame(char *data)
 {
-    if (debugCvt) cout << "cpyFrame cl " << (int)src->channelsLen << endl;
-    if (debugCvt) cout << "cpyFrame cl " << (int)dst->channelsLen << endl;
-
-    dst->firmwareVersionMajor = src->firmwareVersionMajor;
-    dst->firmwareVersionMinor = src->firmwareVersionMinor;
-    dst->firmwareVersionNonFunc = src->firmwareVersionNonFunc;
-    dst->mainTemp = src->mainTemp;
-    dst->ledTemp = src->ledTemp;
-    dst->genericTemp = src->genericTemp;
-    dst->frameCounter = src->frameCounter;
-    dst->timeStamp = src->timeStamp;
-    dst->sequenceCounter = src->sequenceCounter;
-
-    cpyChannels(dst, src);
-
-    if (debugCvt)
-        cout << "cpyFrame sq "
-             << (int)dst->sequenceCounter
-             //   << " it " << dst->integrationTime
-             //   << " mf " << dst->modulationFrequency
-             //   << " unit " << dst-<unit;
-             << endl;
+    return data ? FramePtr((BTA_Frame *)data, freeLoadedFrame) : FramePtr();
 }
 
-uint8_t ctr = 0;
-// queue handling:
-void BtaWrapper::updateFrame(BTA_Frame *frame)
+BtaWrapper::FramePtr BtaWrapper::adoptCapturedFrame(char *data)
 {
-    {
-        boost::lock_guard<boost::mutex> lock{fillFrameMutex};
+    return data ? FramePtr((BTA_Frame *)data, freeCapturedFrame) : FramePtr();
+}
 
-        // cout << "updateFrame inLock " << frameToFill->frameCounter << endl;
+/** FramePtr deleter for frames viewing a recording */
+struct ViewedFrame {
+    std::shared_ptr<const void> recording;
 
-        cpyFrame(frameToFill, frame);
-        frameToFill->sequenceCounter = ctr++;
-        hasBeenUpdated = true;
+    void operator()(BTA_Frame *frame) const
+    {
+        for (int i = 0; i < frame->channelsLen; i++) {
+            free(frame->channels[i]);
+        }
+        free(frame->channels);
+        free(frame);
     }
-    newFrameCond.notify_one();
-    // cout << "updateFrame " << hasBeenUpdated << " " <<
-    // frameToFill->frameCounter << endl;
-}
+};
 
-BTA_Frame *BtaWrapper::flipFrame()
+BtaWrapper::FramePtr BtaWrapper::viewFrame(const char *data,
+                                           std::shared_ptr<const void> keep)
 {
-    boost::lock_guard<boost::mutex> lock{fillFrameMutex};
-    hasBeenUpdated = false;
-
-    BTA_Frame *tmp = frameInUse;
-    frameInUse = frameToFill;
-    frameToFill = tmp;  // ->ftf == fiu
-
-    //cout << "flip fill " << (int)frameToFill->sequenceCounter << " use "
-    //     << (int)frameInUse->sequenceCounter << endl;
-
-    return frameInUse;
-}
-
-BTA_Frame *BtaWrapper::waitForNextFrame()
-{  // wait for next frame to arrive....
-    // boost::lock_guard<boost::mutex> lock{frameMutex};
-    boost::unique_lock<boost::mutex> lock(frameMutex);
-    // cout << "waitForNextFrame " << hasBeenUpdated << endl;
-    while (!hasBeenUpdated) {
-        // cout << "waitForNextFrame ..." << hasBeenUpdated << endl;
-        newFrameCond.wait(lock);
-    }
-    // cout << "waitForNextFrame got one!" << endl;
-    return flipFrame();
+    ViewedFrame v;
+    v.recording = keep;
+    return FramePtr(parseFrame(data, false), v);
 }
@@ -20,7 +20,9 @@
 
 #include <toffy/bta/bta.hpp>
 #include <toffy/filter_helpers.hpp>
+#include <toffy/matPool.hpp>
 #include <toffy/bta/BtaWrapper.hpp>
+#include <toffy/bta/recording.hpp>
 
 #define RECONNECT 10
 static int retries = 0;
@@ -63,6 +65,7 @@ Bta::Bta()
 
 Bta::~Bta()
 {
+    _prefetcher.reset();  // reads through the sensor
     if (((capturers::CapturerFilter*)this)->save() && isConnected())
         sensor->stopGrabbing();
     disconnect();
@@ -95,6 +98,7 @@ int Bta::loadConfig(const boost::property_tree::ptree& pt)
         BOOST_LOG_TRIVIAL(debug)
             << __FUNCTION__ << " " << __LINE__ << " dynOutputs? " << dynOutputs;
     }
+    pt_optional_get(bta, "options.zeroCopy", zeroCopy);
 
     present =
         pt_optional_get(bta, "options.modulationFrequency", modulationFreq);
@@ -173,6 +177,8 @@ void Bta::updateConfig(const boost::property_tree::ptree& pt)
     _out_lt = pt.get<string>("outputs.lt", _out_lt);
     _out_gt = pt.get<string>("outputs.gt", _out_gt);
 
+    zeroCopy = pt.get<bool>("options.zeroCopy", zeroCopy);
+
     camType = pt.get<string>("options.camera", "P230");
     if (camType == "P230") {
         cam.reset(new cam::P230());
@@ -203,6 +209,7 @@ boost::property_tree::ptree Bta::getConfig() const
     pt.put("outputs.gt", _out_gt);
 
     pt.put("options.camera", camType);
+    pt.put("options.zeroCopy", zeroCopy);
 
     return pt;
 }
@@ -210,6 +217,7 @@ boost::property_tree::ptree Bta::getConfig() const
 bool Bta::filter(const Frame& in, Frame& out)
 {
     char* data = NULL;
+    _frame.reset();
 
     using namespace boost::posix_time;
 
@@ -220,7 +228,9 @@ bool Bta::filter(const Frame& in, Frame& out)
     // If not try to reconnect. After 10 tries, stop the toffy.
     // TODO makes this optional as some application do not need to stop toffy
     // completely
-    if (!isConnected()) {
+    // a .trec recording is read by Bta itself, no camera needed
+    bool fromRecording = this->playback() && !bta_stream && _recording;
+    if (!fromRecording && !isConnected()) {
         retries++;
         if (connect() < 0) {
             if (retries > RECONNECT) {
@@ -249,19 +259,27 @@ bool Bta::filter(const Frame& in, Frame& out)
     if (this->playback()) {
         if (!bta_stream) {
             // PlayBack in r/rw files
-            if (in.hasKey("backward") || backward()) {
-                cnt(cnt() - 1);
-                if (cnt() < beginFile()) cnt(endFile());
+            bool back = in.hasKey("backward") || backward();
+            if (_recording) {
+                // frames are served from the mapping
+                cnt(playbackStep(cnt(), back, beginFile(), endFile()));
+                long i = _recording->find(cnt());
+                if (i >= 0) {
+                    // importChannel() copies the channels out of the mapping
+                    // into pooled slots, even with zeroCopy: the mapping is
+                    // read only and filters may write to their inputs
+                    _frame = BtaWrapper::viewFrame(_recording->payload(i),
+                                                   _recording->mapping());
+                    _frameReadOnly = true;
+                    data = (char*)_frame.get();
+                }
+            } else if (prefetch() > 0) {
+                data = nextPrefetched(back);
             } else {
-                cnt(cnt() + 1);
-                if (cnt() > endFile()) cnt(beginFile());
+                cnt(playbackStep(cnt(), back, beginFile(), endFile()));
+                _frame = loadRawFrame(cnt());
+                data = (char*)_frame.get();
             }
-            BOOST_LOG_TRIVIAL(debug)
-                << ((CapturerFilter*)this)->loadPath() + "/" +
-                       boost::lexical_cast<std::string>(cnt()) + fileExt();
-            data = sensor->loadRaw(((CapturerFilter*)this)->loadPath() + "/" +
-                                   boost::lexical_cast<std::string>(cnt()) +
-                                   fileExt());
         } else {
             BOOST_LOG_TRIVIAL(debug) << "bta::filter " << __LINE__
                                      << " cap async? " << sensor->isAsync();
@@ -269,7 +287,7 @@ bool Bta::filter(const Frame& in, Frame& out)
                 BOOST_LOG_TRIVIAL(debug)
                     << "bta::filter " << __LINE__ << " cap async... "
                     << sensor->isAsync();
-                data = (char*)sensor->waitForNextFrame();
+                data = nextFrame();
                 BOOST_LOG_TRIVIAL(debug) << "bta::filter " << __LINE__
                                          << " cap async! " << sensor->isAsync();
 
@@ -281,7 +299,7 @@ bool Bta::filter(const Frame& in, Frame& out)
     } else {  // live connection
         if (sensor->isAsync()) {
             // returns a BTA_Frame *
-            data = (char*)sensor->waitForNextFrame();
+            data = nextFrame();
         } else {
             BOOST_LOG_TRIVIAL(debug)
                 << "bta::filter " << __LINE__ << " what should I do? ";
@@ -292,7 +310,10 @@ bool Bta::filter(const Frame& in, Frame& out)
     //BOOST_LOG_TRIVIAL(debug)
     //    << "duration pre-capture:2 " << diff.total_microseconds();
 
-    if (!data && !sensor->capture(data)) {
+    if (!data && sensor->capture(data)) {
+        _frame = BtaWrapper::adoptCapturedFrame(data);
+    }
+    if (!data) {
         BOOST_LOG_TRIVIAL(warning) << "Could not capture from sensor.";
 #ifdef BTA_P100
         // Issue in bta lib. We stop the application
@@ -343,12 +364,26 @@ bool Bta::filter(const Frame& in, Frame& out)
         this->setOutputsClassic(in, out, start, data);
     }
 
+    // slots wrapping the frame keep their own reference
+    _frame.reset();
+    _frameReadOnly = false;
+
     diff = boost::posix_time::microsec_clock::local_time() - start;
     //BOOST_LOG_TRIVIAL(debug) << "duration free: " << diff.total_microseconds();
 
     return true;
 }
 
+char* Bta::nextFrame()
+{
+    if (!zeroCopy) {
+        return (char*)sensor->waitForNextFrame();
+    }
+    BtaWrapper::FramePtr frame = sensor->takeNextFrame();
+    _frame = frame;
+    return (char*)frame.get();
+}
+
 int Bta::connect()
 {
     int result = sensor->connect();
@@ -411,6 +446,7 @@ void Bta::playback(const bool& pb)
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__;
     BOOST_LOG_TRIVIAL(debug) << "bta_stream: " << bta_stream;
     BOOST_LOG_TRIVIAL(debug) << "pb: " << pb;
+    _prefetcher.reset();
     if (pb == true && bta_stream) {
         sensor->setDeviceType(BTA_DeviceTypeGenericBltstream);
         /*if (sensor->getDeviceType() != BTA_DeviceTypeGenericBltstream) {
@@ -447,6 +483,7 @@ void Bta::playback(const bool& pb)
 int Bta::loadPath(const std::string& newPath)
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__;
+    _prefetcher.reset();
     fs::path fsPath(newPath);
     BOOST_LOG_TRIVIAL(debug) << "fsPath.extension(): " << fsPath.extension();
     if (fs::is_regular_file(fsPath) && fsPath.extension() == ".bltstream") {
@@ -461,9 +498,24 @@ int Bta::loadPath(const std::string& newPath)
         }
 
         bta_stream = true;
+        _recording.reset();
         return 1;
+    } else if (fs::is_regular_file(fsPath) && fsPath.extension() == ".trec") {
+        std::shared_ptr<RecordingReader> rec(new RecordingReader());
+        if (!rec->open(newPath) || !rec->size()) {
+            BOOST_LOG_TRIVIAL(warning) << "bta::loadPath(): no frames in ["
+                                       << newPath << "].";
+            return -1;
+        }
+        setLoadPath(newPath);
+        bta_stream = false;
+        _recording = rec;
+        beginFile(rec->number(0));
+        endFile(rec->number(rec->size() - 1));
+        return rec->size();
     } else {
         bta_stream = false;
+        _recording.reset();
         BOOST_LOG_TRIVIAL(debug) << __LINE__ << "Bta::loadPath here";
         return CapturerFilter::loadPath(newPath);
     }
@@ -557,200 +609,31 @@ void Bta::setOutputsClassic(const Frame& in, Frame& out,
     }
 }
 
-void Bta::setOutputsClassicXYZ(const Frame& in, Frame& out,
+void Bta::setOutputsClassicXYZ(const Frame& /*in*/, Frame& out,
                                const boost::posix_time::ptime& start,
                                char* data)
 {
-    boost::posix_time::time_duration diff;
-    unsigned int size = distsSize, x = 0, y = 0;
-    BTA_Frame* frame = (BTA_Frame*)data;
-
-    matPtr mx, my, mz, ma;
-
-    if (!out.hasKey(_out_depth) || size != frame->channels[0]->dataLen) {
-        // first iteration - initialize depth matrix
-        x = frame->channels[0]->xRes;
-        y = frame->channels[0]->yRes;
-
-        width = x;
-        height = y;
-        size = distsSize = width * height;
-
-        // initialize depth matrix ...:
-        mx.reset(new cv::Mat(height, width, CV_16U));
-        my.reset(new cv::Mat(height, width, CV_16U));
-        mz.reset(new cv::Mat(height, width, CV_16U));
-        out.addData("x", mx);
-        out.addData("y", my);
-        out.addData("z", mz);
-    } else {
-        mx = in.getMatPtr("x");
-        my = in.getMatPtr("y");
-        mz = in.getMatPtr("z");
-        x = width;
-        y = height;
-    }
-
-    unsigned short* px = mx->ptr<unsigned short>();
-    unsigned short* py = my->ptr<unsigned short>();
-    unsigned short* pz = mz->ptr<unsigned short>();
-
-    memcpy(px, frame->channels[0]->data, frame->channels[0]->dataLen);
-    memcpy(py, frame->channels[1]->data, frame->channels[1]->dataLen);
-    memcpy(pz, frame->channels[2]->data, frame->channels[2]->dataLen);
-
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration set: " << diff.total_microseconds();
-
-    if (flip()) {
-        cv::flip(*mx, *mx, -1);
-        cv::flip(*my, *my, -1);
-        cv::flip(*mz, *mz, -1);
-    } else {
-        if (flip_x()) {
-            cv::flip(*mx, *mx, 1);
-            cv::flip(*my, *my, 1);
-            cv::flip(*mz, *mz, 1);
-        }
-        if (flip_y()) {
-            cv::flip(*mx, *mx, 0);
-            cv::flip(*my, *my, 0);
-            cv::flip(*mz, *mz, 0);
-        }
-    }
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration flip: " << diff.total_microseconds();
+    static const int channels[] = {0, 1, 2};
+    static const char* const names[] = {"x", "y", "z"};
+    setOutputsChannels(out, start, data, channels, names, 3);
 }
 
-void Bta::setOutputsClassicXYZAmpl(const Frame& in, Frame& out,
+void Bta::setOutputsClassicXYZAmpl(const Frame& /*in*/, Frame& out,
                                    const boost::posix_time::ptime& start,
                                    char* data)
 {
-    boost::posix_time::time_duration diff;
-    unsigned int size = distsSize, x = 0, y = 0;
-    BTA_Frame* frame = (BTA_Frame*)data;
-
-    matPtr mx, my, mz, ma;
-
-    if (!out.hasKey(_out_depth) || size != frame->channels[0]->dataLen) {
-        // first iteration - initialize depth matrix
-        x = frame->channels[0]->xRes;
-        y = frame->channels[0]->yRes;
-
-        width = x;
-        height = y;
-        size = distsSize = width * height;
-
-        // initialize depth matrix ...:
-        mx.reset(new cv::Mat(height, width, CV_16U));
-        my.reset(new cv::Mat(height, width, CV_16U));
-        mz.reset(new cv::Mat(height, width, CV_16U));
-        ma.reset(new cv::Mat(height, width, CV_16U));
-        out.addData("x", mx);
-        out.addData("y", my);
-        out.addData("z", mz);
-        out.addData("ampl", ma);
-
-    } else {
-        mx = in.getMatPtr("x");
-        my = in.getMatPtr("y");
-        mz = in.getMatPtr("z");
-        ma = in.getMatPtr("ampl");
-        x = width;
-        y = height;
-    }
-
-    unsigned short* px = mx->ptr<unsigned short>();
-    unsigned short* py = my->ptr<unsigned short>();
-    unsigned short* pz = mz->ptr<unsigned short>();
-    unsigned short* pa = ma->ptr<unsigned short>();
-
-    memcpy(px, frame->channels[0]->data, frame->channels[0]->dataLen);
-    memcpy(py, frame->channels[1]->data, frame->channels[1]->dataLen);
-    memcpy(pz, frame->channels[2]->data, frame->channels[2]->dataLen);
-    memcpy(pa, frame->channels[3]->data, frame->channels[3]->dataLen);
-
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration set: " << diff.total_microseconds();
-
-    if (flip()) {
-        cv::flip(*mx, *mx, -1);
-        cv::flip(*my, *my, -1);
-        cv::flip(*mz, *mz, -1);
-        cv::flip(*ma, *ma, -1);
-    } else {
-        if (flip_x()) {
-            cv::flip(*mx, *mx, 1);
-            cv::flip(*my, *my, 1);
-            cv::flip(*mz, *mz, 1);
-            cv::flip(*ma, *ma, 1);
-        }
-        if (flip_y()) {
-            cv::flip(*mx, *mx, 0);
-            cv::flip(*my, *my, 0);
-            cv::flip(*mz, *mz, 0);
-            cv::flip(*ma, *ma, 0);
-        }
-    }
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration flip: " << diff.total_microseconds();
+    static const int channels[] = {0, 1, 2, 3};
+    static const char* const names[] = {"x", "y", "z", "ampl"};
+    setOutputsChannels(out, start, data, channels, names, 4);
 }
 
-void Bta::setOutputsClassicZAmpl(const Frame& in, Frame& out,
+void Bta::setOutputsClassicZAmpl(const Frame& /*in*/, Frame& out,
                                  const boost::posix_time::ptime& start,
                                  char* data)
 {
-    boost::posix_time::time_duration diff;
-    unsigned int size = distsSize, x = 0, y = 0;
-    BTA_Frame* frame = (BTA_Frame*)data;
-
-    matPtr mz, ma;
-
-    if (!out.hasKey(_out_depth) || size != frame->channels[0]->dataLen) {
-        // first iteration - initialize depth matrix
-        x = frame->channels[0]->xRes;
-        y = frame->channels[0]->yRes;
-        width = x;
-        height = y;
-        size = distsSize = width * height;
-
-        // initialize depth matrix ...:
-        mz.reset(new cv::Mat(height, width, CV_16U));
-        ma.reset(new cv::Mat(height, width, CV_16U));
-        out.addData("z", mz);
-        out.addData("ampl", ma);
-
-    } else {
-        mz = in.getMatPtr("z");
-        ma = in.getMatPtr("ampl");
-        x = width;
-        y = height;
-    }
-
-    unsigned short* pz = mz->ptr<unsigned short>();
-    unsigned short* pa = ma->ptr<unsigned short>();
-
-    memcpy(pz, frame->channels[2]->data, frame->channels[2]->dataLen);
-    memcpy(pa, frame->channels[3]->data, frame->channels[3]->dataLen);
-
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration set: " << diff.total_microseconds();
-
-    if (flip()) {
-        cv::flip(*mz, *mz, -1);
-        cv::flip(*ma, *ma, -1);
-    } else {
-        if (flip_x()) {
-            cv::flip(*mz, *mz, 1);
-            cv::flip(*ma, *ma, 1);
-        }
-        if (flip_y()) {
-            cv::flip(*mz, *mz, 0);
-            cv::flip(*ma, *ma, 0);
-        }
-    }
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration flip: " << diff.total_microseconds();
+    static const int channels[] = {2, 3};
+    static const char* const names[] = {"z", "ampl"};
+    setOutputsChannels(out, start, data, channels, names, 2);
 }
 
 void Bta::setOutputsClassicDistAmpl(const Frame& in, Frame& out,
@@ -771,10 +654,10 @@ void Bta::setOutputsClassicDistAmpl(const Frame& in, Frame& out,
         size = distsSize = width * height;
 
         // initialize depth matrix ...:
-        d.reset(new cv::Mat(height, width, CV_32F));
+        d = MatPool::global().acquire(height, width, CV_32F);
         out.addData(_out_depth, d);
 
-        a.reset(new cv::Mat(height, width, CV_16U));
+        a = MatPool::global().acquire(height, width, CV_16U);
         out.addData(_out_ampl, a);
 
     } else {
@@ -822,78 +705,112 @@ void Bta::setOutputsClassicDistAmpl(const Frame& in, Frame& out,
     BOOST_LOG_TRIVIAL(debug) << "duration add: " << diff.total_microseconds();
 }
 
-void Bta::setOutputsClassicRawPhases(const Frame& in, Frame& out,
+void Bta::setOutputsClassicRawPhases(const Frame& /*in*/, Frame& out,
                                      const boost::posix_time::ptime& start,
                                      char* data)
 {
-    boost::posix_time::time_duration diff;
-    unsigned int size = distsSize, x = 0, y = 0;
+    static const int channels[] = {0, 1, 2, 3};
+    static const char* const names[] = {"p0", "p1", "p2", "p3"};
+    setOutputsChannels(out, start, data, channels, names, 4);
+}
+
+void Bta::setOutputsChannels(Frame& out, const boost::posix_time::ptime& start,
+                             char* data, const int* channels,
+                             const char* const* names, int n)
+{
     BTA_Frame* frame = (BTA_Frame*)data;
 
-    matPtr m0, m1, m2, m3;
+    width = frame->channels[0]->xRes;
+    height = frame->channels[0]->yRes;
+    distsSize = width * height;
 
-    if (!out.hasKey("p0") || size != frame->channels[0]->dataLen) {
-        // first iteration - initialize depth matrix
-        x = frame->channels[0]->xRes;
-        y = frame->channels[0]->yRes;
+    for (int i = 0; i < n; i++) {
+        BTA_Channel* chan = frame->channels[channels[i]];
+        matPtr m;
+        if (out.hasKey(names[i])) {
+            m = out.getMatPtr(names[i]);
+        }
+        out.addData(names[i], importChannel(chan->data, chan->yRes,
+                                            chan->xRes, CV_16U, m));
+    }
 
-        width = x;
-        height = y;
-        size = distsSize = width * height;
+    boost::posix_time::time_duration diff =
+        boost::posix_time::microsec_clock::local_time() - start;
+    BOOST_LOG_TRIVIAL(debug) << "duration set: " << diff.total_microseconds();
+}
 
-        // initialize depth matrix ...:
-        m0.reset(new cv::Mat(height, width, CV_16U));
-        m1.reset(new cv::Mat(height, width, CV_16U));
-        m2.reset(new cv::Mat(height, width, CV_16U));
-        m3.reset(new cv::Mat(height, width, CV_16U));
-        out.addData("p0", m0);
-        out.addData("p1", m1);
-        out.addData("p2", m2);
-        out.addData("p3", m3);
+std::shared_ptr<void> Bta::loadRawFrame(int i)
+{
+    std::string file = ((CapturerFilter*)this)->loadPath() + "/" +
+                       boost::lexical_cast<std::string>(i) + fileExt();
+    BOOST_LOG_TRIVIAL(debug) << file;
+    return BtaWrapper::adoptLoadedFrame(sensor->loadRaw(file));
+}
 
-    } else {
-        m0 = in.getMatPtr("p0");
-        m1 = in.getMatPtr("p1");
-        m2 = in.getMatPtr("p2");
-        m3 = in.getMatPtr("p3");
-        x = width;
-        y = height;
+char* Bta::nextPrefetched(bool backward)
+{
+    if (!_prefetcher || _prefetcher->depth() != (size_t)prefetch()) {
+        _prefetcher.reset(new Prefetcher<std::shared_ptr<void> >(prefetch()));
     }
+    if (!_prefetcher->running()) {
+        _prefetcher->start(
+            std::bind(&Bta::loadRawFrame, this, std::placeholders::_1),
+            beginFile(), endFile(), cnt());
+    } else if (_prefetcher->position() != cnt()) {
+        _prefetcher->seek(cnt());  // cnt was set from outside
+    }
+    int i;
+    _frame = _prefetcher->next(backward, i);
+    cnt(i);
+    return (char*)_frame.get();
+}
 
-    unsigned short* p0 = m0->ptr<unsigned short>();
-    unsigned short* p1 = m1->ptr<unsigned short>();
-    unsigned short* p2 = m2->ptr<unsigned short>();
-    unsigned short* p3 = m3->ptr<unsigned short>();
+namespace {
+/** matPtr deleter holding a reference to the BTA frame the header wraps */
+struct FrameRef {
+    std::shared_ptr<void> frame;
 
-    memcpy(p0, frame->channels[0]->data, frame->channels[0]->dataLen);
-    memcpy(p1, frame->channels[1]->data, frame->channels[1]->dataLen);
-    memcpy(p2, frame->channels[2]->data, frame->channels[2]->dataLen);
-    memcpy(p3, frame->channels[3]->data, frame->channels[3]->dataLen);
+    void operator()(cv::Mat* m) const { delete m; }
+};
+}  // namespace
 
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration set: " << diff.total_microseconds();
+matPtr Bta::importChannel(void* data, int rows, int cols, int type,
+                          matPtr dst, bool flipped)
+{
+    // flip_x and flip_y add up to a flip around both axes
+    int code = 0;
+    bool flipping = false;
+    if (flipped) {
+        if (flip() || (flip_x() && flip_y())) {
+            code = -1;
+            flipping = true;
+        } else if (flip_x()) {
+            code = 1;
+            flipping = true;
+        } else if (flip_y()) {
+            code = 0;
+            flipping = true;
+        }
+    }
 
-    if (flip()) {
-        cv::flip(*m0, *m0, -1);
-        cv::flip(*m1, *m1, -1);
-        cv::flip(*m2, *m2, -1);
-        cv::flip(*m3, *m3, -1);
+    cv::Mat src(rows, cols, type, data);
+    if (!flipping && zeroCopy && _frame && !_frameReadOnly) {
+        FrameRef ref;
+        ref.frame = _frame;
+        return matPtr(new cv::Mat(src), ref);
+    }
+
+    // headers over a former frame (no cv::UMatData) must not be written to
+    if (!dst || !dst->u || dst->rows != rows || dst->cols != cols ||
+        dst->type() != type) {
+        dst = MatPool::global().acquire(rows, cols, type);
+    }
+    if (flipping) {
+        cv::flip(src, *dst, code);
     } else {
-        if (flip_x()) {
-            cv::flip(*m0, *m0, 1);
-            cv::flip(*m1, *m1, 1);
-            cv::flip(*m2, *m2, 1);
-            cv::flip(*m3, *m3, 1);
-        }
-        if (flip_y()) {
-            cv::flip(*m0, *m0, 0);
-            cv::flip(*m1, *m1, 0);
-            cv::flip(*m2, *m2, 0);
-            cv::flip(*m3, *m3, 0);
-        }
+        src.copyTo(*dst);
     }
-    diff = boost::posix_time::microsec_clock::local_time() - start;
-    BOOST_LOG_TRIVIAL(debug) << "duration flip: " << diff.total_microseconds();
+    return dst;
 }
 
 void Bta::setOutputsDynamic(const Frame& /*in*/, Frame& out,
@@ -942,38 +859,22 @@ void Bta::setOutputsDynamic(const Frame& /*in*/, Frame& out,
             d = out.getMatPtr(name);
         }
         switch (chan->dataFormat) {
-            case BTA_DataFormatUInt8: {
-                if (!d.get() || (height * width * 1 < (int)chan->dataLen)) {
-                    d.reset(new cv::Mat(height, width, CV_8UC1));
-                }
-                short* f = d->ptr<short>();
-                memcpy(f, chan->data, chan->dataLen);
+            case BTA_DataFormatUInt8:
+                d = importChannel(chan->data, chan->yRes, chan->xRes, CV_8UC1, d,
+                                  false);
                 break;
-            }
-            case BTA_DataFormatUInt16: {
-                if (!d.get() || (height * width * 2 < (int)chan->dataLen)) {
-                    d.reset(new cv::Mat(height, width, CV_16UC1));
-                }
-                short* f = d->ptr<short>();
-                memcpy(f, chan->data, chan->dataLen);
+            case BTA_DataFormatUInt16:
+                d = importChannel(chan->data, chan->yRes, chan->xRes, CV_16UC1, d,
+                                  false);
                 break;
-            }
-            case BTA_DataFormatFloat32: {
-                if (!d.get() || (height * width * 4 < (int)chan->dataLen)) {
-                    d.reset(new cv::Mat(height, width, CV_32F));
-                }
-                float* f = d->ptr<float>();
-                memcpy(f, chan->data, chan->dataLen);
+            case BTA_DataFormatFloat32:
+                d = importChannel(chan->data, chan->yRes, chan->xRes, CV_32F, d,
+                                  false);
                 break;
-            }
-            case BTA_DataFormatSInt16: {
-                if (!d.get() || (height * width * 2 < (int)chan->dataLen)) {
-                    d.reset(new cv::Mat(height, width, CV_16SC1));
-                }
-                short* f = d->ptr<short>();
-                memcpy(f, chan->data, chan->dataLen);
+            case BTA_DataFormatSInt16:
+                d = importChannel(chan->data, chan->yRes, chan->xRes, CV_16SC1, d,
+                                  false);
                 break;
-            }
             case BTA_DataFormatYuv422: {
                 // BOOST_LOG_TRIVIAL(debug) << "img yuv data! " << (width *
                 // height)
@@ -981,7 +882,7 @@ void Bta::setOutputsDynamic(const Frame& /*in*/, Frame& out,
                 int width = chan->xRes;
                 int height = chan->yRes;
                 if (!d.get() || (height * width * 3 < (int)chan->dataLen)) {
-                    d.reset(new cv::Mat(height, width, CV_8UC3));
+                    d = MatPool::global().acquire(height, width, CV_8UC3);
                 }
                 Mat input(height, width, CV_8UC2, chan->data);
 
@@ -995,7 +896,7 @@ void Bta::setOutputsDynamic(const Frame& /*in*/, Frame& out,
                 int width = chan->xRes;
                 int height = chan->yRes;
                 if (!d.get()) {
-                    d.reset(new cv::Mat(height, width, CV_8UC3));
+                    d = MatPool::global().acquire(height, width, CV_8UC3);
                 }
                 // @TODO optimize
                 unsigned char* ptr = chan->data;
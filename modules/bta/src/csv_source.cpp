@@ -13,6 +13,7 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <cstring>
 #include <fstream>
 #include <stdio.h>
 
@@ -23,9 +24,11 @@
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/log/trivial.hpp>
+#include <boost/thread/thread.hpp>
 
-#include <opencv2/highgui.hpp>
+#include <toffy/import/csvMat.hpp>
 #include <toffy/io/csv_source.hpp>
+#include <toffy/matPool.hpp>
 
 using namespace std;
 using namespace cv;
@@ -34,14 +37,15 @@ using namespace toffy::capturers;
 const std::string CSVSource::id_name = "csvSource";  ///< Filter identifier
 
 CSVSource::CSVSource(): CapturerFilter(CSVSource::id_name, 0),
-     width(160), height(120), 
+     width(160), height(120), _delay(0),
       _amplPattern("data/%05d_a.csv"),
       _depthPattern("data/%05d_d.csv"),
       _out_depth("depth"),
-      _out_ampl("ampl") {
+      _out_ampl("ampl"),
+      sequence(0), useSequence(false), _scanLast(true) {
       }
 
-CSVSource::~CSVSource() {}
+CSVSource::~CSVSource() { _prefetcher.reset(); }
 
 int CSVSource::loadConfig(const boost::property_tree::ptree& pt) {
   BOOST_LOG_TRIVIAL(debug) << " ------------ CSVSource::loadConfig() " << id();
@@ -55,7 +59,13 @@ int CSVSource::loadConfig(const boost::property_tree::ptree& pt) {
   _out_depth = pt.get<string>("outputs.depth", _out_depth);
   _out_ampl = pt.get<string>("outputs.ampl", _out_ampl);
 
-  sequence = pt.get<bool>("options.sequence", sequence);
+  useSequence = pt.get<bool>("options.sequence", useSequence);
+  _delay = pt.get<int>("options.delay", _delay);
+  beginFile(pt.get<int>("options.first", beginFile()));
+  configureLast(pt);
+  sequence = beginFile();
+  prefetch(pt.get<int>("options.prefetch", prefetch()));
+  _prefetcher.reset();
 
   std::string pat = pt.get<string>("options.fcs", "");
   if (pat.length() > 0) {
@@ -83,7 +93,11 @@ boost::property_tree::ptree CSVSource::getConfig() const {
     pt.put("outputs.depth", _out_depth);
     pt.put("outputs.ampl", _out_ampl);
 
-    pt.put("options.sequence", sequence);
+    pt.put("options.sequence", useSequence);
+    pt.put("options.delay", _delay);
+    pt.put("options.first", beginFile());
+    pt.put("options.last", endFile());
+    pt.put("options.prefetch", prefetch());
     // @TODO export int array
     //    pt.put("options.fcs", fcs);
 
@@ -101,6 +115,11 @@ void CSVSource::updateConfig(const boost::property_tree::ptree& pt) {
   _out_ampl = pt.get<string>("outputs.ampl", _out_ampl);
 
   useSequence = pt.get<bool>("options.sequence", useSequence);
+  _delay = pt.get<int>("options.delay", _delay);
+  beginFile(pt.get<int>("options.first", beginFile()));
+  configureLast(pt);
+  prefetch(pt.get<int>("options.prefetch", prefetch()));
+  _prefetcher.reset();
 
   std::string pat = pt.get<string>("options.fcs", "");
   if (pat.length() > 0) {
@@ -116,85 +135,97 @@ void CSVSource::updateConfig(const boost::property_tree::ptree& pt) {
                            << _depthPattern << " seq? " << useSequence;
 }
 
-bool CSVSource::filter(const Frame& /*in*/, Frame& out) {
-  BOOST_LOG_TRIVIAL(debug) << " ------------ CSVSource::filter() " << id();
-  cv::waitKey(500);
+bool CSVSource::filter(const Frame& in, Frame& out) {
   BOOST_LOG_TRIVIAL(debug) << " ------------ CSVSource::filter() " << id();
-
-  matPtr ampl;
-  matPtr depth;
-
-  if (out.hasKey(_out_ampl)) {
-    ampl = out.getMatPtr(_out_ampl);
-  } else {
-    // initialize ampl matrix ...:
-    ampl.reset(new cv::Mat(height, width, CV_16U));
-    out.addData(_out_ampl, ampl);
+  if (_delay > 0) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(_delay));
   }
 
-  if (out.hasKey(_out_depth)) {
-    depth = out.getMatPtr(_out_depth);
+  Loaded frame;
+  bool back = in.hasKey("backward") || backward();
+  if (useSequence && prefetch() > 0) {
+    if (!_prefetcher) {
+      _prefetcher.reset(new Prefetcher<Loaded>(prefetch()));
+      _prefetcher->start(
+          std::bind(&CSVSource::load, this, std::placeholders::_1),
+          beginFile(), endFile(),
+          playbackStep(sequence, !back, beginFile(), endFile()));
+    }
+    int seq;
+    frame = _prefetcher->next(back, seq);
+    sequence = playbackStep(seq, back, beginFile(), endFile());
   } else {
-    // initialize depth matrix ...:
-    depth.reset(new cv::Mat(height, width, CV_32F));
-    out.addData(_out_depth, depth);
+    frame = load(sequence);
+    if (useSequence) {
+      sequence = playbackStep(sequence, back, beginFile(), endFile());
+    }
   }
 
   // todo: handle 'file not found' as end of stream
-  loadDepth(out, *depth);
-  loadAmpl(out, *ampl);
+  if (frame.depth) out.addData(_out_depth, frame.depth);
+  if (frame.ampl) out.addData(_out_ampl, frame.ampl);
 
-  if (useSequence) {
-        sequence++;
-  }
   // todo: handle fc counts
   return true;
 }
 
+void CSVSource::configureLast(const boost::property_tree::ptree& pt) {
+  boost::optional<int> last = pt.get_optional<int>("options.last");
+  if (last) {
+    _scanLast = false;
+    endFile(*last);
+  } else if (_scanLast && useSequence) {
+    // the sequence ends before the first missing depth file
+    int seq = beginFile();
+    while (boost::filesystem::exists(filePath(_depthPattern, seq + 1))) seq++;
+    endFile(seq);
+  }
+}
+
+string CSVSource::filePath(const string& pattern, int seq) {
+  char path[1024];
+  snprintf(path, sizeof(path), pattern.c_str(), seq);
+  return path;
+}
+
 int CSVSource::connect() { return 0; }
 int CSVSource::disconnect() { return 0; }
 bool CSVSource::isConnected() { return true; }
 
 int CSVSource::loadPath(const std::string& ) { return 1; }
 
-void CSVSource::loadDepth(Frame& /*frame*/, Mat& depth) {
-  char path[1024];
-  snprintf(path, sizeof(path), _depthPattern.c_str(), sequence);
+CSVSource::Loaded CSVSource::load(int seq) const {
+  Loaded f;
+  matPtr depth = MatPool::global().acquire(height, width, CV_32F);
+  if (loadDepth(seq, *depth)) f.depth = depth;
+  matPtr ampl = MatPool::global().acquire(height, width, CV_16U);
+  if (loadAmpl(seq, *ampl)) f.ampl = ampl;
+  return f;
+}
 
-  cout << "loadD from " << path << endl;
-  FILE* f = fopen(path, "r");
-  if (!f) {
-    cout << "COULD NOT OPEN " << path << " " << strerror(errno) << endl;
-    return;
-  }
+bool CSVSource::loadDepth(int seq, Mat& depth) const {
+  string path = filePath(_depthPattern, seq);
 
-  for (int y = 0; y < height; y++) {
-    float val;
-    for (int x = 0; x < width; x++) {
-      fscanf(f, "%g;", &val);
-      depth.at<float>(y,x) = val;
-    }
-  }
-  fclose(f);
+  BOOST_LOG_TRIVIAL(debug) << "loadD from " << path;
+  return loadMat(path.c_str(), depth);
 }
 
-void CSVSource::loadAmpl(Frame& /*frame*/, Mat& ampl) {
-  char path[1024];
-  snprintf(path, sizeof(path), _amplPattern.c_str(), sequence);
+bool CSVSource::loadAmpl(int seq, Mat& ampl) const {
+  string path = filePath(_amplPattern, seq);
 
-  cout << "loadA from " << path << endl;
-  FILE* f = fopen(path, "r");
-  if (!f) {
-    cout << "COULD NOT OPEN " << path << " " << strerror(errno) << endl;
-    return;
-  }
+  BOOST_LOG_TRIVIAL(debug) << "loadA from " << path;
+  return loadMat(path.c_str(), ampl);
+}
 
-  for (int y = 0; y < height; y++) {
-    int val;
-    for (int x = 0; x < width; x++) {
-      fscanf(f, "%d;", &val);
-      ampl.at<short>(y,x) = val;
-    }
+bool CSVSource::loadMat(const char* path, Mat& mat) const {
+  size_t n = csv::read(path, mat);
+  if (n == 0) return false;
+  if (n < mat.total()) {
+    BOOST_LOG_TRIVIAL(warning) << path << " has " << n << " values, expected "
+                               << mat.total();
+    // clear the rest, pooled mats come with old data
+    uchar* p = mat.ptr(0) + n * mat.elemSize();
+    memset(p, 0, (mat.total() - n) * mat.elemSize());
   }
-  fclose(f);        
+  return true;
 }
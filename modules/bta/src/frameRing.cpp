@@ -0,0 +1,419 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <string.h>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <toffy/bta/frameRing.hpp>
+
+static void freeMetaData(BTA_Channel *chan)
+{
+    for (uint32_t i = 0; i < chan->metadataLen; i++) {
+        free(chan->metadata[i]->data);
+        delete chan->metadata[i];
+    }
+    delete[] chan->metadata;
+    chan->metadata = NULL;
+    chan->metadataLen = 0;
+}
+
+static void freeChannel(BTA_Channel *chan)
+{
+    freeMetaData(chan);
+    delete[] chan->data;
+    delete chan;
+}
+
+static void freeChannels(BTA_Frame *frame)
+{
+    for (uint32_t i = 0; i < frame->channelsLen; i++) {
+        freeChannel(frame->channels[i]);
+    }
+    delete[] frame->channels;
+    frame->channels = NULL;
+    frame->channelsLen = 0;
+}
+
+static inline void cpyMetaData(BTA_Channel *dst, const BTA_Channel *src)
+{
+    for (uint32_t i = 0; i < src->metadataLen; i++) {
+        BTA_Metadata *s = src->metadata[i];
+        BTA_Metadata *d = dst->metadata[i];
+        d->id = s->id;
+        if (d->dataLen != s->dataLen) {
+            free(d->data);
+            d->data = malloc(s->dataLen);
+            d->dataLen = s->dataLen;
+        }
+        memcpy(d->data, s->data, d->dataLen);
+    }
+}
+
+static void cpyChannel(BTA_Channel *dst, const BTA_Channel *src)
+{
+    dst->id = src->id;
+    dst->xRes = src->xRes;
+    dst->yRes = src->yRes;
+    dst->dataFormat = src->dataFormat;
+    dst->unit = src->unit;
+    dst->integrationTime = src->integrationTime;
+    dst->modulationFrequency = src->modulationFrequency;
+    dst->lensIndex = src->lensIndex;
+    dst->flags = src->flags;
+    dst->sequenceCounter = src->sequenceCounter;
+    dst->gain = src->gain;
+
+    // copy data, buffers only change with the format
+    if (src->dataLen != dst->dataLen) {
+        delete[] dst->data;
+        dst->data = new uint8_t[src->dataLen];
+        dst->dataLen = src->dataLen;
+    }
+    memcpy(dst->data, src->data, dst->dataLen);
+
+    // copy metadata
+    if (src->metadataLen != dst->metadataLen) {
+        freeMetaData(dst);
+        dst->metadata = new BTA_Metadata *[src->metadataLen];
+        for (uint32_t i = 0; i < src->metadataLen; i++) {
+            dst->metadata[i] = new BTA_Metadata();
+        }
+        dst->metadataLen = src->metadataLen;
+    }
+    cpyMetaData(dst, src);
+}
+
+void BtaFrameRing::copyFrame(BTA_Frame *dst, const BTA_Frame *src)
+{
+    dst->firmwareVersionMajor = src->firmwareVersionMajor;
+    dst->firmwareVersionMinor = src->firmwareVersionMinor;
+    dst->firmwareVersionNonFunc = src->firmwareVersionNonFunc;
+    dst->mainTemp = src->mainTemp;
+    dst->ledTemp = src->ledTemp;
+    dst->genericTemp = src->genericTemp;
+    dst->frameCounter = src->frameCounter;
+    dst->timeStamp = src->timeStamp;
+    dst->sequenceCounter = src->sequenceCounter;
+
+    // num channels does not fit - create new channels array with dummies:
+    if (dst->channelsLen != src->channelsLen) {
+        freeChannels(dst);
+        dst->channels = new BTA_Channel *[src->channelsLen];
+        dst->channelsLen = src->channelsLen;
+        for (int i = 0; i < dst->channelsLen; i++) {
+            dst->channels[i] = new BTA_Channel();
+        }
+    }
+    for (int i = 0; i < dst->channelsLen; i++) {
+        cpyChannel(dst->channels[i], src->channels[i]);
+    }
+}
+
+void BtaFrameRing::freeFrame(BTA_Frame *frame)
+{
+    freeChannels(frame);
+    delete frame;
+}
+
+class BtaFrameRing::Impl
+{
+   public:
+    Impl(size_t slots, Policy policy)
+        : slots(slots < 2 ? 2 : slots),
+          allocated(0),
+          policy(policy),
+          closed(false),
+          sequence(0)
+    {
+        reset();
+        for (; allocated < this->slots; allocated++) {
+            idle.push_back(new BTA_Frame());
+        }
+    }
+
+    ~Impl()
+    {
+        for (size_t i = 0; i < idle.size(); i++) freeFrame(idle[i]);
+        for (size_t i = 0; i < queue.size(); i++) freeFrame(queue[i]);
+    }
+
+    void reset()
+    {
+        stats.received = stats.delivered = stats.dropped = 0;
+        stats.queued = queue.size();
+    }
+
+    /** free slot for the producer, NULL if the frame has to be dropped */
+    BTA_Frame *take(boost::unique_lock<boost::mutex> &lock)
+    {
+        for (;;) {
+            if (closed) {
+                return NULL;
+            }
+            if (!idle.empty()) {
+                BTA_Frame *f = idle.back();
+                idle.pop_back();
+                return f;
+            }
+            if (allocated < slots) {
+                allocated++;
+                return new BTA_Frame();
+            }
+            switch (policy) {
+                case LatestOnly:
+                    if (queue.empty()) {
+                        return NULL;  // all slots held by the consumer
+                    }
+                    {
+                        // overwrite the oldest, pop() would skip it anyway
+                        BTA_Frame *f = queue.front();
+                        queue.pop_front();
+                        stats.dropped++;
+                        return f;
+                    }
+                case Block:
+                    slotCond.wait(lock);
+                    break;
+                case Queue:
+                default:
+                    return NULL;
+            }
+        }
+    }
+
+    /** slot back from the consumer or out of the queue */
+    void recycle(BTA_Frame *f)
+    {
+        if (allocated > slots) {
+            freeFrame(f);
+            allocated--;
+        } else {
+            idle.push_back(f);
+        }
+        slotCond.notify_one();
+    }
+
+    boost::mutex mtx;
+    boost::condition_variable frameCond;  ///< consumer waits for frames
+    boost::condition_variable slotCond;   ///< Block: producer waits for slots
+
+    std::vector<BTA_Frame *> idle;
+    std::deque<BTA_Frame *> queue;
+    size_t slots;      ///< configured number of slots
+    size_t allocated;  ///< existing slots: idle, queued, filling and held
+    Policy policy;
+    bool closed;
+    uint8_t sequence;
+    Stats stats;
+};
+
+/** FramePtr deleter handing the slot back to its ring */
+struct BtaFrameRing::Release {
+    std::weak_ptr<BtaFrameRing::Impl> ring;
+
+    void operator()(BTA_Frame *f) const
+    {
+        std::shared_ptr<BtaFrameRing::Impl> r = ring.lock();
+        if (r) {
+            boost::lock_guard<boost::mutex> lock(r->mtx);
+            r->recycle(f);
+        } else {
+            freeFrame(f);
+        }
+    }
+};
+
+BtaFrameRing::BtaFrameRing(size_t slots, Policy policy)
+    : _impl(new Impl(slots, policy))
+{
+}
+
+BtaFrameRing::~BtaFrameRing() { close(); }
+
+void BtaFrameRing::configure(size_t slots, Policy policy)
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    _impl->slots = slots < 2 ? 2 : slots;
+    _impl->policy = policy;
+    while (!_impl->queue.empty()) {
+        _impl->recycle(_impl->queue.front());
+        _impl->queue.pop_front();
+        _impl->stats.dropped++;
+    }
+    while (_impl->allocated > _impl->slots && !_impl->idle.empty()) {
+        freeFrame(_impl->idle.back());
+        _impl->idle.pop_back();
+        _impl->allocated--;
+    }
+    _impl->slotCond.notify_all();
+}
+
+size_t BtaFrameRing::slots() const
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    return _impl->slots;
+}
+
+BtaFrameRing::Policy BtaFrameRing::policy() const
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    return _impl->policy;
+}
+
+bool BtaFrameRing::push(const BTA_Frame *frame)
+{
+    BTA_Frame *slot;
+    uint8_t seq;
+    {
+        boost::unique_lock<boost::mutex> lock(_impl->mtx);
+        _impl->stats.received++;
+        slot = _impl->take(lock);
+        if (!slot) {
+            _impl->stats.dropped++;
+            return false;
+        }
+        seq = _impl->sequence++;
+    }
+
+    // the copy does not block pop()
+    copyFrame(slot, frame);
+    slot->sequenceCounter = seq;
+
+    {
+        boost::lock_guard<boost::mutex> lock(_impl->mtx);
+        if (_impl->closed) {
+            _impl->recycle(slot);
+            _impl->stats.dropped++;
+            return false;
+        }
+        _impl->queue.push_back(slot);
+    }
+    _impl->frameCond.notify_one();
+    return true;
+}
+
+BtaFrameRing::FramePtr BtaFrameRing::pop(int timeoutMs)
+{
+    boost::unique_lock<boost::mutex> lock(_impl->mtx);
+    if (timeoutMs < 0) {
+        while (_impl->queue.empty() && !_impl->closed) {
+            _impl->frameCond.wait(lock);
+        }
+    } else {
+        boost::system_time until =
+            boost::get_system_time() + boost::posix_time::milliseconds(timeoutMs);
+        while (_impl->queue.empty() && !_impl->closed) {
+            if (!_impl->frameCond.timed_wait(lock, until)) break;
+        }
+    }
+    if (_impl->queue.empty() || _impl->closed) {
+        return FramePtr();
+    }
+
+    if (_impl->policy == LatestOnly) {
+        while (_impl->queue.size() > 1) {
+            _impl->recycle(_impl->queue.front());
+            _impl->queue.pop_front();
+            _impl->stats.dropped++;
+        }
+    }
+    BTA_Frame *f = _impl->queue.front();
+    _impl->queue.pop_front();
+    _impl->stats.delivered++;
+
+    Release r;
+    r.ring = _impl;
+    return FramePtr(f, r);
+}
+
+void BtaFrameRing::close()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_impl->mtx);
+        _impl->closed = true;
+        while (!_impl->queue.empty()) {
+            _impl->recycle(_impl->queue.front());
+            _impl->queue.pop_front();
+            _impl->stats.dropped++;
+        }
+    }
+    _impl->frameCond.notify_all();
+    _impl->slotCond.notify_all();
+}
+
+void BtaFrameRing::open()
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    _impl->closed = false;
+}
+
+BtaFrameRing::Stats BtaFrameRing::stats() const
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    Stats s = _impl->stats;
+    s.queued = _impl->queue.size();
+    return s;
+}
+
+boost::property_tree::ptree BtaFrameRing::getStats() const
+{
+    Stats s = stats();
+    boost::property_tree::ptree pt;
+    pt.put("received", s.received);
+    pt.put("delivered", s.delivered);
+    pt.put("dropped", s.dropped);
+    pt.put("queued", s.queued);
+    return pt;
+}
+
+void BtaFrameRing::resetStats()
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    _impl->reset();
+}
+
+bool BtaFrameRing::parsePolicy(const std::string &name, Policy &policy)
+{
+    if (name == "latest") {
+        policy = LatestOnly;
+    } else if (name == "block") {
+        policy = Block;
+    } else if (name == "queue") {
+        policy = Queue;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string BtaFrameRing::policyName(Policy policy)
+{
+    switch (policy) {
+        case LatestOnly:
+            return "latest";
+        case Block:
+            return "block";
+        case Queue:
+            return "queue";
+    }
+    return "unknown";
+}
@@ -0,0 +1,348 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#if !defined(MSVC)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <toffy/bta/recording.hpp>
+
+using namespace toffy::capturers;
+namespace fs = boost::filesystem;
+
+static const char recordingMagic[8] = {'T', 'O', 'F', 'F', 'Y', 'R', 'E', 'C'};
+static const uint32_t recordingVersion = 1;
+
+static inline uint64_t align8(uint64_t v) { return (v + 7) & ~(uint64_t)7; }
+
+static bool byNumber(const RecordingIndexEntry &a, const RecordingIndexEntry &b)
+{
+    return a.number < b.number;
+}
+
+RecordingWriter::RecordingWriter() : _file(NULL), _pos(0) {}
+
+RecordingWriter::~RecordingWriter() { close(); }
+
+bool RecordingWriter::open(const std::string &path)
+{
+    close();
+    _file = fopen(path.c_str(), "wb");
+    if (!_file) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not create recording: " << path;
+        return false;
+    }
+    _pos = 0;
+    _index.clear();
+
+    RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, recordingMagic, sizeof(header.magic));
+    header.version = recordingVersion;
+    return write(&header, sizeof(header));
+}
+
+bool RecordingWriter::write(const void *data, size_t len)
+{
+    if (len && fwrite(data, 1, len, _file) != len) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not write recording.";
+        return false;
+    }
+    _pos += len;
+    return true;
+}
+
+bool RecordingWriter::append(const FrameHeader &header, const char *payload,
+                             int number)
+{
+    if (!_file || header.lenght < 0) {
+        return false;
+    }
+    RecordingRecord rec;
+    rec.magic = RecordingRecord::tag;
+    rec.number = number;
+
+    RecordingIndexEntry entry;
+    entry.offset = _pos + sizeof(rec);
+    entry.number = number;
+    entry.length = sizeof(FrameHeader) + header.lenght;
+
+    static const char pad[8] = {0};
+    if (!write(&rec, sizeof(rec)) || !write(&header, sizeof(header)) ||
+        !write(payload, header.lenght) ||
+        !write(pad, align8(_pos) - _pos)) {
+        return false;
+    }
+    _index.push_back(entry);
+    return true;
+}
+
+bool RecordingWriter::appendFile(const std::string &rawFile, int number)
+{
+    FILE *raw = fopen(rawFile.c_str(), "rb");
+    if (!raw) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not open file: " << rawFile;
+        return false;
+    }
+    FrameHeader header;
+    std::vector<char> payload;
+    bool ok = fread(&header, sizeof(header), 1, raw) == 1 &&
+              header.lenght >= 0;
+    if (ok) {
+        payload.resize(header.lenght);
+        ok = fread(payload.data(), 1, payload.size(), raw) == payload.size();
+    }
+    fclose(raw);
+    if (!ok) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not read file: " << rawFile;
+        return false;
+    }
+    return append(header, payload.data(), number);
+}
+
+bool RecordingWriter::close()
+{
+    if (!_file) {
+        return true;
+    }
+    RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, recordingMagic, sizeof(header.magic));
+    header.version = recordingVersion;
+    header.frames = _index.size();
+    header.indexOffset = _pos;
+
+    bool ok = write(_index.data(), _index.size() * sizeof(RecordingIndexEntry));
+    ok = ok && fseek(_file, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, _file) == 1;
+    ok = (fclose(_file) == 0) && ok;
+    _file = NULL;
+    if (!ok) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not finish recording.";
+    }
+    return ok;
+}
+
+#if !defined(MSVC)
+/** munmap()s on release of the last reference */
+struct Unmap {
+    size_t length;
+
+    void operator()(const void *p) const { munmap((void *)p, length); }
+};
+#endif
+
+RecordingReader::RecordingReader()
+    : _data(NULL), _length(0), _index(NULL), _size(0), _sorted(true)
+{
+}
+
+RecordingReader::~RecordingReader() { close(); }
+
+bool RecordingReader::open(const std::string &path)
+{
+    close();
+#if defined(MSVC)
+    // no mmap: the recording is read into memory
+    boost::system::error_code ec;
+    uintmax_t length = fs::file_size(path, ec);
+    if (ec || length < sizeof(RecordingHeader)) {
+        BOOST_LOG_TRIVIAL(warning) << "Not a recording: " << path;
+        return false;
+    }
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not open recording: " << path;
+        return false;
+    }
+    std::shared_ptr<char> buf(new char[length], std::default_delete<char[]>());
+    size_t got = fread(buf.get(), 1, length, f);
+    fclose(f);
+    if (got != length) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not read recording: " << path;
+        return false;
+    }
+    _map = buf;
+    _data = buf.get();
+    _length = length;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not open recording: " << path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RecordingHeader)) {
+        BOOST_LOG_TRIVIAL(warning) << "Not a recording: " << path;
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not map recording: " << path;
+        return false;
+    }
+    Unmap unmap;
+    unmap.length = st.st_size;
+    _map.reset(p, unmap);
+    _data = (const char *)p;
+    _length = st.st_size;
+#endif
+
+    const RecordingHeader *header = (const RecordingHeader *)_data;
+    if (memcmp(header->magic, recordingMagic, sizeof(recordingMagic)) ||
+        header->version != recordingVersion) {
+        BOOST_LOG_TRIVIAL(warning) << "Not a recording: " << path;
+        close();
+        return false;
+    }
+
+    if (header->indexOffset &&
+        header->indexOffset + header->frames * sizeof(RecordingIndexEntry) <=
+            _length) {
+        _index = (const RecordingIndexEntry *)(_data + header->indexOffset);
+        _size = header->frames;
+    } else if (!scan()) {
+        close();
+        return false;
+    } else {
+        BOOST_LOG_TRIVIAL(info) << "Recording " << path
+                                << " was not closed, recovered " << _size
+                                << " frames.";
+    }
+
+    for (size_t i = 0; i < _size; i++) {
+        if (_index[i].offset + _index[i].length > _length) {
+            BOOST_LOG_TRIVIAL(warning) << "Truncated recording: " << path;
+            _size = i;
+            break;
+        }
+    }
+    _sorted = std::is_sorted(_index, _index + _size, byNumber);
+    return true;
+}
+
+bool RecordingReader::scan()
+{
+    _scanned.clear();
+    uint64_t pos = sizeof(RecordingHeader);
+    while (pos + sizeof(RecordingRecord) + sizeof(FrameHeader) <= _length) {
+        const RecordingRecord *rec = (const RecordingRecord *)(_data + pos);
+        const FrameHeader *header =
+            (const FrameHeader *)(_data + pos + sizeof(RecordingRecord));
+        if (rec->magic != RecordingRecord::tag || header->lenght < 0) {
+            break;
+        }
+        RecordingIndexEntry entry;
+        entry.offset = pos + sizeof(RecordingRecord);
+        entry.number = rec->number;
+        entry.length = sizeof(FrameHeader) + header->lenght;
+        if (entry.offset + entry.length > _length) {
+            break;
+        }
+        _scanned.push_back(entry);
+        pos = align8(entry.offset + entry.length);
+    }
+    _index = _scanned.data();
+    _size = _scanned.size();
+    return true;
+}
+
+void RecordingReader::close()
+{
+    _map.reset();
+    _data = NULL;
+    _length = 0;
+    _index = NULL;
+    _size = 0;
+    _sorted = true;
+    _scanned.clear();
+}
+
+long RecordingReader::find(int number) const
+{
+    if (_sorted) {
+        RecordingIndexEntry key;
+        key.number = number;
+        const RecordingIndexEntry *it =
+            std::lower_bound(_index, _index + _size, key, byNumber);
+        return (it != _index + _size && it->number == number)
+                   ? (long)(it - _index)
+                   : -1;
+    }
+    for (size_t i = 0; i < _size; i++) {
+        if (_index[i].number == number) return i;
+    }
+    return -1;
+}
+
+const FrameHeader *RecordingReader::frame(size_t i) const
+{
+    return (const FrameHeader *)(_data + _index[i].offset);
+}
+
+int toffy::capturers::convertRawDirectory(const std::string &dir,
+                                          const std::string &file)
+{
+    fs::path path(dir);
+    if (!fs::is_directory(path)) {
+        BOOST_LOG_TRIVIAL(warning) << dir << " is not a directory.";
+        return -1;
+    }
+
+    // same selection as CapturerFilter::loadPath(): .r files, else .rw
+    std::map<int, fs::path> files;
+    const char *exts[] = {".r", ".rw"};
+    for (size_t e = 0; e < 2 && files.empty(); e++) {
+        for (fs::directory_iterator it(path), end; it != end; ++it) {
+            if (!fs::is_regular_file(it->status()) ||
+                it->path().extension() != exts[e]) {
+                continue;
+            }
+            try {
+                files[boost::lexical_cast<int>(it->path().stem().string())] =
+                    it->path();
+            } catch (const boost::bad_lexical_cast &) {
+                BOOST_LOG_TRIVIAL(debug) << "Skipping " << it->path();
+            }
+        }
+    }
+
+    RecordingWriter writer;
+    if (!writer.open(file)) {
+        return -1;
+    }
+    for (std::map<int, fs::path>::const_iterator it = files.begin();
+         it != files.end(); ++it) {
+        if (!writer.appendFile(it->second.string(), it->first)) {
+            writer.close();
+            return -1;
+        }
+    }
+    int n = writer.size();
+    return writer.close() ? n : -1;
+}
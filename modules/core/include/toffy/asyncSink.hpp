@@ -0,0 +1,178 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "toffy/frame.hpp"
+
+namespace toffy {
+
+/**
+ * @brief Moves the file output of an exporter to a writer thread
+ * @ingroup Core
+ *
+ * An exporter hands its frame to submit() together with the slots it
+ * writes. With async enabled, submit() copies those slots into a new frame
+ * and queues it; a writer thread calls the writer function with the queued
+ * frames in order. Without async, submit() calls the writer directly.
+ *
+ * Images are copied through the MatPool, because the filters before the
+ * exporter may overwrite them in place with the next frame. With share set
+ * the matPtrs themselves are queued, which is only safe if the pipeline
+ * puts new buffers into the frame every time. Other slot types, e.g. point
+ * clouds, are always shared.
+ *
+ * The queue holds at most capacity frames. When the writer falls behind,
+ * the Policy decides: Block waits in submit(), like writing synchronously
+ * but with a buffer for short stalls; DropOldest and DropNewest keep the
+ * pipeline running and throw frames away. Every submitted frame ends up
+ * written, failed or dropped (or still queued), see Stats.
+ *
+ * The writer runs on the sink thread, so it must not touch state the
+ * exporter changes in filter(). Exporters flush() before changing their
+ * configuration and close() in their destructor.
+ *
+ * Config keys, read by updateConfig(): options.async (bool),
+ * options.asyncQueue (capacity), options.asyncPolicy (block, dropOldest,
+ * dropNewest), options.asyncShare (bool).
+ */
+class TOFFY_EXPORT AsyncSink
+{
+   public:
+    typedef std::shared_ptr<const Frame> FramePtr;
+
+    /** @brief Writes one frame, false on failure */
+    typedef std::function<bool(const Frame&)> Writer;
+
+    enum Policy
+    {
+        Block,       ///< submit() waits until there is room
+        DropOldest,  ///< the oldest queued frame makes room
+        DropNewest   ///< the submitted frame is dropped if the queue is full
+    };
+
+    struct Stats {
+        uint64_t submitted;  ///< submit() and push() calls
+        uint64_t written;    ///< frames the writer wrote
+        uint64_t failed;     ///< frames the writer failed on
+        uint64_t dropped;    ///< frames thrown away by the policy
+        uint64_t blocked;    ///< submits that had to wait for room
+        size_t queued;       ///< frames waiting or being written
+        size_t peak;         ///< most frames waiting at once
+    };
+
+    /**
+     * @param name used in log messages, e.g. the exporter id
+     * @param writer called for each frame, on the sink thread if async
+     */
+    AsyncSink(const std::string& name, const Writer& writer,
+              size_t capacity = 8, Policy policy = Block);
+
+    /** @brief Writes what is queued */
+    ~AsyncSink();
+
+    /** @brief Read the options.async* keys, flushes first */
+    void updateConfig(const boost::property_tree::ptree& pt);
+
+    /** @brief Put the options.async* keys */
+    void getConfig(boost::property_tree::ptree& pt) const;
+
+    bool async() const;
+    void async(bool enable);
+
+    size_t capacity() const;
+    Policy policy() const;
+
+    /** @brief Change queue size and policy, the queue is kept */
+    void configure(size_t capacity, Policy policy);
+
+    /**
+     * @brief Write the slots @p keys of @p in, now or on the sink thread
+     * @param share queue the matPtrs of @p in as they are, like
+     * options.asyncShare, for images only the caller holds
+     * @return result of the writer when synchronous, else true: dropped
+     * and failed frames are only counted, they do not stop the pipeline
+     */
+    bool submit(const Frame& in, const std::vector<std::string>& keys,
+                bool share = false);
+
+    /**
+     * @brief Queue a prepared frame, starts the writer thread
+     * @return false if the frame was dropped
+     */
+    bool push(const FramePtr& frame);
+
+    /** @brief Wait until the queue is written */
+    void flush();
+
+    /** @brief Write the queue, then stop the thread */
+    void close();
+
+    Stats stats() const;
+
+    /** @brief stats() as submitted, written, failed, dropped, blocked,
+     * queued, peak */
+    boost::property_tree::ptree getStats() const;
+
+    void resetStats();
+
+    /**
+     * @brief Frame with the slots @p keys of @p in, missing ones skipped
+     * @param share keep the matPtrs instead of pooled copies
+     */
+    static FramePtr snapshot(const Frame& in,
+                             const std::vector<std::string>& keys,
+                             bool share = false);
+
+    /** @brief Policy from "block", "dropOldest" or "dropNewest" */
+    static bool parsePolicy(const std::string& name, Policy& policy);
+    static std::string policyName(Policy policy);
+
+   private:
+    const std::string _name;
+    const Writer _writer;
+    size_t _capacity;
+    Policy _policy;
+    bool _async, _share;
+
+    std::deque<FramePtr> _queue;
+    bool _running,  ///< the thread is started and not closing
+        _busy;      ///< the writer is working on a frame
+    Stats _stats;
+
+    mutable boost::mutex _mtx;
+    boost::condition_variable _cond;
+    boost::thread _thread;
+
+    AsyncSink(const AsyncSink&);
+    AsyncSink& operator=(const AsyncSink&);
+
+    void run();
+    bool write(const Frame& f);
+};
+
+}  // namespace toffy
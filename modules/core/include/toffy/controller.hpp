@@ -17,10 +17,13 @@
 #ifndef __toffy_CONTROLLER_HPP__
 #define __toffy_CONTROLLER_HPP__
 
+#include <memory>
+
 #include <boost/thread.hpp>
 
 #include <toffy/filterbank.hpp>
 #include <toffy/frame.hpp>
+#include <toffy/workerPool.hpp>
 
 namespace toffy {
 
@@ -34,6 +37,12 @@ namespace toffy {
  * It contains the base filterBank and the Frame container with which is defined
  * and toffy instance.
  *
+ * It also owns the process-wide WorkerPool::shared(), configured with
+ * \<workers>\<threads>8\</threads>\<affinity>0 1 2 3\</affinity>\</workers>
+ * under \<toffy>; threads 0 or missing uses one per core, affinity lists
+ * the cpus the workers are pinned to in turn. The workers start with the
+ * first task, configs that never hand one to the pool run none.
+ *
  * @todo Forse constructor with Player instance. Player is the basic ui and
  * should be present, among others.
  *
@@ -131,6 +140,25 @@ public:
      */
     int loadRuntimeConfig(const std::string &configFile);
 
+    /**
+     * @brief Call counts and latencies of all filters
+     * @return FilterBank::getFilterStats() of the base bank plus the
+     * WorkerPool::getStats() of the shared pool as workers
+     */
+    boost::property_tree::ptree getFilterStats() const;
+
+    /**
+     * @brief Clear the filter and worker counters, e.g. after warm-up
+     */
+    void resetFilterStats();
+
+    /**
+     * @brief Write getFilterStats() to a JSON file
+     * @param fileName Path and name of the file to save.
+     * @return True on success, false if failed.
+     */
+    bool saveFilterStats(const std::string &fileName) const;
+
     void loadPlugins(const boost::property_tree::ptree& pt);
 
     void loadPlugin(std::string lib);
@@ -143,13 +171,49 @@ public:
 
     Frame& getFrame() { return f; }
 
+    /**
+     * @brief The pool installed as WorkerPool::shared()
+     */
+    WorkerPool& getWorkers() { return *_workers; }
+
+    /**
+     * @brief Replace the shared pool, only while idle
+     * @param threads number of workers, 0 for one per core
+     * @param cpus see WorkerPool::WorkerPool()
+     */
+    void setWorkers(size_t threads,
+                    const std::vector<int>& cpus = std::vector<int>());
+
 private:
     boost::thread _thread; ///< thread to run the toffy filtering
     state _state; ///< running state of toffy.
     std::vector<void *> _loads;
+    uint32_t _frames; ///< frames run, for tracing
+    std::unique_ptr<WorkerPool> _workers; ///< installed as WorkerPool::shared()
+
+    /**
+     * @brief Apply the \<workers> node of a config
+     */
+    void loadWorkers(const boost::property_tree::ptree& pt);
+
+    /**
+     * @brief run the base FilterBank once on f
+     */
+    bool filterFrame();
 
     void loopFilters();
     void loopFiltersOnce();
+
+    /**
+     * @brief init and start all filters running their own threads
+     * (ParallelFilter, Pipeline)
+     */
+    void startThreadedFilters();
+
+    /**
+     * @brief stop all filters running their own threads
+     */
+    void stopThreadedFilters();
 };
 } // namespace toffy
 
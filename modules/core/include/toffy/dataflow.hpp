@@ -0,0 +1,103 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include "toffy/filter.hpp"
+#include "toffy/workerPool.hpp"
+
+namespace toffy {
+
+/**
+ * @brief Dependencies between the filters of a FilterBank
+ * @ingroup Core
+ *
+ * Built from the slots each filter declares in its config: the values
+ * under inputs.* are read, the ones under outputs.* written. A filter
+ * depends on an earlier one if either writes a slot the other reads or
+ * writes, so running the filters in any order the graph allows gives the
+ * same frame as running them one after the other.
+ *
+ * Filters whose slots cannot be told from their config are barriers: they
+ * run alone, after everything before them and before everything after
+ * them. These are nested filter banks and every filter that does not
+ * override Filter::declaresSlots(), e.g. cameras, detectors and exporters
+ * reading fixed slot names.
+ */
+class TOFFY_EXPORT DataflowGraph
+{
+   public:
+    struct Node {
+        std::string id;
+        std::vector<std::string> reads, writes;  ///< sorted slot names
+        bool barrier;
+        std::vector<size_t> deps;   ///< earlier nodes this one waits for
+        std::vector<size_t> succs;  ///< later nodes waiting for this one
+    };
+
+    /** @brief Runs node i, false aborts the pass */
+    typedef std::function<bool(size_t)> NodeRunner;
+
+    DataflowGraph() {}
+
+    /** @brief Derive the graph from getConfig() of @p filters */
+    void build(const std::vector<Filter*>& filters);
+
+    /** @brief Derive the graph from given slot sets */
+    void build(const std::vector<Node>& nodes);
+
+    const std::vector<Node>& nodes() const { return _nodes; }
+    size_t size() const { return _nodes.size(); }
+
+    /**
+     * @brief Run all nodes once on @p pool, each as soon as its deps are
+     * done
+     *
+     * After a failing node no further nodes are started; nodes already
+     * running finish. Returns when no node is running any more.
+     *
+     * @return true if all nodes ran and succeeded
+     */
+    bool run(WorkerPool& pool, const NodeRunner& runner) const;
+
+    /**
+     * @brief The graph as ptree
+     * @param cost time of each node, e.g. the mean latency; empty to count
+     * every node as 1
+     *
+     * Contains nodes.<id> with deps, reads, writes, barrier and start (the
+     * earliest start with unlimited threads), criticalPath (ids separated
+     * by spaces), criticalPathCost, totalCost and parallelism (totalCost
+     * divided by criticalPathCost, the best possible speedup).
+     */
+    boost::property_tree::ptree report(
+        const std::vector<double>& cost = std::vector<double>()) const;
+
+    /** @brief Slot names under inputs.* and outputs.* of a filter config */
+    static void declaredSlots(const boost::property_tree::ptree& config,
+                              std::vector<std::string>& reads,
+                              std::vector<std::string>& writes);
+
+   private:
+    std::vector<Node> _nodes;
+};
+
+}  // namespace toffy
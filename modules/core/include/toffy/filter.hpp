@@ -234,6 +234,15 @@ class TOFFY_EXPORT Filter
      */
     virtual boost::property_tree::ptree getConfig() const;
 
+    /**
+     * @brief Whether the slots under inputs.* and outputs.* of getConfig()
+     * are all the filter reads and writes
+     *
+     * Only such filters are ordered by their slots in the dataflow mode of
+     * a FilterBank, all others run as barriers. False by default.
+     */
+    virtual bool declaresSlots() const { return false; }
+
     /**
      * @brief Udate the internal configuration of the filter
      * @param pt ptree
@@ -0,0 +1,125 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <toffy/toffy_export.h>
+
+namespace toffy {
+
+/**
+ * @brief Log-linear latency histogram in nanoseconds
+ * @ingroup Core
+ *
+ * Values below 2 * subBuckets are counted exactly. Above, every power of two
+ * is split into subBuckets linear buckets, so a percentile is off by less
+ * than 1 / subBuckets (6%) of its value, from nanoseconds up to hours, at a
+ * fixed size and with constant time record().
+ *
+ * Not thread safe, the owner serializes access.
+ */
+class TOFFY_EXPORT LatencyHistogram
+{
+   public:
+    static const int subBits = 4;
+    static const int subBuckets = 1 << subBits;
+
+    LatencyHistogram();
+
+    void record(uint64_t ns)
+    {
+        _counts[bucket(ns)]++;
+        _count++;
+        _sum += ns;
+        if (ns > _max) _max = ns;
+        if (ns < _min) _min = ns;
+    }
+
+    /** @brief Add the samples of another histogram */
+    void merge(const LatencyHistogram& other);
+
+    void reset();
+
+    uint64_t count() const { return _count; }
+    uint64_t min() const { return _count ? _min : 0; }
+    uint64_t max() const { return _max; }
+    uint64_t mean() const { return _count ? _sum / _count : 0; }
+
+    /**
+     * @brief Upper bound of the bucket holding the p-th percentile
+     * @param p 0..100
+     * @return ns, never above max()
+     */
+    uint64_t percentile(double p) const;
+
+    static size_t bucket(uint64_t ns)
+    {
+        if (ns < 2 * subBuckets) return ns;
+#ifdef __GNUC__
+        int msb = 63 - __builtin_clzll(ns);
+#else
+        int msb = 0;
+        for (uint64_t v = ns >> 1; v; v >>= 1) msb++;
+#endif
+        int shift = msb - subBits;
+        return (shift + 1) * subBuckets + (size_t)(ns >> shift) - subBuckets;
+    }
+
+    /** @brief Highest value counted in bucket @p i */
+    static uint64_t bucketMax(size_t i);
+
+   private:
+    std::vector<uint64_t> _counts;
+    uint64_t _count, _sum, _min, _max;
+};
+
+/**
+ * @brief Call and failure counters plus latency of a single filter
+ * @ingroup Core
+ */
+struct TOFFY_EXPORT FilterStats {
+    typedef std::chrono::steady_clock Clock;
+
+    FilterStats() : calls(0), failures(0) {}
+
+    void record(Clock::duration d, bool ok)
+    {
+        calls++;
+        if (!ok) failures++;
+        latency.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    void merge(const FilterStats& other);
+
+    void reset();
+
+    /**
+     * @brief Counters as calls, failures and latencyUs.{mean,p50,p95,p99,max}
+     */
+    boost::property_tree::ptree toPtree() const;
+
+    uint64_t calls;     ///< filter() invocations
+    uint64_t failures;  ///< invocations that returned false or threw
+    LatencyHistogram latency;
+};
+
+}  // namespace toffy
@@ -18,9 +18,14 @@
 //#include <string>
 //#include <list>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 
 #include "toffy/filter.hpp"
+#include "toffy/filterStats.hpp"
+#include "toffy/spscRing.hpp"
+#include "toffy/workerPool.hpp"
 
 namespace toffy
 {
@@ -31,15 +36,33 @@ namespace toffy
      * Executes all Filter presents in a FilterBank using a separated thread.
      * The FilterBank it self is execute always sequentially
      *
+     * Frames circulate between the caller and the lane through two bounded
+     * single-producer/single-consumer rings: empty frames are enqueue()d
+     * into the input ring, the lane fills them and the caller dequeue()s
+     * them from the output ring. The frames are allocated once in init().
+     *
+     * Started with a WorkerPool, the lane has no thread of its own: a task
+     * on the pool processes the frames waiting in the input ring and ends
+     * when it is empty, the next enqueue() submits a new one. At most one
+     * task per lane runs at a time, so the filter is never entered twice.
+     *
+     * Unseeded lanes only run on frames the caller enqueue()s. Slots set
+     * with copyOnWrite() are detach()ed before the filter runs, so a lane
+     * fed with a frame sharing its Mats with others writes to copies.
+     *
      */
 class FilterThread {
 public:
     /**
-	 * @brief Constructor: the filter passed is from then owned by FT and
-	 * will be deleted in the destructor.
+	 * @brief Constructor: the filter passed is not owned by FT, it must
+	 * outlive the lane.
 	 * @param filter
 	 */
-    FilterThread(Filter* filter) : f(filter) {}
+    FilterThread(Filter* filter)
+        : f(filter), keepRunning(false), _pool(NULL), _scheduled(false),
+          _detachAll(false)
+    {
+    }
 
     /**
 	 * @brief ~FilterThread
@@ -50,27 +73,40 @@ public:
 	 * @brief FilterThread
 	 * @param ft
 	 */
-    FilterThread( const FilterThread& ft): f(ft.f) {}
+    FilterThread(const FilterThread& ft)
+        : f(ft.f), keepRunning(false), _pool(NULL), _scheduled(false),
+          _detach(ft._detach), _detachAll(ft._detachAll)
+    {
+    }
 
     /**
-	 * @brief init the FT with a number of pre-allocated frames
+	 * @brief init the FT with a number of pre-allocated frames. Frames are
+	 * only allocated on the first call, later calls keep the existing ones.
 	 * @param numFrames
 	 */
     void init(int numFrames);
 
     /**
 	 * @brief start the thread
+	 * @param pool run the lane as tasks on pool instead, NULL for a
+	 * thread of its own
+	 * @param seed hand the frames from init() to the lane; false if the
+	 * caller enqueue()s frames of its own
 	 */
-    void start();
+    void start(WorkerPool* pool = NULL, bool seed = true);
 
     /**
-	 * @brief stop the thread
+	 * @brief stop the thread, or wait for the running lane task
 	 */
     void stop();
 
     /**
 	 * @brief synchronously retrieve an output frame
-	 * @return
+	 * @return the filled frame, NULL if the thread has been stopped
+	 *
+	 * Called from a task of the pool the lane runs on, e.g. by a
+	 * ParallelFilter inside another lane, the caller runs queued tasks of
+	 * the pool while it waits instead of blocking its worker.
 	 */
     Frame* dequeue();
 
@@ -79,25 +115,97 @@ public:
 	 */
     void enqueue(Frame*);
 
+    /**
+	 * @brief Slots the lane gets own copies of before running the filter
+	 * @param slots Mat slots written by the filter
+	 * @param all copy all Mat slots, for filters writing undeclared slots
+	 *
+	 * Set before start().
+	 */
+    void copyOnWrite(const std::vector<SlotKey>& slots, bool all = false)
+    {
+        _detach = slots;
+        _detachAll = all;
+    }
+
+    /**
+	 * @brief Number of Mats copied by copyOnWrite() since construction
+	 */
+    size_t copies() const { return _copies.load(); }
+
+    /**
+	 * @brief Number of frames processed by the lane since construction
+	 */
+    size_t processed() const { return _processed.load(); }
+
+    /**
+     * @brief Calls and latencies of the filter run by the lane
+     */
+    FilterStats stats() const;
+
+    /**
+     * @brief Clear stats()
+     */
+    void resetStats();
+
+    /**
+     * @brief The filter (bank) run by the lane
+     */
+    const Filter* filter() const { return f; }
+
 private:
-    Filter* f; ///< @todo document
+    Filter* f; ///< Filter (bank) run by the lane, not owned
 
-    bool keepRunning; ///< @todo document
+    std::atomic<bool> keepRunning; ///< true between start() and stop()
 
-    boost::thread theThread; ///< @todo document
+    boost::thread theThread; ///< the lane thread
 
-    std::list<Frame*> inQ; ///< @todo document
-    boost::mutex inMtx; ///< @todo document
-    boost::condition_variable inCond; ///< @todo document
+    WorkerPool* _pool; ///< runs the lane instead of theThread, not owned
 
-    std::list<Frame*> outQ; ///< @todo document
-    boost::mutex outMtx; ///< @todo document
-    boost::condition_variable outCond; ///< @todo document
+    bool _scheduled; ///< a lane task is queued or running
+
+    boost::mutex _taskMtx; ///< guards _scheduled
+
+    boost::condition_variable _taskDone; ///< signals !_scheduled
+
+    std::vector<Frame*> frames; ///< Frames allocated in init(), owned
+
+    SpscRing<Frame*> inQ; ///< Empty frames: caller -> lane
+
+    SpscRing<Frame*> outQ; ///< Filled frames: lane -> caller
+
+    std::atomic<size_t> _processed{0}; ///< frame counter
+
+    std::vector<SlotKey> _detach; ///< detached before running the filter
+
+    bool _detachAll; ///< detach all Mat slots
+
+    std::atomic<size_t> _copies{0}; ///< Mats copied for _detach
+
+    mutable boost::mutex _statsMtx; ///< guards _stats
+
+    FilterStats _stats; ///< measured in loop()
 
     /**
-     * @brief loop
-     * @todo document
+     * @brief Thread body: takes frames from inQ, runs the filter on them
+     * and hands them over to outQ until stopped.
      */
     void loop();
+
+    /**
+     * @brief Run the filter on one frame and hand it over to outQ
+     * @return false if outQ was closed
+     */
+    bool process(Frame* in);
+
+    /**
+     * @brief Submit a lane task unless one is pending or the lane stopped
+     */
+    void schedule();
+
+    /**
+     * @brief Pool task body: processes frames until inQ is empty
+     */
+    void runTask();
 };
 }
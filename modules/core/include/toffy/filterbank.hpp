@@ -16,13 +16,21 @@
 */
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <memory>
 #include <vector>
 
 #include <boost/container/flat_set.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/interprocess/sync/interprocess_semaphore.hpp>
+#include <boost/thread/mutex.hpp>
 
+#include "toffy/dataflow.hpp"
+#include "toffy/fusedPass.hpp"
 #include "toffy/filterfactory.hpp"
+#include "toffy/filterStats.hpp"
+#include "toffy/workerPool.hpp"
 
 #ifdef MSVC
 #define DLLExport __declspec(dllexport)
@@ -45,6 +53,22 @@ namespace toffy {
  * A FilterBank is a secuencially process line. the filters included on it are
  * execute one after the other.
  *
+ * In dataflow mode the bank instead runs each filter as soon as the filters
+ * it depends on are done, on its own threads. The dependencies come from
+ * the slots the filters declare as inputs and outputs, see DataflowGraph.
+ * Each filter works on a copy of the frame taken when it starts; its
+ * changes are merged back when it is done. Filters must declare every slot
+ * they write under outputs.*, others are not ordered.
+ * Enabled in the config with
+ * \<dataflow>\<enabled>true\</enabled>\<threads>4\</threads>\</dataflow>
+ * at the bank level.
+ *
+ * With \<fuse>true\</fuse> at the bank level, consecutive per-pixel filters
+ * working in place on the same planes run as one FusedPass. Frames the
+ * pass cannot take, e.g. with other plane types, go through the filters one
+ * by one. The fused filters share the time of the pass in the stats.
+ * Not used in dataflow mode.
+ *
  * It also the start point for toffy. A base FilterBank is defined in Player and
  * is the base for creating the execution structure.
  *
@@ -101,6 +125,7 @@ class TOFFY_EXPORT FilterBank : public Filter
     {
         std::vector<Filter*>::iterator it = _pipe.begin();
         _pipe.insert(it + pos, f);
+        invalidatePlan();
     }
 
     /**
@@ -205,6 +230,51 @@ class TOFFY_EXPORT FilterBank : public Filter
      */
     virtual bool filter(const Frame& in, Frame& out);
 
+    /**
+     * @brief Switch dataflow mode on or off
+     * @param enable
+     * @param threads worker threads, 0 for one per core
+     *
+     * The graph is derived again when filters are added or removed or
+     * change their config. Not to be called while filter() runs.
+     */
+    void dataflow(bool enable, size_t threads = 0);
+
+    bool dataflow() const { return _pool.get() != NULL; }
+
+    /**
+     * @brief The dependency graph of the contained filters
+     * @return DataflowGraph::report() weighted with the mean latency of
+     * each filter in us, once the bank has run
+     *
+     * Also available when dataflow mode is off, to see what it would gain.
+     */
+    boost::property_tree::ptree getDataflowReport() const;
+
+    /**
+     * @brief Switch the fusion of per-pixel filters on or off
+     *
+     * The filters are grouped again when they are added or removed or
+     * change their config. Not to be called while filter() runs.
+     */
+    void fuse(bool enable);
+
+    bool fuse() const { return !_passAt.empty(); }
+
+    /** @brief The fused passes, empty if fusion is off */
+    const std::vector<FusedPass>& fusedPasses() const { return _passes; }
+
+    /**
+     * @brief Have the dataflow graph and the fused passes derived again
+     * before the next frame
+     *
+     * Called by add() and insert(), and by Filter::updateConfig() of the
+     * contained filters, as their slots or whether they fuse may have
+     * changed. remove() derives them at once, the old ones would point to
+     * the removed filter.
+     */
+    void invalidatePlan() { _planStale = true; }
+
     /**
      * @brief loadFileConfig
      * @param configFile
@@ -278,6 +348,29 @@ class TOFFY_EXPORT FilterBank : public Filter
 
     virtual boost::property_tree::ptree getConfig() const;
 
+    virtual void updateConfig(const boost::property_tree::ptree& pt);
+
+    /**
+     * @brief Call counts and latency percentiles of the contained filters
+     * @return ptree with calls, failures, latencyUs.{mean,p50,p95,p99,max}
+     * of the passes through this bank and filters.<id> with the same
+     * counters and the type of each contained filter. Nested banks carry
+     * their own filters.<id> subtree.
+     *
+     * Can be called while the filters are running.
+     */
+    virtual boost::property_tree::ptree getFilterStats() const;
+
+    /**
+     * @brief Clear the counters of this bank and all nested banks
+     */
+    virtual void resetFilterStats();
+
+    /**
+     * @brief Counters of the passes through this bank
+     */
+    FilterStats bankStats() const;
+
     /**
      * @brief wait
      */
@@ -347,6 +440,39 @@ class TOFFY_EXPORT FilterBank : public Filter
 
     int loadPlugins(const boost::property_tree::ptree& pt);
 
+    /**
+     * @brief Account a call of the contained filter @p f
+     * @param d duration of the call
+     * @param ok false if the call failed or threw
+     */
+    void recordStats(const Filter* f, FilterStats::Clock::duration d,
+                     bool ok);
+
+    /**
+     * @brief Counters of the contained filter @p f, empty if it was not
+     * run by this bank
+     */
+    virtual FilterStats childStats(const Filter* f) const;
+
+    /**
+     * @brief Run the filter at position @p i and account it
+     * @return false if it failed or threw
+     */
+    bool runFilter(size_t i, const Frame& in, Frame& out);
+
+    /**
+     * @brief One pass through the filters in dataflow mode
+     * @return false if a filter failed
+     */
+    bool runDataflow(const Frame& in, Frame& out);
+
+    /**
+     * @brief Run the fused pass starting at position @p i, if any
+     * @param success [out] result of the pass
+     * @return false if the filters have to run one by one
+     */
+    bool runPass(size_t i, const Frame& in, Frame& out, bool& success);
+
    private:
     FilterFactory* ff = nullptr; ///< Pointer to the FilterFactory
     std::vector<Filter*> _pipe;  ///< Filter container
@@ -356,6 +482,25 @@ class TOFFY_EXPORT FilterBank : public Filter
 
     boost::interprocess::interprocess_semaphore ready;  ///< TODO
 
+    mutable boost::mutex _statsMtx;  ///< guards _stats and _passStats
+    std::map<const Filter*, FilterStats> _stats;  ///< per contained filter
+    FilterStats _passStats;  ///< complete passes through filter()
+
+    bool _dataflow = false;       ///< dataflow mode requested by the config
+    size_t _dataflowThreads = 0;  ///< threads requested by the config
+    DataflowGraph _graph;         ///< deps of the filters in _pipe
+    std::unique_ptr<WorkerPool> _pool;  ///< set in dataflow mode
+
+    bool _fuse = false;              ///< fusion requested by the config
+    std::vector<FusedPass> _passes;  ///< fused groups of _pipe
+    std::vector<int> _passAt;  ///< pass starting at each filter, or -1
+    std::atomic<bool> _planStale{false};  ///< _graph and _passes outdated
+
+    /**
+     * @brief Derive _graph and _passes from the filters in _pipe
+     */
+    void replan();
+
     static std::size_t _filter_counter;  ///< Internal Filter counter
 
     /**
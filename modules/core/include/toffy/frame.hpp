@@ -49,6 +49,61 @@ typedef std::shared_ptr<cv::Mat> matPtr;
 typedef pcl::PointCloud<pcl::PointXYZ>::Ptr pclCloudXyzPtr;
 typedef pcl::PointCloud<pcl::PointXYZRGB>::Ptr pclCloudXyzRgbPtr;
 
+/**
+ * @brief Interned handle to a Frame slot name
+ * @ingroup Core
+ *
+ * Slot names are registered once in a process-wide table and mapped to a
+ * small integer id. Filters create their keys when reading the configuration
+ * (updateConfig) and use them in filter() for indexed access to the Frame
+ * without string compares or temporaries.
+ *
+ * Two SlotKeys created from the same name always share the same id, so
+ * string and key based access to a Frame can be freely mixed.
+ */
+class TOFFY_EXPORT SlotKey
+{
+   public:
+    static const std::size_t invalid;  ///< id of an unset key
+
+    SlotKey() : _id(invalid) {}
+
+    /**
+     * @brief Interns name (if not known yet) and binds the key to it
+     * @param name slot name as used by the string api
+     */
+    explicit SlotKey(const std::string& name);
+
+    std::size_t id() const { return _id; }
+
+    bool valid() const { return _id != invalid; }
+
+    /**
+     * @brief Slot name the key was interned from
+     * @return name, empty string for unset keys
+     */
+    std::string name() const;
+
+    bool operator==(const SlotKey& k) const { return _id == k._id; }
+    bool operator!=(const SlotKey& k) const { return _id != k._id; }
+
+    /**
+     * @brief Looks up an already interned name without registering it
+     * @param name
+     * @param key [out] set to the key on success
+     * @return True if the name is known, false otherwise
+     */
+    static bool find(const std::string& name, SlotKey& key);
+
+    /**
+     * @brief Number of names interned so far
+     */
+    static std::size_t count();
+
+   private:
+    std::size_t _id;
+};
+
 /**
  * @brief Frame is a container where any filter could add, retrieve, modify and
  *  delete all kind of data.
@@ -81,7 +136,8 @@ class TOFFY_EXPORT Frame
      */
     Frame& operator=(const Frame& x)
     {
-        data = x.data;
+        slots = x.slots;
+        lastChange = x.lastChange;
         return *this;
     }
 
@@ -166,15 +222,31 @@ class TOFFY_EXPORT Frame
      */
     void clearData();
 
-    SlotDataType getDataType(const std::string& key) const
-    {
-        return meta.find(key) != meta.end() ? meta.find(key)->second : NotFound;
-    }
+    /**
+     * @brief Copy all slots set in f into this Frame, overwriting existing
+     *  ones. Slots only present here are kept.
+     * @param f
+     */
+    void merge(const Frame& f);
 
-    std::string getDescription(const std::string& key) const
-    {
-        return desc.find(key) != desc.end() ? desc.find(key)->second : "";
-    }
+    /**
+     * @brief Stamp of the latest change, goes up with every addData(),
+     *  removeData() and merge()
+     */
+    unsigned long changeStamp() const { return lastChange; }
+
+    /**
+     * @brief Copy the slots added to or removed from f after its
+     *  changeStamp() was @p since. Other slots are left alone.
+     *
+     * Lets a filter work on a copy of the frame while others change it,
+     * its results are merged back afterwards.
+     */
+    void mergeChanges(const Frame& f, unsigned long since);
+
+    SlotDataType getDataType(const std::string& key) const;
+
+    std::string getDescription(const std::string& key) const;
 
     /**
      * @brief Get data from Frame with key
@@ -278,25 +350,135 @@ class TOFFY_EXPORT Frame
     inline matPtr setGetMatPtr(const std::string& key, Size size, int type);
     inline std::string setGetString(const std::string& key, std::string& dfault);
 */
-    /** get matPtr, if not set, create and insert a new one: */
-    inline matPtr getSertMatPtr(const std::string& key, cv::Size size,
-                                int type);
+    /** get matPtr, if not set, create and insert a new one (taken from
+     * MatPool::global()): */
+    matPtr getSertMatPtr(const std::string& key, cv::Size size, int type);
+
+    /*!
+     *** slot key access ************************
+     *  \addtogroup Slot_keys
+     *  @{
+     */
+
+    /**
+     * @brief Check if a slot is set in the frame
+     * @param key interned slot key
+     * @return True if found, false if not
+     */
+    bool hasKey(const SlotKey& key) const
+    {
+        return key.id() < slots.size() && slots[key.id()].set;
+    }
+
+    /**
+     * @brief Typed, non-copying access to a slot
+     * @param key interned slot key
+     * @return Pointer to the stored value, NULL if the slot is not set or
+     *  holds a different type
+     */
+    template <typename T>
+    const T* get(const SlotKey& key) const
+    {
+        if (!hasKey(key)) return NULL;
+        return boost::any_cast<T>(&slots[key.id()].value);
+    }
+
+    template <typename T>
+    T* get(const SlotKey& key)
+    {
+        if (!hasKey(key)) return NULL;
+        return boost::any_cast<T>(&slots[key.id()].value);
+    }
+
+    /**
+     * @brief Insert data in the Frame under an interned key. Overwrites
+     *  existing data.
+     * @param key interned slot key
+     * @param v the value
+     * @param dt dataType
+     */
+    void addData(const SlotKey& key, boost::any v, SlotDataType dt);
+
+    void addData(const SlotKey& key, matPtr m) { addData(key, m, Mat); }
+
+    /**
+     * @brief Delete data from the Frame by key
+     * @param key
+     * @return True if deleted, False if not found
+     */
+    bool removeData(const SlotKey& key);
+
+    /**
+     * @brief Give a Mat slot a cv::Mat of its own
+     *
+     * If the matPtr in the slot is shared with another owner, e.g. the
+     * Frame it was merge()d from, it is replaced by a deep copy taken from
+     * MatPool::global(). Writing to the Mat afterwards does not show in
+     * the other owners.
+     *
+     * @param key interned slot key
+     * @return True if a copy was made
+     */
+    bool detach(const SlotKey& key);
+
+    /**
+     * @brief detach() all Mat slots
+     * @return Number of copies made
+     */
+    std::size_t detachAll();
+
+    SlotDataType getDataType(const SlotKey& key) const
+    {
+        return hasKey(key) ? slots[key.id()].dt : NotFound;
+    }
+
+    /**
+     * @brief Shorted getter for matPtr in frame
+     * @param key interned slot key
+     * @return matPtr, throws boost::bad_any_cast if not set or not a Mat
+     */
+    inline matPtr getMatPtr(const SlotKey& key) const;
+
+    /**
+     * @brief optional variant - returns dfault if key not present
+     */
+    inline matPtr optMatPtr(const SlotKey& key, matPtr dfault) const;
+
+    /*! @} End Group Slot_keys*/
 
    private:
     /**
-     * Data container in frame.
+     * Data container entry in frame.
+     *
+     * Uses boost::any to save any kind of data, together with its data type
+     * and an optional description.
+     */
+    struct Slot {
+        Slot() : dt(NotFound), set(false), stamp(0) {}
+
+        boost::any value;         ///< the data
+        SlotDataType dt;          ///< data type of the slot
+        std::string description;  ///< optional description for a data slot
+        bool set;                 ///< true if the slot holds data
+        unsigned long stamp;      ///< changeStamp() of the last change
+    };
+
+    /**
+     * Data container in frame, indexed by SlotKey::id().
      *
-     * Its has a unique string key and uses boost::any to save any kind
-     * of data.
-     * Use boost::shared_ptr to avoid any memory leak.
+     * String keys are mapped to the same index through the SlotKey registry.
+     * Use shared_ptr for heavy data to avoid any memory leak.
      */
-    boost::container::flat_map<std::string, boost::any> data;
+    std::vector<Slot> slots;
 
-    /** data type of the slot */
-    boost::container::flat_map<std::string, SlotDataType> meta;
+    unsigned long lastChange;  ///< see changeStamp()
 
-    /** optional description for a data slot */
-    boost::container::flat_map<std::string, std::string> desc;
+    /** returns the slot for key, growing the container if needed */
+    Slot& slot(const SlotKey& key)
+    {
+        if (key.id() >= slots.size()) slots.resize(key.id() + 1);
+        return slots[key.id()];
+    }
 };
 
 inline unsigned int Frame::getUInt(const std::string& key) const
@@ -389,14 +571,17 @@ inline std::string Frame::optString(const std::string& key,
     return hasKey(key) ? getString(key) : dfault;
 };
 
-inline matPtr Frame::getSertMatPtr(const std::string& key, cv::Size size,
-                                   int type)
+inline matPtr Frame::getMatPtr(const SlotKey& key) const
 {
-    if (!hasKey(key)) {
-        matPtr mp(new cv::Mat(size, type));
-        addData(key, mp, Mat);
-    }
-    return getMatPtr(key);
+    const matPtr* m = get<matPtr>(key);
+    if (!m) throw boost::bad_any_cast();
+    return *m;
+}
+
+inline matPtr Frame::optMatPtr(const SlotKey& key, matPtr dfault) const
+{
+    const matPtr* m = get<matPtr>(key);
+    return m ? *m : dfault;
 }
 
 }  // namespace toffy
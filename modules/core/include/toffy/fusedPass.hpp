@@ -0,0 +1,77 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "toffy/pixelFilter.hpp"
+
+namespace toffy {
+
+/**
+ * @brief Consecutive per-pixel filters run as one loop over the image
+ * @ingroup Core
+ *
+ * Each PixelFilter of a chain like range, amplitudeRange, roi, distAmpl
+ * walks the whole image and allocates its own temporaries. A FusedPass
+ * runs their fusedRow() one after the other on each row instead, so
+ * every pixel of the depth and amplitude planes is loaded once and no
+ * intermediate Mats are made. The filters must work in place on the same
+ * depth plane and, if any, the same amplitude plane; the result is the
+ * same as running them one by one.
+ *
+ * The amplitude plane may be CV_32F, CV_16S or CV_16U, integer rows are
+ * converted to float for the stages. The rows are split into bands on
+ * WorkerPool::shared() if one of the filters is tiled.
+ */
+class TOFFY_EXPORT FusedPass
+{
+   public:
+    FusedPass() : _amplWritten(false) {}
+
+    /**
+     * @brief Append @p f to the pass
+     * @return false if @p f is not fusible or works on other planes
+     */
+    bool add(PixelFilter* f);
+
+    std::size_t size() const { return _stages.size(); }
+
+    const std::vector<PixelFilter*>& filters() const { return _stages; }
+
+    /** @brief Ids of the filters, separated by spaces */
+    std::string id() const;
+
+    /**
+     * @brief Run all filters on @p in
+     *
+     * @return false if the planes do not fit the pass or a filter refuses
+     * them in fusedBegin(); no pixel is changed then and the filters have
+     * to run one by one.
+     */
+    bool filter(const Frame& in, Frame& out);
+
+   private:
+    std::vector<PixelFilter*> _stages;  ///< filters of the pass, not owned
+    std::string _depth, _ampl;          ///< plane slot names
+    SlotKey _depthKey, _amplKey;
+    bool _amplWritten;  ///< a stage changes ampl
+
+    void run(int begin, int end, cv::Mat& depth, cv::Mat* ampl) const;
+};
+
+}  // namespace toffy
@@ -0,0 +1,124 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <memory>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <opencv2/core.hpp>
+
+#include "toffy/frame.hpp"
+
+namespace toffy {
+
+/**
+ * @brief Recycles image buffers by size and type
+ * @ingroup Core
+ *
+ * acquire() hands out a matPtr whose deleter puts the cv::Mat back into
+ * the pool instead of freeing it. Buffers therefore return automatically
+ * when the last reference goes away: a frame slot is overwritten, removed,
+ * or the frame is cleared for reuse. A filter that acquires its outputs
+ * from the pool does no image allocations once the pipeline is warm.
+ *
+ * A cv::Mat is only taken back if it still owns its data exclusively; a
+ * buffer that has been reassigned in between is pooled under its new size
+ * and type. Each size/type keeps at most maxPerKey() idle buffers.
+ *
+ * The pool is thread safe. Buffers may outlive the pool, they are freed
+ * normally then.
+ */
+class TOFFY_EXPORT MatPool
+{
+   public:
+    /**
+     * @brief Counters since construction or resetStats()
+     */
+    struct Stats {
+        unsigned long long allocated;  ///< acquires served by a new buffer
+        unsigned long long reused;     ///< acquires served from the pool
+        unsigned long long returned;   ///< buffers taken back
+        unsigned long long dropped;    ///< buffers freed (shared or full)
+        size_t idle;                   ///< buffers waiting in the pool
+        size_t idleBytes;              ///< memory held by idle buffers
+    };
+
+    /**
+     * @brief MatPool
+     * @param maxPerKey idle buffers kept per size and type
+     */
+    explicit MatPool(size_t maxPerKey = 8);
+
+    ~MatPool();
+
+    /**
+     * @brief Get a buffer, its contents are undefined
+     * @param size
+     * @param type OpenCV type, e.g. CV_32F
+     */
+    matPtr acquire(cv::Size size, int type);
+
+    matPtr acquire(int rows, int cols, int type)
+    {
+        return acquire(cv::Size(cols, rows), type);
+    }
+
+    /**
+     * @brief Get a buffer holding a copy of src, the pooled clone()
+     */
+    matPtr clone(const cv::Mat& src);
+
+    /**
+     * @brief Free all idle buffers
+     */
+    void clear();
+
+    size_t maxPerKey() const;
+    void maxPerKey(size_t n);
+
+    Stats stats() const;
+
+    /**
+     * @brief Counters as ptree (allocated, reused, returned, dropped, idle,
+     * idleBytes)
+     */
+    boost::property_tree::ptree getStats() const;
+
+    void resetStats();
+
+    /**
+     * @brief True if @p m can be written in place: at most @p holders
+     * matPtrs point to it, e.g. the frame slot and the caller, and no other
+     * cv::Mat shares its data. Works for any matPtr, pooled or not.
+     */
+    static bool exclusive(const matPtr& m, long holders = 2);
+
+    /**
+     * @brief Process wide pool used by the filters
+     */
+    static MatPool& global();
+
+   private:
+    class Impl;
+    struct Recycle;
+    std::shared_ptr<Impl> _impl;  ///< shared with the buffer deleters
+
+    MatPool(const MatPool&);
+    MatPool& operator=(const MatPool&);
+};
+
+}  // namespace toffy
@@ -32,6 +32,21 @@ class Mux;
  * @brief ParallelFilter treats a collection of filters as a (parallel) set of
  * tasks, collecting the output frames for a subsequent (array) filter.
  * @ingroup Core
+ *
+ * By default each lane fills frames of its own, e.g. from a camera of its
+ * own, and runs ahead of filter(). With options.fanOut the lanes instead
+ * work on the frame passed to filter(): every lane gets a frame sharing
+ * the slots of the input, and the Mats of the slots a lane writes are
+ * copied on the lane before its filters run. The barrier merges the lane
+ * frames as usual. Lanes with filters that do not declare every slot they
+ * use, see Filter::declaresSlots(), copy all Mats.
+ *
+ * The filters of the lanes and the barrier are created through the
+ * FilterFactory and deleted with the ParallelFilter, the lanes only run
+ * them.
+ *
+ * A ParallelFilter may run inside a lane of another one: waiting for its
+ * lanes on a worker of the shared pool, filter() runs their tasks itself.
  */
 class ParallelFilter : public FilterBank
 {
@@ -39,7 +54,13 @@ public:
 
     static const std::string id_name; ///< Const with the filter type
 
-    ParallelFilter() : FilterBank(id_name, _filter_counter) {}
+    ParallelFilter()
+        : FilterBank(id_name, _filter_counter),
+          mux(NULL),
+          _dedicatedThreads(false),
+          _fanOut(false)
+    {
+    }
 
     virtual ~ParallelFilter();
 
@@ -50,6 +71,18 @@ public:
      */
     virtual bool filter(const Frame& in, Frame& out);
 
+    /**
+     * @brief Lanes work on the input frame of filter(), set before init()
+     */
+    void fanOut(bool enable) { _fanOut = enable; }
+
+    bool fanOut() const { return _fanOut; }
+
+    /**
+     * @brief Mats copied by the lanes in fan-out mode
+     */
+    size_t copies() const;
+
 
     /**
      * @brief initialize the threads and supply them with input frames
@@ -66,6 +99,11 @@ public:
      */
     virtual void stop();
 
+    /**
+     * @brief Clears the lane counters as well
+     */
+    virtual void resetFilterStats();
+
 protected:
     /**
      * @brief Handles the parallel filters elements
@@ -76,7 +114,7 @@ protected:
      *
      * Reads through a configFile node and checks the known parallel filter
      * nodes:
-     * - parallelFilter, thread, filterGroup, and barrier.
+     * - parallelFilter, thread, filterGroup, barrier and options.
      *
      *  It creates a list of filterBanks that will be execute in parallel.
      *
@@ -84,9 +122,17 @@ protected:
     virtual int handleConfigItem(const std::string& confFile,
 				 const boost::property_tree::ptree::const_iterator& it);
 
+    /**
+     * @brief Lane filters are measured by their FilterThread
+     */
+    virtual FilterStats childStats(const Filter* f) const;
+
 private:
     static std::size_t _filter_counter; ///< Internal Filter counter
     std::vector<FilterThread*> lanes; ///< Container for all parallel filter threads
     Mux* mux; ///< To synchronize all Filter outputs
+    bool _dedicatedThreads; ///< lanes on own threads, not the shared pool
+    bool _fanOut; ///< lanes work on the input frame
+    std::vector<Frame> _fanFrames; ///< lane frames in fan-out mode
 };
 }
@@ -0,0 +1,154 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "toffy/filterbank.hpp"
+#include "toffy/spscRing.hpp"
+
+namespace toffy {
+
+/**
+ * @brief Pipeline runs groups of filters (stages) on their own threads, so
+ * consecutive frames overlap: while a later stage works on frame N, the
+ * first stage already captures frame N+1.
+ * @ingroup Core
+ *
+ * Every stage is a FilterBank. Stages are connected by bounded queues of
+ * \<queue> frames; a stage blocks when its successor is that far behind.
+ * Frames leave the pipeline in capture order. The frames circulating in
+ * the pipeline are separate from the frame passed to filter(), which
+ * receives the slots of the oldest finished frame.
+ *
+ * Config:
+ * @code
+ * <pipeline>
+ *   <options><queue>2</queue></options>
+ *   <stage> <bta> ... </bta> </stage>
+ *   <stage> <average/> <range/> ... </stage>
+ *   <stage> <blobs/> ... </stage>
+ * </pipeline>
+ * @endcode
+ *
+ * All stages work on the same frame one after the other, so a stage reads
+ * the slots written by the stages before it. Only the "backward" flag is
+ * passed from the input frame to the first stage; filters in front of the
+ * pipeline run on the caller's thread, their slots are not visible to the
+ * stages. If a stage fails on a frame, the remaining stages skip it and
+ * filter() returns false for it, like a sequential FilterBank would.
+ *
+ * When a frame is handed out, the circulating frame takes over the Mats
+ * the output frame held before (those nobody else refers to), so the
+ * stages keep writing into the same buffers.
+ */
+class TOFFY_EXPORT Pipeline : public FilterBank
+{
+   public:
+    static const std::string id_name;  ///< Const with the filter type
+
+    Pipeline();
+
+    virtual ~Pipeline();
+
+    /**
+     * @brief Hands out the oldest finished frame, starting the stage
+     * threads if needed.
+     * @return the result of the stages for that frame
+     */
+    virtual bool filter(const Frame& in, Frame& out);
+
+    virtual boost::property_tree::ptree getConfig() const;
+
+    virtual void updateConfig(const boost::property_tree::ptree& pt);
+
+    // derived from FilterBank:
+    virtual int loadConfig(const boost::property_tree::ptree& pt,
+                           const std::string& confFile = "");
+
+    /**
+     * @brief allocate the circulating frames
+     */
+    virtual void init();
+
+    /**
+     * @brief start the stage threads
+     */
+    virtual void start();
+
+    /**
+     * @brief stop and join the stage threads, logs the statistics
+     */
+    virtual void stop();
+
+    /**
+     * @brief Number of stages
+     */
+    size_t stages() const { return _stages.size(); }
+
+    /**
+     * @brief Per stage and end-to-end counters
+     * @return ptree with stage.<i>.{name,frames,failed,busyAvgUs,busyMaxUs,
+     *  waitAvgUs,queueAvg} and latencyAvgUs, latencyMaxUs
+     */
+    boost::property_tree::ptree getStats() const;
+
+   private:
+    /** a frame travelling through the stages */
+    struct Job {
+        Frame* frame;
+        bool ok;             ///< false once a stage failed on the frame
+        long long startUs;   ///< time the first stage picked the frame up
+        uint32_t number;     ///< frame sequence number, for tracing
+    };
+
+    /** bookkeeping of a single stage */
+    struct Stage {
+        explicit Stage(FilterBank* fb) : bank(fb) {}
+
+        FilterBank* bank;      ///< the filters of the stage
+        boost::thread thread;  ///< runs runStage()
+
+        std::atomic<unsigned long long> frames{0}, failed{0}, busyUs{0},
+            busyMaxUs{0}, waitUs{0}, queueSum{0};
+    };
+
+    static std::size_t _filter_counter;  ///< Internal Filter counter
+
+    size_t _depth;                       ///< frames queued between stages
+    std::vector<Stage*> _stages;         ///< owned, banks are in _pipe
+    std::vector<SpscRing<Job>*> _rings;  ///< _rings[i] feeds stage i, owned
+    std::vector<Frame*> _frames;         ///< circulating frames, owned
+    std::atomic<bool> _running;
+    std::atomic<bool> _backward;  ///< flag forwarded to the first stage
+    uint32_t _sequence;           ///< next Job::number, first stage only
+
+    std::atomic<unsigned long long> _delivered{0}, _latencyUs{0},
+        _latencyMaxUs{0};
+
+    void runStage(size_t i);
+
+    /**
+     * @brief Clears @p frame and gives it the unshared Mats of @p prev
+     */
+    static void recycle(Frame& prev, Frame& frame);
+};
+
+}  // namespace toffy
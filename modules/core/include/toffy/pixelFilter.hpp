@@ -0,0 +1,122 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <functional>
+
+#include "toffy/filter.hpp"
+
+namespace toffy {
+
+class FusedPass;
+
+/**
+ * @brief Base of filters that handle each pixel on its own
+ * @ingroup Core
+ *
+ * Derived filters put their per-pixel work into a body for a range of
+ * rows and run it with forEachBand(). With options.tiled set the rows are
+ * split into bands that run concurrently on WorkerPool::shared(),
+ * otherwise the body gets all rows at once on the calling thread. Outputs
+ * must be allocated before, a band must not resize them.
+ *
+ * A filter that works on each pixel of a float depth plane, optionally
+ * reading or writing the amplitude of the same pixel, can also run as a
+ * stage of a FusedPass: it describes its planes in fusible() and does its
+ * work row by row in fusedRow().
+ *
+ * Options, in addition to those of the filter:
+ * - tiled: bool, run bands concurrently, default false
+ * - bandRows: rows per band, 0 to split into two bands per worker
+ */
+class TOFFY_EXPORT PixelFilter : public Filter
+{
+   public:
+    PixelFilter(std::string type, std::size_t counter = 0);
+    virtual ~PixelFilter() {}
+
+    virtual boost::property_tree::ptree getConfig() const;
+    virtual void updateConfig(const boost::property_tree::ptree& pt);
+
+    bool tiled() const { return _tiled; }
+    void tiled(bool t) { _tiled = t; }
+
+    int bandRows() const { return _bandRows; }
+    void bandRows(int rows) { _bandRows = rows; }
+
+    /** @brief Slots a filter works on as stage of a FusedPass */
+    struct FusedPlanes {
+        FusedPlanes() : amplWritten(false) {}
+
+        std::string depth;  ///< CV_32F plane, changed in place
+        std::string ampl;   ///< amplitude plane, empty if not used
+        bool amplWritten;   ///< the stage changes ampl in place
+    };
+
+    /**
+     * @brief Describe the filter as stage of a FusedPass
+     * @return false if the filter cannot be fused as configured, the
+     * default
+     */
+    virtual bool fusible(FusedPlanes& /*planes*/) const { return false; }
+
+    /**
+     * @brief Prepare a fused pass over @p depth and @p ampl
+     *
+     * Checks the planes like filter() and allocates side outputs in
+     * @p out. @p ampl is NULL if the pass uses no amplitude plane.
+     *
+     * @return false to run the filters of the pass one by one instead
+     */
+    virtual bool fusedBegin(const cv::Mat& /*depth*/, const cv::Mat* /*ampl*/,
+                            Frame& /*out*/)
+    {
+        return false;
+    }
+
+    /**
+     * @brief The work of filter() on row @p y
+     * @param depth the row of the depth plane
+     * @param ampl the row of the amplitude plane as float, NULL if the
+     * pass uses none
+     * @param cols length of the rows
+     *
+     * Called concurrently for distinct rows.
+     */
+    virtual void fusedRow(int /*y*/, float* /*depth*/, float* /*ampl*/,
+                          int /*cols*/) const
+    {
+    }
+
+   protected:
+    /** @brief Works on rows [begin, end) */
+    typedef std::function<void(int begin, int end)> BandTask;
+
+    /**
+     * @brief Run @p body over rows [0, rows), in bands if tiled()
+     *
+     * Exceptions of a band are rethrown once all bands are done.
+     */
+    void forEachBand(int rows, const BandTask& body) const;
+
+   private:
+    friend class FusedPass;
+
+    bool _tiled;    ///< split into bands
+    int _bandRows;  ///< rows per band, 0 for automatic
+};
+
+}  // namespace toffy
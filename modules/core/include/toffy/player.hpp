@@ -60,6 +60,15 @@ public:
      */
     int loadConfig(const std::string &configFile);
 
+    /**
+     * @brief Instanciate the filters of an already parsed config
+     * @param pt Config with the root node \<toffy>
+     * @param configFile Path the config was read from, for relative paths
+     * @return Positive on success, negative or 0 in failed
+     */
+    int loadConfig(const boost::property_tree::ptree &pt,
+                   const std::string &configFile = "");
+
     /**
      * @brief An accessor to the Frame to load data from different sources
      * @param key Data identifier
@@ -117,6 +126,30 @@ public:
 
     void loadPlugin(std::string lib);
 
+    /**
+     * @brief Call counts and latency percentiles of all filters
+     * @see FilterBank::getFilterStats()
+     */
+    boost::property_tree::ptree getFilterStats() const
+    {
+        return _controller.getFilterStats();
+    }
+
+    /**
+     * @brief Clear the filter counters
+     */
+    void resetFilterStats() { _controller.resetFilterStats(); }
+
+    /**
+     * @brief Dump getFilterStats() as JSON
+     * @param fileName
+     * @return True on success, false if failed.
+     */
+    bool saveFilterStats(const std::string& fileName) const
+    {
+        return _controller.saveFilterStats(fileName);
+    }
+
     /**
      * @brief Getter for the base FilterBank
      * @return Pointer to base Filterbank on success, NULL in failed
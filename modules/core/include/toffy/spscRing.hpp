@@ -0,0 +1,231 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace toffy {
+
+/**
+ * @brief Bounded single-producer/single-consumer ring buffer
+ * @ingroup Core
+ *
+ * Exactly one thread may push and exactly one thread may pop. The slots are
+ * allocated once in the constructor (or reset()), push and pop are lock-free.
+ *
+ * The blocking variants spin and yield for a short while before they park
+ * on a condition variable. Parking is announced through a waiter counter
+ * that the other side checks after each operation, so wakeups are never
+ * lost and the fast path never touches the mutex.
+ *
+ * close() wakes up all blocked calls; afterwards push() fails and pop()
+ * drains the remaining elements before failing.
+ */
+template <typename T>
+class SpscRing
+{
+   public:
+    /**
+     * @brief SpscRing
+     * @param capacity maximum number of elements
+     */
+    explicit SpscRing(size_t capacity = 2) { reset(capacity); }
+
+    /**
+     * @brief Re-allocates the ring. Not thread safe, only call it while no
+     * producer or consumer is active.
+     * @param capacity
+     */
+    void reset(size_t capacity)
+    {
+        if (capacity == 0) capacity = 1;
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        _buf.assign(cap, T());
+        _mask = cap - 1;
+        _capacity = capacity;
+        _head.store(0);
+        _tail.store(0);
+        _waiters.store(0);
+        _closed.store(false);
+    }
+
+    /**
+     * @brief Maximum number of elements in the ring
+     */
+    size_t capacity() const { return _capacity; }
+
+    /**
+     * @brief Number of queued elements, a snapshot only
+     */
+    size_t size() const
+    {
+        return _tail.load(std::memory_order_acquire) -
+               _head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    /**
+     * @brief Non-blocking push
+     * @return true on success, false if full or closed
+     */
+    bool tryPush(const T& v)
+    {
+        if (_closed.load(std::memory_order_acquire)) return false;
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) >= _capacity) {
+            return false;
+        }
+        _buf[tail & _mask] = v;
+        _tail.store(tail + 1, std::memory_order_seq_cst);
+        wakeup();
+        return true;
+    }
+
+    /**
+     * @brief Non-blocking pop
+     * @return true on success, false if empty
+     */
+    bool tryPop(T& v)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) return false;
+        v = _buf[head & _mask];
+        _head.store(head + 1, std::memory_order_seq_cst);
+        wakeup();
+        return true;
+    }
+
+    /**
+     * @brief Blocking push, waits while the ring is full.
+     * @return true on success, false if the ring has been closed
+     */
+    bool push(const T& v)
+    {
+        for (int i = 0; !tryPush(v); i++) {
+            if (_closed.load(std::memory_order_acquire)) return false;
+            if (!backoff(i)) {
+                park([this]() {
+                    return _closed.load() ||
+                           _tail.load() - _head.load() < _capacity;
+                });
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Blocking pop, waits while the ring is empty.
+     * @return true on success, false if the ring is closed and drained
+     */
+    bool pop(T& v)
+    {
+        for (int i = 0; !tryPop(v); i++) {
+            if (_closed.load(std::memory_order_acquire)) {
+                // a last element may have been pushed before closing
+                return tryPop(v);
+            }
+            if (!backoff(i)) {
+                park([this]() {
+                    return _closed.load() || _tail.load() != _head.load();
+                });
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Fail all future pushes and wake up blocked callers
+     */
+    void close()
+    {
+        _closed.store(true);
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        _cond.notify_all();
+    }
+
+    /**
+     * @brief Re-enable a closed ring, keeping its contents
+     */
+    void open() { _closed.store(false); }
+
+    bool closed() const { return _closed.load(); }
+
+   private:
+    static const int spins = 64;   ///< busy iterations before yielding
+    static const int yields = 16;  ///< yields before parking
+
+    std::vector<T> _buf;  ///< slots, a power of 2 for cheap indexing
+    size_t _mask;         ///< _buf.size() - 1
+    size_t _capacity;     ///< usable slots, <= _buf.size()
+
+    // producer and consumer indices live on separate cache lines (padding
+    // instead of alignas, C++14 new does not honour extended alignment)
+    char _pad0[64];
+    std::atomic<size_t> _head;  ///< next slot to pop
+    char _pad1[64];
+    std::atomic<size_t> _tail;  ///< next slot to push
+    char _pad2[64];
+    std::atomic<int> _waiters;  ///< number of parked threads
+    std::atomic<bool> _closed;
+
+    boost::mutex _mtx;
+    boost::condition_variable _cond;
+
+    /**
+     * @brief Spin, then yield
+     * @return false once the caller should park
+     */
+    bool backoff(int i)
+    {
+        if (i < spins) return true;
+        if (i < spins + yields) {
+            boost::this_thread::yield();
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Pred>
+    void park(Pred ready)
+    {
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        {
+            boost::unique_lock<boost::mutex> lock(_mtx);
+            while (!ready()) _cond.wait(lock);
+        }
+        _waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void wakeup()
+    {
+        if (_waiters.load(std::memory_order_seq_cst) == 0) return;
+        {
+            // serialize with a waiter that is between its check and wait()
+            boost::lock_guard<boost::mutex> lock(_mtx);
+        }
+        _cond.notify_all();
+    }
+};
+
+}  // namespace toffy
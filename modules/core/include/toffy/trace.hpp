@@ -0,0 +1,130 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include <toffy/toffy_export.h>
+
+namespace toffy {
+
+/**
+ * @brief Timeline of filter calls for chrome://tracing or Perfetto
+ * @ingroup Core
+ *
+ * Every thread writes begin/end events into its own ring buffer: a
+ * timestamp, the interned event name (usually a filter id), the frame the
+ * thread is working on and the phase, 16 bytes per event. Writing takes no
+ * lock; once a ring is full the oldest events are overwritten.
+ *
+ * Tracing is off by default. While off, begin() and end() return after a
+ * single relaxed atomic load, so the calls can stay in the filter loops.
+ *
+ * saveChromeTrace() writes all rings as Chrome trace event JSON, with one
+ * track per thread. It may be called while the filters are running;
+ * events overwritten during the dump are left out.
+ */
+class TOFFY_EXPORT Tracer
+{
+   public:
+    /**
+     * @brief Start recording
+     * @param eventsPerThread ring size for threads that did not trace yet,
+     * rounded up to a power of two
+     */
+    static void enable(size_t eventsPerThread = 1 << 16);
+
+    /** @brief Stop recording, the recorded events are kept */
+    static void disable();
+
+    static bool enabled() { return _on.load(std::memory_order_relaxed); }
+
+    /** @brief Drop all events recorded so far */
+    static void clear();
+
+    static void begin(const std::string& name)
+    {
+        if (enabled()) record(name, 'B');
+    }
+
+    static void end(const std::string& name)
+    {
+        if (enabled()) record(name, 'E');
+    }
+
+    /** @brief Single point in time, e.g. a dropped frame */
+    static void instant(const std::string& name)
+    {
+        if (enabled()) record(name, 'i');
+    }
+
+    /**
+     * @brief Frame number attached to the following events of the calling
+     * thread
+     */
+    static void setFrame(uint32_t frame);
+
+    /** @brief Track name of the calling thread */
+    static void setThreadName(const std::string& name);
+
+    /**
+     * @brief Write the recorded events as Chrome trace JSON
+     * @return false if the file could not be written
+     */
+    static bool saveChromeTrace(const std::string& fileName);
+
+    /** @brief Number of events currently held by all rings */
+    static size_t size();
+
+   private:
+    friend class TraceScope;
+
+    static std::atomic<bool> _on;
+
+    static void record(const std::string& name, char phase);
+};
+
+/**
+ * @brief Traces the lifetime of the scope as a begin/end pair
+ * @ingroup Core
+ *
+ * @p name must outlive the scope; filter ids do.
+ */
+class TraceScope
+{
+   public:
+    explicit TraceScope(const std::string& name)
+        : _name(Tracer::enabled() ? &name : NULL)
+    {
+        if (_name) Tracer::record(*_name, 'B');
+    }
+
+    ~TraceScope()
+    {
+        // close the event even if tracing was switched off meanwhile
+        if (_name) Tracer::record(*_name, 'E');
+    }
+
+   private:
+    const std::string* _name;  ///< NULL if tracing was off at construction
+
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+};
+
+}  // namespace toffy
@@ -0,0 +1,167 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <toffy/toffy_export.h>
+
+namespace toffy {
+
+/**
+ * @brief Work-stealing set of threads running submitted tasks
+ * @ingroup Core
+ *
+ * Every worker has its own task queue. Tasks submitted from a worker go to
+ * its own queue and are taken newest first, which keeps data in the cache
+ * of that core; tasks from other threads are spread over the queues. A
+ * worker with an empty queue steals the oldest task of another one.
+ *
+ * The threads start with the first submit(), a pool nobody submits to
+ * costs no threads. Exceptions escaping a task are logged and dropped. The
+ * destructor runs what is still queued, then joins the threads.
+ *
+ * The Controller owns the process-wide pool returned by shared(), which
+ * runs the ParallelFilter lanes and the parallelFor() loops of filters.
+ */
+class TOFFY_EXPORT WorkerPool
+{
+   public:
+    typedef std::function<void()> Task;
+
+    /** @brief Body of parallelFor(), called for [begin, end) */
+    typedef std::function<void(size_t begin, size_t end)> RangeTask;
+
+    /** @brief Counters of a single worker since start or resetStats() */
+    struct WorkerStats {
+        int cpu;             ///< pinned cpu, -1 if not pinned
+        uint64_t tasks;      ///< tasks run
+        uint64_t steals;     ///< tasks taken from other workers
+        double utilization;  ///< fraction of the time spent in tasks
+    };
+
+    /**
+     * @param threads number of threads, 0 for one per core, started on
+     * first use
+     * @param cpus worker i is pinned to cpus[i % cpus.size()]; empty to
+     * let the OS schedule them. Only supported on Linux.
+     */
+    explicit WorkerPool(size_t threads = 0,
+                        const std::vector<int>& cpus = std::vector<int>());
+    ~WorkerPool();
+
+    void submit(const Task& task);
+
+    /**
+     * @brief Run @p body over [begin, end) split into chunks of @p grain
+     *
+     * The chunks run on the workers and on the calling thread, which
+     * returns once all are done. Can be nested and called from tasks of
+     * this pool. The first exception thrown by a chunk is rethrown here,
+     * chunks not started by then are skipped.
+     *
+     * @param grain chunk size, 0 to split into a few chunks per worker
+     */
+    void parallelFor(size_t begin, size_t end, size_t grain,
+                     const RangeTask& body);
+
+    /**
+     * @brief Run one queued task on the calling worker of this pool
+     * @return false if not called from a worker of this pool or nothing
+     * is queued
+     *
+     * For tasks waiting on other tasks of the pool: they keep their worker
+     * busy with those instead of blocking it, which would deadlock once
+     * all workers wait.
+     */
+    bool runPending();
+
+    /** @brief True if called from one of the threads of this pool */
+    bool inWorker() const;
+
+    /** @brief Number of threads, running or to be started */
+    size_t size() const { return _workers.size(); }
+
+    std::vector<WorkerStats> stats() const;
+
+    /**
+     * @brief stats() as ptree
+     * @return threads, queued and workers.<i>.{cpu,tasks,steals,utilization}
+     */
+    boost::property_tree::ptree getStats() const;
+
+    void resetStats();
+
+    /**
+     * @brief The process-wide pool
+     *
+     * The one installed with setShared(), usually by the Controller. Without
+     * one, a pool with a thread per core is created on first use.
+     */
+    static WorkerPool& shared();
+
+    /**
+     * @brief Install @p pool as shared(), NULL to go back to the default
+     *
+     * The caller keeps ownership. Only to be called while no filter runs.
+     */
+    static void setShared(WorkerPool* pool);
+
+   private:
+    struct Worker {
+        boost::mutex mtx;       ///< guards tasks
+        std::deque<Task> tasks;  ///< own tasks at the back, stolen at front
+        boost::thread thread;
+        std::atomic<int> cpu;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> busyNs{0};
+    };
+
+    std::vector<Worker*> _workers;
+    std::atomic<size_t> _pending;  ///< queued tasks, all workers
+    std::atomic<size_t> _next;     ///< queue for the next outside submit
+    bool _stop;
+    boost::mutex _mtx;  ///< guards _stop and sleeping on _cond
+    boost::condition_variable _cond;
+    std::atomic<int64_t> _statsSince;  ///< ns, steady clock
+    std::once_flag _started;           ///< threads started
+
+    /** @brief Start the threads, once */
+    void start();
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    /** @brief Take a task, own queue first */
+    bool take(size_t self, Task& task);
+
+    void run(size_t self);
+
+    /** @brief Run @p task on worker @p self and account it */
+    void execute(size_t self, Task& task);
+};
+
+}  // namespace toffy
@@ -0,0 +1,295 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+#include <cstring>
+
+#include <boost/log/trivial.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "toffy/asyncSink.hpp"
+#include "toffy/matPool.hpp"
+
+using namespace toffy;
+
+AsyncSink::AsyncSink(const std::string& name, const Writer& writer,
+                     size_t capacity, Policy policy)
+    : _name(name),
+      _writer(writer),
+      _capacity(std::max<size_t>(1, capacity)),
+      _policy(policy),
+      _async(false),
+      _share(false),
+      _running(false),
+      _busy(false)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+AsyncSink::~AsyncSink() { close(); }
+
+void AsyncSink::updateConfig(const boost::property_tree::ptree& pt)
+{
+    flush();
+
+    size_t capacity = std::max(1, pt.get<int>("options.asyncQueue",
+                                              (int)this->capacity()));
+    Policy policy = this->policy();
+    std::string name = pt.get<std::string>("options.asyncPolicy", "");
+    if (!name.empty() && !parsePolicy(name, policy)) {
+        BOOST_LOG_TRIVIAL(warning)
+            << _name << ": unknown asyncPolicy " << name << ", keeping "
+            << policyName(policy);
+    }
+    configure(capacity, policy);
+
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    _async = pt.get<bool>("options.async", _async);
+    _share = pt.get<bool>("options.asyncShare", _share);
+}
+
+void AsyncSink::getConfig(boost::property_tree::ptree& pt) const
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    pt.put("options.async", _async);
+    pt.put("options.asyncQueue", _capacity);
+    pt.put("options.asyncPolicy", policyName(_policy));
+    pt.put("options.asyncShare", _share);
+}
+
+bool AsyncSink::async() const
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    return _async;
+}
+
+void AsyncSink::async(bool enable)
+{
+    if (!enable) flush();
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    _async = enable;
+}
+
+size_t AsyncSink::capacity() const
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    return _capacity;
+}
+
+AsyncSink::Policy AsyncSink::policy() const
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    return _policy;
+}
+
+void AsyncSink::configure(size_t capacity, Policy policy)
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    _capacity = std::max<size_t>(1, capacity);
+    _policy = policy;
+    _cond.notify_all();
+}
+
+bool AsyncSink::submit(const Frame& in, const std::vector<std::string>& keys,
+                       bool share)
+{
+    bool async;
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        async = _async;
+        share = share || _share;
+    }
+    if (async) {
+        push(snapshot(in, keys, share));
+        return true;
+    }
+
+    bool ok = write(in);
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    _stats.submitted++;
+    ok ? _stats.written++ : _stats.failed++;
+    return ok;
+}
+
+bool AsyncSink::push(const FramePtr& frame)
+{
+    boost::unique_lock<boost::mutex> lock(_mtx);
+    _stats.submitted++;
+    if (!_running) {
+        if (_thread.joinable()) _thread.join();
+        _running = true;
+        _thread = boost::thread(&AsyncSink::run, this);
+    }
+
+    if (_queue.size() >= _capacity) {
+        switch (_policy) {
+            case Block:
+                _stats.blocked++;
+                while (_queue.size() >= _capacity && _running) {
+                    _cond.wait(lock);
+                }
+                break;
+            case DropOldest:
+                while (_queue.size() >= _capacity) {
+                    _queue.pop_front();
+                    _stats.dropped++;
+                }
+                break;
+            case DropNewest:
+                _stats.dropped++;
+                break;
+        }
+        // log 1, 2, 4, 8, ... drops
+        if (_stats.dropped && !(_stats.dropped & (_stats.dropped - 1))) {
+            BOOST_LOG_TRIVIAL(warning)
+                << _name << ": writer too slow, dropped " << _stats.dropped
+                << " frames";
+        }
+        if (_policy == DropNewest) return false;
+    }
+    _queue.push_back(frame);
+    _stats.peak = std::max(_stats.peak, _queue.size());
+    _cond.notify_all();
+    return true;
+}
+
+void AsyncSink::flush()
+{
+    boost::unique_lock<boost::mutex> lock(_mtx);
+    while ((!_queue.empty() || _busy) && _running) _cond.wait(lock);
+}
+
+void AsyncSink::close()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        _running = false;
+    }
+    _cond.notify_all();
+    if (_thread.joinable()) _thread.join();
+
+    Stats s = stats();
+    if (s.submitted) {
+        BOOST_LOG_TRIVIAL(debug)
+            << _name << ": " << s.written << " written, " << s.failed
+            << " failed, " << s.dropped << " dropped, " << s.blocked
+            << " blocked, peak queue " << s.peak;
+    }
+}
+
+AsyncSink::Stats AsyncSink::stats() const
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    Stats s = _stats;
+    s.queued = _queue.size() + _busy;
+    return s;
+}
+
+boost::property_tree::ptree AsyncSink::getStats() const
+{
+    Stats s = stats();
+    boost::property_tree::ptree pt;
+    pt.put("submitted", s.submitted);
+    pt.put("written", s.written);
+    pt.put("failed", s.failed);
+    pt.put("dropped", s.dropped);
+    pt.put("blocked", s.blocked);
+    pt.put("queued", s.queued);
+    pt.put("peak", s.peak);
+    return pt;
+}
+
+void AsyncSink::resetStats()
+{
+    boost::lock_guard<boost::mutex> lock(_mtx);
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.peak = _queue.size();
+}
+
+AsyncSink::FramePtr AsyncSink::snapshot(const Frame& in,
+                                        const std::vector<std::string>& keys,
+                                        bool share)
+{
+    std::shared_ptr<Frame> f = std::make_shared<Frame>();
+    for (size_t i = 0; i < keys.size(); i++) {
+        Frame::SlotDataType dt = in.getDataType(keys[i]);
+        if (dt == Frame::NotFound) continue;
+        boost::any v = in.getData(keys[i]);
+        const matPtr* m = boost::any_cast<matPtr>(&v);
+        if (m && *m && !share) {
+            v = MatPool::global().clone(**m);
+        }
+        f->addData(keys[i], v, dt, in.getDescription(keys[i]));
+    }
+    return f;
+}
+
+bool AsyncSink::parsePolicy(const std::string& name, Policy& policy)
+{
+    if (name == "block") {
+        policy = Block;
+    } else if (name == "dropOldest") {
+        policy = DropOldest;
+    } else if (name == "dropNewest") {
+        policy = DropNewest;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string AsyncSink::policyName(Policy policy)
+{
+    switch (policy) {
+        case DropOldest:
+            return "dropOldest";
+        case DropNewest:
+            return "dropNewest";
+        default:
+            return "block";
+    }
+}
+
+void AsyncSink::run()
+{
+    boost::unique_lock<boost::mutex> lock(_mtx);
+    for (;;) {
+        while (_queue.empty() && _running) _cond.wait(lock);
+        if (_queue.empty()) break;  // closed and written
+        FramePtr f = _queue.front();
+        _queue.pop_front();
+        _busy = true;
+        _cond.notify_all();  // room for a blocked push()
+
+        lock.unlock();
+        bool ok = write(*f);
+        f.reset();  // pooled images go back outside the lock
+        lock.lock();
+
+        ok ? _stats.written++ : _stats.failed++;
+        _busy = false;
+        _cond.notify_all();
+    }
+}
+
+bool AsyncSink::write(const Frame& f)
+{
+    try {
+        return _writer(f);
+    } catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(warning) << _name << ": write failed, " << e.what();
+        return false;
+    }
+}
@@ -19,13 +19,18 @@
 
 #include <toffy/controller.hpp>
 #include <toffy/parallelFilter.hpp>
+#include <toffy/pipeline.hpp>
 #include <toffy/common/plugins.hpp>
+#include <toffy/trace.hpp>
 
 #include <opencv2/highgui.hpp>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/xml_parser.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <toffy/viewers/imageview.hpp>
 
@@ -48,13 +53,15 @@ Controller * Controller::getInstance() {
     return _controller;
 }*/
 
-Controller::Controller() : baseFilterBank(NULL), _state(Controller::IDLE)
+Controller::Controller()
+    : baseFilterBank(NULL), _state(Controller::IDLE), _frames(0)
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__;
     baseFilterBank = static_cast<FilterBank *>(
         toffy::FilterFactory::getInstance()->createFilter("filterBank",
                                                           "baseController"));
     baseFilterBank->bank(NULL);
+    setWorkers(0);
 }
 
 Controller::~Controller()
@@ -63,6 +70,8 @@ Controller::~Controller()
     _state = Controller::IDLE;
     toffy::FilterFactory::getInstance()->deleteFilter(baseFilterBank->id());
     baseFilterBank = NULL;
+    WorkerPool::setShared(NULL);
+    _workers.reset();
     toffy::FilterFactory::getInstance()->clearCreators();
     /*for (size_t i = 0; i < _loads.size(); i++) {
 	cout << "_loads: " << _loads[i] << endl;
@@ -74,12 +83,7 @@ Controller::~Controller()
 bool Controller::forward()
 {
     if (_state == Controller::IDLE) {
-        std::vector<Filter *> vec;
-        baseFilterBank->getFiltersByType("parallelFilter", vec);
-        for (size_t i = 0; i < vec.size(); i++) {
-            ((ParallelFilter *)vec[i])->init();
-            ((ParallelFilter *)vec[i])->start();
-        }
+        startThreadedFilters();
         _state = Controller::FORWARD;
         _thread = boost::thread(boost::bind(&Controller::loopFilters, this));
         if (!_thread.joinable()) {
@@ -99,12 +103,7 @@ bool Controller::forward()
 bool Controller::backward()
 {
     if (_state == Controller::IDLE) {
-        std::vector<Filter *> vec;
-        baseFilterBank->getFiltersByType("parallelFilter", vec);
-        for (size_t i = 0; i < vec.size(); i++) {
-            ((ParallelFilter *)vec[i])->init();
-            ((ParallelFilter *)vec[i])->start();
-        }
+        startThreadedFilters();
         _state = Controller::BACKWARD;
         _thread = boost::thread(boost::bind(&Controller::loopFilters, this));
         if (!_thread.joinable()) {
@@ -124,12 +123,7 @@ bool Controller::backward()
 bool Controller::stepForward()
 {
     if (_state == Controller::IDLE) {
-        std::vector<Filter *> vec;
-        baseFilterBank->getFiltersByType("parallelFilter", vec);
-        for (size_t i = 0; i < vec.size(); i++) {
-            ((ParallelFilter *)vec[i])->init();
-            ((ParallelFilter *)vec[i])->start();
-        }
+        startThreadedFilters();
         /*_state = Controller::FORWARD;
 	_thread = boost::thread( boost::bind(&Controller::loopFiltersOnce, this));
 	if (!_thread.joinable()) {
@@ -140,10 +134,8 @@ bool Controller::stepForward()
 	    return false;
 	}
 	_thread.join();*/
-        baseFilterBank->filter(f, f);
-        for (size_t i = 0; i < vec.size(); i++) {
-            ((ParallelFilter *)vec[i])->stop();
-        }
+        filterFrame();
+        stopThreadedFilters();
     } else {
         //already RUNNING
         return false;
@@ -154,12 +146,7 @@ bool Controller::stepForward()
 bool Controller::stedBackward()
 {
     if (_state == Controller::IDLE) {
-        std::vector<Filter *> vec;
-        baseFilterBank->getFiltersByType("parallelFilter", vec);
-        for (size_t i = 0; i < vec.size(); i++) {
-            ((ParallelFilter *)vec[i])->init();
-            ((ParallelFilter *)vec[i])->start();
-        }
+        startThreadedFilters();
         /*_state = Controller::BACKWARD;
 	_thread = boost::thread( boost::bind(&Controller::loopFiltersOnce, this));
 	if (!_thread.joinable()) {
@@ -170,11 +157,9 @@ bool Controller::stedBackward()
 	    return false;
 	}*/
         f.addData("backward", true);
-        baseFilterBank->filter(f, f);
+        filterFrame();
         f.removeData("backward");
-        for (size_t i = 0; i < vec.size(); i++) {
-            ((ParallelFilter *)vec[i])->stop();
-        }
+        stopThreadedFilters();
     } else {
         //already RUNNING
         return false;
@@ -187,22 +172,47 @@ bool Controller::stop()
 {
     _state = Controller::IDLE;
     _thread.join();
+    stopThreadedFilters();
+    return true;
+}
+
+void Controller::startThreadedFilters()
+{
     std::vector<Filter *> vec;
-    baseFilterBank->getFiltersByType("parallelFilter", vec);
+    baseFilterBank->getFiltersByType(ParallelFilter::id_name, vec);
+    baseFilterBank->getFiltersByType(Pipeline::id_name, vec);
     for (size_t i = 0; i < vec.size(); i++) {
-        ((ParallelFilter *)vec[i])->stop();
+        vec[i]->init();
+        vec[i]->start();
     }
-    return true;
+}
+
+void Controller::stopThreadedFilters()
+{
+    std::vector<Filter *> vec;
+    baseFilterBank->getFiltersByType(ParallelFilter::id_name, vec);
+    baseFilterBank->getFiltersByType(Pipeline::id_name, vec);
+    for (size_t i = 0; i < vec.size(); i++) {
+        vec[i]->stop();
+    }
+}
+
+bool Controller::filterFrame()
+{
+    Tracer::setFrame(_frames++);
+    TraceScope trace(baseFilterBank->id());
+    return baseFilterBank->filter(f, f);
 }
 
 void Controller::loopFilters()
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__;
+    Tracer::setThreadName("controller");
     if (baseFilterBank->size() == 0) _state = Controller::IDLE;
     int viewers = baseFilterBank->countFiltersByType(ImageView::id_name);
     while (_state > Controller::IDLE) {
         if (_state == Controller::BACKWARD) f.addData("backward", true);
-        baseFilterBank->filter(f, f);
+        filterFrame();
         if (_state == Controller::BACKWARD) f.removeData("backward");
         if (viewers > 0) cv::waitKey(10);
         //cv::waitKey(1);
@@ -218,14 +228,12 @@ void Controller::loopFiltersOnce()
 
     if (_state > Controller::IDLE) {
         if (_state == Controller::BACKWARD) f.addData("backward", true);
-        std::cout << "in thread." << std::endl;
-        baseFilterBank->filter(f, f);
+        filterFrame();
         if (_state == Controller::BACKWARD) f.removeData("backward");
         cv::waitKey(1);
         _state = Controller::IDLE;
     }
     BOOST_LOG_TRIVIAL(debug) << "Thread " << __FUNCTION__ << " ends";
-    std::cout << "Thread ends." << std::endl;
 }
 
 int Controller::loadRuntimeConfig(const std::string &configFile)
@@ -276,6 +284,67 @@ void Controller::saveRunConfig(std::string fileName)
     //std::cout << "OUTPUT: " << ss.str() << std::endl;
 }
 
+boost::property_tree::ptree Controller::getFilterStats() const
+{
+    boost::property_tree::ptree pt = baseFilterBank->getFilterStats();
+    pt.add_child("workers", _workers->getStats());
+    return pt;
+}
+
+void Controller::resetFilterStats()
+{
+    baseFilterBank->resetFilterStats();
+    _workers->resetStats();
+}
+
+void Controller::setWorkers(size_t threads, const std::vector<int> &cpus)
+{
+    // the old pool finishes its queued tasks when it goes
+    std::unique_ptr<WorkerPool> old(_workers.release());
+    _workers.reset(new WorkerPool(threads, cpus));
+    WorkerPool::setShared(_workers.get());
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << _workers->size()
+                             << " workers";
+}
+
+void Controller::loadWorkers(const boost::property_tree::ptree &pt)
+{
+    boost::optional<const boost::property_tree::ptree &> workers =
+        pt.get_child_optional("toffy.workers");
+    if (!workers) return;
+
+    std::vector<int> cpus;
+    std::vector<std::string> items;
+    std::string affinity = workers->get<std::string>("affinity", "");
+    boost::algorithm::split(items, affinity, boost::is_any_of(" ,\t\n"),
+                            boost::token_compress_on);
+    for (size_t i = 0; i < items.size(); i++) {
+        if (items[i].empty()) continue;
+        try {
+            cpus.push_back(boost::lexical_cast<int>(items[i]));
+        } catch (boost::bad_lexical_cast &) {
+            BOOST_LOG_TRIVIAL(warning)
+                << "workers: ignoring affinity entry " << items[i];
+        }
+    }
+    setWorkers(workers->get<size_t>("threads", 0), cpus);
+    BOOST_LOG_TRIVIAL(info) << "Using " << _workers->size() << " workers";
+}
+
+bool Controller::saveFilterStats(const std::string &fileName) const
+{
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << fileName;
+    try {
+        boost::property_tree::json_parser::write_json(fileName,
+                                                      getFilterStats());
+    } catch (boost::property_tree::json_parser_error &e) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "Could not write filter stats: " << e.what();
+        return false;
+    }
+    return true;
+}
+
 int Controller::loadConfigFile(const std::string &configFile)
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__;
@@ -292,6 +361,7 @@ int Controller::loadConfigFile(const std::string &configFile)
     }
 
     loadPlugins(pt);
+    loadWorkers(pt);
     return baseFilterBank->loadConfig(pt, configFile);
 }
 
@@ -300,6 +370,7 @@ int Controller::loadConfig(const boost::property_tree::ptree &pt)
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__;
 
     loadPlugins(pt);
+    loadWorkers(pt);
     return baseFilterBank->loadConfig(pt);
 }
 
@@ -0,0 +1,264 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+
+#include <boost/algorithm/string/join.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "toffy/dataflow.hpp"
+#include "toffy/filterbank.hpp"
+
+using namespace toffy;
+
+namespace {
+
+void collect(const boost::property_tree::ptree& pt,
+             std::vector<std::string>& names)
+{
+    for (boost::property_tree::ptree::const_iterator it = pt.begin();
+         it != pt.end(); ++it) {
+        if (it->second.empty()) {
+            if (!it->second.data().empty()) names.push_back(it->second.data());
+        } else {
+            collect(it->second, names);
+        }
+    }
+}
+
+void sortUnique(std::vector<std::string>& v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+bool intersects(const std::vector<std::string>& a,
+                const std::vector<std::string>& b)
+{
+    std::vector<std::string>::const_iterator i = a.begin(), j = b.begin();
+    while (i != a.end() && j != b.end()) {
+        if (*i < *j) {
+            ++i;
+        } else if (*j < *i) {
+            ++j;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** state of one DataflowGraph::run() */
+struct Pass {
+    boost::mutex mtx;
+    boost::condition_variable cond;
+    std::vector<size_t> pending;  ///< unfinished deps per node
+    size_t running;
+    bool failed;
+};
+
+void runNode(const DataflowGraph* g, WorkerPool* pool,
+             const DataflowGraph::NodeRunner* runner, Pass* pass, size_t i)
+{
+    bool ok = false;
+    try {
+        ok = (*runner)(i);
+    } catch (std::exception& e) {
+        BOOST_LOG_TRIVIAL(error)
+            << "dataflow: exception in " << g->nodes()[i].id << ": "
+            << e.what();
+    } catch (...) {
+        BOOST_LOG_TRIVIAL(error)
+            << "dataflow: unknown exception in " << g->nodes()[i].id;
+    }
+
+    std::vector<size_t> ready;
+    boost::unique_lock<boost::mutex> lock(pass->mtx);
+    if (!ok) pass->failed = true;
+    if (!pass->failed) {
+        const std::vector<size_t>& succs = g->nodes()[i].succs;
+        for (size_t k = 0; k < succs.size(); k++) {
+            if (--pass->pending[succs[k]] == 0) ready.push_back(succs[k]);
+        }
+    }
+    pass->running += ready.size();
+    pass->running--;
+    for (size_t k = 0; k < ready.size(); k++) {
+        pool->submit(std::bind(&runNode, g, pool, runner, pass, ready[k]));
+    }
+    if (!pass->running) pass->cond.notify_all();
+}
+
+}  // namespace
+
+void DataflowGraph::declaredSlots(const boost::property_tree::ptree& config,
+                                  std::vector<std::string>& reads,
+                                  std::vector<std::string>& writes)
+{
+    reads.clear();
+    writes.clear();
+    boost::optional<const boost::property_tree::ptree&> in =
+        config.get_child_optional("inputs");
+    if (in) collect(*in, reads);
+    boost::optional<const boost::property_tree::ptree&> out =
+        config.get_child_optional("outputs");
+    if (out) collect(*out, writes);
+    sortUnique(reads);
+    sortUnique(writes);
+}
+
+void DataflowGraph::build(const std::vector<Filter*>& filters)
+{
+    std::vector<Node> nodes(filters.size());
+    for (size_t i = 0; i < filters.size(); i++) {
+        Node& n = nodes[i];
+        n.id = filters[i]->id();
+        boost::property_tree::ptree config = filters[i]->getConfig();
+        declaredSlots(config, n.reads, n.writes);
+        n.barrier = dynamic_cast<FilterBank*>(filters[i]) ||
+                    !filters[i]->declaresSlots();
+    }
+    build(nodes);
+}
+
+void DataflowGraph::build(const std::vector<Node>& nodes)
+{
+    _nodes = nodes;
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        Node& n = _nodes[i];
+        sortUnique(n.reads);
+        sortUnique(n.writes);
+        n.deps.clear();
+        n.succs.clear();
+        for (size_t j = 0; j < i; j++) {
+            const Node& m = _nodes[j];
+            if (n.barrier || m.barrier || intersects(m.writes, n.reads) ||
+                intersects(m.reads, n.writes) ||
+                intersects(m.writes, n.writes)) {
+                n.deps.push_back(j);
+            }
+        }
+    }
+    // only keep deps that are not implied by others: a node waiting for
+    // j and for k that waits for j itself need not wait for j
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        Node& n = _nodes[i];
+        std::vector<char> implied(i, 0);
+        for (size_t d = n.deps.size(); d-- > 0;) {
+            size_t k = n.deps[d];
+            if (implied[k]) continue;
+            // everything k waits for, transitively
+            std::vector<size_t> stack(_nodes[k].deps);
+            while (!stack.empty()) {
+                size_t j = stack.back();
+                stack.pop_back();
+                if (implied[j]) continue;
+                implied[j] = 1;
+                stack.insert(stack.end(), _nodes[j].deps.begin(),
+                             _nodes[j].deps.end());
+            }
+        }
+        std::vector<size_t> direct;
+        for (size_t d = 0; d < n.deps.size(); d++) {
+            if (!implied[n.deps[d]]) direct.push_back(n.deps[d]);
+        }
+        n.deps.swap(direct);
+        for (size_t d = 0; d < n.deps.size(); d++) {
+            _nodes[n.deps[d]].succs.push_back(i);
+        }
+    }
+}
+
+bool DataflowGraph::run(WorkerPool& pool, const NodeRunner& runner) const
+{
+    Pass pass;
+    pass.pending.resize(_nodes.size());
+    pass.running = 0;
+    pass.failed = false;
+
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < _nodes.size(); i++) {
+        pass.pending[i] = _nodes[i].deps.size();
+        if (!pass.pending[i]) ready.push_back(i);
+    }
+    boost::unique_lock<boost::mutex> lock(pass.mtx);
+    pass.running = ready.size();
+    for (size_t k = 0; k < ready.size(); k++) {
+        pool.submit(std::bind(&runNode, this, &pool, &runner, &pass, ready[k]));
+    }
+    while (pass.running) pass.cond.wait(lock);
+
+    if (pass.failed) return false;
+    for (size_t i = 0; i < pass.pending.size(); i++) {
+        if (pass.pending[i]) return false;
+    }
+    return true;
+}
+
+boost::property_tree::ptree DataflowGraph::report(
+    const std::vector<double>& cost) const
+{
+    boost::property_tree::ptree pt, nodes;
+    const size_t n = _nodes.size();
+    // deps always point backwards, so index order is a topological order
+    std::vector<double> start(n, 0.), finish(n, 0.);
+    std::vector<int> via(n, -1);
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        const Node& node = _nodes[i];
+        for (size_t d = 0; d < node.deps.size(); d++) {
+            if (via[i] < 0 || finish[node.deps[d]] > start[i]) {
+                start[i] = finish[node.deps[d]];
+                via[i] = node.deps[d];
+            }
+        }
+        double c = i < cost.size() ? cost[i] : 1.;
+        finish[i] = start[i] + c;
+        total += c;
+
+        std::vector<std::string> deps;
+        for (size_t d = 0; d < node.deps.size(); d++) {
+            deps.push_back(_nodes[node.deps[d]].id);
+        }
+        boost::property_tree::ptree p;
+        p.put("deps", boost::algorithm::join(deps, " "));
+        p.put("reads", boost::algorithm::join(node.reads, " "));
+        p.put("writes", boost::algorithm::join(node.writes, " "));
+        p.put("barrier", node.barrier);
+        p.put("start", start[i]);
+        nodes.push_back(std::make_pair(node.id, p));
+    }
+
+    size_t last = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (finish[i] > finish[last]) last = i;
+    }
+    std::vector<std::string> path;
+    double critical = n ? finish[last] : 0.;
+    for (int i = n ? (int)last : -1; i >= 0; i = via[i]) {
+        path.push_back(_nodes[i].id);
+    }
+    std::reverse(path.begin(), path.end());
+
+    pt.add_child("nodes", nodes);
+    pt.put("criticalPath", boost::algorithm::join(path, " "));
+    pt.put("criticalPathCost", critical);
+    pt.put("totalCost", total);
+    pt.put("parallelism", critical > 0 ? total / critical : 1.);
+    return pt;
+}
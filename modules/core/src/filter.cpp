@@ -146,6 +146,9 @@ void Filter::updateConfig(const boost::property_tree::ptree& pt)
         pt.get<int>("options.loglvl", _log_lvl));
     pt_optional_get_default(pt, "name", _name, _name);
     std::cout << id() << "::updateConfig NAME SET TO " << _name << std::endl;
+    // the bank's fused passes and dataflow graph depend on our config
+    FilterBank* fb = dynamic_cast<FilterBank*>(_bank);
+    if (fb) fb->invalidatePlan();
 }
 
 void Filter::setState(filterState state)
@@ -0,0 +1,101 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+#include <limits>
+
+#include "toffy/filterStats.hpp"
+
+using namespace toffy;
+
+// enough buckets for any uint64_t
+static const size_t numBuckets =
+    LatencyHistogram::bucket(std::numeric_limits<uint64_t>::max()) + 1;
+
+LatencyHistogram::LatencyHistogram() : _counts(numBuckets) { reset(); }
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < _counts.size(); i++) {
+        _counts[i] += other._counts[i];
+    }
+    _count += other._count;
+    _sum += other._sum;
+    if (other._max > _max) _max = other._max;
+    if (other._min < _min) _min = other._min;
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(_counts.begin(), _counts.end(), 0);
+    _count = _sum = _max = 0;
+    _min = std::numeric_limits<uint64_t>::max();
+}
+
+uint64_t LatencyHistogram::bucketMax(size_t i)
+{
+    if (i < 2 * subBuckets) return i;
+    int shift = i / subBuckets - 1;
+    uint64_t top = i % subBuckets + subBuckets;
+    return ((top + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (!_count) return 0;
+    // rank of the sample, 1-based
+    uint64_t rank = (uint64_t)(p / 100.0 * _count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > _count) rank = _count;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); i++) {
+        seen += _counts[i];
+        if (seen >= rank) {
+            uint64_t v = bucketMax(i);
+            return v < _max ? v : _max;
+        }
+    }
+    return _max;
+}
+
+void FilterStats::merge(const FilterStats& other)
+{
+    calls += other.calls;
+    failures += other.failures;
+    latency.merge(other.latency);
+}
+
+void FilterStats::reset()
+{
+    calls = failures = 0;
+    latency.reset();
+}
+
+/** ns to rounded us */
+static uint64_t us(uint64_t ns) { return (ns + 500) / 1000; }
+
+boost::property_tree::ptree FilterStats::toPtree() const
+{
+    boost::property_tree::ptree pt;
+    pt.put("calls", calls);
+    pt.put("failures", failures);
+    pt.put("latencyUs.mean", us(latency.mean()));
+    pt.put("latencyUs.p50", us(latency.percentile(50)));
+    pt.put("latencyUs.p95", us(latency.percentile(95)));
+    pt.put("latencyUs.p99", us(latency.percentile(99)));
+    pt.put("latencyUs.max", us(latency.max()));
+    return pt;
+}
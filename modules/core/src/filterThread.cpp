@@ -17,8 +17,10 @@
 #include <iostream>
 
 #include <boost/log/trivial.hpp>
+#include <boost/thread/locks.hpp>
 
 #include "toffy/filterThread.hpp"
+#include "toffy/trace.hpp"
 
 using namespace toffy;
 using namespace std;
@@ -26,100 +28,169 @@ using namespace std;
 FilterThread::~FilterThread()
 {
     // stop thread, kill all.
-    theThread.join();
-    inQ.clear();
-    outQ.clear(); //TODO: check frames..
+    stop();
 
-    delete f;
+    for (size_t i = 0; i < frames.size(); i++) delete frames[i];
+    frames.clear();
 }
 
 
 // init the FT with a number of pre-allocated frames
 void FilterThread::init(int numFrames)
 {
+    if (!frames.empty()) {
+        // already initialized, start() re-distributes the frames
+        return;
+    }
     for (int i=0;i<numFrames;i++) {
-	Frame* f = new Frame();
-	inQ.push_back(f);
+	frames.push_back(new Frame());
     }
 }
 
 
-void FilterThread::start()
+void FilterThread::start(WorkerPool* pool, bool seed)
 {
+    if (keepRunning) return;
     keepRunning = true;
-    //todo: launch thread
+    _pool = pool;
+    // (re-)seed the lane with all frames, results of an earlier run are
+    // dropped.
+    inQ.reset(frames.size());
+    outQ.reset(frames.size());
+    for (size_t i = 0; seed && i < frames.size(); i++) {
+        inQ.tryPush(frames[i]);
+    }
+    if (_pool) {
+        schedule();
+        return;
+    }
     theThread = boost::thread( boost::bind(&FilterThread::loop, this) );
 
 }
 
 void FilterThread::stop()
 {
-    keepRunning = false;
-    inCond.notify_one();
+    {
+        boost::lock_guard<boost::mutex> lock(_taskMtx);
+        keepRunning = false;
+    }
+    inQ.close();
+    outQ.close();
+    {
+        // a lane task may still be queued or busy with a frame
+        boost::unique_lock<boost::mutex> lock(_taskMtx);
+        while (_scheduled) _taskDone.wait(lock);
+    }
+    if (theThread.joinable() &&
+        theThread.get_id() != boost::this_thread::get_id()) {
+        theThread.join();
+    }
 }
 
 Frame* FilterThread::dequeue()
 {
-    Frame* fr;
-
-    //cout << "FT deq " << outQ.size() << endl;
-
-    if ( outQ.empty() ) {
-	boost::mutex mtx;
-	boost::unique_lock<boost::mutex> lock(mtx);
-
-	//cout << "FT deq wait " << endl;
-	outCond.wait(lock);
+    Frame* fr = NULL;
+    if (_pool && _pool->inWorker()) {
+        // called from a task of our own pool: blocking here could leave no
+        // worker for the lane, run queued tasks until the frame is there
+        while (!outQ.tryPop(fr)) {
+            if (outQ.closed()) {
+                // a last frame may have been pushed before closing
+                if (outQ.tryPop(fr)) break;
+                BOOST_LOG_TRIVIAL(debug) << "FT dequeue: lane stopped";
+                return NULL;
+            }
+            if (!_pool->runPending()) boost::this_thread::yield();
+        }
+        return fr;
+    }
+    if (!outQ.pop(fr)) {
+        BOOST_LOG_TRIVIAL(debug) << "FT dequeue: lane stopped";
+        return NULL;
     }
-    outMtx.lock();
-    fr = outQ.front();
-    outQ.pop_front();
-    outMtx.unlock();
     return fr;
 }
 
 void FilterThread::enqueue(Frame* fr)
 {
-    inMtx.lock();
-    inQ.push_back(fr);
-    inMtx.unlock();
+    if (!inQ.tryPush(fr)) {
+        // cannot happen with the frames from init(), they always fit
+        BOOST_LOG_TRIVIAL(warning) << "FT enqueue: input ring full or closed";
+    }
+    if (_pool) schedule();
+}
+
+void FilterThread::schedule()
+{
+    boost::lock_guard<boost::mutex> lock(_taskMtx);
+    if (!keepRunning || _scheduled) return;
+    _scheduled = true;
+    _pool->submit(boost::bind(&FilterThread::runTask, this));
+}
 
-    inCond.notify_one();
+void FilterThread::runTask()
+{
+    Frame* in;
+    for (;;) {
+        bool open = true;
+        while (open && keepRunning && inQ.tryPop(in)) open = process(in);
+
+        boost::lock_guard<boost::mutex> lock(_taskMtx);
+        // a frame enqueued after the last tryPop found this task still
+        // scheduled and left the frame to it
+        if (open && keepRunning && !inQ.empty()) continue;
+        _scheduled = false;
+        _taskDone.notify_all();
+        return;
+    }
 }
 
 void FilterThread::loop()
 {
-    boost::mutex mtx;
-    boost::unique_lock<boost::mutex> lock(mtx);
     Frame* in;
 
-    cout << "FT thread started " << boost::this_thread::get_id() << endl;
-    while (keepRunning) {
-	while (inQ.empty()) {
-	    cout << "FT wait for data" << endl;
-	    inCond.wait(lock);
-	    if (!keepRunning) {
-		cout << "FT loop exit" << endl;
-		return;
-	    }
-	}
-	cout << "FT get data" << endl;
-	// get one frame
-	inMtx.lock();
-	in = inQ.front();
-	inQ.pop_front();
-	inMtx.unlock();
-
-	cout << "FT run filter on " << in << endl;
-	// run the filter
-	f->filter(*in, *in);
-
-	cout << "FT push result" << endl;
-	// post the result
-	outMtx.lock();
-	outQ.push_back(in);
-	outMtx.unlock();
-	outCond.notify_all();
+    BOOST_LOG_TRIVIAL(debug) << "FT thread started " << boost::this_thread::get_id();
+    Tracer::setThreadName("lane " + f->id());
+    while (keepRunning && inQ.pop(in)) {
+	if (!process(in)) break;
+    }
+    BOOST_LOG_TRIVIAL(debug) << "FT thread loop exit " << boost::this_thread::get_id();
+}
+
+bool FilterThread::process(Frame* in)
+{
+    // run the filter
+    FilterStats::Clock::time_point start = FilterStats::Clock::now();
+    bool ok = false;
+    Tracer::setFrame(_processed);
+    try {
+	size_t copies = _detachAll ? in->detachAll() : 0;
+	for (size_t i = 0; i < _detach.size(); i++) copies += in->detach(_detach[i]);
+	_copies += copies;
+	TraceScope trace(f->id());
+	ok = f->filter(*in, *in);
+    } catch (std::exception& e) {
+	BOOST_LOG_TRIVIAL(error) << "FT " << f->id() << " exception: "
+				 << e.what();
+    }
+    {
+	boost::lock_guard<boost::mutex> lock(_statsMtx);
+	_stats.record(FilterStats::Clock::now() - start, ok);
     }
-    cout << "FT thread loop exit " << boost::this_thread::get_id() << endl;
+    _processed++;
+
+    // post the result, fails if closed while we were busy
+    return outQ.push(in);
+}
+
+FilterStats FilterThread::stats() const
+{
+    boost::lock_guard<boost::mutex> lock(_statsMtx);
+    return _stats;
+}
+
+void FilterThread::resetStats()
+{
+    boost::lock_guard<boost::mutex> lock(_statsMtx);
+    _stats.reset();
 }
@@ -14,16 +14,21 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <algorithm>
+
+#include <boost/algorithm/string/join.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
 
 #include "toffy/filterbank.hpp"
 #include "toffy/filter_helpers.hpp"
 #include "toffy/event.hpp"
+#include "toffy/trace.hpp"
 #include <toffy/common/plugins.hpp>
 #include <iostream>
 
@@ -44,42 +49,256 @@ FilterBank::~FilterBank() { clearBank(); }
 
 bool FilterBank::filter(const Frame& in, Frame& out)
 {
-    using namespace boost::posix_time;
+    typedef FilterStats::Clock Clock;
 
     setLoggingLvl();  // set our own log level..
-    for (size_t i = 0; i < _pipe.size(); i++) {
-        bool success = false;
+    Clock::time_point begin = Clock::now();
+    bool success = true;
+    if (_planStale) replan();
+    if (_pool && _graph.size() == _pipe.size()) {
+        success = runDataflow(in, out);
+    } else {
+        for (size_t i = 0; i < _pipe.size() && success; i++) {
+            if (runPass(i, in, out, success)) {
+                i += _passes[_passAt[i]].size() - 1;
+                continue;
+            }
+            success = runFilter(i, in, out);
+        }
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(_statsMtx);
+        _passStats.record(Clock::now() - begin, success);
+    }
+    if (!success) return false;
+    ready.post();
+    return true;
+}
 
-        _pipe[i]->setLoggingLvl();
-        ptime start = microsec_clock::local_time();
-        try {
-            success = _pipe[i]->filter(in, out);
+bool FilterBank::runFilter(size_t i, const Frame& in, Frame& out)
+{
+    typedef FilterStats::Clock Clock;
+    bool success = false;
 
-        } catch (std::exception& e) {
-            BOOST_LOG_TRIVIAL(error) << name() << "::" << __FUNCTION__
-                                     << " Exception in " << _pipe[i]->name();
-            BOOST_LOG_TRIVIAL(error)
-                << name() << "::" << __FUNCTION__ << " " << e.what();
-        }
+    // the log filter is process wide; concurrent filters share the bank's
+    if (!_pool) _pipe[i]->setLoggingLvl();
+    Clock::time_point start = Clock::now();
+    try {
+        TraceScope trace(_pipe[i]->id());
+        success = _pipe[i]->filter(in, out);
 
-        boost::posix_time::time_duration diff =
-            microsec_clock::local_time() - start;
-        setLoggingLvl();
-        if (!success) {
-            BOOST_LOG_TRIVIAL(info)
-                << id() << "::filter" << i << "\t" << diff.total_milliseconds()
-                << "\t" << _pipe[i]->name() << "\t failed!" << endl;
-            return false;
+    } catch (std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << name() << "::" << __FUNCTION__
+                                 << " Exception in " << _pipe[i]->name();
+        BOOST_LOG_TRIVIAL(error)
+            << name() << "::" << __FUNCTION__ << " " << e.what();
+    }
+
+    Clock::time_point end = Clock::now();
+    recordStats(_pipe[i], end - start, success);
+    if (!_pool) setLoggingLvl();
+    if (!success) {
+        BOOST_LOG_TRIVIAL(info)
+            << id() << "::filter" << i << "\t"
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end -
+                                                                     start)
+                   .count()
+            << "\t" << _pipe[i]->name() << "\t failed!" << endl;
+    }
+    return success;
+}
+
+bool FilterBank::runDataflow(const Frame& in, Frame& out)
+{
+    // Every filter works on a copy of out taken when it starts, so the
+    // filters running at the same time never share a container. What it
+    // changed is merged back when it is done; the graph keeps filters on
+    // the same slots apart.
+    boost::mutex mtx;
+    DataflowGraph::NodeRunner runner = [&](size_t i) {
+        Frame task;
+        {
+            boost::lock_guard<boost::mutex> lock(mtx);
+            task = out;
         }
+        unsigned long since = task.changeStamp();
+        bool ok = runFilter(i, &in == &out ? task : in, task);
+        boost::lock_guard<boost::mutex> lock(mtx);
+        out.mergeChanges(task, since);
+        return ok;
+    };
+    return _graph.run(*_pool, runner);
+}
+
+bool FilterBank::runPass(size_t i, const Frame& in, Frame& out, bool& success)
+{
+    typedef FilterStats::Clock Clock;
+    if (_passAt.size() != _pipe.size() || _passAt[i] < 0) return false;
+    FusedPass& pass = _passes[_passAt[i]];
 
-        // BOOST_LOG_TRIVIAL(debug)
-        //    << id() << "::filter" << i << "\t" << _pipe[i]->name() << "\t done"
-        //    << "\t duration: " << diff.total_microseconds() << " us";
+    Clock::time_point start = Clock::now();
+    try {
+        TraceScope trace(pass.id());
+        if (!pass.filter(in, out)) return false;
+        success = true;
+    } catch (std::exception& e) {
+        LOG(error) << "fused " << pass.id() << " failed: " << e.what();
+        success = false;
+    }
+    Clock::duration d = (Clock::now() - start) / pass.size();
+    for (size_t j = 0; j < pass.size(); j++) {
+        recordStats(pass.filters()[j], d, success);
     }
-    ready.post();
     return true;
 }
 
+void FilterBank::fuse(bool enable)
+{
+    _fuse = enable;
+    _passes.clear();
+    _passAt.clear();
+    if (!enable) return;
+    _passAt.assign(_pipe.size(), -1);
+    for (size_t i = 0; i < _pipe.size();) {
+        FusedPass pass;
+        size_t j = i;
+        while (j < _pipe.size() && pass.add(dynamic_cast<PixelFilter*>(_pipe[j])))
+            j++;
+        if (pass.size() > 1) {
+            LOG(info) << "fused " << pass.id();
+            _passAt[i] = _passes.size();
+            _passes.push_back(pass);
+        }
+        i = std::max(j, i + 1);
+    }
+}
+
+void FilterBank::dataflow(bool enable, size_t threads)
+{
+    _dataflow = enable;
+    _dataflowThreads = threads;
+    _pool.reset();
+    _graph.build(_pipe);
+    if (!enable) return;
+    _pool.reset(new WorkerPool(threads));
+
+    boost::property_tree::ptree report = _graph.report();
+    LOG(info) << "dataflow on " << _pool->size() << " threads, "
+              << "critical path " << report.get<std::string>("criticalPath")
+              << ", parallelism " << report.get<double>("parallelism");
+    const std::vector<DataflowGraph::Node>& nodes = _graph.nodes();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        std::vector<std::string> deps;
+        for (size_t d = 0; d < nodes[i].deps.size(); d++) {
+            deps.push_back(nodes[nodes[i].deps[d]].id);
+        }
+        LOG(debug) << "dataflow " << nodes[i].id
+                   << (nodes[i].barrier ? " (barrier)" : "") << " after: "
+                   << boost::algorithm::join(deps, " ");
+    }
+}
+
+void FilterBank::replan()
+{
+    // the pool stays, only the filters it runs changed
+    _planStale = false;
+    _graph.build(_pipe);
+    fuse(_fuse);
+}
+
+boost::property_tree::ptree FilterBank::getDataflowReport() const
+{
+    DataflowGraph graph;
+    if (_graph.size() == _pipe.size()) {
+        graph = _graph;
+    } else {
+        graph.build(_pipe);
+    }
+    std::vector<double> cost;
+    bool measured = false;
+    for (size_t i = 0; i < _pipe.size(); i++) {
+        FilterStats s = childStats(_pipe[i]);
+        cost.push_back(s.latency.mean() / 1000.);
+        measured |= s.calls > 0;
+    }
+    if (!measured) cost.clear();
+    boost::property_tree::ptree pt = graph.report(cost);
+    pt.put("enabled", dataflow());
+    if (_pool) pt.put("threads", _pool->size());
+    return pt;
+}
+
+void FilterBank::recordStats(const Filter* f, FilterStats::Clock::duration d,
+                             bool ok)
+{
+    boost::lock_guard<boost::mutex> lock(_statsMtx);
+    _stats[f].record(d, ok);
+}
+
+FilterStats FilterBank::childStats(const Filter* f) const
+{
+    boost::lock_guard<boost::mutex> lock(_statsMtx);
+    std::map<const Filter*, FilterStats>::const_iterator it = _stats.find(f);
+    return it != _stats.end() ? it->second : FilterStats();
+}
+
+FilterStats FilterBank::bankStats() const
+{
+    boost::lock_guard<boost::mutex> lock(_statsMtx);
+    return _passStats;
+}
+
+boost::property_tree::ptree FilterBank::getFilterStats() const
+{
+    boost::property_tree::ptree pt = bankStats().toPtree();
+    boost::property_tree::ptree filters;
+
+    for (size_t i = 0; i < _pipe.size(); i++) {
+        FilterStats s = childStats(_pipe[i]);
+        boost::property_tree::ptree node;
+        const FilterBank* fb = dynamic_cast<const FilterBank*>(_pipe[i]);
+        if (fb) {
+            // Pipeline stages run on their own threads and are only
+            // measured by themselves
+            boost::property_tree::ptree sub = fb->getFilterStats();
+            if (s.calls) {
+                node = s.toPtree();
+                boost::optional<boost::property_tree::ptree&> nested =
+                    sub.get_child_optional("filters");
+                if (nested) node.add_child("filters", *nested);
+            } else {
+                node = sub;
+            }
+        } else {
+            node = s.toPtree();
+        }
+        node.put("type", _pipe[i]->type());
+        // ids are keys, not paths
+        filters.push_back(std::make_pair(_pipe[i]->id(), node));
+    }
+    pt.add_child("filters", filters);
+    return pt;
+}
+
+void FilterBank::resetFilterStats()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_statsMtx);
+        _stats.clear();
+        _passStats.reset();
+    }
+    for (size_t i = 0; i < _pipe.size(); i++) {
+        FilterBank* fb = dynamic_cast<FilterBank*>(_pipe[i]);
+        if (fb) fb->resetFilterStats();
+    }
+}
+
+void FilterBank::updateConfig(const boost::property_tree::ptree& pt)
+{
+    Filter::updateConfig(pt);
+    invalidatePlan();
+}
+
 boost::property_tree::ptree FilterBank::getConfig() const
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << id();
@@ -109,9 +328,16 @@ int FilterBank::handleConfigItem(
                                  << " " << it->second.data();
         fb->loadFileConfig(it->second.data());
         add(fb);
+    } else if (it->first == "dataflow") {
+        // applied once all filters are loaded
+        _dataflow = it->second.get<bool>("enabled", true);
+        _dataflowThreads = it->second.get<size_t>("threads", 0);
+    } else if (it->first == "fuse") {
+        // applied once all filters are loaded
+        _fuse = it->second.get_value<bool>(true);
         // Ignore comments and global options
     } else if (it->first == "<xmlcomment>" || it->first == "globals" ||
-               it->first == "plugins") {
+               it->first == "plugins" || it->first == "workers") {
         ;
     } else {
         BOOST_LOG_TRIVIAL(debug)
@@ -170,6 +396,8 @@ int FilterBank::loadConfig(
         // but ok, you're the boss...
         throw std::runtime_error("filterBank::loadConfig() failure");
     }
+    if (_dataflow) dataflow(true, _dataflowThreads);
+    if (_fuse) fuse(true);
     return 1;
 }
 
@@ -177,6 +405,7 @@ void FilterBank::add(Filter* f)
 {
     _pipe.push_back(f);
     //_filters.insert(std::pair<std::string, Filter*>(f->name(),f));
+    invalidatePlan();
 }
 
 int FilterBank::loadConfig(const boost::property_tree::ptree& pt,
@@ -247,7 +476,8 @@ int FilterBank::getFiltersByType(const std::string& type,
         //BOOST_LOG_TRIVIAL(debug) << type;
         //BOOST_LOG_TRIVIAL(debug) << (*it)->id();
         if ((*it)->type() == "filterBank" ||
-            (*it)->type() == "parallelFilter") {
+            (*it)->type() == "parallelFilter" ||
+            (*it)->type() == "pipeline") {
             ((FilterBank*)(*it))->getFiltersByType(type, vec);
         }
         if ((*it)->type() == type) vec.push_back((*it));
@@ -264,7 +494,8 @@ int FilterBank::countFiltersByType(const std::string& type)
         //BOOST_LOG_TRIVIAL(debug) << type;
         //BOOST_LOG_TRIVIAL(debug) << (*it)->id();
         if ((*it)->type() == "filterBank" ||
-            (*it)->type() == "parallelFilter") {
+            (*it)->type() == "parallelFilter" ||
+            (*it)->type() == "pipeline") {
             cnt += ((FilterBank*)(*it))->countFiltersByType(type);
         }
         if ((*it)->type() == type) cnt++;
@@ -283,8 +514,18 @@ size_t FilterBank::findPos(std::string name)
 int FilterBank::remove(std::string name)
 {
     int pos = findPos(name);
+    if (pos < 0) {
+        BOOST_LOG_TRIVIAL(warning) << "Filter " << name << " not found.";
+        return -1;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(_statsMtx);
+        _stats.erase(_pipe[pos]);
+    }
+    const string id = _pipe[pos]->id();
     _pipe.erase(_pipe.begin() + pos);
-    ff->deleteFilter(name);
+    replan();
+    ff->deleteFilter(id);
     return 1;
 }
 
@@ -294,9 +535,14 @@ int FilterBank::remove(size_t i)
         BOOST_LOG_TRIVIAL(warning) << "Position i: " << i << "out of bounds.";
         return -1;
     }
-    const string name = _pipe[i]->name();
-    ff->deleteFilter(name);
-    _pipe.erase(_pipe.end() + i);
+    const string id = _pipe[i]->id();
+    {
+        boost::lock_guard<boost::mutex> lock(_statsMtx);
+        _stats.erase(_pipe[i]);
+    }
+    _pipe.erase(_pipe.begin() + i);
+    replan();
+    ff->deleteFilter(id);
     return 1;
 }
 
@@ -306,7 +552,8 @@ void FilterBank::clearBank()
     for (size_t i = 0; i < _pipe.size(); i++) {
         string n = _pipe[i]->name();
         try {
-            ff->deleteFilter(_pipe[i]->name());
+            // the factory keeps its filters by id, the name may differ
+            ff->deleteFilter(_pipe[i]->id());
         } catch (std::exception& e) {
             BOOST_LOG_TRIVIAL(warning)
                 << name() << "::clearBank failed at " << i << " " << n;
@@ -316,6 +563,9 @@ void FilterBank::clearBank()
         }
     }
     _pipe.clear();
+    replan();
+    boost::lock_guard<boost::mutex> lock(_statsMtx);
+    _stats.clear();
 }
 
 void FilterBank::processEvent(Event& e)
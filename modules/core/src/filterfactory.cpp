@@ -19,6 +19,7 @@
 
 // from core/include:
 #include "toffy/parallelFilter.hpp"
+#include "toffy/pipeline.hpp"
 
 // from filters/include:
 #include "toffy/base/amplitudeRange.hpp"
@@ -44,8 +45,10 @@
 #include <toffy/detection/mask.hpp>
 
 #include "toffy/import/dataimporter.hpp"
+#include "toffy/import/importSnapshot.hpp"
 #include "toffy/import/importYaml.hpp"
 #include "toffy/io/csv_source.hpp"
+#include "toffy/capture/synthetic.hpp"
 
 #include "toffy/reproject/reprojectopencv.hpp"
 
@@ -64,6 +67,7 @@
 #include "toffy/3d/xyz2pcl.hpp"
 #include "toffy/3d/groundprojection.hpp"
 #include "toffy/viewers/exportcloud.hpp"
+#include "toffy/viewers/exportSnapshot.hpp"
 #include "toffy/viewers/exportYaml.hpp"
 #include "toffy/detection/squareDetect.hpp"
 
@@ -171,6 +175,8 @@ Filter* FilterFactory::createFilter(const std::string& type,
 #endif
     else if (type == "csvSource")
         f = new capturers::CSVSource();
+    else if (type == capturers::SyntheticCapturer::id_name)
+        f = new capturers::SyntheticCapturer();
 
     else if (type == "amplitudeRange")
         f = new AmplitudeRange();
@@ -185,10 +191,8 @@ Filter* FilterFactory::createFilter(const std::string& type,
         f = new smoothing::Bilateral();
     else if (type == "average")
         f = new smoothing::Average();
-#if OPENCV_TRACKING
     else if (type == toffy::filters::smoothing::KalmanAverage::id_name)
         f = new smoothing::KalmanAverage();
-#endif
     else if (type == "objectTrack")
         f = new detection::ObjectTrack();
     else if (type == "blobs")
@@ -203,6 +207,10 @@ Filter* FilterFactory::createFilter(const std::string& type,
         f = new import::DataImporter();
     else if (type == "importYaml")
         f = new import::ImportYaml();
+    else if (type == import::ImportSnapshot::id_name)
+        f = new import::ImportSnapshot();
+    else if (type == ExportSnapshot::id_name)
+        f = new ExportSnapshot();
     else if (type == "roi")
         f = new Roi();
     else if (type == BackgroundSubs::id_name)
@@ -242,6 +250,8 @@ Filter* FilterFactory::createFilter(const std::string& type,
     //#endif
     else if (type == "parallelFilter")
         f = new ParallelFilter();
+    else if (type == Pipeline::id_name)
+        f = new Pipeline();
 
     else {
         // try an external creator fn:
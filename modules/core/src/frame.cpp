@@ -16,80 +16,257 @@
 */
 
 #include "toffy/frame.hpp"
+#include "toffy/matPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
 
 #include <boost/log/trivial.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 using namespace toffy;
 
-Frame::Frame() : data(), meta() {}
+namespace {
+/**
+ * Process-wide table of interned slot names. Names are only ever added, so
+ * an id stays valid for the lifetime of the process.
+ *
+ * Each thread caches the names it has looked up, so the string api of
+ * Frame only takes the lock the first time a thread meets a name.
+ */
+struct SlotRegistry {
+    typedef boost::container::flat_map<std::string, std::size_t> Ids;
+
+    boost::shared_mutex mtx;
+    Ids ids;
+    std::deque<std::string> names;
+    std::atomic<std::size_t> size{0};
+
+    static Ids& cache()
+    {
+        static thread_local Ids c;
+        return c;
+    }
+
+    bool find(const std::string& name, std::size_t& id)
+    {
+        Ids& c = cache();
+        Ids::const_iterator it = c.find(name);
+        if (it != c.end()) {
+            id = it->second;
+            return true;
+        }
+        {
+            boost::shared_lock<boost::shared_mutex> lock(mtx);
+            it = ids.find(name);
+            if (it == ids.end()) return false;
+            id = it->second;
+        }
+        c[name] = id;
+        return true;
+    }
+
+    std::size_t intern(const std::string& name)
+    {
+        std::size_t id;
+        if (find(name, id)) return id;
+        {
+            boost::unique_lock<boost::shared_mutex> lock(mtx);
+            // someone else may have been faster:
+            Ids::const_iterator it = ids.find(name);
+            if (it != ids.end()) {
+                id = it->second;
+            } else {
+                id = names.size();
+                names.push_back(name);
+                ids[name] = id;
+                size = names.size();
+            }
+        }
+        cache()[name] = id;
+        return id;
+    }
+
+    std::string name(std::size_t id)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mtx);
+        return id < names.size() ? names[id] : std::string();
+    }
 
-Frame::Frame(const Frame& f) : data(f.data), meta(f.meta) {}
+    std::size_t count() { return size.load(); }
+};
 
-Frame::~Frame()
+SlotRegistry& registry()
 {
-    data.clear();
-    meta.clear();
+    static SlotRegistry reg;
+    return reg;
 }
+}  // namespace
+
+const std::size_t SlotKey::invalid = static_cast<std::size_t>(-1);
+
+SlotKey::SlotKey(const std::string& name) : _id(registry().intern(name)) {}
+
+std::string SlotKey::name() const { return registry().name(_id); }
+
+bool SlotKey::find(const std::string& name, SlotKey& key)
+{
+    std::size_t id;
+    if (!registry().find(name, id)) return false;
+    key._id = id;
+    return true;
+}
+
+std::size_t SlotKey::count() { return registry().count(); }
+
+Frame::Frame() : slots(), lastChange(0) {}
+
+Frame::Frame(const Frame& f) : slots(f.slots), lastChange(f.lastChange) {}
+
+Frame::~Frame() { slots.clear(); }
 
 bool Frame::hasKey(std::string key) const
 {
-    if (data.find(key) != data.end()) return true;
-    return false;
+    SlotKey k;
+    return SlotKey::find(key, k) && hasKey(k);
 }
 
 boost::any Frame::getData(const std::string& key) const
 {
     // BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << ", key: " << key;
-    boost::any out;
-    if (data.find(key) != data.end()) {
-        try {
-            out = data.at(key);
-        } catch (std::out_of_range& e) {
-            BOOST_LOG_TRIVIAL(warning)
-                << "Frame::getData(): Could not find key " << key;
-        }
-    } else {
-        BOOST_LOG_TRIVIAL(info)
-            << "Frame::getData(): Could not find key " << key;
+    SlotKey k;
+    if (SlotKey::find(key, k) && hasKey(k)) {
+        return slots[k.id()].value;
     }
-    return out;
+    BOOST_LOG_TRIVIAL(info) << "Frame::getData(): Could not find key " << key;
+    return boost::any();
 }
 
 void Frame::addData(std::string key, boost::any v, SlotDataType dt)
 {
-    data[key] = v;
-    meta[key] = dt;
+    addData(SlotKey(key), v, dt);
 }
 
 void Frame::addData(std::string key, boost::any v, SlotDataType dt,
                     const std::string& description)
 {
-    data[key] = v;
-    meta[key] = dt;
-    desc[key] = description;
+    SlotKey k(key);
+    addData(k, v, dt);
+    slots[k.id()].description = description;
+}
+
+void Frame::addData(const SlotKey& key, boost::any v, SlotDataType dt)
+{
+    if (!key.valid()) {
+        BOOST_LOG_TRIVIAL(warning) << "Frame::addData(): unset slot key";
+        return;
+    }
+    Slot& s = slot(key);
+    s.value.swap(v);
+    s.dt = dt;
+    s.set = true;
+    s.stamp = ++lastChange;
 }
 
 bool toffy::Frame::removeData(std::string key)
 {
-    if (data.find(key) != data.end()) {
-        data.erase(data.find(key));
-        return true;
-    } else
-        return false;
+    SlotKey k;
+    return SlotKey::find(key, k) && removeData(k);
 }
 
-void Frame::clearData() { return data.clear(); }
+bool Frame::removeData(const SlotKey& key)
+{
+    if (!hasKey(key)) return false;
+    slots[key.id()] = Slot();
+    slots[key.id()].stamp = ++lastChange;
+    return true;
+}
+
+/** replaces a shared *m by a copy of its own */
+static bool detachMat(matPtr* m)
+{
+    if (!m || !*m || m->use_count() < 2) return false;
+    matPtr copy = MatPool::global().acquire((*m)->size(), (*m)->type());
+    (*m)->copyTo(*copy);
+    *m = copy;
+    return true;
+}
+
+bool Frame::detach(const SlotKey& key) { return detachMat(get<matPtr>(key)); }
+
+std::size_t Frame::detachAll()
+{
+    std::size_t n = 0;
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].set && detachMat(boost::any_cast<matPtr>(&slots[i].value)))
+            n++;
+    }
+    return n;
+}
+
+void Frame::clearData()
+{
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!slots[i].set) continue;
+        slots[i] = Slot();
+        slots[i].stamp = ++lastChange;
+    }
+}
+
+void Frame::merge(const Frame& f)
+{
+    if (f.slots.size() > slots.size()) slots.resize(f.slots.size());
+    for (size_t i = 0; i < f.slots.size(); i++) {
+        if (!f.slots[i].set) continue;
+        slots[i] = f.slots[i];
+        slots[i].stamp = ++lastChange;
+    }
+}
+
+void Frame::mergeChanges(const Frame& f, unsigned long since)
+{
+    if (f.slots.size() > slots.size()) slots.resize(f.slots.size());
+    for (size_t i = 0; i < f.slots.size(); i++) {
+        if (f.slots[i].stamp <= since) continue;
+        slots[i] = f.slots[i];
+        slots[i].stamp = ++lastChange;
+    }
+}
 
+Frame::SlotDataType Frame::getDataType(const std::string& key) const
+{
+    SlotKey k;
+    return SlotKey::find(key, k) ? getDataType(k) : NotFound;
+}
+
+matPtr Frame::getSertMatPtr(const std::string& key, cv::Size size, int type)
+{
+    if (!hasKey(key)) {
+        addData(key, MatPool::global().acquire(size, type), Mat);
+    }
+    return getMatPtr(key);
+}
+
+std::string Frame::getDescription(const std::string& key) const
+{
+    SlotKey k;
+    if (!SlotKey::find(key, k) || !hasKey(k)) return "";
+    return slots[k.id()].description;
+}
 
 void Frame::info(std::vector<SlotInfo>& fields) const
 {
-    auto it = data.begin();
-    while (it != data.end()) {
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!slots[i].set) continue;
         Frame::SlotInfo si;
-        si.key = it->first;
-        si.dt = getDataType(si.key);
-        si.description = getDescription(si.key);
+        si.key = registry().name(i);
+        si.dt = slots[i].dt;
+        si.description = slots[i].description;
         fields.push_back(si);
-        it++;
     }
+    // keep the alphabetical listing of the former map based container
+    std::sort(fields.begin(), fields.end(),
+              [](const SlotInfo& a, const SlotInfo& b) { return a.key < b.key; });
 }
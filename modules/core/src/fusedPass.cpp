@@ -0,0 +1,129 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "toffy/fusedPass.hpp"
+
+using namespace toffy;
+
+template <typename T>
+static void loadRow(const cv::Mat& m, int y, float* row)
+{
+    const T* p = m.ptr<T>(y);
+    for (int x = 0; x < m.cols; x++) row[x] = p[x];
+}
+
+template <typename T>
+static void storeRow(const float* row, cv::Mat& m, int y)
+{
+    T* p = m.ptr<T>(y);
+    for (int x = 0; x < m.cols; x++) p[x] = static_cast<T>(row[x]);
+}
+
+bool FusedPass::add(PixelFilter* f)
+{
+    PixelFilter::FusedPlanes planes;
+    if (!f || !f->fusible(planes) || planes.depth.empty() ||
+        planes.ampl == planes.depth) {
+        return false;
+    }
+    if (!_stages.empty() && planes.depth != _depth) return false;
+    if (!planes.ampl.empty() && !_ampl.empty() && planes.ampl != _ampl) {
+        return false;
+    }
+    _depth = planes.depth;
+    _depthKey = SlotKey(_depth);
+    if (!planes.ampl.empty()) {
+        _ampl = planes.ampl;
+        _amplKey = SlotKey(_ampl);
+    }
+    _amplWritten |= planes.amplWritten;
+    _stages.push_back(f);
+    return true;
+}
+
+std::string FusedPass::id() const
+{
+    std::string id;
+    for (size_t i = 0; i < _stages.size(); i++) {
+        if (i) id += " ";
+        id += _stages[i]->id();
+    }
+    return id;
+}
+
+bool FusedPass::filter(const Frame& in, Frame& out)
+{
+    matPtr depth = in.optMatPtr(_depthKey, matPtr());
+    if (!depth || depth->empty() || depth->type() != CV_32F) return false;
+    matPtr ampl;
+    if (_amplKey.valid()) {
+        ampl = in.optMatPtr(_amplKey, matPtr());
+        if (!ampl || ampl->size() != depth->size() ||
+            (ampl->type() != CV_32F && ampl->type() != CV_16S &&
+             ampl->type() != CV_16U)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < _stages.size(); i++) {
+        if (!_stages[i]->fusedBegin(*depth, ampl.get(), out)) return false;
+    }
+
+    PixelFilter::BandTask body = [&](int begin, int end) {
+        run(begin, end, *depth, ampl.get());
+    };
+    const PixelFilter* tiled = NULL;
+    for (size_t i = 0; i < _stages.size() && !tiled; i++) {
+        if (_stages[i]->tiled()) tiled = _stages[i];
+    }
+    if (tiled)
+        tiled->forEachBand(depth->rows, body);
+    else
+        body(0, depth->rows);
+
+    out.addData(_depthKey, depth);
+    if (ampl) out.addData(_amplKey, ampl);
+    return true;
+}
+
+void FusedPass::run(int begin, int end, cv::Mat& depth, cv::Mat* ampl) const
+{
+    const int cols = depth.cols;
+    const int amplType = ampl ? ampl->type() : CV_32F;
+    std::vector<float> row(amplType == CV_32F ? 0 : cols);
+    for (int y = begin; y < end; y++) {
+        float* d = depth.ptr<float>(y);
+        float* a = NULL;
+        if (ampl && amplType == CV_32F) {
+            a = ampl->ptr<float>(y);
+        } else if (ampl) {
+            a = row.data();
+            if (amplType == CV_16S)
+                loadRow<short>(*ampl, y, a);
+            else
+                loadRow<unsigned short>(*ampl, y, a);
+        }
+
+        for (size_t s = 0; s < _stages.size(); s++) {
+            _stages[s]->fusedRow(y, d, a, cols);
+        }
+
+        if (ampl && amplType != CV_32F && _amplWritten) {
+            if (amplType == CV_16S)
+                storeRow<short>(a, *ampl, y);
+            else
+                storeRow<unsigned short>(a, *ampl, y);
+        }
+    }
+}
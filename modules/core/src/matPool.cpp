@@ -0,0 +1,191 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "toffy/matPool.hpp"
+
+using namespace toffy;
+
+class MatPool::Impl
+{
+   public:
+    typedef std::tuple<int, int, int> Key;  ///< rows, cols, type
+
+    explicit Impl(size_t maxPerKey) : maxPerKey(maxPerKey) { reset(); }
+
+    ~Impl() { clear(); }
+
+    cv::Mat* get(cv::Size size, int type)
+    {
+        type = CV_MAT_TYPE(type);
+        boost::lock_guard<boost::mutex> lock(mtx);
+        std::vector<cv::Mat*>& idle = pool[Key(size.height, size.width, type)];
+        if (!idle.empty()) {
+            cv::Mat* m = idle.back();
+            idle.pop_back();
+            stats.reused++;
+            stats.idle--;
+            stats.idleBytes -= bytes(*m);
+            return m;
+        }
+        stats.allocated++;
+        return NULL;
+    }
+
+    void put(cv::Mat* m)
+    {
+        // only take back plain buffers nobody else shares
+        if (m->empty() || !m->u || m->u->refcount != 1 || m->dims != 2 ||
+            !m->isContinuous() || m->data != m->datastart) {
+            boost::lock_guard<boost::mutex> lock(mtx);
+            stats.dropped++;
+            delete m;
+            return;
+        }
+
+        boost::lock_guard<boost::mutex> lock(mtx);
+        std::vector<cv::Mat*>& idle = pool[Key(m->rows, m->cols, m->type())];
+        if (idle.size() >= maxPerKey) {
+            stats.dropped++;
+            delete m;
+            return;
+        }
+        idle.push_back(m);
+        stats.returned++;
+        stats.idle++;
+        stats.idleBytes += bytes(*m);
+    }
+
+    void clear()
+    {
+        boost::lock_guard<boost::mutex> lock(mtx);
+        for (std::map<Key, std::vector<cv::Mat*> >::iterator it = pool.begin();
+             it != pool.end(); ++it) {
+            for (size_t i = 0; i < it->second.size(); i++) delete it->second[i];
+        }
+        pool.clear();
+        stats.idle = 0;
+        stats.idleBytes = 0;
+    }
+
+    void reset()
+    {
+        stats.allocated = stats.reused = stats.returned = stats.dropped = 0;
+        stats.idle = stats.idleBytes = 0;
+    }
+
+    static size_t bytes(const cv::Mat& m) { return m.total() * m.elemSize(); }
+
+    mutable boost::mutex mtx;
+    std::map<Key, std::vector<cv::Mat*> > pool;
+    size_t maxPerKey;
+    MatPool::Stats stats;
+};
+
+/** matPtr deleter handing the buffer back to its pool */
+struct MatPool::Recycle {
+    std::weak_ptr<MatPool::Impl> pool;
+
+    void operator()(cv::Mat* m) const
+    {
+        std::shared_ptr<MatPool::Impl> p = pool.lock();
+        if (p) {
+            p->put(m);
+        } else {
+            delete m;
+        }
+    }
+};
+
+MatPool::MatPool(size_t maxPerKey) : _impl(new Impl(maxPerKey)) {}
+
+MatPool::~MatPool() {}
+
+matPtr MatPool::acquire(cv::Size size, int type)
+{
+    cv::Mat* m = _impl->get(size, type);
+    if (!m) {
+        m = new cv::Mat(size, type);
+    }
+    Recycle r;
+    r.pool = _impl;
+    return matPtr(m, r);
+}
+
+matPtr MatPool::clone(const cv::Mat& src)
+{
+    matPtr m = acquire(src.size(), src.type());
+    src.copyTo(*m);
+    return m;
+}
+
+bool MatPool::exclusive(const matPtr& m, long holders)
+{
+    return m && m.use_count() <= holders && m->u && m->u->refcount == 1;
+}
+
+void MatPool::clear() { _impl->clear(); }
+
+size_t MatPool::maxPerKey() const
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    return _impl->maxPerKey;
+}
+
+void MatPool::maxPerKey(size_t n)
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    _impl->maxPerKey = n;
+}
+
+MatPool::Stats MatPool::stats() const
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    return _impl->stats;
+}
+
+boost::property_tree::ptree MatPool::getStats() const
+{
+    Stats s = stats();
+    boost::property_tree::ptree pt;
+    pt.put("allocated", s.allocated);
+    pt.put("reused", s.reused);
+    pt.put("returned", s.returned);
+    pt.put("dropped", s.dropped);
+    pt.put("idle", s.idle);
+    pt.put("idleBytes", s.idleBytes);
+    return pt;
+}
+
+void MatPool::resetStats()
+{
+    boost::lock_guard<boost::mutex> lock(_impl->mtx);
+    size_t idle = _impl->stats.idle, idleBytes = _impl->stats.idleBytes;
+    _impl->reset();
+    _impl->stats.idle = idle;
+    _impl->stats.idleBytes = idleBytes;
+}
+
+MatPool& MatPool::global()
+{
+    static MatPool pool;
+    return pool;
+}
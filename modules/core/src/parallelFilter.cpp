@@ -14,15 +14,16 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
-#include <iostream>
-
 #include <boost/log/trivial.hpp>
 
+#include "toffy/dataflow.hpp"
 #include "toffy/filterbank.hpp"
+#include "toffy/filterfactory.hpp"
 #include "toffy/filterThread.hpp"
 #include "toffy/mux.hpp"
 
 #include "toffy/parallelFilter.hpp"
+#include "toffy/trace.hpp"
 
 using namespace std;
 using namespace toffy;
@@ -30,6 +31,29 @@ using namespace toffy;
 std::size_t ParallelFilter::_filter_counter = 1;
 const std::string ParallelFilter::id_name = "parallelFilter";
 
+static const std::string traceWait = "wait for lanes";
+
+/**
+ * Collects the slots the filters of a lane write, false if one of them
+ * may write slots it does not declare.
+ */
+static bool laneWrites(const Filter* f, std::vector<std::string>& writes)
+{
+    const FilterBank* fb = dynamic_cast<const FilterBank*>(f);
+    if (fb) {
+        bool declared = true;
+        for (size_t i = 0; i < fb->size(); i++) {
+            declared &= laneWrites(fb->getFilter((int)i), writes);
+        }
+        return declared;
+    }
+    boost::property_tree::ptree config = f->getConfig();
+    std::vector<std::string> reads, out;
+    DataflowGraph::declaredSlots(config, reads, out);
+    writes.insert(writes.end(), out.begin(), out.end());
+    return f->declaresSlots();
+}
+
 ParallelFilter::~ParallelFilter()
 {
     for (size_t i = 0; i < lanes.size(); i++) {
@@ -45,16 +69,18 @@ int ParallelFilter::handleConfigItem(
     BOOST_LOG_TRIVIAL(debug)
         << __FUNCTION__ << ":: " << type() << " " << it->first;
 
-    cout << "PF::handle " << it->first << endl;
     if (it->first == "parallelFilter") {
         // recurse
         return loadConfig(confFile, it->second.begin(), it->second.end());
     } else if (it->first == "thread") {
-        cout << "PF::THREAD FOUND!" << endl;
         Filter* f;
+        // lane filters are created through the factory, the bank deletes
+        // them with its other filters
         if (it->second.size() > 1) {
             // instantiate a filterbank
-            FilterBank* fb = new FilterBank();
+            FilterBank* fb = static_cast<FilterBank*>(
+                FilterFactory::getInstance()->createFilter(
+                    FilterBank::id_name));
 
             fb->bank(NULL);
             fb->loadConfig(it->second);
@@ -62,10 +88,11 @@ int ParallelFilter::handleConfigItem(
             f = fb;
         } else if (it->second.begin()->first == "filterGroup") {
             // instantiate a filterbank
-            FilterBank* fb = new FilterBank();
+            FilterBank* fb = static_cast<FilterBank*>(
+                FilterFactory::getInstance()->createFilter(
+                    FilterBank::id_name));
             const boost::property_tree::ptree pt = it->second.begin()->second;
 
-            cout << "DD " << pt.data() << endl;
             fb->bank(NULL);
             fb->loadFileConfig(pt.data());
 
@@ -82,8 +109,6 @@ int ParallelFilter::handleConfigItem(
 
     } else if (it->first == "barrier") {
         boost::property_tree::ptree::const_iterator child = it->second.begin();
-        cout << "PF::BARRIER FOUND! " << child->first << endl;
-
         Filter* f = instantiateFilter(child);
 
         f->loadConfig(it->second);
@@ -92,34 +117,70 @@ int ParallelFilter::handleConfigItem(
 
         add(f);  // book-keeping
 
+    } else if (it->first == "options") {
+        _dedicatedThreads =
+            it->second.get<bool>("dedicatedThreads", _dedicatedThreads);
+        _fanOut = it->second.get<bool>("fanOut", _fanOut);
     } else {
         // return FilterBank::handleConfigItem(confFile, it);
     }
     return 1;
 }
-//@TODO: TEST! works right now for filterbanks with integrated image source (bta), but not if input frame is from extern.
-bool ParallelFilter::filter(const Frame& /*in*/, Frame& out)
+bool ParallelFilter::filter(const Frame& in, Frame& out)
 {
     std::vector<Frame*> res;
     size_t i;
+    if (_fanOut) {
+        if (_fanFrames.size() != lanes.size()) {
+            BOOST_LOG_TRIVIAL(warning)
+                << name() << "::" << __FUNCTION__ << " fan-out not initialized.";
+            return false;
+        }
+        // share the input with all lanes, they copy what they write
+        for (i = 0; i < lanes.size(); i++) {
+            _fanFrames[i].clearData();
+            _fanFrames[i].merge(in);
+            lanes[i]->enqueue(&_fanFrames[i]);
+        }
+    }
     // sync all threads to get one result
     res.resize(lanes.size());
+    Tracer::begin(traceWait);
     for (i = 0; i < lanes.size(); i++) {
-        cout << "ParallelFilter::filter.deq " << i << endl;
         res[i] = lanes[i]->dequeue();
+        if (!res[i]) {
+            // lane stopped, hand back what we got so far
+            BOOST_LOG_TRIVIAL(warning)
+                << name() << "::" << __FUNCTION__ << " lane " << i
+                << " stopped.";
+            if (_fanOut) {
+                // the others may still work on our frames
+                for (size_t j = i + 1; j < lanes.size(); j++) lanes[j]->dequeue();
+            } else {
+                for (size_t j = 0; j < i; j++) lanes[j]->enqueue(res[j]);
+            }
+            Tracer::end(traceWait);
+            return false;
+        }
     }
-    cout << "ParallelFilter::filter.deqed " << endl;
+    Tracer::end(traceWait);
 
     if (mux) {
-        mux->filter(res, out);
+        FilterStats::Clock::time_point start = FilterStats::Clock::now();
+        TraceScope trace(mux->id());
+        bool ok = mux->filter(res, out);
+        recordStats(mux, FilterStats::Clock::now() - start, ok);
     } else {
         BOOST_LOG_TRIVIAL(debug)
             << name() << "::" << __FUNCTION__ << " --> No Muxer found! ";
     }
 
-    // release frames again
+    // release frames again, fan-out frames drop their share of the input
     for (i = 0; i < lanes.size(); i++) {
-        lanes[i]->enqueue(res[i]);
+        if (_fanOut)
+            res[i]->clearData();
+        else
+            lanes[i]->enqueue(res[i]);
     }
 
     return true;
@@ -129,13 +190,28 @@ void ParallelFilter::init()
 {
     for (size_t i = 0; i < lanes.size(); i++) {
         lanes[i]->init(2);
+        if (!_fanOut) continue;
+        std::vector<std::string> writes;
+        bool declared = laneWrites(lanes[i]->filter(), writes);
+        std::vector<SlotKey> keys;
+        for (size_t j = 0; j < writes.size(); j++) {
+            keys.push_back(SlotKey(writes[j]));
+        }
+        lanes[i]->copyOnWrite(keys, !declared);
+        if (!declared) {
+            BOOST_LOG_TRIVIAL(info)
+                << name() << " lane " << lanes[i]->filter()->id()
+                << " has filters without declared slots, copies all Mats.";
+        }
     }
+    _fanFrames.resize(_fanOut ? lanes.size() : 0);
 }
 
 void ParallelFilter::start()
 {
     for (size_t i = 0; i < lanes.size(); i++) {
-        lanes[i]->start();
+        lanes[i]->start(_dedicatedThreads ? NULL : &WorkerPool::shared(),
+                        !_fanOut);
     }
 }
 
@@ -145,3 +221,26 @@ void ParallelFilter::stop()
         lanes[i]->stop();
     }
 }
+
+size_t ParallelFilter::copies() const
+{
+    size_t n = 0;
+    for (size_t i = 0; i < lanes.size(); i++) n += lanes[i]->copies();
+    return n;
+}
+
+FilterStats ParallelFilter::childStats(const Filter* f) const
+{
+    for (size_t i = 0; i < lanes.size(); i++) {
+        if (lanes[i]->filter() == f) return lanes[i]->stats();
+    }
+    return FilterBank::childStats(f);
+}
+
+void ParallelFilter::resetFilterStats()
+{
+    for (size_t i = 0; i < lanes.size(); i++) {
+        lanes[i]->resetStats();
+    }
+    FilterBank::resetFilterStats();
+}
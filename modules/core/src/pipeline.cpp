@@ -0,0 +1,314 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <chrono>
+
+#include <boost/log/trivial.hpp>
+
+#include "toffy/filterfactory.hpp"
+#include "toffy/pipeline.hpp"
+#include "toffy/trace.hpp"
+
+using namespace toffy;
+using namespace std;
+
+std::size_t Pipeline::_filter_counter = 1;
+const std::string Pipeline::id_name = "pipeline";
+
+static long long nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static void updateMax(std::atomic<unsigned long long>& m,
+                      unsigned long long v)
+{
+    unsigned long long cur = m.load();
+    while (v > cur && !m.compare_exchange_weak(cur, v)) {
+    }
+}
+
+Pipeline::Pipeline()
+    : FilterBank(id_name, _filter_counter),
+      _depth(2),
+      _running(false),
+      _backward(false),
+      _sequence(0)
+{
+    _filter_counter++;
+}
+
+Pipeline::~Pipeline()
+{
+    stop();
+    for (size_t i = 0; i < _stages.size(); i++) delete _stages[i];
+    for (size_t i = 0; i < _rings.size(); i++) delete _rings[i];
+    for (size_t i = 0; i < _frames.size(); i++) delete _frames[i];
+}
+
+int Pipeline::loadConfig(const boost::property_tree::ptree& pt,
+                         const std::string& confFile)
+{
+    if (pt.begin()->first != type()) {
+        // stage banks are loaded through FilterBank, pass the call up
+        return FilterBank::loadConfig(pt, confFile);
+    }
+
+    const boost::property_tree::ptree& self = pt.get_child(type());
+    name(self.get("name", name()));
+    updateConfig(self);
+
+    for (boost::property_tree::ptree::const_iterator it = self.begin();
+         it != self.end(); ++it) {
+        if (it->first != "stage") continue;
+
+        FilterBank* fb = static_cast<FilterBank*>(
+            FilterFactory::getInstance()->createFilter(FilterBank::id_name));
+        if (!fb) {
+            BOOST_LOG_TRIVIAL(error)
+                << id() << " could not create stage " << _stages.size();
+            return -1;
+        }
+        fb->bank(this);
+
+        // FilterBank::loadConfig expects the filters below a root node
+        boost::property_tree::ptree root;
+        root.add_child("toffy", it->second);
+        fb->loadConfig(root, confFile);
+        fb->name(name() + "_stage" + std::to_string(_stages.size()));
+
+        add(fb);  // book-keeping
+        _stages.push_back(new Stage(fb));
+    }
+
+    if (_stages.empty()) {
+        BOOST_LOG_TRIVIAL(warning) << id() << " no <stage> defined!";
+        return 0;
+    }
+    BOOST_LOG_TRIVIAL(info) << id() << " loaded " << _stages.size()
+                            << " stages, queue depth " << _depth;
+    return 1;
+}
+
+boost::property_tree::ptree Pipeline::getConfig() const
+{
+    boost::property_tree::ptree pt;
+
+    pt = Filter::getConfig();
+    pt.put("options.queue", _depth);
+
+    return pt;
+}
+
+void Pipeline::updateConfig(const boost::property_tree::ptree& pt)
+{
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id();
+
+    Filter::updateConfig(pt);
+
+    size_t depth = pt.get("options.queue", _depth);
+    if (depth != _depth && _running) {
+        BOOST_LOG_TRIVIAL(warning)
+            << id() << " queue depth changes only apply after a restart.";
+    }
+    _depth = depth > 0 ? depth : 1;
+}
+
+void Pipeline::init()
+{
+    if (!_frames.empty() || _stages.empty()) return;
+
+    // rings between the stages and towards filter() hold _depth frames,
+    // each stage may hold one more while working on it.
+    size_t numFrames = (_stages.size() + 1) * _depth + _stages.size();
+    for (size_t i = 0; i < numFrames; i++) {
+        _frames.push_back(new Frame());
+    }
+    _rings.push_back(new SpscRing<Job>(numFrames));  // free frames
+    for (size_t i = 0; i < _stages.size(); i++) {
+        _rings.push_back(new SpscRing<Job>(_depth));
+    }
+}
+
+void Pipeline::start()
+{
+    if (_running || _stages.empty()) return;
+    init();
+
+    _rings[0]->reset(_frames.size());
+    for (size_t i = 1; i < _rings.size(); i++) _rings[i]->reset(_depth);
+    for (size_t i = 0; i < _frames.size(); i++) {
+        _frames[i]->clearData();
+        Job job = {_frames[i], true, 0, 0};
+        _rings[0]->tryPush(job);
+    }
+
+    _running = true;
+    for (size_t i = 0; i < _stages.size(); i++) {
+        _stages[i]->thread =
+            boost::thread(boost::bind(&Pipeline::runStage, this, i));
+    }
+    Filter::start();
+}
+
+void Pipeline::stop()
+{
+    if (!_running) return;
+    _running = false;
+    for (size_t i = 0; i < _rings.size(); i++) _rings[i]->close();
+    for (size_t i = 0; i < _stages.size(); i++) {
+        if (_stages[i]->thread.joinable()) _stages[i]->thread.join();
+    }
+
+    boost::property_tree::ptree stats = getStats();
+    for (size_t i = 0; i < _stages.size(); i++) {
+        const boost::property_tree::ptree& s =
+            stats.get_child("stage." + std::to_string(i));
+        BOOST_LOG_TRIVIAL(info)
+            << id() << " stage " << i << " (" << s.get<string>("name")
+            << "): frames " << s.get<string>("frames") << ", failed "
+            << s.get<string>("failed") << ", busy avg/max "
+            << s.get<string>("busyAvgUs") << "/" << s.get<string>("busyMaxUs")
+            << " us, wait avg " << s.get<string>("waitAvgUs")
+            << " us, queue avg " << s.get<string>("queueAvg");
+    }
+    BOOST_LOG_TRIVIAL(info)
+        << id() << " latency avg/max " << stats.get<string>("latencyAvgUs")
+        << "/" << stats.get<string>("latencyMaxUs") << " us";
+    Filter::stop();
+}
+
+bool Pipeline::filter(const Frame& in, Frame& out)
+{
+    if (_stages.empty()) return false;
+    if (!_running) start();
+
+    _backward = in.optBool("backward", false);
+
+    Job job;
+    if (!_rings.back()->pop(job)) {
+        BOOST_LOG_TRIVIAL(debug) << id() << "::" << __FUNCTION__ << " stopped";
+        return false;
+    }
+
+    bool ok = job.ok;
+    if (ok) {
+        Frame prev;
+        prev.merge(out);
+        out.merge(*job.frame);
+        recycle(prev, *job.frame);
+        unsigned long long lat = nowUs() - job.startUs;
+        _delivered++;
+        _latencyUs += lat;
+        updateMax(_latencyMaxUs, lat);
+    }
+    // a failed frame was not handed out, it keeps its buffers.
+    _rings.front()->tryPush(job);
+
+    return ok;
+}
+
+void Pipeline::recycle(Frame& prev, Frame& frame)
+{
+    // The slots of frame now live in out as well. Give frame the Mats out
+    // held before instead, where nobody else refers to them any more, so
+    // the stages write the next frames into them as a sequential bank
+    // would. Mats out still shares, e.g. slots of the filters in front of
+    // the pipeline, are left alone.
+    std::vector<Frame::SlotInfo> fields;
+    prev.info(fields);
+    frame.clearData();
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i].dt != Frame::Mat) continue;
+        matPtr m = prev.getMatPtr(fields[i].key);
+        prev.removeData(fields[i].key);
+        if (m && m.use_count() == 1) frame.addData(fields[i].key, m);
+    }
+}
+
+void Pipeline::runStage(size_t i)
+{
+    Stage& stage = *_stages[i];
+    SpscRing<Job>& inRing = *_rings[i];
+    SpscRing<Job>& outRing = *_rings[i + 1];
+    Job job;
+
+    BOOST_LOG_TRIVIAL(debug) << id() << " stage " << i << " started";
+    Tracer::setThreadName(id() + " stage " + std::to_string(i));
+    while (_running) {
+        long long t0 = nowUs();
+        size_t queued = inRing.size();
+        if (!inRing.pop(job)) break;
+        long long t1 = nowUs();
+
+        if (i == 0) {
+            job.ok = true;
+            job.startUs = t1;
+            job.number = _sequence++;
+            if (_backward)
+                job.frame->addData("backward", true);
+            else
+                job.frame->removeData("backward");
+        }
+
+        if (job.ok) {
+            try {
+                Tracer::setFrame(job.number);
+                TraceScope trace(stage.bank->id());
+                job.ok = stage.bank->filter(*job.frame, *job.frame);
+            } catch (std::exception& e) {
+                BOOST_LOG_TRIVIAL(error) << id() << " stage " << i
+                                         << " exception: " << e.what();
+                job.ok = false;
+            }
+            if (!job.ok) stage.failed++;
+        }
+        long long t2 = nowUs();
+
+        stage.frames++;
+        stage.waitUs += t1 - t0;
+        stage.busyUs += t2 - t1;
+        updateMax(stage.busyMaxUs, t2 - t1);
+        stage.queueSum += queued;
+
+        if (!outRing.push(job)) break;
+    }
+    BOOST_LOG_TRIVIAL(debug) << id() << " stage " << i << " ends";
+}
+
+boost::property_tree::ptree Pipeline::getStats() const
+{
+    boost::property_tree::ptree pt;
+    for (size_t i = 0; i < _stages.size(); i++) {
+        const Stage& s = *_stages[i];
+        unsigned long long n = s.frames.load();
+        boost::property_tree::ptree st;
+        st.put("name", s.bank->name());
+        st.put("frames", n);
+        st.put("failed", s.failed.load());
+        st.put("busyAvgUs", n ? s.busyUs.load() / n : 0);
+        st.put("busyMaxUs", s.busyMaxUs.load());
+        st.put("waitAvgUs", n ? s.waitUs.load() / n : 0);
+        st.put("queueAvg", n ? double(s.queueSum.load()) / n : 0.0);
+        pt.put_child("stage." + std::to_string(i), st);
+    }
+    unsigned long long n = _delivered.load();
+    pt.put("frames", n);
+    pt.put("latencyAvgUs", n ? _latencyUs.load() / n : 0);
+    pt.put("latencyMaxUs", _latencyMaxUs.load());
+    return pt;
+}
@@ -0,0 +1,56 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+
+#include "toffy/pixelFilter.hpp"
+#include "toffy/workerPool.hpp"
+
+using namespace toffy;
+
+PixelFilter::PixelFilter(std::string type, std::size_t counter)
+    : Filter(type, counter), _tiled(false), _bandRows(0)
+{
+}
+
+boost::property_tree::ptree PixelFilter::getConfig() const
+{
+    boost::property_tree::ptree pt = Filter::getConfig();
+    pt.put("options.tiled", _tiled);
+    pt.put("options.bandRows", _bandRows);
+    return pt;
+}
+
+void PixelFilter::updateConfig(const boost::property_tree::ptree& pt)
+{
+    Filter::updateConfig(pt);
+    _tiled = pt.get<bool>("options.tiled", _tiled);
+    _bandRows = pt.get<int>("options.bandRows", _bandRows);
+}
+
+void PixelFilter::forEachBand(int rows, const BandTask& body) const
+{
+    if (rows <= 0) return;
+    if (!_tiled) {
+        body(0, rows);
+        return;
+    }
+    WorkerPool& pool = WorkerPool::shared();
+    size_t grain = _bandRows > 0 ? _bandRows
+                                 : std::max<size_t>(8, rows / (2 * pool.size()));
+    pool.parallelFor(0, rows, grain, [&body](size_t begin, size_t end) {
+        body((int)begin, (int)end);
+    });
+}
@@ -84,6 +84,11 @@ int Player::loadConfig(const std::string &configFile) {
         return -1;
     }
 
+    return loadConfig(pt, configFile);
+}
+
+int Player::loadConfig(const boost::property_tree::ptree &pt,
+                       const std::string &configFile) {
     loadPlugins(pt);
     return _controller.baseFilterBank->loadConfig(pt,configFile);
 }
@@ -0,0 +1,316 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/log/trivial.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "toffy/trace.hpp"
+
+using namespace toffy;
+
+typedef std::chrono::steady_clock Clock;
+
+std::atomic<bool> Tracer::_on(false);
+
+namespace {
+
+/**
+ * Events of a single thread. Each event takes two words: the timestamp in
+ * ns and frame << 32 | name << 8 | phase. Only the owning thread writes.
+ *
+ * The writer announces a slot in claimed before overwriting it and
+ * publishes it in head afterwards. A reader that saw a word of a newer
+ * event therefore sees the claim and can drop the slot.
+ */
+struct Ring {
+    Ring(uint32_t tid, size_t capacity)
+        : tid(tid),
+          mask(capacity - 1),
+          words(new std::atomic<uint64_t>[2 * capacity]),
+          claimed(0),
+          head(0)
+    {
+    }
+
+    uint32_t tid;
+    std::string name;  ///< track name, guarded by the registry mutex
+    size_t mask;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    std::atomic<uint64_t> claimed;  ///< events started
+    std::atomic<uint64_t> head;     ///< events completely written
+
+    void push(uint64_t ts, uint64_t info)
+    {
+        uint64_t i = head.load(std::memory_order_relaxed);
+        claimed.store(i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        size_t slot = 2 * (i & mask);
+        words[slot].store(ts, std::memory_order_relaxed);
+        words[slot + 1].store(info, std::memory_order_relaxed);
+        head.store(i + 1, std::memory_order_release);
+    }
+};
+
+struct TraceEvent {
+    uint64_t ts, info;
+};
+
+struct Registry {
+    Registry()
+        : eventsPerThread(1 << 16), nextTid(1), since(0), epoch(Clock::now())
+    {
+    }
+
+    boost::mutex mtx;
+    std::vector<std::shared_ptr<Ring> > rings;
+    std::vector<std::string> names;  ///< interned event names
+    std::unordered_map<std::string, uint32_t> ids;
+    size_t eventsPerThread;
+    uint32_t nextTid;
+    std::atomic<uint64_t> since;  ///< events before clear() are ignored
+    Clock::time_point epoch;
+};
+
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+thread_local std::shared_ptr<Ring> tlRing;
+thread_local std::string tlName;
+thread_local uint32_t tlFrame = 0;
+thread_local std::unordered_map<std::string, uint32_t> tlIds;
+
+/** rings of finished threads kept for the next dump */
+static const size_t maxRetired = 16;
+
+Ring* ring()
+{
+    if (!tlRing) {
+        Registry& r = registry();
+        boost::lock_guard<boost::mutex> lock(r.mtx);
+        // lanes are restarted with every run, forget the oldest threads
+        size_t retired = 0;
+        for (size_t i = r.rings.size(); i-- > 0;) {
+            if (r.rings[i].use_count() == 1 && ++retired > maxRetired) {
+                r.rings.erase(r.rings.begin() + i);
+            }
+        }
+        tlRing.reset(new Ring(r.nextTid++, r.eventsPerThread));
+        tlRing->name = tlName;
+        r.rings.push_back(tlRing);
+    }
+    return tlRing.get();
+}
+
+uint32_t intern(const std::string& name)
+{
+    std::unordered_map<std::string, uint32_t>::const_iterator it =
+        tlIds.find(name);
+    if (it != tlIds.end()) return it->second;
+
+    Registry& r = registry();
+    uint32_t id;
+    {
+        boost::lock_guard<boost::mutex> lock(r.mtx);
+        std::unordered_map<std::string, uint32_t>::const_iterator g =
+            r.ids.find(name);
+        if (g != r.ids.end()) {
+            id = g->second;
+        } else {
+            id = r.names.size();
+            r.names.push_back(name);
+            r.ids[name] = id;
+        }
+    }
+    tlIds[name] = id;
+    return id;
+}
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               Clock::now() - registry().epoch)
+        .count();
+}
+
+/** events of a ring that are still valid, oldest first */
+void collect(const Ring& ring, uint64_t since, std::vector<TraceEvent>& out)
+{
+    size_t capacity = ring.mask + 1;
+    uint64_t h = ring.head.load(std::memory_order_acquire);
+    uint64_t first = h > capacity ? h - capacity : 0;
+
+    std::vector<TraceEvent> events;
+    events.reserve(h - first);
+    for (uint64_t i = first; i < h; i++) {
+        size_t slot = 2 * (i & ring.mask);
+        TraceEvent e;
+        e.ts = ring.words[slot].load(std::memory_order_relaxed);
+        e.info = ring.words[slot + 1].load(std::memory_order_relaxed);
+        events.push_back(e);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t claimed = ring.claimed.load(std::memory_order_relaxed);
+    // slots claimed by the writer meanwhile may hold newer data
+    uint64_t valid = claimed > capacity ? claimed - capacity : 0;
+
+    for (uint64_t i = std::max(first, valid); i < h; i++) {
+        const TraceEvent& e = events[i - first];
+        if (e.ts >= since) out.push_back(e);
+    }
+}
+
+void writeString(FILE* f, const std::string& s)
+{
+    fputc('"', f);
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+}  // namespace
+
+void Tracer::enable(size_t eventsPerThread)
+{
+    Registry& r = registry();
+    {
+        boost::lock_guard<boost::mutex> lock(r.mtx);
+        size_t capacity = 16;
+        while (capacity < eventsPerThread) capacity <<= 1;
+        r.eventsPerThread = capacity;
+    }
+    _on.store(true);
+}
+
+void Tracer::disable() { _on.store(false); }
+
+void Tracer::clear() { registry().since.store(now()); }
+
+void Tracer::record(const std::string& name, char phase)
+{
+    Ring* r = ring();
+    uint64_t info = (uint64_t)tlFrame << 32 |
+                    (uint64_t)(intern(name) & 0xffffff) << 8 |
+                    (uint8_t)phase;
+    r->push(now(), info);
+}
+
+void Tracer::setFrame(uint32_t frame) { tlFrame = frame; }
+
+void Tracer::setThreadName(const std::string& name)
+{
+    tlName = name;
+    if (tlRing) {
+        boost::lock_guard<boost::mutex> lock(registry().mtx);
+        tlRing->name = name;
+    }
+}
+
+size_t Tracer::size()
+{
+    Registry& r = registry();
+    std::vector<std::shared_ptr<Ring> > rings;
+    {
+        boost::lock_guard<boost::mutex> lock(r.mtx);
+        rings = r.rings;
+    }
+    size_t n = 0;
+    std::vector<TraceEvent> events;
+    for (size_t i = 0; i < rings.size(); i++) {
+        events.clear();
+        collect(*rings[i], r.since.load(), events);
+        n += events.size();
+    }
+    return n;
+}
+
+bool Tracer::saveChromeTrace(const std::string& fileName)
+{
+    Registry& r = registry();
+    std::vector<std::shared_ptr<Ring> > rings;
+    std::vector<std::string> threadNames, names;
+    {
+        boost::lock_guard<boost::mutex> lock(r.mtx);
+        rings = r.rings;
+        names = r.names;
+        for (size_t i = 0; i < rings.size(); i++) {
+            threadNames.push_back(rings[i]->name);
+        }
+    }
+
+    FILE* f = fopen(fileName.c_str(), "w");
+    if (!f) {
+        BOOST_LOG_TRIVIAL(warning) << "Could not write trace: " << fileName;
+        return false;
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    size_t count = 0;
+    std::vector<TraceEvent> events;
+    for (size_t t = 0; t < rings.size(); t++) {
+        unsigned tid = rings[t]->tid;
+        if (!threadNames[t].empty()) {
+            fprintf(f,
+                    "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",", tid);
+            writeString(f, threadNames[t]);
+            fprintf(f, "}}");
+            first = false;
+        }
+
+        events.clear();
+        collect(*rings[t], r.since.load(), events);
+        for (size_t i = 0; i < events.size(); i++) {
+            const TraceEvent& e = events[i];
+            uint32_t name = (e.info >> 8) & 0xffffff;
+            char phase = (char)(e.info & 0xff);
+            fprintf(f, "%s\n{\"name\":", first ? "" : ",");
+            writeString(f, name < names.size() ? names[name] : "?");
+            fprintf(f,
+                    ",\"ph\":\"%c\",%s\"ts\":%llu.%03u,\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"frame\":%u}}",
+                    phase, phase == 'i' ? "\"s\":\"t\"," : "",
+                    (unsigned long long)(e.ts / 1000),
+                    (unsigned)(e.ts % 1000), tid, (unsigned)(e.info >> 32));
+            first = false;
+        }
+        count += events.size();
+    }
+    fprintf(f, "\n]}\n");
+    bool ok = fclose(f) == 0;
+    BOOST_LOG_TRIVIAL(info) << "Wrote " << count << " trace events of "
+                            << rings.size() << " threads to " << fileName;
+    return ok;
+}
@@ -0,0 +1,316 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <memory>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <boost/log/trivial.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "toffy/trace.hpp"
+#include "toffy/workerPool.hpp"
+
+using namespace toffy;
+
+namespace {
+
+thread_local WorkerPool* tlPool = NULL;  ///< pool of the current worker
+thread_local size_t tlWorker = 0;        ///< its index there
+thread_local int tlDepth = 0;  ///< tasks running on the worker, nested ones too
+
+boost::mutex sharedMtx;
+WorkerPool* sharedPool = NULL;
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/** state of one parallelFor(), shared with the helper tasks */
+struct Loop {
+    std::atomic<size_t> next{0};  ///< next chunk to take
+    std::atomic<size_t> done{0};  ///< chunks finished
+    std::atomic<bool> failed{false};
+    size_t chunks, begin, end, grain;
+    const WorkerPool::RangeTask* body;  ///< valid until all chunks are done
+    boost::mutex mtx;
+    boost::condition_variable cond;
+    std::exception_ptr error;
+};
+
+void runChunks(const std::shared_ptr<Loop>& loop)
+{
+    for (;;) {
+        size_t c = loop->next++;
+        if (c >= loop->chunks) return;
+        if (!loop->failed) {
+            size_t b = loop->begin + c * loop->grain;
+            size_t e = std::min(loop->end, b + loop->grain);
+            try {
+                (*loop->body)(b, e);
+            } catch (...) {
+                boost::lock_guard<boost::mutex> lock(loop->mtx);
+                if (!loop->error) loop->error = std::current_exception();
+                loop->failed = true;
+            }
+        }
+        if (++loop->done == loop->chunks) {
+            boost::lock_guard<boost::mutex> lock(loop->mtx);
+            loop->cond.notify_all();
+        }
+    }
+}
+
+}  // namespace
+
+WorkerPool::WorkerPool(size_t threads, const std::vector<int>& cpus)
+    : _pending(0), _next(0), _stop(false), _statsSince(nowNs())
+{
+    if (!threads) threads = std::max(1u, boost::thread::hardware_concurrency());
+    for (size_t i = 0; i < threads; i++) {
+        Worker* w = new Worker;
+        w->cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        _workers.push_back(w);
+    }
+}
+
+void WorkerPool::start()
+{
+    // all queues exist before the first worker looks for work
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->thread = boost::thread(&WorkerPool::run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _cond.notify_all();
+    for (size_t i = 0; i < _workers.size(); i++) {
+        if (_workers[i]->thread.joinable()) _workers[i]->thread.join();
+    }
+    for (size_t i = 0; i < _workers.size(); i++) delete _workers[i];
+}
+
+void WorkerPool::submit(const Task& task)
+{
+    std::call_once(_started, &WorkerPool::start, this);
+    Worker* w = tlPool == this ? _workers[tlWorker]
+                               : _workers[_next++ % _workers.size()];
+    {
+        boost::lock_guard<boost::mutex> lock(w->mtx);
+        w->tasks.push_back(task);
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        _pending++;
+    }
+    _cond.notify_one();
+}
+
+void WorkerPool::parallelFor(size_t begin, size_t end, size_t grain,
+                             const RangeTask& body)
+{
+    if (end <= begin) return;
+    const size_t n = end - begin;
+    if (!grain) grain = std::max<size_t>(1, n / (4 * _workers.size()));
+    const size_t chunks = (n + grain - 1) / grain;
+    if (chunks == 1) {
+        body(begin, end);
+        return;
+    }
+
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+    loop->chunks = chunks;
+    loop->begin = begin;
+    loop->end = end;
+    loop->grain = grain;
+    loop->body = &body;
+    // helpers starting after all chunks are taken return right away
+    size_t helpers = std::min(chunks - 1, _workers.size());
+    for (size_t i = 0; i < helpers; i++) {
+        submit(std::bind(&runChunks, loop));
+    }
+    runChunks(loop);
+
+    boost::unique_lock<boost::mutex> lock(loop->mtx);
+    while (loop->done < chunks) loop->cond.wait(lock);
+    if (loop->error) std::rethrow_exception(loop->error);
+}
+
+bool WorkerPool::runPending()
+{
+    if (tlPool != this) return false;
+    Task task;
+    if (!take(tlWorker, task)) return false;
+    execute(tlWorker, task);
+    return true;
+}
+
+bool WorkerPool::inWorker() const { return tlPool == this; }
+
+bool WorkerPool::take(size_t self, Task& task)
+{
+    const size_t n = _workers.size();
+    for (size_t k = 0; k < n; k++) {
+        Worker* w = _workers[(self + k) % n];
+        boost::lock_guard<boost::mutex> lock(w->mtx);
+        if (w->tasks.empty()) continue;
+        if (!k) {
+            task.swap(w->tasks.back());
+            w->tasks.pop_back();
+        } else {
+            task.swap(w->tasks.front());
+            w->tasks.pop_front();
+            _workers[self]->steals++;
+        }
+        _pending--;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::run(size_t self)
+{
+    Worker* w = _workers[self];
+    tlPool = this;
+    tlWorker = self;
+    Tracer::setThreadName("worker " + std::to_string(self));
+    if (w->cpu >= 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            BOOST_LOG_TRIVIAL(warning) << "WorkerPool: cannot pin worker "
+                                       << self << " to cpu " << w->cpu;
+            w->cpu = -1;
+        }
+#else
+        BOOST_LOG_TRIVIAL(warning)
+            << "WorkerPool: cpu affinity not supported on this platform";
+        w->cpu = -1;
+#endif
+    }
+
+    Task task;
+    for (;;) {
+        if (take(self, task)) {
+            execute(self, task);
+            continue;
+        }
+        boost::unique_lock<boost::mutex> lock(_mtx);
+        if (_pending) {
+            // taken by another worker or not counted yet, look again
+            lock.unlock();
+            boost::this_thread::yield();
+            continue;
+        }
+        if (_stop) return;  // stopped and drained
+        _cond.wait(lock);
+    }
+}
+
+void WorkerPool::execute(size_t self, Task& task)
+{
+    Worker* w = _workers[self];
+    int64_t start = nowNs();
+    tlDepth++;
+    try {
+        task();
+    } catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "WorkerPool: task failed, " << e.what();
+    } catch (...) {
+        BOOST_LOG_TRIVIAL(error) << "WorkerPool: task failed";
+    }
+    task = Task();  // release what the task holds
+    // the time of a nested task is already part of the one it ran in
+    if (!--tlDepth) w->busyNs += nowNs() - start;
+    w->executed++;
+}
+
+std::vector<WorkerPool::WorkerStats> WorkerPool::stats() const
+{
+    double elapsed = (double)(nowNs() - _statsSince);
+    std::vector<WorkerStats> s(_workers.size());
+    for (size_t i = 0; i < _workers.size(); i++) {
+        const Worker* w = _workers[i];
+        s[i].cpu = w->cpu;
+        s[i].tasks = w->executed;
+        s[i].steals = w->steals;
+        s[i].utilization =
+            elapsed > 0 ? std::min(1., w->busyNs / elapsed) : 0.;
+    }
+    return s;
+}
+
+boost::property_tree::ptree WorkerPool::getStats() const
+{
+    boost::property_tree::ptree pt, workers;
+    std::vector<WorkerStats> s = stats();
+    double total = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        boost::property_tree::ptree w;
+        w.put("cpu", s[i].cpu);
+        w.put("tasks", s[i].tasks);
+        w.put("steals", s[i].steals);
+        w.put("utilization", s[i].utilization);
+        workers.push_back(std::make_pair(std::to_string(i), w));
+        total += s[i].utilization;
+    }
+    pt.put("threads", s.size());
+    pt.put("queued", _pending.load());
+    pt.put("utilization", s.empty() ? 0. : total / s.size());
+    pt.add_child("workers", workers);
+    return pt;
+}
+
+void WorkerPool::resetStats()
+{
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->executed = 0;
+        _workers[i]->steals = 0;
+        _workers[i]->busyNs = 0;
+    }
+    _statsSince = nowNs();
+}
+
+WorkerPool& WorkerPool::shared()
+{
+    static std::unique_ptr<WorkerPool> fallback;
+    boost::lock_guard<boost::mutex> lock(sharedMtx);
+    if (sharedPool) return *sharedPool;
+    if (!fallback) fallback.reset(new WorkerPool());
+    return *fallback;
+}
+
+void WorkerPool::setShared(WorkerPool* pool)
+{
+    boost::lock_guard<boost::mutex> lock(sharedMtx);
+    sharedPool = pool;
+}
@@ -16,7 +16,7 @@
 */
 #pragma once
 
-#include "toffy/filter.hpp"
+#include "toffy/pixelFilter.hpp"
 
 namespace toffy {
 namespace filters {
@@ -28,7 +28,7 @@ namespace filters {
  * For detailled information see \ref amplitudeRange_page description page
  *
  */
-class AmplitudeRange : public Filter {
+class AmplitudeRange : public PixelFilter {
 public:
     static const std::string id_name; ///< Filter identifier
 
@@ -36,16 +36,35 @@ public:
     virtual ~AmplitudeRange() {}
 
     virtual boost::property_tree::ptree getConfig() const;
+    virtual bool declaresSlots() const { return true; }
     virtual void updateConfig(const boost::property_tree::ptree &pt);
 
     virtual bool filter(const Frame& in, Frame& out);
+
+    virtual bool fusible(FusedPlanes& planes) const;
+    virtual bool fusedBegin(const cv::Mat& depth, const cv::Mat* ampl,
+                            Frame& out);
+    virtual void fusedRow(int y, float* depth, float* ampl, int cols) const;
 private:
     std::string _in_ampl,
 	_in_depth,
 	_out_ampl,
-	_out_depth;
+	_out_depth,
+	_mask; ///< 255 where the amplitude is in range
+    SlotKey _in_ampl_key,
+	_in_depth_key,
+	_out_ampl_key,
+	_out_depth_key,
+	_mask_key;
     double _minAmpl,
-	_maxAmpl;
+	_maxAmpl,
+	_fusedMin, ///< _minAmpl as compared with the amplitude type
+	_fusedMax;
+    matPtr _fusedMask; ///< mask written by fusedRow()
+
+    /** copy of src in the Mat of the output slot key, or a new one */
+    matPtr output(const cv::Mat& src, const SlotKey& key,
+                  const Frame& out) const;
     static std::size_t _filter_counter;
 };
 }
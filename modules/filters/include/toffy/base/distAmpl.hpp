@@ -20,7 +20,7 @@
 #include <boost/filesystem.hpp>
 
 #include <string>
-#include <toffy/filter.hpp>
+#include <toffy/pixelFilter.hpp>
 
 
 namespace toffy {
@@ -31,7 +31,7 @@ namespace filters {
  * @ingroup Filters
  *
  */
-class DistAmpl: public toffy::Filter{
+class DistAmpl: public toffy::PixelFilter{
     // linear interpolation breakpoints and coefficients
     float *breaks,
 	*coeffs;
@@ -57,10 +57,15 @@ public:
     virtual boost::property_tree::ptree getConfig() const;
     virtual void updateConfig(const boost::property_tree::ptree &pt);
 
+    virtual bool fusible(FusedPlanes& planes) const;
+    virtual bool fusedBegin(const cv::Mat& depth, const cv::Mat* ampl,
+			    toffy::Frame& out);
+    virtual void fusedRow(int y, float* depth, float* ampl, int cols) const;
+
 private:
     virtual bool f1(const toffy::Frame& in, toffy::Frame& /*out*/);
 
-    float linearInterp(int measuredAmpl)
+    float linearInterp(int measuredAmpl) const
     {
 	int i=1;
 	while ( measuredAmpl < breaks[i] && i<blen ) {
@@ -16,7 +16,7 @@
 */
 #pragma once
 
-#include <toffy/filter.hpp>
+#include <toffy/pixelFilter.hpp>
 
 #include <opencv2/core.hpp>
 
@@ -27,7 +27,7 @@
 namespace toffy {
 namespace filters {
 
-class OffSet : public Filter
+class OffSet : public PixelFilter
 {
     std::vector<cv::Rect> _rois;
     float _sumValue, _mulValue;
@@ -43,6 +43,7 @@ class OffSet : public Filter
 
     //virtual int loadConfig(const boost::property_tree::ptree& pt);
     virtual boost::property_tree::ptree getConfig() const;
+    virtual bool declaresSlots() const { return true; }
     virtual void updateConfig(const boost::property_tree::ptree& pt);
 
     virtual bool filter(const Frame& in, Frame& out) const;
@@ -16,7 +16,7 @@
 */
 #pragma once
 
-#include <toffy/filter.hpp>
+#include <toffy/pixelFilter.hpp>
 
 #include <opencv2/core.hpp>
 
@@ -27,11 +27,15 @@ namespace filters {
  * using the camera lens fov
  * @ingroup Filters
  *
+ * The per pixel correction factors only depend on the image size and the
+ * field of view. They are kept in a map that is rebuilt when one of them
+ * (or the configuration) changes, each frame is a single multiply.
+ *
  * \section ex1 Xml Configuration
  * @include polar2cart.xml
  *
  */
-class Polar2Cart : public Filter
+class Polar2Cart : public PixelFilter
 {
    public:
     static const std::string id_name;  ///< Filter identifier
@@ -39,15 +43,31 @@ class Polar2Cart : public Filter
     virtual ~Polar2Cart() {}
 
     virtual boost::property_tree::ptree getConfig() const;
+    virtual bool declaresSlots() const { return true; }
     void updateConfig(const boost::property_tree::ptree& pt);
 
     virtual bool filter(const Frame& in, Frame& out);
 
+    /**
+     * @brief Multiplies the valid distances (0 < d < 65) with the
+     * correction map, copies the others
+     * @param src input distances
+     * @param lut correction factors
+     * @param dst output, may be src
+     * @param n number of pixels
+     */
+    static void applyLut(const float* src, const float* lut, float* dst,
+                         size_t n);
+
    private:
     double _fovx, _fovy;
+    double _lutFovx, _lutFovy;  ///< fov _lut was built for
     std::string _in_img, _out_img, _in_fovx, _in_fovy;
     cv::Mat _cameraMatrix;
+    cv::Mat _lut;  ///< cos(h) * cos(v) per pixel, CV_32F
     static std::size_t _filter_counter;
+
+    void updateLut(const cv::Size& size);
 };
 }  // namespace filters
 }  // namespace toffy
@@ -16,7 +16,7 @@
 */
 #pragma once
 
-#include "toffy/filter.hpp"
+#include "toffy/pixelFilter.hpp"
 
 /**
  * @brief
@@ -24,9 +24,10 @@
  */
 namespace toffy {
  namespace filters {
-	class Range : public Filter {
+	class Range : public PixelFilter {
 
 		std::string _in_img, _out_img;
+		SlotKey _in_key, _out_key;
 		double _min, _max;
 		static std::size_t _filter_counter;
 	 public:
@@ -37,9 +38,16 @@ namespace toffy {
 		//virtual int loadConfig(const boost::property_tree::ptree& pt);
 
 		virtual boost::property_tree::ptree getConfig() const;
+		virtual bool declaresSlots() const { return true; }
 		void updateConfig(const boost::property_tree::ptree &pt);
 
 		virtual bool filter(const Frame& in, Frame& out);
+
+		virtual bool fusible(FusedPlanes& planes) const;
+		virtual bool fusedBegin(const cv::Mat& depth, const cv::Mat* ampl,
+					Frame& out);
+		virtual void fusedRow(int y, float* depth, float* ampl,
+				      int cols) const;
 	};
  }
 }
@@ -16,7 +16,7 @@
 */
 #pragma once
 
-#include <toffy/filter.hpp>
+#include <toffy/pixelFilter.hpp>
 
 #include <opencv2/core.hpp>
 
@@ -30,7 +30,7 @@ namespace filters {
  * For detailled information see \ref roi_page description page
  *
  */
-class Roi : public Filter
+class Roi : public PixelFilter
 {
    public:
     static const std::string id_name;  ///< Filter identifier
@@ -39,10 +39,16 @@ class Roi : public Filter
     virtual ~Roi() {}
 
     virtual boost::property_tree::ptree getConfig() const;
+    virtual bool declaresSlots() const { return true; }
     virtual void updateConfig(const boost::property_tree::ptree& pt);
 
     virtual bool filter(const Frame& in, Frame& out);
 
+    virtual bool fusible(FusedPlanes& planes) const;
+    virtual bool fusedBegin(const cv::Mat& depth, const cv::Mat* ampl,
+                            Frame& out);
+    virtual void fusedRow(int y, float* depth, float* ampl, int cols) const;
+
    private:
     std::string _in_img,  ///< Input image name
         _out_img;         ///< Output filtered image name
@@ -59,6 +65,10 @@ class Roi : public Filter
 		well be check */
     static std::size_t _filter_counter;  ///< Internal filter counter
     cv::Rect _roi;                       ///< OpenCV rectangle defining the roi
+    bool _fusedApply;  ///< the roi fits the image of the fused pass
+
+    /** @brief The roi is set and inside an image of @p size, logs if not */
+    bool applies(const cv::Size& size) const;
 };
 }  // namespace filters
 }  // namespace toffy
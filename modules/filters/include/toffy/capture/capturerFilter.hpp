@@ -52,7 +52,8 @@ class /*DLLExport*/ TOFFY_EXPORT CapturerFilter : public Filter
     //Sensor *sensor;
     int _cnt,               ///< counter for load and save
         _beginFile,         ///< start frame for playback frames
-        _endFile;           ///< last frame playback
+        _endFile,           ///< last frame playback
+        _prefetch;          ///< frames read ahead in playback, 0 = off
     std::string _loadPath,  ///< Folder or file to load frames
         _savePath,          ///<File prefix or file name
         _saveFolder;        ///< Extra folder path where to save frames
@@ -297,6 +298,21 @@ class /*DLLExport*/ TOFFY_EXPORT CapturerFilter : public Filter
      */
     void endFile(int endFile) { _endFile = endFile; }
 
+    /**
+     * @brief Getter prefetch
+     * @return Number of playback frames read ahead on a background
+     * thread, 0 if frames are loaded in filter()
+     *
+     * @see Prefetcher
+     */
+    int prefetch() const { return _prefetch; }
+
+    /**
+     * @brief Setter prefetch
+     * @param prefetch
+     */
+    void prefetch(int prefetch) { _prefetch = prefetch; }
+
     /**
      * @brief Getter flip
      * @return bool
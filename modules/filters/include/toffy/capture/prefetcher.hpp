@@ -0,0 +1,239 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <utility>
+
+#include <boost/log/trivial.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace toffy {
+namespace capturers {
+
+/**
+ * @brief Playback frame number following @p i, wrapping around at
+ * @p begin and @p end
+ */
+inline int playbackStep(int i, bool backward, int begin, int end)
+{
+    if (backward) return i <= begin ? end : i - 1;
+    return i >= end ? begin : i + 1;
+}
+
+/**
+ * @brief Reads the next playback frames ahead on a background thread
+ * @ingroup Capturers
+ *
+ * Playback capturers number their frames from begin to end. The
+ * prefetcher decodes the frames following the last one handed out, in
+ * playback direction and wrapping around at begin and end, until depth
+ * frames are waiting. next() then only takes the oldest one, so loading
+ * and the filters after the capturer run in parallel.
+ *
+ * Changing the direction or seeking drops the frames read so far; a
+ * decode still running for them is thrown away.
+ *
+ * @p T is whatever the decoder returns for a frame number, e.g. a shared
+ * pointer to the loaded data. A default constructed T marks a frame that
+ * could not be loaded.
+ */
+template <typename T>
+class Prefetcher
+{
+   public:
+    typedef std::function<T(int)> Decoder;
+
+    explicit Prefetcher(size_t depth = 4)
+        : _depth(depth ? depth : 1),
+          _begin(0),
+          _end(0),
+          _pos(0),
+          _tail(0),
+          _backward(false),
+          _generation(0),
+          _running(false),
+          _ready(0),
+          _waited(0)
+    {
+    }
+
+    ~Prefetcher() { stop(); }
+
+    /**
+     * @brief Start reading after frame @p pos
+     * @param decode loads a frame, called on the prefetch thread
+     * @param begin, end first and last frame number
+     * @param pos last frame handed out, the next one is read first
+     */
+    void start(const Decoder& decode, int begin, int end, int pos)
+    {
+        stop();
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        _decode = decode;
+        _begin = begin;
+        _end = end;
+        _pos = _tail = pos;
+        _queue.clear();
+        _generation++;
+        _running = true;
+        _thread = boost::thread(&Prefetcher::run, this);
+    }
+
+    void stop()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(_mtx);
+            if (!_running) return;
+            _running = false;
+            _queue.clear();
+        }
+        _cond.notify_all();
+        _thread.join();
+    }
+
+    bool running() const
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        return _running;
+    }
+
+    /**
+     * @brief Frame after the last one handed out, waits until it is read
+     * @param backward playback direction
+     * @param[out] index its number
+     */
+    T next(bool backward, int& index)
+    {
+        boost::unique_lock<boost::mutex> lock(_mtx);
+        if (!_running) {
+            index = _pos;
+            return T();
+        }
+        if (backward != _backward) {
+            _backward = backward;
+            flush();
+        }
+        if (_queue.empty()) {
+            _waited++;
+            while (_queue.empty() && _running) _cond.wait(lock);
+            if (!_running) {
+                index = _pos;
+                return T();
+            }
+        } else {
+            _ready++;
+        }
+        std::pair<int, T> f = _queue.front();
+        _queue.pop_front();
+        _pos = f.first;
+        _cond.notify_all();
+        index = f.first;
+        return f.second;
+    }
+
+    /** @brief Continue after frame @p pos */
+    void seek(int pos)
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        _pos = pos;
+        flush();
+    }
+
+    /** @brief Last frame handed out */
+    int position() const
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        return _pos;
+    }
+
+    size_t depth() const { return _depth; }
+
+    /** @brief Calls of next() served without waiting */
+    unsigned long ready() const
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        return _ready;
+    }
+
+    /** @brief Calls of next() that had to wait for the decoder */
+    unsigned long waited() const
+    {
+        boost::lock_guard<boost::mutex> lock(_mtx);
+        return _waited;
+    }
+
+   private:
+    const size_t _depth;
+    Decoder _decode;
+    int _begin, _end;
+    int _pos,   ///< last frame handed out
+        _tail;  ///< last frame queued
+    bool _backward;
+    unsigned int _generation;  ///< incremented with every flush
+    bool _running;
+    unsigned long _ready, _waited;
+    std::deque<std::pair<int, T> > _queue;
+
+    mutable boost::mutex _mtx;
+    boost::condition_variable _cond;
+    boost::thread _thread;
+
+    Prefetcher(const Prefetcher&);
+    Prefetcher& operator=(const Prefetcher&);
+
+    /** drop the queue, called with the lock held */
+    void flush()
+    {
+        _queue.clear();
+        _tail = _pos;
+        _generation++;
+        _cond.notify_all();
+    }
+
+    void run()
+    {
+        boost::unique_lock<boost::mutex> lock(_mtx);
+        while (_running) {
+            if (_queue.size() >= _depth) {
+                _cond.wait(lock);
+                continue;
+            }
+            int i = playbackStep(_tail, _backward, _begin, _end);
+            unsigned int generation = _generation;
+            lock.unlock();
+            T frame = T();
+            try {
+                frame = _decode(i);
+            } catch (const std::exception& e) {
+                BOOST_LOG_TRIVIAL(warning)
+                    << "Could not prefetch frame " << i << ": " << e.what();
+            }
+            lock.lock();
+            if (generation != _generation) continue;  // flushed meanwhile
+            _queue.push_back(std::make_pair(i, frame));
+            _tail = i;
+            _cond.notify_all();
+        }
+    }
+};
+
+}  // namespace capturers
+}  // namespace toffy
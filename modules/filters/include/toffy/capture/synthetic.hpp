@@ -0,0 +1,143 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <toffy/capture/capturerFilter.hpp>
+
+namespace toffy {
+namespace capturers {
+
+/**
+ * @brief Renders a synthetic ToF scene instead of reading a camera
+ * @ingroup Capturers
+ *
+ * A camera looks straight down onto a floor. Boxes and people-sized blobs
+ * move across the field of view on straight paths and wrap around at the
+ * borders. Every frame gets gaussian depth noise and randomly dropped
+ * pixels, set to 0 or NaN.
+ *
+ * The scene is a function of the seed and the frame counter only: frame
+ * n is the same on every run and machine, whatever was rendered before.
+ * With options.loop set the content repeats after that many frames, which
+ * are rendered once and then copied, so that the capturer costs little in
+ * benchmarks.
+ *
+ * The outputs match the Bta capturer: depth in m (CV_32F) and amplitudes
+ * (CV_16U) for the distAmp mode, x/y/z in mm (CV_16S) for xyz, all of
+ * them for xyzAmp, plus fc, ts, mf, it and the temperatures.
+ */
+class TOFFY_EXPORT SyntheticCapturer : public CapturerFilter
+{
+   public:
+    static const std::string id_name;  ///< Filter identifier
+
+    SyntheticCapturer();
+
+    virtual ~SyntheticCapturer() {}
+
+    virtual boost::property_tree::ptree getConfig() const;
+
+    virtual void updateConfig(const boost::property_tree::ptree &pt);
+
+    virtual bool filter(const Frame &in, Frame &out);
+
+    virtual int connect();
+    virtual int disconnect();
+    virtual bool isConnected() { return _connected; }
+
+    virtual bool playback() const { return true; }
+
+    /** @brief Nothing to load, always succeeds */
+    virtual int loadPath(const std::string &) { return 1; }
+
+    /**
+     * @brief Render frame @p fc into @p out, without pacing or counting
+     *
+     * filter() renders the next frame counter through this.
+     */
+    void render(unsigned int fc, Frame &out);
+
+    /** @brief Frame counter of the next frame */
+    unsigned int nextFc() const { return _fc; }
+
+    /** @brief Continue with frame @p fc */
+    void seek(unsigned int fc) { _fc = fc; }
+
+    static Filter *creator() { return new SyntheticCapturer(); }
+
+   private:
+    /** a box or a person, in floor coordinates (m) */
+    struct Object {
+        float x0, y0,  ///< position at frame 0
+            vx, vy,    ///< speed in m/s
+            a, b,      ///< half size, radii for people
+            h,         ///< height
+            refl;      ///< reflectivity
+        bool person;
+    };
+
+    int _width, _height;
+    double _fps;
+    bool _realtime;
+    std::string _mode;  ///< distAmp, xyz or xyzAmp
+    uint32_t _seed;
+    float _fovx, _fovy,  ///< degrees
+        _ground,         ///< distance to the floor in m
+        _speed,          ///< maximum object speed in m/s
+        _noise,          ///< depth noise sigma in m
+        _dropout,        ///< fraction of invalid pixels
+        _amplitude;      ///< amplitude of a white surface at 1 m
+    int _boxes, _people;
+    int _loop;  ///< content repeats after this many frames, 0 = never
+    bool _nanDropout;
+    unsigned int _modFreq, _intTime;
+
+    std::string _out_depth, _out_ampl, _out_x, _out_y, _out_z, _out_fc,
+        _out_ts, _out_mf, _out_it, _out_mt, _out_lt, _out_gt;
+
+    unsigned int _fc;
+    bool _connected;
+    boost::posix_time::ptime _next;  ///< due time of the next frame
+
+    // scene, rebuilt when the config changes
+    bool _dirty;
+    std::vector<Object> _objects;
+    float _fx, _fy, _cx, _cy;   ///< pinhole model from the fov
+    float _halfX, _halfY;       ///< objects wrap around at +-half
+    std::vector<float> _u,      ///< ray x per column at z = 1
+        _v,                     ///< ray y per row at z = 1
+        _k;                     ///< ray length per unit z, per pixel
+    std::vector<float> _z,      ///< z of the nearest surface per pixel
+        _refl;                  ///< reflectivity per pixel
+    std::vector<float> _lo, _hi;  ///< z range of a box per column
+    /** rendered depth, ampl, x, y, z per frame of the loop */
+    std::vector<std::vector<cv::Mat> > _cache;
+
+    static const int outputCount = 5;
+
+    void build();
+    void draw(unsigned int fc, const matPtr *all);
+    void drawObject(const Object &o, float t);
+    matPtr output(Frame &out, const std::string &key, int type);
+};
+
+}  // namespace capturers
+}  // namespace toffy
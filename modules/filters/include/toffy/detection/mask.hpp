@@ -25,6 +25,9 @@
  *
  */
 namespace toffy {
+namespace cam {
+class RayMap;
+}
 namespace detection {
 /**
  * @brief A try of base class for all kind of detector.
@@ -51,12 +54,14 @@ public:
 
     //virtual int loadConfig(const boost::property_tree::ptree& pt);
     virtual boost::property_tree::ptree getConfig() const;
+    virtual bool declaresSlots() const { return true; }
     void updateConfig(const boost::property_tree::ptree &pt);
 
     virtual bool filter(const Frame& in, Frame& out);
 
 
     matPtr depth, ampl, proj2d, fground, new_mask, img3d, _cameraMatrix;
+    std::shared_ptr<const cam::RayMap> _rays;  ///< rays of _cameraMatrix
     double maxSizeX , maxSizeY, fovx, fovy;
     double _dis, _apertureWidth, _apertureHeight;
     int _scale;
@@ -0,0 +1,64 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#include <toffy/toffy_export.h>
+
+namespace toffy {
+/**
+ * @brief Reading and writing single channel images as csv text
+ *
+ * One line per image row, every value followed by a ';', as ExportCSV
+ * writes and CSVSource reads them. Numbers are formatted like an ostream
+ * does, floats with 6 significant digits ("%g"), but without going through
+ * iostreams or printf per pixel. Reading parses the mapped file in place,
+ * on MSVC a copy read through the file stream.
+ */
+namespace csv {
+
+/**
+ * @brief Append the csv text of @p mat to @p out
+ * @return false for types other than 8U, 16U, 16S, 32S, 32F and 64F with
+ * one channel
+ */
+TOFFY_EXPORT bool format(const cv::Mat &mat, std::string &out);
+
+/** @brief Write @p mat to the file @p path, in blocks */
+TOFFY_EXPORT bool write(const std::string &path, const cv::Mat &mat);
+
+/**
+ * @brief Parse the values in [@p begin, @p end) into @p mat, row by row
+ *
+ * @p mat has to be allocated with the expected size and type. Values are
+ * separated by ';', ',' or white space, integers are saturated to the mat
+ * type. Pixels without a value are left untouched.
+ *
+ * @return number of values read
+ */
+TOFFY_EXPORT size_t parse(const char *begin, const char *end, cv::Mat &mat);
+
+/**
+ * @brief Read the file @p path into @p mat
+ * @return number of values read, 0 if the file could not be opened
+ */
+TOFFY_EXPORT size_t read(const std::string &path, cv::Mat &mat);
+
+}  // namespace csv
+}  // namespace toffy
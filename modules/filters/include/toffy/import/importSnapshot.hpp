@@ -0,0 +1,58 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <string>
+
+#include "toffy/filter.hpp"
+
+namespace toffy {
+namespace import {
+
+/**
+ * @brief Play back snapshot files written by exportSnapshot
+ *
+ * Loads %path/%prefix_%04d.tfs with a counter going up from options.start,
+ * like importYaml: all stored slots except the file counter, fc (0 if
+ * missing) and ts (the counter if missing). When a file is missing the
+ * counter goes back to start, so a dump plays in a loop; if the start
+ * file is missing filter() fails.
+ */
+class ImportSnapshot : public Filter
+{
+    static std::size_t _filter_counter;
+
+   public:
+    static const std::string id_name;
+
+    ImportSnapshot();
+    virtual ~ImportSnapshot() {}
+
+    virtual boost::property_tree::ptree getConfig() const;
+    void updateConfig(const boost::property_tree::ptree& pt);
+
+    virtual bool filter(const Frame& in, Frame& out);
+
+   private:
+    std::string path, prefix;
+    bool _seq;
+    int start, counter;
+
+    bool load(Frame& f, int idx);
+};
+
+}  // namespace import
+}  // namespace toffy
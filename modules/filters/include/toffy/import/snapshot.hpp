@@ -0,0 +1,141 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <toffy/frame.hpp>
+#include <toffy/toffy_export.h>
+
+namespace toffy {
+/**
+ * @brief Binary frame dumps (.tfs), the fast replacement for the yaml ones
+ *
+ * A snapshot holds a set of frame slots in one file:
+ *
+ *     SnapshotHeader
+ *     SnapshotSlot[slots]
+ *     names               slot names, not terminated
+ *     payloads            images and strings, 8 byte aligned
+ *
+ * Numbers are stored in the slot table itself. Images are stored as they
+ * are in memory (Raw) or compressed in the LZ4 block format, optionally
+ * after grouping the bytes of each element (ShuffleLz): the high bytes
+ * of depth and amplitude planes are very similar, so they compress much
+ * better that way. Byte order is the one of the writing machine.
+ */
+namespace snapshot {
+
+struct SnapshotHeader {
+    char magic[8];      ///< "TOFFYSNP"
+    uint32_t version;   ///< format version
+    uint32_t slots;     ///< entries in the slot table
+    uint64_t size;      ///< file size, to detect truncated files
+};
+
+/** @brief Slot table entry */
+struct SnapshotSlot {
+    uint32_t nameOffset;  ///< of the name, from the start of the file
+    uint16_t nameLength;
+    uint8_t type;         ///< SlotType
+    uint8_t encoding;     ///< Encoding of the payload
+    int32_t rows, cols,   ///< image size
+        cvType;           ///< OpenCV type of the image
+    uint32_t reserved;
+    uint64_t value;       ///< numbers, doubles and floats as their bits
+    uint64_t offset,      ///< of the payload, from the start of the file
+        size,             ///< stored payload bytes
+        rawSize;          ///< payload bytes after decoding
+};
+
+enum SlotType
+{
+    Bool = 1,
+    Int,
+    UInt,
+    Float,
+    Double,
+    String,
+    Mat
+};
+
+enum Encoding
+{
+    Raw,       ///< as in memory
+    Lz,        ///< LZ4 block
+    ShuffleLz  ///< element bytes grouped, then LZ4 block
+};
+
+/**
+ * @brief Write the slots @p keys of @p f to @p path
+ *
+ * Missing slots and values of types without a SlotType are skipped. With
+ * @p compress images are stored compressed unless that does not make them
+ * smaller.
+ */
+TOFFY_EXPORT bool write(const std::string &path, const Frame &f,
+                        const std::vector<std::string> &keys, bool compress);
+
+/**
+ * @brief Add the slots stored in @p path to @p f
+ *
+ * Images get new buffers from the MatPool, ints and uints are added as
+ * int and unsigned int. Slots named in @p skip are not loaded.
+ *
+ * @return false if the file is missing or not a valid snapshot, @p f is
+ * not changed then
+ */
+TOFFY_EXPORT bool read(const std::string &path, Frame &f,
+                       const std::vector<std::string> &skip =
+                           std::vector<std::string>());
+
+/**
+ * @brief Convert an exportYaml dump to a snapshot
+ *
+ * Takes every top level entry: images, ints (fc and ts as UInt, like
+ * importYaml loads them), reals as Double and strings.
+ */
+TOFFY_EXPORT bool fromYaml(const std::string &yaml, const std::string &path,
+                           bool compress);
+
+/**
+ * @brief Convert all .yaml files in @p dir to .tfs files next to them
+ * @return number of files converted, -1 on error
+ */
+TOFFY_EXPORT int convertYamlDirectory(const std::string &dir, bool compress);
+
+/** @brief Largest LZ4 block compress() can produce for @p n bytes */
+inline size_t compressBound(size_t n) { return n + n / 255 + 16; }
+
+/**
+ * @brief LZ4 block compression
+ * @return compressed size, 0 if it does not fit into @p capacity
+ */
+TOFFY_EXPORT size_t compress(const uint8_t *src, size_t n, uint8_t *dst,
+                             size_t capacity);
+
+/**
+ * @brief Decode an LZ4 block of @p n bytes that expands to exactly
+ * @p rawSize bytes
+ * @return false for corrupt input, nothing is read or written out of bounds
+ */
+TOFFY_EXPORT bool decompress(const uint8_t *src, size_t n, uint8_t *dst,
+                             size_t rawSize);
+
+}  // namespace snapshot
+}  // namespace toffy
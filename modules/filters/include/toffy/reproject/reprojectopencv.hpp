@@ -16,9 +16,12 @@
 */
 #pragma once
 
-#include "toffy/filter.hpp"
+#include "toffy/pixelFilter.hpp"
 
 namespace toffy {
+namespace cam {
+class RayMap;
+}
 
 /**
  * @brief Reproject a depth image into a 3D cloud using OpenCV
@@ -30,13 +33,15 @@ namespace toffy {
  * @todo We can also get the cloud in wcs using the camera pose (or other
  * transformation available).
  *
- * The output is a OpenCV Mat of CV_32FC3 values.
+ * The output is a OpenCV Mat of CV_32FC3 values, distances <= 0 or > 65
+ * become NaN points. The viewing rays are taken from the shared
+ * cam::RayMap of the camera matrix.
  *
  * \section Xml Configuration
  * @include reprojectopencv.xml
  *
  */
-class ReprojectOpenCv : public Filter {
+class ReprojectOpenCv : public PixelFilter {
 
 public:
 
@@ -45,11 +50,13 @@ public:
     virtual ~ReprojectOpenCv() {}
 
     virtual boost::property_tree::ptree getConfig() const;
+    virtual bool declaresSlots() const { return true; }
     virtual void updateConfig(const boost::property_tree::ptree &pt);
 
     virtual bool filter(const Frame& in, Frame& out);
 private:
     cv::Mat _cameraMatrix; ///< internal camera matrix var
+    std::shared_ptr<const cam::RayMap> _rays; ///< rays of _cameraMatrix
     std::string _in_img, ///< Name of the input depth image
 	_in_cameraMatrix, ///< Name of the input camera matrix
 	_out_cloud; ///< Name of the output cloud
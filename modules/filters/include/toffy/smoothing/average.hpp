@@ -35,14 +35,34 @@ namespace toffy {
 namespace filters {
 namespace smoothing {
 /** perform averaging of the (depth) channel over multiple frames.
-     */
+ *
+ * Only pixels > 0 are averaged, pixels without any valid value are 0.
+ *
+ * With options.incremental (default) float images keep a running sum and
+ * count of the valid pixels: each frame adds the new and subtracts the
+ * evicted image, the cost no longer depends on the window size. The sums
+ * are kept in double and rebuilt from the queued frames every _resync
+ * frames, and whenever an infinite pixel enters or leaves the window.
+ * The result matches the full sum up to float rounding. Other image types
+ * are summed up over the whole window every frame.
+ */
 class DLLExport Average : public Filter
 {
     std::string _in_img, _out_img;
+    SlotKey _in_key, _out_key;
     static std::size_t _filter_counter;
     std::deque<matPtr> _queue;
     size_t _size;
+    bool _incremental;  ///< keep running sums instead of re-summing
     cv::Mat _dst, _cnt;
+    cv::Mat _sum;        ///< running sum of the valid pixels, CV_64F
+    size_t _updates;     ///< frames since the sums were rebuilt
+    static const size_t _resync = 1024;
+
+    void averageIncremental(const cv::Mat& img, cv::Mat& new_img);
+    /** rebuild _sum and _cnt from the queue, write the average */
+    void resync(cv::Mat& new_img);
+    void averageFull(const cv::Mat& img, cv::Mat& new_img);
 
    public:
     Average();
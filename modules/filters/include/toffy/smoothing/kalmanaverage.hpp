@@ -17,11 +17,23 @@
 #pragma once
 
 #include <toffy/filter.hpp>
-#include "opencv2/video/tracking.hpp"
+#include <opencv2/core.hpp>
 
 namespace toffy {
 namespace filters {
 namespace smoothing {
+    /**
+     * @brief Per pixel Kalman smoothing of the (depth) image over time.
+     *
+     * Every pixel runs a constant velocity filter with the state
+     * (distance, velocity), the distance is measured directly. The states
+     * and covariances of all pixels are kept in separate float planes and
+     * updated in one vectorized pass per frame.
+     *
+     * Pixels that are NaN, or <= 0 with skipZeros, are passed through and
+     * keep their state. A pixel without a valid state starts over from its
+     * next measurement.
+     */
     class KalmanAverage: public toffy::Filter
     {
 	std::string _in_img, out_img, _in_mask;
@@ -30,10 +42,11 @@ namespace smoothing {
 	float measurementNoiseCov; //< measurement noise covar value  (1e-1)
 	bool skipZeros;            //< skip zero distance values from averaging
 
-	FilterPtr _avg;
-	matPtr avgdImg;
-	std::shared_ptr<std::vector<cv::KalmanFilter > > vKF;
+	/// state planes: distance, velocity and the covariance a b / b d
+	cv::Mat _pos, _vel, _covA, _covB, _covD;
 	static std::size_t _filter_counter;
+
+	void reset(const cv::Mat& img);
     public:
 	KalmanAverage();
 	virtual ~KalmanAverage();
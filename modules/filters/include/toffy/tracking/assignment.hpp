@@ -0,0 +1,92 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "toffy/toffy_export.h"
+
+namespace toffy {
+namespace tracking {
+
+/**
+ * @brief Uniform grid over a set of points for radius queries
+ * @ingroup Tracking
+ *
+ * The points are bucketed by cells of the query radius, so a query only
+ * looks at the 3x3 cells around its position. The grid is limited to a
+ * few cells per point; far spread points get larger cells.
+ */
+class TOFFY_EXPORT SpatialGrid
+{
+   public:
+    SpatialGrid() : _cell(1.f), _x0(0.f), _y0(0.f), _w(0), _h(0) {}
+
+    /** @brief Index @p pts, which are copied */
+    void build(const std::vector<cv::Point2f>& pts, float cellSize);
+
+    /** @brief Indices of the points within @p radius of @p p, sorted */
+    void query(const cv::Point2f& p, float radius,
+               std::vector<int>& found) const;
+
+   private:
+    std::vector<cv::Point2f> _pts;
+    float _cell, _x0, _y0;
+    int _w, _h;
+    std::vector<int> _start;  ///< first entry of each cell in _index
+    std::vector<int> _index;  ///< point indices, ordered by cell
+};
+
+/** @brief Size of the last assignment problem */
+struct AssignmentStats {
+    size_t candidates;  ///< track/blob pairs within the gate
+    size_t components;  ///< independent sub-problems solved
+    size_t largest;     ///< tracks + blobs of the largest sub-problem
+};
+
+/**
+ * @brief Match tracks to blobs with the least total distance
+ * @ingroup Tracking
+ *
+ * Pairs further apart than @p maxDistance are never matched. Leaving a
+ * track unmatched costs maxDistance, so the result matches as many
+ * tracks as possible without paying for it in distance: two crossing
+ * objects keep their ids where the nearest-first greedy match swaps them
+ * or loses one. The candidate pairs come from a SpatialGrid, and the
+ * problem is split into groups of tracks and blobs that share candidates,
+ * each solved with the Hungarian method. Crowds of hundreds of objects
+ * stay cheap as long as the groups stay small.
+ *
+ * @param match set to the blob index for each track, -1 if unmatched
+ * @return number of matched tracks
+ */
+TOFFY_EXPORT size_t assignOptimal(const std::vector<cv::Point2f>& tracks,
+                                  const std::vector<cv::Point2f>& blobs,
+                                  double maxDistance, std::vector<int>& match,
+                                  AssignmentStats* stats = NULL);
+
+/**
+ * @brief The former Tracker match: each track in order takes the nearest
+ * blob left within @p maxDistance
+ */
+TOFFY_EXPORT size_t assignGreedy(const std::vector<cv::Point2f>& tracks,
+                                 const std::vector<cv::Point2f>& blobs,
+                                 double maxDistance, std::vector<int>& match);
+
+}  // namespace tracking
+}  // namespace toffy
@@ -18,6 +18,7 @@
 
 #include <toffy/filter.hpp>
 #include <toffy/detection/detectedObject.hpp>
+#include <toffy/tracking/assignment.hpp>
 
 
 /** @defgroup Tracking Tracking
@@ -58,6 +59,9 @@ public:
      */
     const std::vector<toffy::detection::DetectedObject* >& getDetObjs() const { return detObjs; }
 
+    /** @brief Size of the last optimal assignment */
+    const AssignmentStats& assignmentStats() const { return _assignStats; }
+
 
 private:
     std::string _in_vec, ///< Name of the next list of detected blobs
@@ -68,6 +72,9 @@ private:
 	_out_count; ///< # of detected objects
     int nextId; ///< id for the next newly-found DetectedObject. Strictly incrementing
     double maxMergeDistance;
+    bool _greedy; ///< nearest-first matching as before, instead of assignOptimal()
+    bool _predict; ///< match objects at the position their motion predicts
+    AssignmentStats _assignStats;
 
     static std::size_t _filter_counter; ///< Internal filter counter
 
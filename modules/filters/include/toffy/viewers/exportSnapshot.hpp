@@ -0,0 +1,61 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <string>
+
+#include "toffy/asyncSink.hpp"
+#include "toffy/filter.hpp"
+
+namespace toffy {
+
+/**
+ * @brief Dump frames to binary snapshot files, see toffy::snapshot
+ *
+ * Writes the same slots and file names as exportYaml, with the extension
+ * .tfs: x, y, z, depth, ampl and confidence if present, fc and ts (1000 if
+ * missing) and the file counter. Use importSnapshot to play them back.
+ *
+ * options.compress stores the images LZ4 compressed, which makes the files
+ * about half as large for a few ms per frame.
+ */
+class ExportSnapshot : public Filter
+{
+   public:
+    static const std::string id_name;
+
+    ExportSnapshot();
+    virtual ~ExportSnapshot() { _sink.close(); }
+
+    virtual boost::property_tree::ptree getConfig() const;
+
+    virtual void updateConfig(const boost::property_tree::ptree &pt);
+
+    virtual bool filter(const Frame &in, Frame &out);
+
+    /** @brief Write queue and counters, see AsyncSink */
+    const AsyncSink &sink() const { return _sink; }
+
+   private:
+    std::string path, prefix;
+    bool useCounter, useFc, compress;
+    int counter;
+    AsyncSink _sink;
+
+    /** write one file, on the sink thread if options.async is set */
+    bool write(const Frame &in);
+};
+}  // namespace toffy
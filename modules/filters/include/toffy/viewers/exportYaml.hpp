@@ -16,6 +16,9 @@
 */
 #pragma once
 
+#include <functional>
+
+#include "toffy/asyncSink.hpp"
 #include "toffy/filter.hpp"
 
 namespace toffy {
@@ -29,8 +32,9 @@ public:
     ExportYaml(): Filter("exportYaml"),
 	_in_cloud("cloud"),_seqName(""), path("./"), prefix("tofData"),
         useCounter(true), useFc(false),
-	counter(1) {}
-    virtual ~ExportYaml() {}
+	counter(1),
+	_sink("exportYaml", std::bind(&ExportYaml::write, this, std::placeholders::_1)) {}
+    virtual ~ExportYaml() { _sink.close(); }
 
     virtual boost::property_tree::ptree getConfig() const;
 
@@ -38,12 +42,18 @@ public:
 
     virtual bool filter(const Frame& in, Frame& out);
 
+    /** @brief Write queue and counters, see AsyncSink */
+    const AsyncSink& sink() const { return _sink; }
+
 private:
     std::string _in_cloud, _fileName, _seqName;
     std::string path, prefix;
     bool useCounter, useFc;
     int counter;
+    AsyncSink _sink;
 
+    /** write one file, on the sink thread if options.async is set */
+    bool write(const Frame& in);
     void dumpToYaml(const Frame& frame, const std::string& id);
 };
 }
@@ -19,6 +19,9 @@
 #include <pcl/point_cloud.h>
 #include <pcl/io/pcd_io.h>
 
+#include <functional>
+
+#include "toffy/asyncSink.hpp"
 #include "toffy/filter.hpp"
 
 namespace toffy {
@@ -28,8 +31,9 @@ public:
     ExportCloud(): Filter("exportcloud"),
 	_in_cloud("cloud"), _fileName("cloud"),
         _pattern(""),_seqName(""),
-	_seq(false), _bin(true), _cnt(1) {}
-    virtual ~ExportCloud() {}
+	_seq(false), _bin(true), _cnt(1),
+	_sink("exportcloud", std::bind(&ExportCloud::write, this, std::placeholders::_1)) {}
+    virtual ~ExportCloud() { _sink.close(); }
 
     virtual boost::property_tree::ptree getConfig() const;
 
@@ -37,16 +41,23 @@ public:
 
     virtual bool filter(const Frame& in, Frame& out);
 
+    /** @brief Write queue and counters, see AsyncSink */
+    const AsyncSink& sink() const { return _sink; }
+
 private:
     std::string _in_cloud, _path, _fileName, _pattern, _seqName;
     bool _seq, _bin, _xyz;
     pcl::PCDWriter _w;
     int _cnt;
+    AsyncSink _sink;
+
+    /** write one cloud, on the sink thread if options.async is set */
+    bool write(const Frame& in);
 
     bool getInputPoints(const Frame& in, pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud);
 
-    bool exportPcl2(const Frame& in, Frame& out);
-    bool exportXyz(const Frame& in, Frame& out);
+    bool exportPcl2(const Frame& in);
+    bool exportXyz(const Frame& in);
 
 };
 }
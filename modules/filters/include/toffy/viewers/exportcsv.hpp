@@ -15,6 +15,9 @@
 */
 #pragma once
 
+#include <functional>
+
+#include "toffy/asyncSink.hpp"
 #include "toffy/filter.hpp"
 #include <pcl/io/pcd_io.h>
 
@@ -25,17 +28,26 @@ class ExportCSV : public Filter	{
     std::string _fc;
     bool _seq, _skip0s;
     int _cnt;
+    AsyncSink _sink;
 public:
     ExportCSV(): Filter("exportcsv"),
 	_in("depth"), _filePattern("depth_%d.csv"),
         _fc(""),
-	_seq(false), _skip0s(false), _cnt(0) {}
-    virtual ~ExportCSV() {}
+	_seq(false), _skip0s(false), _cnt(0),
+	_sink("exportcsv", std::bind(&ExportCSV::write, this, std::placeholders::_1)) {}
+    virtual ~ExportCSV() { _sink.close(); }
 
     virtual int loadConfig(const boost::property_tree::ptree& pt);
     virtual boost::property_tree::ptree getConfig() const;
     virtual void updateConfig(const boost::property_tree::ptree &pt);
 
     virtual bool filter(const Frame& in, Frame& out);
+
+    /** @brief Write queue and counters, see AsyncSink */
+    const AsyncSink& sink() const { return _sink; }
+
+private:
+    /** write one image, on the sink thread if options.async is set */
+    bool write(const Frame& in);
 };
 }
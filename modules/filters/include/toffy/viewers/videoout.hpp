@@ -17,6 +17,7 @@
 #pragma once
 #include <string>
 
+#include "toffy/asyncSink.hpp"
 #include "toffy/filter.hpp"
 
 namespace cv {
@@ -55,10 +56,17 @@ public:
 
     double scale;   //< scale factor for distance and amplitude images
 
+    /** @brief Write queue and counters, see AsyncSink */
+    const AsyncSink& sink() const { return _sink; }
+
 private:
     bool saving;
     cv::VideoWriter* writer;
     cv::Mat image;
+    AsyncSink _sink;
+
+    /** encode one image, on the sink thread if options.async is set */
+    bool write(const Frame& in);
 };
 
 }
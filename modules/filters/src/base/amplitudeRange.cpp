@@ -24,6 +24,7 @@
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include "toffy/base/amplitudeRange.hpp"
+#include "toffy/matPool.hpp"
 
 using namespace toffy;
 using namespace toffy::filters;
@@ -35,9 +36,12 @@ namespace fs = boost::filesystem;
 std::size_t AmplitudeRange::_filter_counter = 1;
 const std::string AmplitudeRange::id_name = "amplitudeRange";
 
-AmplitudeRange::AmplitudeRange(): Filter(AmplitudeRange::id_name, _filter_counter),
+AmplitudeRange::AmplitudeRange(): PixelFilter(AmplitudeRange::id_name, _filter_counter),
   _in_ampl("ampl"), _in_depth("depth"), _out_ampl(_in_ampl),
-  _out_depth(_in_depth), _minAmpl(0), _maxAmpl(25000)
+  _out_depth(_in_depth), _mask("mask"), _in_ampl_key(_in_ampl),
+  _in_depth_key(_in_depth), _out_ampl_key(_out_ampl),
+  _out_depth_key(_out_depth), _mask_key(_mask),
+  _minAmpl(0), _maxAmpl(25000)
 {
     _filter_counter++;
 }
@@ -47,7 +51,7 @@ void AmplitudeRange::updateConfig(const boost::property_tree::ptree &pt) {
 
     using namespace boost::property_tree;
 
-    Filter::updateConfig(pt);
+    PixelFilter::updateConfig(pt);
 
     _minAmpl = pt.get<double>("options.minAmpl",_minAmpl);
     _maxAmpl = pt.get<double>("options.maxAmpl",_maxAmpl);
@@ -57,12 +61,19 @@ void AmplitudeRange::updateConfig(const boost::property_tree::ptree &pt) {
 
     _out_depth = pt.get<string>("outputs.depth",_out_depth);
     _out_ampl = pt.get<string>("outputs.ampl",_out_ampl);
+    _mask = pt.get<string>("outputs.mask",_mask);
+
+    _in_depth_key = SlotKey(_in_depth);
+    _in_ampl_key = SlotKey(_in_ampl);
+    _out_depth_key = SlotKey(_out_depth);
+    _out_ampl_key = SlotKey(_out_ampl);
+    _mask_key = SlotKey(_mask);
 }
 
 boost::property_tree::ptree AmplitudeRange::getConfig() const {
     boost::property_tree::ptree pt;
 
-    pt = Filter::getConfig();
+    pt = PixelFilter::getConfig();
 
     pt.put("options.minAmpl", _minAmpl);
     pt.put("options.maxAmpl", _maxAmpl);
@@ -72,6 +83,7 @@ boost::property_tree::ptree AmplitudeRange::getConfig() const {
 
     pt.put("outputs.depth", _out_depth);
     pt.put("outputs.ampl", _out_ampl);
+    pt.put("outputs.mask", _mask);
 
     return pt;
 }
@@ -79,53 +91,100 @@ boost::property_tree::ptree AmplitudeRange::getConfig() const {
 bool AmplitudeRange::filter(const Frame &in, Frame& out) {
 	BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ <<  " " << id();
 
-	matPtr ampl, depth;
-
-	try {
-		ampl = boost::any_cast<matPtr>(in.getData(_in_ampl));
-	} catch(const boost::bad_any_cast &) {
+	matPtr ampl = in.optMatPtr(_in_ampl_key, matPtr());
+	if (!ampl) {
 		BOOST_LOG_TRIVIAL(warning) <<
 			"Could not cast input " << _in_ampl <<
 			", filter  " << id() <<" not applied.";
 		return false;
 	}
 	
-	try {
-		depth = boost::any_cast<matPtr>(in.getData(_in_depth));
-	} catch(const boost::bad_any_cast &) {
+	matPtr depth = in.optMatPtr(_in_depth_key, matPtr());
+	if (!depth) {
 		BOOST_LOG_TRIVIAL(warning) <<
 			"Could not cast input " << _in_depth <<
 			", filter  " << id() <<" not applied.";
 		return false;
 	}
-    matPtr maskPtr;
-    if (out.hasKey("mask")) {
-        maskPtr = out.getMatPtr("mask");
-    } else {
+    matPtr maskPtr = out.optMatPtr(_mask_key, matPtr());
+    if (!maskPtr) {
         maskPtr.reset(new cv::Mat(ampl->rows, ampl->cols, CV_8UC1));
-        out.addData("mask", maskPtr);
+        out.addData(_mask_key, maskPtr);
     }
-
-	//TODO we need new data at the output
-	//TODO handle aux vars creation
-	Mat minMask = *ampl > _minAmpl;
-	Mat maxMask = *ampl < _maxAmpl;
-	
-    *maskPtr = minMask & maxMask;
-
+    maskPtr->create(ampl->size(), CV_8UC1);
+
+    // the inputs are only written to when they are the outputs
+    if (_out_ampl != _in_ampl) ampl = output(*ampl, _out_ampl_key, out);
+    if (_out_depth != _in_depth) depth = output(*depth, _out_depth_key, out);
+
+	forEachBand(ampl->rows, [&](int begin, int end) {
+	    Mat a = ampl->rowRange(begin, end), d = depth->rowRange(begin, end);
+	    Mat mask = maskPtr->rowRange(begin, end), outside;
+	    compare(a, _minAmpl, mask, CMP_GT);
+	    bitwise_and(mask, a < _maxAmpl, mask);
+	    bitwise_not(mask, outside);
+	    a.setTo(0, outside);
+	    d.setTo(0, outside);
+	});
     // debug: 
     // imshow("mask", *maskPtr);
 
-	Mat newAmpl, newDepth;
+	out.addData(_out_ampl_key,ampl);
+	out.addData(_out_depth_key,depth);
 
-	ampl->copyTo(newAmpl, *maskPtr);
-	depth->copyTo(newDepth, *maskPtr);
+	return true;
+}
 
-	newAmpl.copyTo(*ampl);
-	newDepth.copyTo(*depth);
+matPtr AmplitudeRange::output(const cv::Mat& src, const SlotKey& key,
+                              const Frame& out) const {
+    matPtr dst = out.optMatPtr(key, matPtr());
+    if (!dst || dst->data == src.data) {
+        dst = MatPool::global().acquire(src.size(), src.type());
+    }
+    src.copyTo(*dst);
+    return dst;
+}
 
-	out.addData(_out_ampl,ampl);
-	out.addData(_out_depth,depth);
+bool AmplitudeRange::fusible(FusedPlanes& planes) const {
+    if (_in_ampl != _out_ampl || _in_depth != _out_depth) return false;
+    planes.depth = _in_depth;
+    planes.ampl = _in_ampl;
+    planes.amplWritten = true;
+    return true;
+}
 
-	return true;
+bool AmplitudeRange::fusedBegin(const cv::Mat& /*depth*/, const cv::Mat* ampl,
+                                Frame& out) {
+    if (!ampl) return false;
+    matPtr maskPtr = out.optMatPtr(_mask_key, matPtr());
+    if (!maskPtr) {
+        maskPtr.reset(new cv::Mat(ampl->rows, ampl->cols, CV_8UC1));
+        out.addData(_mask_key, maskPtr);
+    }
+    maskPtr->create(ampl->size(), CV_8UC1);
+    _fusedMask = maskPtr;
+
+    // compare() takes the bounds as float for float images, integer
+    // images are compared exactly
+    if (ampl->type() == CV_32F) {
+        _fusedMin = (float)_minAmpl;
+        _fusedMax = (float)_maxAmpl;
+    } else {
+        _fusedMin = _minAmpl;
+        _fusedMax = _maxAmpl;
+    }
+    return true;
+}
+
+void AmplitudeRange::fusedRow(int y, float* depth, float* ampl,
+                              int cols) const {
+    uchar* mask = _fusedMask->ptr<uchar>(y);
+    for (int x = 0; x < cols; x++) {
+        bool keep = ampl[x] > _fusedMin && ampl[x] < _fusedMax;
+        mask[x] = keep ? 255 : 0;
+        if (!keep) {
+            ampl[x] = 0;
+            depth[x] = 0;
+        }
+    }
 }
@@ -30,7 +30,7 @@ using namespace cv;
 using namespace std;
 
 DistAmpl::DistAmpl(std::string name)
-    : Filter(name), _in_ampl("ampl"), _in_depth("depth")
+    : PixelFilter(name), _in_ampl("ampl"), _in_depth("depth")
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << "DA";
 }
@@ -40,25 +40,26 @@ bool DistAmpl::f1(const toffy::Frame& in, toffy::Frame& /*out*/)
     matPtr ampl = in.getMatPtr(_in_ampl);
     matPtr d = in.getMatPtr(_in_depth);
 
-    for (int y = 0; y < ampl->rows; y++) {
-        float* rowD = d->ptr<float>(y);
-        short* rowA = ampl->ptr<short>(y);
+    forEachBand(ampl->rows, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            float* rowD = d->ptr<float>(y);
+            short* rowA = ampl->ptr<short>(y);
 
-        for (int x = 0; x < ampl->cols; x++) {
-            short a = *rowA;
+            for (int x = 0; x < ampl->cols; x++) {
+                short a = *rowA;
 
-            if (a > 500 && a < 12000) {  // todo:limit to valid distances?
+                if (a > 500 && a < 12000) {  // todo:limit to valid distances?
 
-                float corr = linearInterp(a);
+                    float corr = linearInterp(a);
 
-                *rowD *= corr;  // apply ampl. correction
-            }
+                    *rowD *= corr;  // apply ampl. correction
+                }
 
-            rowA++;
-            rowD++;
+                rowA++;
+                rowD++;
+            }
         }
-    }
-
+    });
     return true;
 }
 
@@ -69,6 +70,30 @@ bool DistAmpl::filter(const toffy::Frame& in, toffy::Frame& out)
     return true;
 }
 
+bool DistAmpl::fusible(FusedPlanes& planes) const
+{
+    planes.depth = _in_depth;
+    planes.ampl = _in_ampl;
+    return true;
+}
+
+bool DistAmpl::fusedBegin(const cv::Mat& /*depth*/, const cv::Mat* ampl,
+                          toffy::Frame& /*out*/)
+{
+    // f1() reads the amplitudes as short
+    return ampl && ampl->type() == CV_16S;
+}
+
+void DistAmpl::fusedRow(int /*y*/, float* depth, float* ampl, int cols) const
+{
+    for (int x = 0; x < cols; x++) {
+        short a = (short)ampl[x];
+        if (a > 500 && a < 12000) {
+            depth[x] *= linearInterp(a);
+        }
+    }
+}
+
 int DistAmpl::loadConfig(const boost::property_tree::ptree& pt)
 {
     const boost::property_tree::ptree& fltr = pt.get_child(this->name());
@@ -82,7 +107,7 @@ void DistAmpl::updateConfig(const boost::property_tree::ptree& pt)
 
     using namespace boost::property_tree;
 
-    Filter::updateConfig(pt);
+    PixelFilter::updateConfig(pt);
 
     //_minAmpl = pt.get<double>("options.minAmpl",_minAmpl);
     //_maxAmpl = pt.get<double>("options.maxAmpl",_maxAmpl);
@@ -118,7 +143,7 @@ boost::property_tree::ptree DistAmpl::getConfig() const
 {
     boost::property_tree::ptree pt;
 
-    pt = Filter::getConfig();
+    pt = PixelFilter::getConfig();
 
     //pt.put("options.timeStamped", _tsd);
     return pt;
@@ -15,6 +15,7 @@
    limitations under the License.
 */
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -40,7 +41,7 @@ std::size_t OffSet::_filter_counter = 1;
 const std::string OffSet::id_name = "offset";
 
 OffSet::OffSet()
-    : Filter(OffSet::id_name, _filter_counter),
+    : PixelFilter(OffSet::id_name, _filter_counter),
       _sumValue(0.0),
       _mulValue(1.0),
       _in_img("img") {
@@ -66,7 +67,7 @@ void OffSet::updateConfig(const boost::property_tree::ptree &pt) {
 
   using namespace boost::property_tree;
 
-  Filter::updateConfig(pt); // sets log level and other common settings
+  PixelFilter::updateConfig(pt); // sets log level and other common settings
 
   _in_img = pt.get<string>("inputs.img", _in_img);
 
@@ -108,16 +109,31 @@ bool OffSet::filter(const Frame &in, Frame &out) const {
       out.addData(_out_img, o);
     }
 
-    *o = *d + _sumValue;
-    *o *= _mulValue;
+    o->create(d->size(), d->type());
+    forEachBand(d->rows, [&](int begin, int end) {
+      Mat dst = o->rowRange(begin, end);
+      add(d->rowRange(begin, end), Scalar::all(_sumValue), dst);
+      dst *= _mulValue;
+    });
 
   } else {
+    matPtr d = in.getMatPtr(_in_img);
+    // rois reaching past the border throw here, before any band ran
+    std::vector<Mat> rois;
     for (size_t i = 0; i < _rois.size(); i++) {
-      matPtr d = in.getMatPtr(_in_img);
-      Mat roi((*d)(_rois[i]));
-      roi += _sumValue;
-      roi *= _mulValue;
+      rois.push_back((*d)(_rois[i]));
     }
+    forEachBand(d->rows, [&](int begin, int end) {
+      for (size_t i = 0; i < rois.size(); i++) {
+        // the rows of roi i in this band
+        int r0 = std::max(begin - _rois[i].y, 0);
+        int r1 = std::min(end - _rois[i].y, _rois[i].height);
+        if (r0 >= r1) continue;
+        Mat roi = rois[i].rowRange(r0, r1);
+        roi += _sumValue;
+        roi *= _mulValue;
+      }
+    });
   }
 
   diff = boost::posix_time::microsec_clock::local_time() - start;
@@ -134,7 +150,7 @@ void OffSet::addRoi(cv::Rect newRoi) {
 boost::property_tree::ptree OffSet::getConfig() const {
   boost::property_tree::ptree pt, opt;
 
-  pt = Filter::getConfig();
+  pt = PixelFilter::getConfig();
 
   opt.put("sumValue", _sumValue);
   opt.put("mulValue", _mulValue);
@@ -23,6 +23,10 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <opencv2/core.hpp>
 #include <opencv2/calib3d.hpp>
 
@@ -31,6 +35,7 @@
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include "toffy/base/polar2cart.hpp"
+#include "toffy/matPool.hpp"
 #include "toffy/common/filenodehelper.hpp"
 
 using namespace toffy;
@@ -44,9 +49,11 @@ std::size_t Polar2Cart::_filter_counter = 1;
 const std::string Polar2Cart::id_name = "polar2cart";
 
 Polar2Cart::Polar2Cart()
-    : Filter(Polar2Cart::id_name, _filter_counter),
+    : PixelFilter(Polar2Cart::id_name, _filter_counter),
       _fovx(-1),
       _fovy(-1),
+      _lutFovx(-1),
+      _lutFovy(-1),
       _in_img("img"),
       _out_img(_in_img)
 {
@@ -59,7 +66,7 @@ void Polar2Cart::updateConfig(const boost::property_tree::ptree &pt)
 
     using namespace boost::property_tree;
 
-    Filter::updateConfig(pt);
+    PixelFilter::updateConfig(pt);
 
     _fovx = pt.get<double>("options.fovx", _fovx);
     _fovy = pt.get<double>("options.fovy", _fovy);
@@ -85,13 +92,15 @@ void Polar2Cart::updateConfig(const boost::property_tree::ptree &pt)
     _in_fovy = pt.get<string>("inputs.fovy", _in_fovy);
 
     _out_img = pt.get<string>("outputs.img", _out_img);
+
+    _lut.release();  // fov or camera matrix may have changed
 }
 
 boost::property_tree::ptree Polar2Cart::getConfig() const
 {
     boost::property_tree::ptree pt;
 
-    pt = Filter::getConfig();
+    pt = PixelFilter::getConfig();
     pt.put("options.x_ang", _fovx);
     pt.put("options.y_ang", _fovy);
 
@@ -104,7 +113,7 @@ boost::property_tree::ptree Polar2Cart::getConfig() const
     return pt;
 }
 
-bool Polar2Cart::filter(const Frame &in, Frame & /*out*/)
+bool Polar2Cart::filter(const Frame &in, Frame &out)
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id();
 
@@ -117,7 +126,7 @@ bool Polar2Cart::filter(const Frame &in, Frame & /*out*/)
         return false;
     }
 
-    if (_cameraMatrix.data) {
+    if (_cameraMatrix.data && img->size() != _lut.size()) {
         double noV, apertureWidth = (45 / 1000) * img->size().width,
                     apertureHeight = (45 / 1000) * img->size().height;
         Point2d np;
@@ -145,25 +154,93 @@ bool Polar2Cart::filter(const Frame &in, Frame & /*out*/)
             << "No FoV data, filter " << id() << " not applied.";
         return false;
     }
+    if (img->type() != CV_32FC1) {
+        BOOST_LOG_TRIVIAL(warning) << "Input " << _in_img
+                                   << " is not a float image, filter  "
+                                   << id() << " not applied.";
+        return false;
+    }
+
+    if (img->size() != _lut.size() || _fovx != _lutFovx ||
+        _fovy != _lutFovy) {
+        updateLut(img->size());
+    }
 
-    // TODO we need new data at the output
-    // TODO handle aux vars creation
-    Mat new_img = *img;
-
-    float coef_h = (M_PI * _fovx / 180) / new_img.cols,
-          coef_v = (M_PI * _fovy / 180) / new_img.rows;
-
-    for (int i = 0; i < new_img.rows; i++) {
-        for (int j = 0; j < new_img.cols; j++) {
-            if (new_img.at<float>(i, j) < 65. && new_img.at<float>(i, j) > 0. &&
-                new_img.at<float>(i, j) == new_img.at<float>(i, j)) {
-                // TODO check type and channels
-                new_img.at<float>(i, j) *=
-                    (cos(coef_h * (abs(j - ((new_img.cols / 2) - 1))))) *
-                    (cos(coef_v * (abs(i - ((new_img.rows / 2) - 1)))));
-            }
+    matPtr new_img = img;
+    if (_out_img != _in_img) {
+        new_img = out.optMatPtr(_out_img, matPtr());
+        if (!new_img) {
+            new_img = MatPool::global().acquire(img->size(), CV_32F);
         }
+        new_img->create(img->size(), CV_32F);
+        out.addData(_out_img, new_img);
     }
 
+    const size_t cols = img->cols;
+    const bool continuous = img->isContinuous() && new_img->isContinuous();
+    forEachBand(img->rows, [&](int begin, int end) {
+        if (continuous) {
+            applyLut(img->ptr<float>(begin), _lut.ptr<float>(begin),
+                     new_img->ptr<float>(begin), (end - begin) * cols);
+            return;
+        }
+        // roi views: rows are apart in memory
+        for (int i = begin; i < end; i++) {
+            applyLut(img->ptr<float>(i), _lut.ptr<float>(i),
+                     new_img->ptr<float>(i), cols);
+        }
+    });
+
     return true;
 }
+
+void Polar2Cart::updateLut(const cv::Size &size)
+{
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id() << " " << size
+                             << " fov " << _fovx << "x" << _fovy;
+
+    float coef_h = (M_PI * _fovx / 180) / size.width,
+          coef_v = (M_PI * _fovy / 180) / size.height;
+
+    std::vector<float> cos_h(size.width);
+    for (int j = 0; j < size.width; j++) {
+        cos_h[j] = cos(coef_h * (abs(j - ((size.width / 2) - 1))));
+    }
+
+    _lut.create(size, CV_32F);
+    for (int i = 0; i < size.height; i++) {
+        float cos_v = cos(coef_v * (abs(i - ((size.height / 2) - 1))));
+        float *lut = _lut.ptr<float>(i);
+        for (int j = 0; j < size.width; j++) {
+            lut[j] = cos_h[j] * cos_v;
+        }
+    }
+    _lutFovx = _fovx;
+    _lutFovy = _fovy;
+}
+
+/*
+ * dst = src * lut for the valid distances (0 < d < 65), others are copied.
+ * NaN fails both compares. dst may alias src.
+ */
+void Polar2Cart::applyLut(const float *src, const float *lut, float *dst,
+                          size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 lo = _mm_setzero_ps();
+    const __m128 hi = _mm_set1_ps(65.f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        __m128 mask =
+            _mm_and_ps(_mm_cmpgt_ps(v, lo), _mm_cmplt_ps(v, hi));
+        __m128 c = _mm_mul_ps(v, _mm_loadu_ps(lut + i));
+        _mm_storeu_ps(dst + i, _mm_or_ps(_mm_and_ps(mask, c),
+                                         _mm_andnot_ps(mask, v)));
+    }
+#endif
+    for (; i < n; i++) {
+        float v = src[i];
+        dst[i] = (v < 65.f && v > 0.f) ? v * lut[i] : v;
+    }
+}
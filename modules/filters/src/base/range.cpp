@@ -31,8 +31,9 @@ namespace logging = boost::log;
 
 std::size_t toffy::filters::Range::_filter_counter = 1;
 
-toffy::filters::Range::Range(): Filter("range",_filter_counter),
-    _in_img("img"), _out_img(_in_img), _min(0), _max(0) {
+toffy::filters::Range::Range(): PixelFilter("range",_filter_counter),
+    _in_img("img"), _out_img(_in_img), _in_key(_in_img), _out_key(_out_img),
+    _min(0), _max(0) {
     _filter_counter++;
 }
 
@@ -51,7 +52,7 @@ void toffy::filters::Range::updateConfig(const boost::property_tree::ptree &pt)
 
     using namespace boost::property_tree;
 
-    Filter::updateConfig(pt);
+    PixelFilter::updateConfig(pt);
 
     _min = pt.get<float>("options.min",_min);
     _max = pt.get<float>("options.max",_max);
@@ -59,28 +60,21 @@ void toffy::filters::Range::updateConfig(const boost::property_tree::ptree &pt)
     _in_img = pt.get<string>("inputs.img",_in_img);
     _out_img = pt.get<string>("outputs.img",_out_img);
 
+    _in_key = SlotKey(_in_img);
+    _out_key = SlotKey(_out_img);
 }
 
 bool toffy::filters::Range::filter(const Frame &in, Frame& out) {
 	BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ <<  " " << id();
 
-	matPtr img;
-	try {
-		img = boost::any_cast<matPtr>(in.getData(_in_img));
-	} catch(const boost::bad_any_cast &) {
+	matPtr img = in.optMatPtr(_in_key, matPtr());
+	if (!img) {
 		BOOST_LOG_TRIVIAL(warning) <<
 			"Could not cast input " << _in_img <<
 			", filter  " << id() <<" not applied.";
 		return false;
 	}
 
-	// Mat minMask = *img < _min;
-	// Mat maxMask = *img > _max;
-	// Mat mask = minMask | maxMask;
-	// mask = ~mask;
-
-	Mat mask = (*img >= _min) & (*img <= _max) ;
-
 	if (!img->data) {
 	    BOOST_LOG_TRIVIAL(warning) <<
 		    "Range filtered out everything from input: " << _in_img <<
@@ -88,30 +82,57 @@ bool toffy::filters::Range::filter(const Frame &in, Frame& out) {
 	    return false;
 	}
 
-
-	matPtr img_out;
-	try {
-		img_out = boost::any_cast<matPtr>(in.getData(_out_img));
-	} catch(const boost::bad_any_cast &) {
+	matPtr img_out = in.optMatPtr(_out_key, matPtr());
+	if (!img_out) {
 		BOOST_LOG_TRIVIAL(info) << 
 			"Range::filter() Could not cast output " << _out_img << " - initializing it.";
 		img_out.reset(new Mat());
-		img->copyTo(*img_out, mask);
-		out.addData(_out_img,img_out);
-		return true;
+		out.addData(_out_key,img_out);
 	}
-	//img_out.reset(new Mat());
-    *img_out = 0;
-	img->copyTo(*img_out, mask);
+	img_out->create(img->size(), img->type());
+
+	forEachBand(img->rows, [&](int begin, int end) {
+	    Mat src = img->rowRange(begin, end), dst = img_out->rowRange(begin, end);
+	    Mat mask = (src >= _min) & (src <= _max);
+	    if (img_out == img) {
+		dst.setTo(0, ~mask);
+	    } else {
+		dst = 0;
+		src.copyTo(dst, mask);
+	    }
+	});
 
 	return true;
 }
 
+bool toffy::filters::Range::fusible(FusedPlanes& planes) const
+{
+    if (_in_img != _out_img) return false;
+    planes.depth = _in_img;
+    return true;
+}
+
+bool toffy::filters::Range::fusedBegin(const cv::Mat& /*depth*/,
+				       const cv::Mat* /*ampl*/, Frame& /*out*/)
+{
+    return true;
+}
+
+void toffy::filters::Range::fusedRow(int /*y*/, float* depth, float* /*ampl*/,
+				     int cols) const
+{
+    // compare() takes the bounds as float for float images
+    const float lo = _min, hi = _max;
+    for (int x = 0; x < cols; x++) {
+	if (!(depth[x] >= lo && depth[x] <= hi)) depth[x] = 0;
+    }
+}
+
 boost::property_tree::ptree toffy::filters::Range::getConfig() const
 {
     boost::property_tree::ptree pt, opt;
 
-    pt = Filter::getConfig();
+    pt = PixelFilter::getConfig();
 
     opt.put("min", _min);
     opt.put("max", _max);
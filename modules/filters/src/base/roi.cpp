@@ -22,6 +22,7 @@
 #include <boost/log/trivial.hpp>
 
 #include "toffy/base/roi.hpp"
+#include "toffy/matPool.hpp"
 
 using namespace toffy;
 using namespace toffy::filters;
@@ -33,7 +34,7 @@ std::size_t Roi::_filter_counter = 1;
 const std::string Roi::id_name = "roi";
 
 toffy::filters::Roi::Roi()
-    : Filter(Roi::id_name, _filter_counter),
+    : PixelFilter(Roi::id_name, _filter_counter),
       _in_img("img"),
       _out_img(_in_img),
       _x(0),
@@ -44,7 +45,8 @@ toffy::filters::Roi::Roi()
       _outValue(0.0),
       _in(false),
       _filter(false),
-      _below(false)
+      _below(false),
+      _fusedApply(false)
 {
     _filter_counter++;
 }
@@ -55,7 +57,7 @@ void toffy::filters::Roi::updateConfig(const boost::property_tree::ptree &pt)
 
     using namespace boost::property_tree;
 
-    Filter::updateConfig(pt);
+    PixelFilter::updateConfig(pt);
 
     _x = pt.get<double>("options.x", _x);
     _y = pt.get<double>("options.y", _y);
@@ -95,64 +97,59 @@ bool toffy::filters::Roi::filter(const Frame &in, Frame &out)
             img_out = in.getMatPtr(_out_img);
         } catch (const boost::bad_any_cast &) {
             BOOST_LOG_TRIVIAL(info) << "Could not cast input " << _out_img;
-            img_out.reset(new cv::Mat(img->size(), img->type()));
+            img_out = MatPool::global().acquire(img->size(), img->type());
             out.addData(_out_img, img_out);
         }
-        *img_out = img->clone();
-
+        // the last output may still be held elsewhere, e.g. queued by an
+        // exporter: write into a new buffer then
+        if (!MatPool::exclusive(img_out)) {
+            img_out = MatPool::global().acquire(img->size(), img->type());
+            out.addData(_out_img, img_out);
+        }
+        img_out->create(img->size(), img->type());
     } else
         img_out = img;
 
-    if (_roi.area()) {
-        cv::Rect rect_mat(0, 0, img_out->cols, img_out->rows);
-        if ((_roi & rect_mat) == _roi) {
-            if (_in) {
-                Mat dst_roi = (*img_out)(_roi);
-                if (_filter) {
-                    Mat fmask;
-                    if (_below) {
-                        fmask = dst_roi < _inValue;
-                        //imshow("below", fmask);
-                    } else {
-                        fmask = dst_roi > _inValue;
-                        //imshow("above", fmask);
-                    }
-                    dst_roi.setTo(_outValue, fmask);
-                } else
-                    dst_roi = _outValue;
-                //img_out->copyTo(*img_out,dst_roi);
-            } else {
-                //cv::Mat outliers = cv::Mat(img_out->size(), img_out->type(),_outValue);
-                //Mat imgRoi = (*img_out)(_roi);
-                //Mat dst_roi = outliers(_roi);
-                if (_filter) {
-                    Mat fmask;
-                    if (_below) {
-                        fmask = *img_out > _inValue;
-                        //imshow("below", fmask);
-                    } else {
-                        fmask = *img_out < _inValue;
-                        //imshow("above", fmask);
-                    }
-                    Mat copyImg = img_out->clone();
-                    copyImg.setTo(_outValue, fmask);
-                    (*img_out)(_roi).copyTo((copyImg)(_roi));
-                    *img_out = copyImg.clone();
+    bool apply = applies(img_out->size());
+
+    forEachBand(img->rows, [&](int begin, int end) {
+        Mat dst = img_out->rowRange(begin, end);
+        if (img_out != img) img->rowRange(begin, end).copyTo(dst);
+        if (!apply) return;
+
+        // the part of the roi in this band, in band coordinates
+        cv::Rect roi = _roi & cv::Rect(0, begin, dst.cols, end - begin);
+        roi.y -= begin;
+        if (_in) {
+            if (!roi.area()) return;
+            Mat dst_roi = dst(roi);
+            if (_filter) {
+                Mat fmask;
+                if (_below) {
+                    fmask = dst_roi < _inValue;
                 } else {
-                    cv::Mat outliers =
-                        cv::Mat(img_out->size(), img_out->type(), _outValue);
-                    (*img_out)(_roi).copyTo(outliers(_roi));
-                    *img_out = outliers.clone();
+                    fmask = dst_roi > _inValue;
                 }
-            }
-        } else
-            BOOST_LOG_TRIVIAL(info)
-                << "Roi does not match image: img: " << rect_mat
-                << " roi: " << _roi << ". Skipping... .Filter  " << id()
-                << " not applied.";
-    } else
-        BOOST_LOG_TRIVIAL(info)
-            << "Roi is null. Skipping... .Filter  " << id() << " not applied.";
+                dst_roi.setTo(_outValue, fmask);
+            } else
+                dst_roi = _outValue;
+        } else {
+            // set everything outside the roi, then restore the roi
+            Mat keep;
+            if (roi.area()) keep = dst(roi).clone();
+            if (_filter) {
+                Mat fmask;
+                if (_below) {
+                    fmask = dst > _inValue;
+                } else {
+                    fmask = dst < _inValue;
+                }
+                dst.setTo(_outValue, fmask);
+            } else
+                dst = _outValue;
+            if (roi.area()) keep.copyTo(dst(roi));
+        }
+    });
 
     /*if (_in_img != _out_img) {
 	    matPtr img_out;
@@ -170,11 +167,68 @@ bool toffy::filters::Roi::filter(const Frame &in, Frame &out)
     return true;
 }
 
+bool toffy::filters::Roi::applies(const cv::Size &size) const
+{
+    if (_roi.area()) {
+        cv::Rect rect_mat(0, 0, size.width, size.height);
+        if ((_roi & rect_mat) == _roi) return true;
+        BOOST_LOG_TRIVIAL(info)
+            << "Roi does not match image: img: " << rect_mat
+            << " roi: " << _roi << ". Skipping... .Filter  " << id()
+            << " not applied.";
+    } else
+        BOOST_LOG_TRIVIAL(info)
+            << "Roi is null. Skipping... .Filter  " << id() << " not applied.";
+    return false;
+}
+
+bool toffy::filters::Roi::fusible(FusedPlanes &planes) const
+{
+    if (_in_img != _out_img) return false;
+    planes.depth = _in_img;
+    return true;
+}
+
+bool toffy::filters::Roi::fusedBegin(const cv::Mat &depth,
+                                     const cv::Mat * /*ampl*/, Frame & /*out*/)
+{
+    _fusedApply = applies(depth.size());
+    return true;
+}
+
+void toffy::filters::Roi::fusedRow(int y, float *depth, float * /*ampl*/,
+                                   int cols) const
+{
+    if (!_fusedApply) return;
+    // compare() and setTo() take the values as float for float images
+    const float inValue = _inValue, outValue = _outValue;
+    // the part of the roi in this row
+    bool inRoi = y >= _roi.y && y < _roi.y + _roi.height;
+    int x0 = inRoi ? _roi.x : 0, x1 = inRoi ? _roi.x + _roi.width : 0;
+    if (_in) {
+        for (int x = x0; x < x1; x++) {
+            if (!_filter ||
+                (_below ? depth[x] < inValue : depth[x] > inValue))
+                depth[x] = outValue;
+        }
+    } else {
+        auto outside = [&](int begin, int end) {
+            for (int x = begin; x < end; x++) {
+                if (!_filter ||
+                    (_below ? depth[x] > inValue : depth[x] < inValue))
+                    depth[x] = outValue;
+            }
+        };
+        outside(0, x0);
+        outside(x1, cols);
+    }
+}
+
 boost::property_tree::ptree toffy::filters::Roi::getConfig() const
 {
     boost::property_tree::ptree pt;
 
-    pt = Filter::getConfig();
+    pt = PixelFilter::getConfig();
 
     pt.put("options.x", _x);
     pt.put("options.y", _y);
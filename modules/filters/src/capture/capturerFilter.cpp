@@ -14,6 +14,7 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <algorithm>
 #include <map>
 #include <ctime>
 #include <iostream>
@@ -60,6 +61,7 @@ boost::property_tree::ptree CapturerFilter::getConfig() const
     pt.put("options.rotations", _rotations);
     //pt.put("options.flip_x", _rotations);
     pt.put("options.startIdx", _cnt);
+    pt.put("options.prefetch", _prefetch);
 
     return pt;
 }
@@ -124,7 +126,7 @@ void CapturerFilter::setFlip_y(bool flip_y)
     _flip_y = flip_y;
 }
 CapturerFilter::CapturerFilter(): _cnt(0), _beginFile(0), _endFile(0),
-    _playBack(false), _save(false), _flip(false), _flip_x(false),
+    _prefetch(0), _playBack(false), _save(false), _flip(false), _flip_x(false),
     _flip_y(false), _tsd(true), _backward(false),
     _center_position(0, 0., 0.) , _rotations(0.,.0,.0)
 {
@@ -132,7 +134,7 @@ CapturerFilter::CapturerFilter(): _cnt(0), _beginFile(0), _endFile(0),
 
 CapturerFilter::CapturerFilter(std::string type,
     std::size_t counter): Filter(type,counter), _cnt(0), _beginFile(0),
-    _endFile(0), _playBack(false), _save(false), _flip(false), _flip_x(false),
+    _endFile(0), _prefetch(0), _playBack(false), _save(false), _flip(false), _flip_x(false),
     _flip_y(false), _tsd(true),
     _backward(false), _center_position(0, 0., 0.) , _rotations(0.,.0,.0)
 {
@@ -290,6 +292,7 @@ void CapturerFilter::updateConfig(const boost::property_tree::ptree &pt)
     _tsd = pt.get<bool>("options.timeStamped",_tsd);
 
     _cnt = pt.get<int>("options.startIdx",_cnt);
+    _prefetch = std::max(0, pt.get<int>("options.prefetch",_prefetch));
 
     try {
 	boost::optional<const boost::property_tree::ptree& > ocvo = pt.get_child_optional( "options.center_position" );
@@ -0,0 +1,500 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+#include <limits>
+
+#ifdef MSVC
+#define _USE_MATH_DEFINES
+#endif
+#include <cmath>
+
+#include <boost/log/trivial.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <opencv2/core.hpp>
+
+#include <toffy/capture/synthetic.hpp>
+#include <toffy/matPool.hpp>
+
+using namespace toffy;
+using namespace toffy::capturers;
+namespace pt = boost::posix_time;
+
+const std::string SyntheticCapturer::id_name = "synthetic";
+
+namespace {
+
+const float floorRefl = 0.35f;
+
+/**
+ * splitmix64, used instead of the std distributions, whose output differs
+ * between standard libraries
+ */
+inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline float uniform(uint64_t& state, float lo, float hi)
+{
+    state += 0x9e3779b97f4a7c15ULL;
+    return lo + (hi - lo) * (mix(state) >> 40) * (1.f / (1 << 24));
+}
+
+/** about N(0, 1) from the sum of four 12 bit uniforms */
+inline float gauss(uint64_t r)
+{
+    int s = (int)(r & 0xfff) + (int)((r >> 12) & 0xfff) +
+            (int)((r >> 24) & 0xfff) + (int)((r >> 36) & 0xfff);
+    return (s - 4 * 2047.5f) * (1.f / 2364.6f);
+}
+
+inline float wrap(float v, float half)
+{
+    v = std::fmod(v + half, 2 * half);
+    if (v < 0) v += 2 * half;
+    return v - half;
+}
+
+/**
+ * Limit [lo, hi] to the z where the ray coordinate d * z lies within
+ * c +- half.
+ */
+inline void slab(float d, float c, float half, float& lo, float& hi)
+{
+    if (std::fabs(d) < 1e-9f) {
+        if (std::fabs(c) > half) lo = std::numeric_limits<float>::infinity();
+        return;
+    }
+    float z1 = (c - half) / d, z2 = (c + half) / d;
+    if (z1 > z2) std::swap(z1, z2);
+    lo = std::max(lo, z1);
+    hi = std::min(hi, z2);
+}
+
+/**
+ * z where the ray (u, v, 1) enters the elliptic cylinder centered at X, Y
+ * with radii a, b reaching from the floor at z = ground up to z = top,
+ * infinity if it misses. @p r2 is the squared normalized radius of the
+ * hit point.
+ */
+inline float enterCylinder(float u, float v, float X, float Y, float a,
+                           float b, float top, float ground, float& r2)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    float ia = 1 / (a * a), ib = 1 / (b * b);
+    // ((u z - X) / a)^2 + ((v z - Y) / b)^2 <= 1
+    float A = u * u * ia + v * v * ib, B = -2 * (u * X * ia + v * Y * ib),
+          C = X * X * ia + Y * Y * ib - 1;
+    float lo = top, hi = ground;
+    if (A < 1e-12f) {
+        if (C > 0) return inf;
+    } else {
+        float disc = B * B - 4 * A * C;
+        if (disc < 0) return inf;
+        float s = std::sqrt(disc);
+        lo = std::max(lo, (-B - s) / (2 * A));
+        hi = std::min(hi, (-B + s) / (2 * A));
+        if (lo > hi) return inf;
+    }
+    float dx = u * lo - X, dy = v * lo - Y;
+    r2 = dx * dx * ia + dy * dy * ib;
+    return lo;
+}
+
+inline short mm(float m) { return (short)std::lround(m * 1000.f); }
+
+}  // namespace
+
+SyntheticCapturer::SyntheticCapturer()
+    : CapturerFilter(SyntheticCapturer::id_name, 0),
+      _width(160),
+      _height(120),
+      _fps(25),
+      _realtime(false),
+      _mode("distAmp"),
+      _seed(1),
+      _fovx(90),
+      _fovy(67.5f),
+      _ground(3.f),
+      _speed(1.f),
+      _noise(0.01f),
+      _dropout(0.01f),
+      _amplitude(4000),
+      _boxes(2),
+      _people(3),
+      _loop(0),
+      _nanDropout(false),
+      _modFreq(20000),
+      _intTime(1000),
+      _out_depth("depth"),
+      _out_ampl("ampl"),
+      _out_x("x"),
+      _out_y("y"),
+      _out_z("z"),
+      _out_fc("fc"),
+      _out_ts("ts"),
+      _out_mf("mf"),
+      _out_it("it"),
+      _out_mt("mt"),
+      _out_lt("lt"),
+      _out_gt("gt"),
+      _fc(0),
+      _connected(true),
+      _dirty(true)
+{
+}
+
+boost::property_tree::ptree SyntheticCapturer::getConfig() const
+{
+    boost::property_tree::ptree pt = CapturerFilter::getConfig();
+
+    pt.put("options.width", _width);
+    pt.put("options.height", _height);
+    pt.put("options.fps", _fps);
+    pt.put("options.realtime", _realtime);
+    pt.put("options.frameMode", _mode);
+    pt.put("options.seed", _seed);
+    pt.put("options.fovx", _fovx);
+    pt.put("options.fovy", _fovy);
+    pt.put("options.ground", _ground);
+    pt.put("options.boxes", _boxes);
+    pt.put("options.people", _people);
+    pt.put("options.loop", _loop);
+    pt.put("options.speed", _speed);
+    pt.put("options.noise", _noise);
+    pt.put("options.dropout", _dropout);
+    pt.put("options.nanDropout", _nanDropout);
+    pt.put("options.amplitude", _amplitude);
+    pt.put("options.mf", _modFreq);
+    pt.put("options.it", _intTime);
+
+    pt.put("outputs.depth", _out_depth);
+    pt.put("outputs.ampl", _out_ampl);
+    pt.put("outputs.x", _out_x);
+    pt.put("outputs.y", _out_y);
+    pt.put("outputs.z", _out_z);
+    pt.put("outputs.fc", _out_fc);
+    pt.put("outputs.ts", _out_ts);
+    pt.put("outputs.mf", _out_mf);
+    pt.put("outputs.it", _out_it);
+    pt.put("outputs.mt", _out_mt);
+    pt.put("outputs.lt", _out_lt);
+    pt.put("outputs.gt", _out_gt);
+
+    return pt;
+}
+
+void SyntheticCapturer::updateConfig(const boost::property_tree::ptree& pt)
+{
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id();
+
+    CapturerFilter::updateConfig(pt);
+
+    _width = std::max(1, pt.get<int>("options.width", _width));
+    _height = std::max(1, pt.get<int>("options.height", _height));
+    _fps = pt.get<double>("options.fps", _fps);
+    if (_fps <= 0) _fps = 25;
+    _realtime = pt.get<bool>("options.realtime", _realtime);
+    _mode = pt.get<std::string>("options.frameMode", _mode);
+    if (_mode != "distAmp" && _mode != "xyz" && _mode != "xyzAmp") {
+        BOOST_LOG_TRIVIAL(warning)
+            << id() << ": unknown frameMode " << _mode << ", using distAmp";
+        _mode = "distAmp";
+    }
+    _seed = pt.get<uint32_t>("options.seed", _seed);
+    _fovx = pt.get<float>("options.fovx", _fovx);
+    _fovy = pt.get<float>("options.fovy", _fovy);
+    _ground = pt.get<float>("options.ground", _ground);
+    _boxes = std::max(0, pt.get<int>("options.boxes", _boxes));
+    _people = std::max(0, pt.get<int>("options.people", _people));
+    _loop = std::max(0, pt.get<int>("options.loop", _loop));
+    _speed = pt.get<float>("options.speed", _speed);
+    _noise = pt.get<float>("options.noise", _noise);
+    _dropout = pt.get<float>("options.dropout", _dropout);
+    _nanDropout = pt.get<bool>("options.nanDropout", _nanDropout);
+    _amplitude = pt.get<float>("options.amplitude", _amplitude);
+    _modFreq = pt.get<unsigned int>("options.mf", _modFreq);
+    _intTime = pt.get<unsigned int>("options.it", _intTime);
+
+    _out_depth = pt.get<std::string>("outputs.depth", _out_depth);
+    _out_ampl = pt.get<std::string>("outputs.ampl", _out_ampl);
+    _out_x = pt.get<std::string>("outputs.x", _out_x);
+    _out_y = pt.get<std::string>("outputs.y", _out_y);
+    _out_z = pt.get<std::string>("outputs.z", _out_z);
+    _out_fc = pt.get<std::string>("outputs.fc", _out_fc);
+    _out_ts = pt.get<std::string>("outputs.ts", _out_ts);
+    _out_mf = pt.get<std::string>("outputs.mf", _out_mf);
+    _out_it = pt.get<std::string>("outputs.it", _out_it);
+    _out_mt = pt.get<std::string>("outputs.mt", _out_mt);
+    _out_lt = pt.get<std::string>("outputs.lt", _out_lt);
+    _out_gt = pt.get<std::string>("outputs.gt", _out_gt);
+
+    _dirty = true;
+}
+
+int SyntheticCapturer::connect()
+{
+    _connected = true;
+    _next = pt::ptime();
+    return 1;
+}
+
+int SyntheticCapturer::disconnect()
+{
+    _connected = false;
+    return 1;
+}
+
+void SyntheticCapturer::build()
+{
+    const float deg = (float)M_PI / 180;
+    _fx = (_width / 2.f) / std::tan(_fovx * deg / 2);
+    _fy = (_height / 2.f) / std::tan(_fovy * deg / 2);
+    _cx = (_width - 1) / 2.f;
+    _cy = (_height - 1) / 2.f;
+
+    _u.resize(_width);
+    _v.resize(_height);
+    for (int x = 0; x < _width; x++) _u[x] = (x - _cx) / _fx;
+    for (int y = 0; y < _height; y++) _v[y] = (y - _cy) / _fy;
+    _k.resize((size_t)_width * _height);
+    for (int y = 0; y < _height; y++) {
+        for (int x = 0; x < _width; x++) {
+            _k[(size_t)y * _width + x] =
+                std::sqrt(1 + _u[x] * _u[x] + _v[y] * _v[y]);
+        }
+    }
+    _z.resize(_k.size());
+    _refl.resize(_k.size());
+    _lo.resize(_width);
+    _hi.resize(_width);
+
+    // the visible floor plus a margin to enter and leave the view
+    _halfX = _ground * (_width / 2.f) / _fx + 1;
+    _halfY = _ground * (_height / 2.f) / _fy + 1;
+
+    uint64_t s = _seed;
+    _objects.resize(_boxes + _people);
+    for (size_t i = 0; i < _objects.size(); i++) {
+        Object& o = _objects[i];
+        o.person = (int)i >= _boxes;
+        o.x0 = uniform(s, -_halfX, _halfX);
+        o.y0 = uniform(s, -_halfY, _halfY);
+        float dir = uniform(s, 0, 2 * (float)M_PI),
+              v = _speed * uniform(s, 0.2f, 1.f);
+        o.vx = v * std::cos(dir);
+        o.vy = v * std::sin(dir);
+        if (o.person) {
+            o.a = uniform(s, 0.2f, 0.28f);
+            o.b = o.a * 0.6f;
+            o.h = uniform(s, 1.5f, 1.95f);
+            o.refl = uniform(s, 0.4f, 0.7f);
+        } else {
+            o.a = uniform(s, 0.15f, 0.5f);
+            o.b = uniform(s, 0.15f, 0.5f);
+            o.h = uniform(s, 0.2f, 1.f);
+            o.refl = uniform(s, 0.3f, 0.9f);
+        }
+        // keep the camera above everything
+        o.h = std::min(o.h, _ground * 0.8f);
+    }
+    // tall objects first, they hide more of the others
+    std::stable_sort(
+        _objects.begin(), _objects.end(),
+        [](const Object& a, const Object& b) { return a.h > b.h; });
+    _cache.assign(_loop, std::vector<cv::Mat>());
+    _dirty = false;
+
+    BOOST_LOG_TRIVIAL(debug) << id() << ": " << _width << "x" << _height
+                             << ", " << _boxes << " boxes, " << _people
+                             << " people";
+}
+
+void SyntheticCapturer::drawObject(const Object& o, float t)
+{
+    float X = wrap(o.x0 + o.vx * t, _halfX), Y = wrap(o.y0 + o.vy * t, _halfY);
+    // pixels seeing the top or the sides
+    float zt = _ground - o.h;
+    float u0 = std::min((X - o.a) / zt, (X - o.a) / _ground),
+          u1 = std::max((X + o.a) / zt, (X + o.a) / _ground),
+          v0 = std::min((Y - o.b) / zt, (Y - o.b) / _ground),
+          v1 = std::max((Y + o.b) / zt, (Y + o.b) / _ground);
+    int x0 = std::max(0, (int)std::floor(_cx + u0 * _fx)),
+        x1 = std::min(_width - 1, (int)std::ceil(_cx + u1 * _fx)),
+        y0 = std::max(0, (int)std::floor(_cy + v0 * _fy)),
+        y1 = std::min(_height - 1, (int)std::ceil(_cy + v1 * _fy));
+
+    // the columns and rows that can see the bounding box
+    for (int x = x0; x <= x1; x++) {
+        _lo[x] = zt;
+        _hi[x] = _ground;
+        slab(_u[x], X, o.a, _lo[x], _hi[x]);
+    }
+    for (int y = y0; y <= y1; y++) {
+        float rlo = zt, rhi = _ground;
+        slab(_v[y], Y, o.b, rlo, rhi);
+        if (rlo > rhi) continue;
+        float* zbuf = &_z[(size_t)y * _width];
+        float* refl = &_refl[(size_t)y * _width];
+        for (int x = x0; x <= x1; x++) {
+            float z = std::max(rlo, _lo[x]);
+            if (z > std::min(rhi, _hi[x]) || z >= zbuf[x]) continue;
+            if (o.person) {
+                // shoulders falling off to the sides, head on top
+                float zs = _ground - 0.82f * o.h, r2 = 0;
+                z = enterCylinder(_u[x], _v[y], X, Y, o.a, o.b, zs, _ground,
+                                  r2);
+                if (z == zs) z += 0.25f * o.h * r2;
+                // rays missing the body could only graze the head
+                if (z != std::numeric_limits<float>::infinity()) {
+                    float zh = enterCylinder(_u[x], _v[y], X, Y, 0.1f, 0.1f,
+                                             zt, _ground, r2);
+                    if (zh == zt) zh += 0.12f * r2;
+                    z = std::min(z, zh);
+                }
+            }
+            if (z < zbuf[x]) {
+                zbuf[x] = z;
+                refl[x] = o.refl;
+            }
+        }
+    }
+}
+
+matPtr SyntheticCapturer::output(Frame& out, const std::string& key, int type)
+{
+    matPtr m = out.optMatPtr(key, matPtr());
+    if (!m || m->rows != _height || m->cols != _width || m->type() != type) {
+        m = MatPool::global().acquire(_height, _width, type);
+        out.addData(key, m);
+    }
+    return m;
+}
+
+void SyntheticCapturer::render(unsigned int fc, Frame& out)
+{
+    if (_dirty) build();
+
+    bool dist = _mode == "distAmp", xyz = !dist, ampl = _mode != "xyz";
+    matPtr all[outputCount];
+    if (dist) all[0] = output(out, _out_depth, CV_32F);
+    if (ampl) all[1] = output(out, _out_ampl, CV_16U);
+    if (xyz) {
+        all[2] = output(out, _out_x, CV_16S);
+        all[3] = output(out, _out_y, CV_16S);
+        all[4] = output(out, _out_z, CV_16S);
+    }
+
+    if (_loop) {
+        std::vector<cv::Mat>& cached = _cache[fc % _loop];
+        if (cached.empty()) {
+            draw(fc % _loop, all);
+            cached.resize(outputCount);
+            for (int i = 0; i < outputCount; i++) {
+                if (all[i]) all[i]->copyTo(cached[i]);
+            }
+        } else {
+            for (int i = 0; i < outputCount; i++) {
+                if (all[i]) cached[i].copyTo(*all[i]);
+            }
+        }
+    } else {
+        draw(fc, all);
+    }
+
+    if (flip() || flip_x() || flip_y()) {
+        int code = flip() || (flip_x() && flip_y()) ? -1 : flip_x() ? 1 : 0;
+        for (int i = 0; i < outputCount; i++) {
+            if (all[i]) cv::flip(*all[i], *all[i], code);
+        }
+    }
+
+    out.addData(_out_fc, fc);
+    out.addData(_out_ts, (unsigned int)std::lround(fc * 1000. / _fps));
+    out.addData(_out_mf, _modFreq);
+    out.addData(_out_it, _intTime);
+    out.addData(_out_mt, 40.f);
+    out.addData(_out_lt, 40.f);
+    out.addData(_out_gt, 40.f);
+}
+
+void SyntheticCapturer::draw(unsigned int fc, const matPtr* all)
+{
+    float t = (float)(fc / _fps);
+    std::fill(_z.begin(), _z.end(), _ground);
+    std::fill(_refl.begin(), _refl.end(), floorRefl);
+    for (size_t i = 0; i < _objects.size(); i++) drawObject(_objects[i], t);
+
+    const matPtr &d = all[0], &a = all[1], &mx = all[2], &my = all[3],
+                 &mz = all[4];
+    const float invalid =
+        _nanDropout ? std::numeric_limits<float>::quiet_NaN() : 0.f;
+    const uint32_t dropLimit =
+        (uint32_t)(std::min(std::max(_dropout, 0.f), 1.f) * 65536);
+    const uint64_t key = mix(((uint64_t)_seed << 32) | fc);
+    for (int y = 0; y < _height; y++) {
+        float* pd = d ? d->ptr<float>(y) : NULL;
+        uint16_t* pa = a ? a->ptr<uint16_t>(y) : NULL;
+        short* px = mx ? mx->ptr<short>(y) : NULL;
+        short* py = my ? my->ptr<short>(y) : NULL;
+        short* pz = mz ? mz->ptr<short>(y) : NULL;
+        size_t row = (size_t)y * _width;
+        for (int x = 0; x < _width; x++) {
+            size_t i = row + x;
+            uint64_t r = mix(key + i * 0x9e3779b97f4a7c15ULL);
+            bool dropped = (r & 0xffff) < dropLimit;
+            float range = _z[i] * _k[i] + _noise * gauss(r >> 16);
+            if (pd) pd[x] = dropped ? invalid : range;
+            if (pa) {
+                pa[x] = dropped ? 0
+                                : (uint16_t)std::min(
+                                      65535.f, _amplitude * _refl[i] /
+                                                   (range * range));
+            }
+            if (pz) {
+                float z = dropped ? 0.f : range / _k[i];
+                px[x] = mm(_u[x] * z);
+                py[x] = mm(_v[y] * z);
+                pz[x] = mm(z);
+            }
+        }
+    }
+}
+
+bool SyntheticCapturer::filter(const Frame& /*in*/, Frame& out)
+{
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id();
+    if (!_connected) return false;
+
+    if (_realtime) {
+        pt::time_duration period = pt::microseconds((long)(1e6 / _fps));
+        pt::ptime now = pt::microsec_clock::local_time();
+        if (_next.is_not_a_date_time() || now > _next + period) {
+            // first frame or too slow, do not try to catch up
+            _next = now;
+        } else if (now < _next) {
+            boost::this_thread::sleep(_next - now);
+        }
+        _next += period;
+    }
+
+    render(_fc, out);
+    _fc++;
+    return true;
+}
@@ -24,6 +24,7 @@
 #include <boost/log/trivial.hpp>
 #include <toffy/common/filenodehelper.hpp>
 
+#include <toffy/cam/cameraParams.hpp>
 #include <toffy/detection/mask.hpp>
 
 using namespace toffy;
@@ -336,7 +337,7 @@ bool Mask::filter(const Frame &in, Frame &out)
         } catch (const boost::bad_any_cast &) {
             BOOST_LOG_TRIVIAL(debug) << "Not mask.";
             mask.reset(new cv::Mat());
-            out.addData("mask", mask);
+            out.addData(_out_mask, mask);
         }
 
         if (mask->empty()) {
@@ -615,43 +616,10 @@ void Mask::generate3D()
     if (!img3d) {
         img3d.reset(new cv::Mat(depth->size(), CV_32FC3));
     }
-
-    //Allocating the 3D points
-
-    //Saving parameter from the camera matrix
-    static double fl_x_reciprocal = 1.f / _cameraMatrix->at<double>(0, 0);
-    static double fl_y_reciprocal = 1.f / _cameraMatrix->at<double>(1, 1);
-    static double center_x = _cameraMatrix->at<double>(0, 2);
-    static double center_y = _cameraMatrix->at<double>(1, 2);
+    if (!_rays || !_rays->matches(*_cameraMatrix, depth->size())) {
+        _rays = cam::RayMap::get(*_cameraMatrix, depth->size());
+    }
 
     // Calculates the 3D point for each depth value
-    for (int y = 0; y < static_cast<int>(depth->rows); ++y) {
-        for (int x = 0; x < static_cast<int>(depth->cols); ++x) {
-            //PointWithRange& point = getPointNoCheck (x, y);
-            float *dptr = img3d->ptr<float>(y, x);
-            float depthValue = depth->at<float>(y, x);
-
-            dptr[0] = numeric_limits<float>::quiet_NaN();  //X
-            dptr[1] = numeric_limits<float>::quiet_NaN();  //Y
-            dptr[2] = numeric_limits<float>::quiet_NaN();  //Y
-            //cout << " Filtered (" << x << "," << y << ")" << endl;
-
-            //cout << "(" << x << "," << y << ")" << endl;
-            //cout << frame.amp().at<unsigned short>(y,x) << endl;
-            //point.z = depth;
-            //point.x = (static_cast<float> (x) - center_x) * point.z * fl_x_reciprocal;
-            //point.y = (static_cast<float> (y) - center_y) * point.z * fl_y_reciprocal;
-            /*
-         * cout << "x: " <<  (static_cast<float> (x) - center_x) * depthValue * fl_x_reciprocal;
-         * cout << ", y: " <<  (static_cast<float> (y) - center_y) * depthValue * fl_y_reciprocal;
-         * cout << ", z: " <<  depthValue << endl;
-         */
-            //Set 3D points
-            dptr[0] = (static_cast<float>(x) - center_x) * depthValue *
-                      fl_x_reciprocal;  //X
-            dptr[1] = (static_cast<float>(y) - center_y) * depthValue *
-                      fl_y_reciprocal;  //Y
-            dptr[2] = depthValue;       //Z
-        }
-    }
+    _rays->backProject(*depth, *img3d);
 }
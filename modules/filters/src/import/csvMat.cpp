@@ -0,0 +1,432 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <stdint.h>
+#if !defined(MSVC)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <boost/log/trivial.hpp>
+
+#include <toffy/import/csvMat.hpp>
+
+namespace {
+
+const double powers[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                         1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                         1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/** longest text of one value, including the ';' */
+const size_t maxValue = 32;
+/** rows are written in blocks of about this size */
+const size_t blockSize = 1 << 16;
+
+inline char *putUInt(char *p, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+inline char *putInt(char *p, int64_t v)
+{
+    if (v < 0) {
+        *p++ = '-';
+        return putUInt(p, 0 - (uint64_t)v);
+    }
+    return putUInt(p, v);
+}
+
+inline char *putPrintf(char *p, double v)
+{
+    return p + snprintf(p, maxValue, "%g", v);
+}
+
+/**
+ * printf("%g", v): 6 significant digits, exponent notation below 1e-4 and
+ * from 1e6 on, no trailing zeros.
+ *
+ * A float times 10^k, k <= 9, needs at most 24 + 21 bits (10^k = 2^k 5^k),
+ * so the product is exact in a double and rounding it to an integer gives
+ * the same digits as printf. The exponent notation, NaN and inf are rare
+ * and left to printf.
+ */
+inline char *putFloat(char *p, float f)
+{
+    if (f == 0) {
+        if (std::signbit(f)) *p++ = '-';
+        *p++ = '0';
+        return p;
+    }
+    double a = std::fabs((double)f);
+    if (!(a >= 1e-4 && a < 1e6)) return putPrintf(p, f);
+
+    int e = 5;  // decimal exponent of the first digit
+    while (e > -4 && a < (e >= 0 ? powers[e] : 1. / powers[-e])) e--;
+    double m = std::nearbyint(a * powers[5 - e]);
+    if (m >= 1e6) {  // rounded up to the next power of ten
+        if (++e > 5) return putPrintf(p, f);
+        m = 1e5;
+    }
+    if (m < 1e5) return putPrintf(p, f);
+
+    char d[6];
+    uint32_t digits = (uint32_t)m;
+    for (int i = 5; i >= 0; i--) {
+        d[i] = '0' + digits % 10;
+        digits /= 10;
+    }
+    int last = 5;
+    while (d[last] == '0') last--;
+
+    if (f < 0) *p++ = '-';
+    if (e >= 0) {
+        for (int i = 0; i <= e; i++) *p++ = d[i];
+        if (last > e) {
+            *p++ = '.';
+            for (int i = e + 1; i <= last; i++) *p++ = d[i];
+        }
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = -1; i > e; i--) *p++ = '0';
+        for (int i = 0; i <= last; i++) *p++ = d[i];
+    }
+    return p;
+}
+
+inline char *put(char *p, uint8_t v) { return putUInt(p, v); }
+inline char *put(char *p, uint16_t v) { return putUInt(p, v); }
+inline char *put(char *p, int16_t v) { return putInt(p, v); }
+inline char *put(char *p, int32_t v) { return putInt(p, v); }
+inline char *put(char *p, float v) { return putFloat(p, v); }
+inline char *put(char *p, double v) { return putPrintf(p, v); }
+
+template <typename T>
+void formatRows(const cv::Mat &mat, int y0, int y1, std::string &out)
+{
+    size_t start = out.size();
+    out.resize(start + (size_t)(y1 - y0) * (mat.cols * maxValue + 1));
+    char *begin = &out[0];
+    char *p = begin + start;
+    for (int y = y0; y < y1; y++) {
+        const T *row = mat.ptr<T>(y);
+        for (int x = 0; x < mat.cols; x++) {
+            p = put(p, row[x]);
+            *p++ = ';';
+        }
+        *p++ = '\n';
+    }
+    out.resize(p - begin);
+}
+
+bool formatRows(const cv::Mat &mat, int y0, int y1, std::string &out)
+{
+    if (mat.channels() != 1) return false;
+    switch (mat.type()) {
+        case CV_8UC1:
+            formatRows<uint8_t>(mat, y0, y1, out);
+            break;
+        case CV_16UC1:
+            formatRows<uint16_t>(mat, y0, y1, out);
+            break;
+        case CV_16SC1:
+            formatRows<int16_t>(mat, y0, y1, out);
+            break;
+        case CV_32SC1:
+            formatRows<int32_t>(mat, y0, y1, out);
+            break;
+        case CV_32FC1:
+            formatRows<float>(mat, y0, y1, out);
+            break;
+        case CV_64FC1:
+            formatRows<double>(mat, y0, y1, out);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+inline bool separator(char c)
+{
+    return c == ';' || c == ',' || c == ' ' || c == '\n' || c == '\r' ||
+           c == '\t';
+}
+
+/** a parsed value, integral if it has neither a '.' nor an exponent */
+struct Number {
+    bool integral;
+    int64_t i;
+    double d;
+};
+
+/** strtod on a copy of the token, for whatever the fast path rejects */
+bool parseSlow(const char *p, const char *end, Number &n)
+{
+    char buf[64];
+    size_t len = end - p;
+    if (len >= sizeof(buf)) return false;
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    char *stop;
+    n.d = strtod(buf, &stop);
+    n.integral = false;
+    return stop == buf + len;
+}
+
+/**
+ * Decimal numbers with up to 19 significant digits. Mantissa and power of
+ * ten are exact doubles for the values written by format(), so a single
+ * multiplication or division rounds correctly.
+ */
+bool parseNumber(const char *p, const char *end, Number &n)
+{
+    const char *start = p;
+    bool neg = false;
+    if (*p == '-' || *p == '+') neg = *p++ == '-';
+
+    uint64_t mant = 0;
+    int digits = 0, exp = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if (mant == 0 && *p == '0') continue;
+        if (digits < 19) {
+            mant = mant * 10 + (*p - '0');
+            digits++;
+        } else {
+            exp++;
+        }
+    }
+    n.integral = true;
+    if (p < end && *p == '.') {
+        n.integral = false;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            if (mant == 0 && *p == '0') {
+                exp--;
+                continue;
+            }
+            if (digits < 19) {
+                mant = mant * 10 + (*p - '0');
+                digits++;
+                exp--;
+            }
+        }
+    }
+    if (!any) return parseSlow(start, end, n);
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        n.integral = false;
+        p++;
+        bool eneg = false;
+        if (p < end && (*p == '-' || *p == '+')) eneg = *p++ == '-';
+        if (p == end) return parseSlow(start, end, n);
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (e < 10000) e = e * 10 + (*p - '0');
+        }
+        exp += eneg ? -e : e;
+    }
+    if (p != end) return parseSlow(start, end, n);
+
+    if (n.integral && exp == 0 && mant <= (uint64_t)INT64_MAX) {
+        n.i = neg ? -(int64_t)mant : (int64_t)mant;
+        n.d = neg ? -(double)mant : (double)mant;
+        return true;
+    }
+    n.integral = false;
+    if (mant >= (1ull << 53) || exp < -22 || exp > 22) {
+        return parseSlow(start, end, n);
+    }
+    n.d = exp >= 0 ? mant * powers[exp] : mant / powers[-exp];
+    if (neg) n.d = -n.d;
+    return true;
+}
+
+template <typename T>
+inline T clamp(const Number &n)
+{
+    double lo = std::numeric_limits<T>::min(),
+           hi = std::numeric_limits<T>::max();
+    if (n.integral) {
+        return n.i < lo ? (T)lo : n.i > hi ? (T)hi : (T)n.i;
+    }
+    if (std::isnan(n.d)) return 0;
+    double r = std::nearbyint(n.d);
+    return r < lo ? (T)lo : r > hi ? (T)hi : (T)r;
+}
+
+template <typename T>
+inline void store(T &dst, const Number &n)
+{
+    dst = clamp<T>(n);
+}
+template <>
+inline void store(float &dst, const Number &n)
+{
+    dst = (float)n.d;
+}
+template <>
+inline void store(double &dst, const Number &n)
+{
+    dst = n.d;
+}
+
+template <typename T>
+size_t parseAs(const char *p, const char *end, cv::Mat &mat)
+{
+    size_t count = 0;
+    for (int y = 0; y < mat.rows; y++) {
+        T *row = mat.ptr<T>(y);
+        for (int x = 0; x < mat.cols;) {
+            while (p < end && separator(*p)) p++;
+            if (p == end) return count;
+            const char *token = p;
+            while (p < end && !separator(*p)) p++;
+            Number n;
+            if (!parseNumber(token, p, n)) {
+                BOOST_LOG_TRIVIAL(debug)
+                    << "csv: skipping " << std::string(token, p);
+                continue;
+            }
+            store(row[x++], n);
+            count++;
+        }
+    }
+    return count;
+}
+
+}  // namespace
+
+namespace toffy {
+namespace csv {
+
+bool format(const cv::Mat &mat, std::string &out)
+{
+    return formatRows(mat, 0, mat.rows, out);
+}
+
+bool write(const std::string &path, const cv::Mat &mat)
+{
+    std::string block;
+    if (!formatRows(mat, 0, 0, block)) {
+        BOOST_LOG_TRIVIAL(warning) << "csv: cannot write mats of type "
+                                   << mat.type() << " to " << path;
+        return false;
+    }
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "csv: could not create " << path << ": " << strerror(errno);
+        return false;
+    }
+    int rows = std::max<int>(1, blockSize / (mat.cols * maxValue + 1));
+    block.reserve(rows * (mat.cols * maxValue + 1));
+    bool ok = true;
+    for (int y = 0; y < mat.rows && ok; y += rows) {
+        block.clear();
+        formatRows(mat, y, std::min(y + rows, mat.rows), block);
+        ok = fwrite(block.data(), 1, block.size(), f) == block.size();
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok) BOOST_LOG_TRIVIAL(warning) << "csv: could not write " << path;
+    return ok;
+}
+
+size_t parse(const char *begin, const char *end, cv::Mat &mat)
+{
+    if (mat.channels() != 1) return 0;
+    switch (mat.type()) {
+        case CV_8UC1:
+            return parseAs<uint8_t>(begin, end, mat);
+        case CV_16UC1:
+            return parseAs<uint16_t>(begin, end, mat);
+        case CV_16SC1:
+            return parseAs<int16_t>(begin, end, mat);
+        case CV_32SC1:
+            return parseAs<int32_t>(begin, end, mat);
+        case CV_32FC1:
+            return parseAs<float>(begin, end, mat);
+        case CV_64FC1:
+            return parseAs<double>(begin, end, mat);
+    }
+    return 0;
+}
+
+size_t read(const std::string &path, cv::Mat &mat)
+{
+#if defined(MSVC)
+    // no mmap: read the file through its stream into one buffer
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "csv: could not open " << path << ": " << strerror(errno);
+        return 0;
+    }
+    std::vector<char> data;
+    char block[65536];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+        data.insert(data.end(), block, block + n);
+    }
+    fclose(f);
+    if (data.empty()) return 0;
+    return parse(data.data(), data.data() + data.size(), mat);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "csv: could not open " << path << ": " << strerror(errno);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return 0;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        BOOST_LOG_TRIVIAL(warning) << "csv: could not map " << path;
+        return 0;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    const char *data = (const char *)p;
+    size_t count = parse(data, data + st.st_size, mat);
+    munmap(p, st.st_size);
+    return count;
+#endif
+}
+
+}  // namespace csv
+}  // namespace toffy
@@ -0,0 +1,107 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <boost/log/trivial.hpp>
+
+#include <toffy/filter_helpers.hpp>
+
+#include "toffy/import/importSnapshot.hpp"
+#include "toffy/import/snapshot.hpp"
+
+using namespace toffy;
+using namespace toffy::import;
+
+std::size_t ImportSnapshot::_filter_counter = 1;
+const std::string ImportSnapshot::id_name = "importSnapshot";
+
+ImportSnapshot::ImportSnapshot()
+    : Filter(id_name, _filter_counter),
+      path("./"),
+      prefix("tofData"),
+      _seq(false),
+      start(1),
+      counter(1)
+{
+    _filter_counter++;
+}
+
+boost::property_tree::ptree ImportSnapshot::getConfig() const
+{
+    boost::property_tree::ptree pt;
+
+    pt = Filter::getConfig();
+
+    pt.put("options.path", path);
+    pt.put("options.prefix", prefix);
+    pt.put("options.start", start);
+    pt.put("options.sequence", _seq);
+
+    return pt;
+}
+
+void ImportSnapshot::updateConfig(const boost::property_tree::ptree& pt)
+{
+    LOG(debug) << __FUNCTION__ << " " << id();
+
+    Filter::updateConfig(pt);
+
+    _seq = pt.get<bool>("options.sequence", _seq);
+
+    path = pt.get("options.path", path);
+    prefix = pt.get("options.prefix", prefix);
+    start = pt.get("options.start", start);
+    counter = start;
+}
+
+bool ImportSnapshot::filter(const Frame& in, Frame& out)
+{
+    BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id();
+    UNUSED(in);
+
+    if (load(out, counter)) {
+        return true;
+    }
+    if (counter == start) {
+        return false;  // none ever worked
+    }
+    BOOST_LOG_TRIVIAL(info) << id() << " RESTARTING AT " << start;
+    counter = start;
+    return load(out, counter);
+}
+
+bool ImportSnapshot::load(Frame& f, int idx)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s/%s_%04d.tfs", path.c_str(),
+             prefix.c_str(), idx);
+    BOOST_LOG_TRIVIAL(debug) << id() << "... to open " << buf;
+
+    static const std::vector<std::string> skip(1, "counter");
+    Frame loaded;
+    if (!snapshot::read(buf, loaded, skip)) {
+        BOOST_LOG_TRIVIAL(warning) << id() << " failed to open " << buf;
+        return false;
+    }
+    if (!loaded.hasKey("fc")) {
+        loaded.addData("fc", 0u);
+    }
+    if (!loaded.hasKey("ts")) {
+        loaded.addData("ts", (unsigned int)counter);
+    }
+    f.merge(loaded);
+
+    counter++;
+    return true;
+}
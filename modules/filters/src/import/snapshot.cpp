@@ -0,0 +1,594 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#if !defined(MSVC)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+#include <opencv2/core.hpp>
+
+#include <toffy/import/snapshot.hpp>
+#include <toffy/matPool.hpp>
+
+using namespace toffy;
+using namespace toffy::snapshot;
+
+namespace {
+
+const char snapshotMagic[8] = {'T', 'O', 'F', 'F', 'Y', 'S', 'N', 'P'};
+const uint32_t snapshotVersion = 1;
+
+inline uint64_t align8(uint64_t v) { return (v + 7) & ~(uint64_t)7; }
+
+// LZ4 block format: sequences of a token (literal length << 4 | match
+// length - 4), the literals, a 16 bit offset and extra length bytes. The
+// last 5 bytes are always literals and no match starts in the last 12.
+const size_t minMatch = 4, lastLiterals = 5, matchLimit = 12;
+const int hashLog = 12;
+const size_t maxOffset = 65535;
+
+inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - hashLog);
+}
+
+inline uint8_t *putLength(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/** literals and match of one sequence, NULL if out of space */
+uint8_t *putSequence(uint8_t *op, uint8_t *oend, const uint8_t *literals,
+                     size_t litLen, size_t offset, size_t matchLen)
+{
+    if (op + 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1 > oend) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)(std::min<size_t>(litLen, 15) << 4);
+    if (litLen >= 15) op = putLength(op, litLen - 15);
+    memcpy(op, literals, litLen);
+    op += litLen;
+    if (!matchLen) return op;  // the last sequence
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    size_t ml = matchLen - minMatch;
+    *token |= (uint8_t)std::min<size_t>(ml, 15);
+    if (ml >= 15) op = putLength(op, ml - 15);
+    return op;
+}
+
+/** byte b of element i goes to b * count + i */
+void shuffle(const uint8_t *src, size_t count, size_t elemSize, uint8_t *dst)
+{
+    for (size_t b = 0; b < elemSize; b++) {
+        uint8_t *d = dst + b * count;
+        const uint8_t *s = src + b;
+        for (size_t i = 0; i < count; i++, s += elemSize) d[i] = *s;
+    }
+}
+
+void unshuffle(const uint8_t *src, size_t count, size_t elemSize,
+               uint8_t *dst)
+{
+    for (size_t b = 0; b < elemSize; b++) {
+        const uint8_t *s = src + b * count;
+        uint8_t *d = dst + b;
+        for (size_t i = 0; i < count; i++, d += elemSize) *d = s[i];
+    }
+}
+
+/** a slot to write, payload points to the image or to buffer */
+struct Entry {
+    std::string name;
+    SnapshotSlot slot;
+    const uint8_t *payload;
+    std::vector<uint8_t> buffer;
+    matPtr mat;  ///< keeps the image alive
+};
+
+bool fillValue(const boost::any &v, SnapshotSlot &s, Entry &e)
+{
+    if (const bool *b = boost::any_cast<bool>(&v)) {
+        s.type = Bool;
+        s.value = *b;
+    } else if (const int *i = boost::any_cast<int>(&v)) {
+        s.type = Int;
+        s.value = (uint64_t)(int64_t)*i;
+    } else if (const long *l = boost::any_cast<long>(&v)) {
+        s.type = Int;
+        s.value = (uint64_t)(int64_t)*l;
+    } else if (const unsigned int *u = boost::any_cast<unsigned int>(&v)) {
+        s.type = UInt;
+        s.value = *u;
+    } else if (const unsigned long *ul = boost::any_cast<unsigned long>(&v)) {
+        s.type = UInt;
+        s.value = *ul;
+    } else if (const float *f = boost::any_cast<float>(&v)) {
+        s.type = Float;
+        double d = *f;
+        memcpy(&s.value, &d, sizeof(d));
+    } else if (const double *d = boost::any_cast<double>(&v)) {
+        s.type = Double;
+        memcpy(&s.value, d, sizeof(*d));
+    } else if (const std::string *str = boost::any_cast<std::string>(&v)) {
+        s.type = String;
+        e.buffer.assign(str->begin(), str->end());
+        e.payload = e.buffer.data();
+        s.size = s.rawSize = str->size();
+    } else if (const matPtr *m = boost::any_cast<matPtr>(&v)) {
+        if (!*m) return false;
+        s.type = Mat;
+        e.mat = (*m)->isContinuous() ? *m : matPtr(new cv::Mat((*m)->clone()));
+        s.rows = e.mat->rows;
+        s.cols = e.mat->cols;
+        s.cvType = e.mat->type();
+        s.size = s.rawSize = e.mat->total() * e.mat->elemSize();
+        e.payload = e.mat->data;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/** compress the image of @p e if that makes it smaller */
+void compressEntry(Entry &e)
+{
+    SnapshotSlot &s = e.slot;
+    size_t n = s.rawSize, elemSize = e.mat->elemSize1();
+    if (n < 64) return;
+
+    std::vector<uint8_t> shuffled;
+    const uint8_t *src = e.payload;
+    uint8_t encoding = Lz;
+    if (elemSize > 1 && n % elemSize == 0) {
+        shuffled.resize(n);
+        shuffle(src, n / elemSize, elemSize, shuffled.data());
+        src = shuffled.data();
+        encoding = ShuffleLz;
+    }
+    e.buffer.resize(n);  // only worth it if smaller
+    size_t size = snapshot::compress(src, n, e.buffer.data(), n);
+    if (!size) {
+        e.buffer.clear();
+        return;
+    }
+    e.buffer.resize(size);
+    e.payload = e.buffer.data();
+    s.size = size;
+    s.encoding = encoding;
+}
+
+/**
+ * The slot describes a Mat of rawSize bytes its payload can decode to.
+ * Checked before the Mat is allocated: an LZ4 block decodes to at most 255
+ * bytes per stored byte, so a corrupt size cannot ask for more.
+ */
+bool validMat(const SnapshotSlot &s)
+{
+    if (s.rows < 0 || s.cols < 0 || s.cvType != CV_MAT_TYPE(s.cvType)) {
+        return false;
+    }
+    uint64_t limit;
+    switch (s.encoding) {
+        case Raw:
+            limit = s.size;
+            break;
+        case Lz:
+        case ShuffleLz:
+            limit = s.size * 255;
+            break;
+        default:
+            return false;
+    }
+    const uint64_t elemSize = CV_ELEM_SIZE(s.cvType);
+    const uint64_t pixels = (uint64_t)s.rows * s.cols;
+    return s.rawSize <= limit && pixels <= s.rawSize / elemSize &&
+           pixels * elemSize == s.rawSize;
+}
+
+bool decodeMat(const SnapshotSlot &s, const uint8_t *payload, cv::Mat &m)
+{
+    uint8_t *dst = m.data;
+    size_t n = s.rawSize;
+    switch (s.encoding) {
+        case Raw:
+            if (s.size != n) return false;
+            memcpy(dst, payload, n);
+            return true;
+        case Lz:
+            return snapshot::decompress(payload, s.size, dst, n);
+        case ShuffleLz: {
+            size_t elemSize = m.elemSize1();
+            std::vector<uint8_t> tmp(n);
+            if (!snapshot::decompress(payload, s.size, tmp.data(), n)) {
+                return false;
+            }
+            unshuffle(tmp.data(), n / elemSize, elemSize, dst);
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+size_t snapshot::compress(const uint8_t *src, size_t n, uint8_t *dst,
+                          size_t capacity)
+{
+    uint8_t *op = dst, *oend = dst + capacity;
+    size_t anchor = 0;
+
+    if (n > matchLimit) {
+        int32_t table[1 << hashLog];
+        std::fill(table, table + (1 << hashLog), -1);
+        const size_t limit = n - matchLimit, end = n - lastLiterals;
+        size_t ip = 0;
+        unsigned misses = 0;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash(seq);
+            int32_t ref = table[h];
+            table[h] = (int32_t)ip;
+            if (ref < 0 || ip - ref > maxOffset || read32(src + ref) != seq) {
+                ip += 1 + (misses++ >> 6);  // speed through random data
+                continue;
+            }
+            misses = 0;
+            size_t len = minMatch;
+            while (ip + len < end && src[ref + len] == src[ip + len]) len++;
+            op = putSequence(op, oend, src + anchor, ip - anchor, ip - ref,
+                             len);
+            if (!op) return 0;
+            ip += len;
+            anchor = ip;
+        }
+    }
+    op = putSequence(op, oend, src + anchor, n - anchor, 0, 0);
+    return op ? op - dst : 0;
+}
+
+bool snapshot::decompress(const uint8_t *src, size_t n, uint8_t *dst,
+                          size_t rawSize)
+{
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst, *oend = dst + rawSize;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t len = token >> 4;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+        if (ip == iend) break;  // the last sequence has no match
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return false;
+
+        len = token & 15;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return false;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += minMatch;
+        if (len > (size_t)(oend - op)) return false;
+        const uint8_t *match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        } else {  // overlapping, repeats the last offset bytes
+            for (size_t i = 0; i < len; i++) *op++ = match[i];
+        }
+    }
+    return op == oend;
+}
+
+bool snapshot::write(const std::string &path, const Frame &f,
+                     const std::vector<std::string> &keys, bool compress)
+{
+    std::vector<Entry> entries;
+    entries.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!f.hasKey(keys[i])) continue;
+        entries.push_back(Entry());
+        Entry &e = entries.back();
+        e.name = keys[i];
+        e.payload = NULL;
+        memset(&e.slot, 0, sizeof(e.slot));
+        if (!fillValue(f.getData(keys[i]), e.slot, e)) {
+            BOOST_LOG_TRIVIAL(debug) << "snapshot: skipping slot " << keys[i];
+            entries.pop_back();
+            continue;
+        }
+        if (compress && e.slot.type == Mat) compressEntry(e);
+    }
+
+    uint64_t pos = sizeof(SnapshotHeader) + entries.size() * sizeof(SnapshotSlot);
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].slot.nameOffset = (uint32_t)pos;
+        entries[i].slot.nameLength = (uint16_t)entries[i].name.size();
+        pos += entries[i].name.size();
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].payload) continue;
+        pos = align8(pos);
+        entries[i].slot.offset = pos;
+        pos += entries[i].slot.size;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.slots = (uint32_t)entries.size();
+    header.size = pos;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "snapshot: could not create " << path << ": "
+            << strerror(errno);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < entries.size(); i++) {
+        ok = fwrite(&entries[i].slot, sizeof(SnapshotSlot), 1, file) == 1;
+    }
+    for (size_t i = 0; ok && i < entries.size(); i++) {
+        ok = fwrite(entries[i].name.data(), 1, entries[i].name.size(), file) ==
+             entries[i].name.size();
+    }
+    static const char zeros[8] = {0};
+    for (size_t i = 0; ok && i < entries.size(); i++) {
+        if (!entries[i].payload) continue;
+        long pad = (long)entries[i].slot.offset - ftell(file);
+        ok = pad >= 0 && pad < 8 && fwrite(zeros, 1, pad, file) == (size_t)pad;
+        ok = ok && fwrite(entries[i].payload, 1, entries[i].slot.size, file) ==
+                       entries[i].slot.size;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok) BOOST_LOG_TRIVIAL(warning) << "snapshot: could not write " << path;
+    return ok;
+}
+
+bool snapshot::read(const std::string &path, Frame &f,
+                    const std::vector<std::string> &skip)
+{
+    // the file contents, mapped or (MSVC) read into memory
+    std::shared_ptr<const void> map;
+#if defined(MSVC)
+    boost::system::error_code ec;
+    const uint64_t length = boost::filesystem::file_size(path, ec);
+    if (ec) {
+        BOOST_LOG_TRIVIAL(debug) << "snapshot: could not open " << path;
+        return false;
+    }
+    if (length < sizeof(SnapshotHeader)) {
+        BOOST_LOG_TRIVIAL(warning) << "snapshot: not a snapshot: " << path;
+        return false;
+    }
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        BOOST_LOG_TRIVIAL(debug)
+            << "snapshot: could not open " << path << ": " << strerror(errno);
+        return false;
+    }
+    std::shared_ptr<uint8_t> buf(new uint8_t[length],
+                                 std::default_delete<uint8_t[]>());
+    size_t got = fread(buf.get(), 1, length, file);
+    fclose(file);
+    if (got != length) {
+        BOOST_LOG_TRIVIAL(warning) << "snapshot: could not read " << path;
+        return false;
+    }
+    map = buf;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        BOOST_LOG_TRIVIAL(debug)
+            << "snapshot: could not open " << path << ": " << strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        BOOST_LOG_TRIVIAL(warning) << "snapshot: not a snapshot: " << path;
+        ::close(fd);
+        return false;
+    }
+    const uint64_t length = st.st_size;
+    void *p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        BOOST_LOG_TRIVIAL(warning) << "snapshot: could not map " << path;
+        return false;
+    }
+    map.reset(p, [length](const void *m) { munmap((void *)m, length); });
+#endif
+    const uint8_t *data = (const uint8_t *)map.get();
+
+    const SnapshotHeader *header = (const SnapshotHeader *)data;
+    bool ok = !memcmp(header->magic, snapshotMagic, sizeof(snapshotMagic)) &&
+              header->version == snapshotVersion && header->size == length &&
+              header->slots <= (length - sizeof(SnapshotHeader)) /
+                                   sizeof(SnapshotSlot);
+    if (!ok) {
+        BOOST_LOG_TRIVIAL(warning) << "snapshot: not a valid snapshot (or "
+                                      "truncated): "
+                                   << path;
+        return false;
+    }
+
+    // decode everything first, so that a corrupt file leaves f alone
+    Frame loaded;
+    const SnapshotSlot *slots = (const SnapshotSlot *)(header + 1);
+    for (uint32_t i = 0; ok && i < header->slots; i++) {
+        SnapshotSlot s;
+        memcpy(&s, slots + i, sizeof(s));
+        ok = (uint64_t)s.nameOffset + s.nameLength <= length &&
+             (s.size == 0 || (s.offset <= length && s.size <= length - s.offset));
+        if (!ok) break;
+        std::string name((const char *)data + s.nameOffset, s.nameLength);
+        if (std::find(skip.begin(), skip.end(), name) != skip.end()) continue;
+
+        double d;
+        switch (s.type) {
+            case Bool:
+                loaded.addData(name, s.value != 0);
+                break;
+            case Int:
+                loaded.addData(name, (int)(int64_t)s.value);
+                break;
+            case UInt:
+                loaded.addData(name, (unsigned int)s.value);
+                break;
+            case Float:
+                memcpy(&d, &s.value, sizeof(d));
+                loaded.addData(name, (float)d);
+                break;
+            case Double:
+                memcpy(&d, &s.value, sizeof(d));
+                loaded.addData(name, d);
+                break;
+            case String:
+                loaded.addData(name, std::string((const char *)data + s.offset,
+                                                 s.size),
+                               Frame::String);
+                break;
+            case Mat: {
+                ok = validMat(s);
+                if (!ok) break;
+                matPtr m = MatPool::global().acquire(s.rows, s.cols, s.cvType);
+                ok = decodeMat(s, data + s.offset, *m);
+                if (ok) loaded.addData(name, m);
+                break;
+            }
+            default:
+                BOOST_LOG_TRIVIAL(debug) << "snapshot: unknown slot type "
+                                         << (int)s.type << " of " << name;
+        }
+    }
+    map.reset();
+    if (!ok) {
+        BOOST_LOG_TRIVIAL(warning) << "snapshot: corrupt file " << path;
+        return false;
+    }
+    f.merge(loaded);
+    return true;
+}
+
+bool snapshot::fromYaml(const std::string &yaml, const std::string &path,
+                        bool compress)
+{
+    cv::FileStorage file;
+    try {
+        if (!file.open(yaml, cv::FileStorage::READ)) {
+            BOOST_LOG_TRIVIAL(warning) << "snapshot: could not open " << yaml;
+            return false;
+        }
+    } catch (const cv::Exception &e) {
+        BOOST_LOG_TRIVIAL(warning)
+            << "snapshot: could not parse " << yaml << ": " << e.what();
+        return false;
+    }
+
+    Frame f;
+    std::vector<std::string> keys;
+    cv::FileNode root = file.root();
+    for (cv::FileNodeIterator it = root.begin(); it != root.end(); ++it) {
+        cv::FileNode node = *it;
+        std::string name = node.name();
+        if (node.isMap()) {  // opencv-matrix
+            matPtr m(new cv::Mat());
+            node >> *m;
+            f.addData(name, m);
+        } else if (node.isInt()) {
+            if (name == "fc" || name == "ts") {
+                f.addData(name, (unsigned int)(int)node);
+            } else {
+                f.addData(name, (int)node);
+            }
+        } else if (node.isReal()) {
+            f.addData(name, (double)node);
+        } else if (node.isString()) {
+            f.addData(name, (std::string)node, Frame::String);
+        } else {
+            BOOST_LOG_TRIVIAL(debug)
+                << "snapshot: skipping " << name << " in " << yaml;
+            continue;
+        }
+        keys.push_back(name);
+    }
+    return write(path, f, keys, compress);
+}
+
+int snapshot::convertYamlDirectory(const std::string &dir, bool compress)
+{
+    namespace fs = boost::filesystem;
+    if (!fs::is_directory(dir)) {
+        BOOST_LOG_TRIVIAL(warning) << dir << " is not a directory.";
+        return -1;
+    }
+    int n = 0;
+    for (fs::directory_iterator it(dir), end; it != end; ++it) {
+        if (!fs::is_regular_file(it->status()) ||
+            it->path().extension() != ".yaml") {
+            continue;
+        }
+        fs::path out = it->path();
+        out.replace_extension(".tfs");
+        if (!fromYaml(it->path().string(), out.string(), compress)) {
+            return -1;
+        }
+        n++;
+    }
+    return n;
+}
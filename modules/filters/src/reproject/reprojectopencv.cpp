@@ -21,8 +21,10 @@
 #include <boost/any.hpp>
 
 #include "toffy/filter_helpers.hpp"
+#include "toffy/matPool.hpp"
 #include "toffy/common/filenodehelper.hpp"
 
+#include "toffy/cam/cameraParams.hpp"
 #include "toffy/reproject/reprojectopencv.hpp"
 
 using namespace toffy;
@@ -32,7 +34,7 @@ std::size_t ReprojectOpenCv::_filter_counter = 1;
 const std::string ReprojectOpenCv::id_name = "reprojectopencv";
 
 ReprojectOpenCv::ReprojectOpenCv():
-    Filter(ReprojectOpenCv::id_name,_filter_counter), _in_img("img"),
+    PixelFilter(ReprojectOpenCv::id_name,_filter_counter), _in_img("img"),
     _in_cameraMatrix("camera_matrix"), _out_cloud("cloud")
 {
     _filter_counter++;
@@ -43,9 +45,11 @@ void ReprojectOpenCv::updateConfig(const boost::property_tree::ptree &pt) {
 
     using namespace boost::property_tree;
 
-    Filter::updateConfig(pt);
+    PixelFilter::updateConfig(pt);
 
     _in_img = pt.get<std::string>("inputs.img",_in_img);
+    _in_cameraMatrix = pt.get<std::string>("inputs.cameraMatrix",
+                                           _in_cameraMatrix);
 
     _out_cloud = pt.get<std::string>("outputs.cloud",_out_cloud);
 
@@ -69,9 +73,10 @@ void ReprojectOpenCv::updateConfig(const boost::property_tree::ptree &pt) {
 boost::property_tree::ptree ReprojectOpenCv::getConfig() const {
     boost::property_tree::ptree pt;
 
-    pt = Filter::getConfig();
+    pt = PixelFilter::getConfig();
 
     pt.put("inputs.img", _in_img);
+    pt.put("inputs.cameraMatrix", _in_cameraMatrix);
 
     pt.put("outputs.cloud", _out_cloud);
 
@@ -79,7 +84,7 @@ boost::property_tree::ptree ReprojectOpenCv::getConfig() const {
 }
 
 bool ReprojectOpenCv::filter(const Frame &in, Frame& out) {
-    LOG(info) << __FUNCTION__ << " " << __LINE__;
+    LOG(debug) << __FUNCTION__ << " " << __LINE__;
     matPtr img;
     matPtr img3d;
 
@@ -94,13 +99,12 @@ bool ReprojectOpenCv::filter(const Frame &in, Frame& out) {
     try {
       img3d = out.getMatPtr(_out_cloud);
     } catch (const boost::bad_any_cast &) {
-      LOG(info) << "Initializing output " << _out_cloud;
-      img3d.reset(new Mat(img->size(), CV_32FC3));
+      LOG(debug) << "Initializing output " << _out_cloud;
+      img3d = MatPool::global().acquire(img->size(), CV_32FC3);
     }
     if (img3d->size() != img->size()) {
-      img3d.reset(new Mat(img->size(), CV_32FC3));
+      img3d = MatPool::global().acquire(img->size(), CV_32FC3);
     }
-    LOG(info) << __FUNCTION__ << " " << __LINE__ << " in " << img->cols << "x" << img->rows ;
 
     if (!_in_cameraMatrix.empty() && in.hasKey(_in_cameraMatrix) ) {
 	try {
@@ -110,59 +114,25 @@ bool ReprojectOpenCv::filter(const Frame &in, Frame& out) {
         }
     }
 
-    double fl_x_reciprocal, fl_y_reciprocal;
-    Point2d center;
-    if (_cameraMatrix.data) {
-      // Saving parameter from the camera matrix
-      fl_x_reciprocal = 1.0f / _cameraMatrix.at<double>(0, 0);
-      fl_y_reciprocal = 1.0f / _cameraMatrix.at<double>(1, 1);
-      // center_x = _cameraMatrix.at<double>(0,2);
-      // center_y = _cameraMatrix.at<double>(1,2);
-      LOG(info) << __LINE__ << "cam mtx rep " << fl_x_reciprocal
-                 << "x" << fl_y_reciprocal << " " << _cameraMatrix;
-
-      double noV, apertureWidth = 4.5 , // sensor w/h in mm
-                  apertureHeight = 4.5;
-       double fovx, fovy,focLen, aspect;
-      calibrationMatrixValues(_cameraMatrix, img->size(), apertureWidth,
-                              apertureHeight, fovx, fovy,focLen, center, aspect);
-      LOG(info) << "cam mtx result fov " << fovx << "x" <<fovy << " flen " << focLen << " asp " << aspect;
-    } else {
+    if (!_cameraMatrix.data) {
       LOG(warning) << "No cameraMatrix data, filter " << id()
                    << " not applied.";
       return false;
     }
-    LOG(info) << __FUNCTION__ << " " << __LINE__;
-
-    float *dptr, depthValue;
-    int go=0,nogo=0;
-    // Calculates the 3D point for each depth value
-    for (int y = 0; y < img->rows; ++y) {
-      for (int x = 0; x < img->cols; ++x) {
-        // PointWithRange& point = getPointNoCheck (x, y);
-        dptr = img3d->ptr<float>(y, x);
-        depthValue = img->at<float>(y, x);
-
-        // Filtering by roi, min and max distance and by amplitudes
-        if (depthValue <= 0.0f || depthValue > 65.0f) {
-          dptr[0] = std::numeric_limits<float>::quiet_NaN();  // X
-          dptr[1] = std::numeric_limits<float>::quiet_NaN();  // Y
-          dptr[2] = std::numeric_limits<float>::quiet_NaN();  // Y
-          // cout << " Filtered (" << x << "," << y << ")" << endl;
-          nogo++;
-        } else {
-          // Set 3D points
-          dptr[0] = (static_cast<float>(x) - center.x) * depthValue *
-                    fl_x_reciprocal;  // X
-          dptr[1] = (static_cast<float>(y) - center.y) * depthValue *
-                    fl_y_reciprocal;  // Y
-          dptr[2] = depthValue;       // Z
-          go++;
-        }
-      }
+    if (!_rays || !_rays->matches(_cameraMatrix, img->size())) {
+      _rays = cam::RayMap::get(_cameraMatrix, img->size());
+      LOG(info) << "cam mtx " << _cameraMatrix << ", rays for "
+                << img->cols << "x" << img->rows;
     }
+
+    // Calculates the 3D point for each depth value, filtering by min and
+    // max distance
+    img3d->create(img->size(), CV_32FC3);
+    forEachBand(img->rows, [&](int begin, int end) {
+      _rays->backProjectRows(*img, *img3d, begin, end, 0.0f, 65.0f);
+    });
+
     out.addData(_out_cloud,img3d);
-    LOG(info) << __FUNCTION__ << " " << __LINE__ << " g " << go << " " << nogo;
 
     return true;
 }
@@ -14,11 +14,18 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <algorithm>
+#include <cfloat>
 #include <iostream>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include "toffy/filter_helpers.hpp"
+#include "toffy/matPool.hpp"
 #include "toffy/smoothing/average.hpp"
 
 using namespace toffy;
@@ -33,7 +40,11 @@ const std::string Average::id_name = "average";
 Average::Average() :Filter(Average::id_name,_filter_counter),
 			_in_img("depth"),
 			_out_img("depth"),
-			_size(10)
+			_in_key(_in_img),
+			_out_key(_out_img),
+			_size(10),
+			_incremental(true),
+			_updates(0)
 {
     _filter_counter++;
 }
@@ -43,61 +54,208 @@ bool Average::filter(const Frame &in, Frame& out)
 {
     LOG(debug) << __FUNCTION__ <<  " " << id();
 
-    matPtr img;
+    matPtr img = in.optMatPtr(_in_key, matPtr());
     matPtr new_img;
 
-    try {
-    	img = boost::any_cast<matPtr >(in.getData(_in_img));
-
-    } catch(const boost::bad_any_cast &) {
+    if (!img) {
         LOG(warning) <<
             "Could not cast input " << _in_img <<
             ", filter  " << id() <<" not applied.";
         return false;
     }
-    try {
-        if (out.hasKey(_out_img)) {
-            new_img = boost::any_cast<matPtr >(out.getData(_out_img));
-        } else {
-            LOG(info) << "init new_img!";
-            new_img.reset(new Mat());
+    if (out.hasKey(_out_key)) {
+        new_img = out.optMatPtr(_out_key, matPtr());
+        if (!new_img) {
+            LOG(warning) <<
+                "Could not cast output " << _in_img <<
+                ", filter  " << id() <<" not applied.";
+            return false;
         }
-    } catch(const boost::bad_any_cast &) {
-        LOG(warning) <<
-            "Could not cast output " << _in_img <<
-            ", filter  " << id() <<" not applied.";
-        return false;
+    } else {
+        LOG(info) << "init new_img!";
+        new_img = MatPool::global().acquire(img->size(), img->type());
+    }
+    // an output without cv::UMatData wraps a buffer it does not own, e.g. a
+    // camera frame imported with zeroCopy, and a shared one may still be
+    // read elsewhere: do not write to either
+    if (!MatPool::exclusive(new_img) || new_img->size() != img->size() ||
+        new_img->type() != img->type()) {
+        new_img = MatPool::global().acquire(img->size(), img->type());
     }
 
-    //bilateralFilter(*depth, *bi, d, sigmaColor, sigmaSpace, BORDER_REPLICATE);
+    if (_incremental && img->type() == CV_32FC1 && img->isContinuous() &&
+        new_img->isContinuous()) {
+        averageIncremental(*img, *new_img);
+    } else {
+        averageFull(*img, *new_img);
+    }
+
+    out.addData(_out_key, new_img);
+    //cout << id() << " wrote to " << _out_img << endl;
+
+    return true;
+}
+
+/*
+ * One pass over the pixels: adds the new frame to the running sum, removes
+ * the evicted one, stores the new frame in the ring slot of the evicted one
+ * and writes the average. The sums are kept in double, so adding and
+ * subtracting does not drift noticeably. dst may alias src.
+ *
+ * Returns true if an infinite pixel entered or left the window: the sum of
+ * that pixel is inf or NaN then and has to be rebuilt.
+ */
+template <bool Evict>
+static bool accumulate(const float* src, float* slot, double* sum, int* cnt,
+                       float* dst, size_t n)
+{
+    bool inf = false;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max = _mm_set1_ps(FLT_MAX);
+    __m128 big = zero;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        __m128i c = _mm_loadu_si128((const __m128i*)(cnt + i));
+
+        __m128 valid = _mm_cmpgt_ps(v, zero);
+        big = _mm_or_ps(big, _mm_cmpgt_ps(v, max));
+        __m128 add = _mm_and_ps(v, valid);
+        c = _mm_sub_epi32(c, _mm_castps_si128(valid));  // mask is -1
+        __m128d s0 = _mm_add_pd(_mm_loadu_pd(sum + i), _mm_cvtps_pd(add));
+        __m128d s1 = _mm_add_pd(_mm_loadu_pd(sum + i + 2),
+                                _mm_cvtps_pd(_mm_movehl_ps(add, add)));
+        if (Evict) {
+            __m128 o = _mm_loadu_ps(slot + i);
+            __m128 old = _mm_cmpgt_ps(o, zero);
+            big = _mm_or_ps(big, _mm_cmpgt_ps(o, max));
+            __m128 sub = _mm_and_ps(o, old);
+            c = _mm_add_epi32(c, _mm_castps_si128(old));
+            s0 = _mm_sub_pd(s0, _mm_cvtps_pd(sub));
+            s1 = _mm_sub_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(sub, sub)));
+        }
+        _mm_storeu_ps(slot + i, v);
+        _mm_storeu_si128((__m128i*)(cnt + i), c);
+        _mm_storeu_pd(sum + i, s0);
+        _mm_storeu_pd(sum + i + 2, s1);
+
+        __m128d c0 = _mm_cvtepi32_pd(c);
+        __m128d c1 = _mm_cvtepi32_pd(_mm_shuffle_epi32(c, 0xee));
+        __m128 avg = _mm_movelh_ps(_mm_cvtpd_ps(_mm_div_pd(s0, c0)),
+                                   _mm_cvtpd_ps(_mm_div_pd(s1, c1)));
+        __m128 any = _mm_castsi128_ps(
+            _mm_cmpgt_epi32(c, _mm_setzero_si128()));
+        _mm_storeu_ps(dst + i, _mm_and_ps(avg, any));
+    }
+    inf = _mm_movemask_ps(big) != 0;
+#endif
+    for (; i < n; i++) {
+        float v = src[i];
+        if (v > 0.0f) {
+            sum[i] += v;
+            cnt[i]++;
+            inf |= v > FLT_MAX;
+        }
+        if (Evict && slot[i] > 0.0f) {
+            sum[i] -= slot[i];
+            cnt[i]--;
+            inf |= slot[i] > FLT_MAX;
+        }
+        slot[i] = v;
+        dst[i] = cnt[i] != 0 ? float(sum[i] / cnt[i]) : 0.0f;
+    }
+    return inf;
+}
+
+void Average::averageIncremental(const Mat& img, Mat& new_img)
+{
+    if (img.size() != _sum.size() || _queue.empty()) {
+        _queue.clear();
+        _sum = Mat::zeros(img.size(), CV_64F);
+        _cnt = Mat::zeros(img.size(), CV_32S);
+        _updates = 0;
+    }
+
+    size_t n = img.total();
+    matPtr slot;
+    bool inf;
+    if (_queue.size() >= _size) {
+        LOG(debug) << "queue FULL";
+        slot = _queue.front();
+        _queue.pop_front();
+        inf = accumulate<true>(img.ptr<float>(), slot->ptr<float>(),
+                               _sum.ptr<double>(), _cnt.ptr<int>(),
+                               new_img.ptr<float>(), n);
+    } else {
+        LOG(debug) << "Filling queue";
+        slot = MatPool::global().acquire(img.size(), CV_32F);
+        inf = accumulate<false>(img.ptr<float>(), slot->ptr<float>(),
+                                _sum.ptr<double>(), _cnt.ptr<int>(),
+                                new_img.ptr<float>(), n);
+    }
+    _queue.push_back(slot);
+
+    // start over from the queued frames now and then, so rounding residue
+    // cannot stick in the sums forever. An inf pixel leaves NaN behind in
+    // its sum, rebuild right away then.
+    if (++_updates >= _resync || inf) {
+        resync(new_img);
+    }
+}
+
+void Average::resync(Mat& new_img)
+{
+    size_t n = new_img.total();
+    _updates = 0;
+    _sum = Scalar::all(0.0);
+    _cnt = Scalar::all(0);
+    double* sum = _sum.ptr<double>();
+    int* cnt = _cnt.ptr<int>();
+    for (size_t q = 0; q < _queue.size(); q++) {
+        const float* src = _queue[q]->ptr<float>();
+        for (size_t i = 0; i < n; i++) {
+            if (src[i] > 0.0f) {
+                sum[i] += src[i];
+                cnt[i]++;
+            }
+        }
+    }
+    float* dst = new_img.ptr<float>();
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = cnt[i] != 0 ? float(sum[i] / cnt[i]) : 0.0f;
+    }
+}
+
+void Average::averageFull(const Mat& img, Mat& new_img)
+{
+    _sum.release();  // invalidates the running sums
 
     matPtr imgadd;
     if (_queue.size() == _size) {
         LOG(debug) << "queue FULL";
         imgadd = _queue.front();
         _queue.pop_front();
-        img->copyTo(*imgadd);
+        img.copyTo(*imgadd);
         _queue.push_back(imgadd);
     } else {
         LOG(debug) << "Filling queue";
-        imgadd.reset( new Mat(img->clone()));
+        imgadd = MatPool::global().clone(img);
         _queue.push_back(imgadd);
         LOG(debug) << _queue.size();
     }
 
-    if (img->type() != _dst.type() || img->size() != _dst.size()) {
+    if (img.type() != _dst.type() || img.size() != _dst.size()) {
         _dst.release();
-        _dst = Mat(img->size(), img->type());
+        _dst = Mat(img.size(), img.type());
     }
-    if (img->size() != _cnt.size()) {
+    if (img.size() != _cnt.size()) {
         _cnt.release();
-        _cnt = Mat(img->size(), CV_32S);
+        _cnt = Mat(img.size(), CV_32S);
     }
     _dst = Scalar::all(0.0);
     _cnt = Scalar::all(0);
 
-    //int count[size];
-    //memset(count, 0, sizeof count);
     float* src;
     float* dst;
     int* cnt;
@@ -127,22 +285,7 @@ bool Average::filter(const Frame &in, Frame& out)
         }
     }
 
-    *new_img = _dst.clone();
-
-
-
-    /**new_img = _queue[0]->clone();
-    for (size_t i=1; i < _queue.size(); i++)
-	*new_img += *_queue[i];
-
-    BOOST_LOG_TRIVIAL(debug) << "averaging over: " <<_queue.size();
-    *new_img /= _queue.size();*/
-
-    
-    out.addData(_out_img, new_img);
-    //cout << id() << " wrote to " << _out_img << endl;
-
-    return true;
+    _dst.copyTo(new_img);
 }
 
 /*
@@ -161,6 +304,7 @@ boost::property_tree::ptree Average::getConfig() const
     boost::property_tree::ptree pt;
     pt = Filter::getConfig();
     pt.put("options.size", _size);
+    pt.put("options.incremental", _incremental);
 
     pt.put("inputs.img", _in_img);
 
@@ -173,12 +317,16 @@ void Average::updateConfig(const boost::property_tree::ptree &pt) {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ <<  " " << id();
 
     Filter::updateConfig(pt);
-    _size = pt.get("options.size", _size);
+    _size = std::max<size_t>(pt.get("options.size", _size), 1);
+    _incremental = pt.get("options.incremental", _incremental);
     _queue.clear();
 
     _in_img = pt.get("inputs.img", _in_img);
 
     _out_img = pt.get("outputs.img", _out_img);
 
+    _in_key = SlotKey(_in_img);
+    _out_key = SlotKey(_out_img);
+
     LOG(debug) << "averaging " << _size << " " << _in_img << " -> " << _out_img;
 }
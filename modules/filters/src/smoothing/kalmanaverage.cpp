@@ -17,10 +17,8 @@
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 
-#include <opencv2/imgproc/imgproc.hpp>
-#include <opencv2/highgui/highgui.hpp>
-
 #include "toffy/filter_helpers.hpp"
+#include "toffy/matPool.hpp"
 #include "toffy/smoothing/kalmanaverage.hpp"
 
 #include <iostream>
@@ -28,8 +26,13 @@
 
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 using namespace cv;
+using namespace toffy;
 using namespace toffy::filters::smoothing;
 
 std::size_t toffy::filters::smoothing::KalmanAverage::_filter_counter = 1;
@@ -95,7 +98,128 @@ boost::property_tree::ptree KalmanAverage::getConfig() const
     return pt;
 }
 
-bool KalmanAverage::filter(const toffy::Frame& in, toffy::Frame& /*out*/)
+void KalmanAverage::reset(const cv::Mat& img)
+{
+    img.copyTo(_pos);
+    _vel = Mat::zeros(img.size(), CV_32F);
+    _covA = Mat(img.size(), CV_32F);
+    _covA = Scalar::all(1);
+    _covB = Mat::zeros(img.size(), CV_32F);
+    _covD = Mat(img.size(), CV_32F);
+    _covD = Scalar::all(1);
+}
+
+#if defined(__SSE2__)
+/// per lane mask ? a : b
+static inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+/*
+ * One predict/correct step for n pixels. The transition is
+ * [1 1; 0 1], the measurement [1 0], the covariance [a b; b d] is
+ * symmetric, so the 2x2 matrix products reduce to a few multiply-adds.
+ */
+static void kalmanStep(const float* z, float* out, float* pos, float* vel,
+                       float* ca, float* cb, float* cd, size_t n, float q,
+                       float r, bool skipZeros)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 vq = _mm_set1_ps(q);
+    const __m128 vr = _mm_set1_ps(r);
+    for (; i + 4 <= n; i += 4) {
+        __m128 m = _mm_loadu_ps(z + i);
+        __m128 p0 = _mm_loadu_ps(pos + i);
+        __m128 v0 = _mm_loadu_ps(vel + i);
+        __m128 a0 = _mm_loadu_ps(ca + i);
+        __m128 b0 = _mm_loadu_ps(cb + i);
+        __m128 d0 = _mm_loadu_ps(cd + i);
+
+        __m128 valid, fresh;
+        if (skipZeros) {
+            valid = _mm_cmpgt_ps(m, zero);
+            fresh = _mm_cmpngt_ps(p0, zero);
+        } else {
+            valid = _mm_cmpord_ps(m, m);
+            fresh = _mm_cmpunord_ps(p0, p0);
+        }
+
+        // (re-)start from the measurement
+        __m128 p = select(fresh, m, p0);
+        __m128 v = _mm_andnot_ps(fresh, v0);
+        __m128 a = select(fresh, one, a0);
+        __m128 b = _mm_andnot_ps(fresh, b0);
+        __m128 d = select(fresh, one, d0);
+
+        // predict
+        p = _mm_add_ps(p, v);
+        a = _mm_add_ps(_mm_add_ps(a, _mm_add_ps(b, b)), _mm_add_ps(d, vq));
+        b = _mm_add_ps(b, d);
+        d = _mm_add_ps(d, vq);
+
+        // correct
+        __m128 s = _mm_add_ps(a, vr);
+        __m128 k0 = _mm_div_ps(a, s);
+        __m128 k1 = _mm_div_ps(b, s);
+        __m128 y = _mm_sub_ps(m, p);
+        p = _mm_add_ps(p, _mm_mul_ps(k0, y));
+        v = _mm_add_ps(v, _mm_mul_ps(k1, y));
+        d = _mm_sub_ps(d, _mm_mul_ps(k1, b));
+        __m128 k0c = _mm_sub_ps(one, k0);
+        a = _mm_mul_ps(k0c, a);
+        b = _mm_mul_ps(k0c, b);
+
+        _mm_storeu_ps(pos + i, select(valid, p, p0));
+        _mm_storeu_ps(vel + i, select(valid, v, v0));
+        _mm_storeu_ps(ca + i, select(valid, a, a0));
+        _mm_storeu_ps(cb + i, select(valid, b, b0));
+        _mm_storeu_ps(cd + i, select(valid, d, d0));
+        _mm_storeu_ps(out + i, select(valid, p, m));
+    }
+#endif
+    for (; i < n; i++) {
+        float m = z[i];
+        if (skipZeros ? !(m > 0.0f) : m != m) {
+            out[i] = m;  // nothing to estimate..
+            continue;
+        }
+        float p = pos[i], v = vel[i], a = ca[i], b = cb[i], d = cd[i];
+        if (skipZeros ? !(p > 0.0f) : p != p) {
+            p = m;
+            v = 0.0f;
+            a = d = 1.0f;
+            b = 0.0f;
+        }
+
+        p += v;
+        a += b + b + d + q;
+        b += d;
+        d += q;
+
+        float s = a + r;
+        float k0 = a / s, k1 = b / s;
+        float y = m - p;
+        p += k0 * y;
+        v += k1 * y;
+        d -= k1 * b;
+        a *= 1.0f - k0;
+        b *= 1.0f - k0;
+
+        pos[i] = p;
+        vel[i] = v;
+        ca[i] = a;
+        cb[i] = b;
+        cd[i] = d;
+        out[i] = p;
+    }
+}
+
+bool KalmanAverage::filter(const toffy::Frame& in, toffy::Frame& out)
 {
     BOOST_LOG_TRIVIAL(debug) << __FUNCTION__ << " " << id();
     matPtr img;
@@ -107,73 +231,33 @@ bool KalmanAverage::filter(const toffy::Frame& in, toffy::Frame& /*out*/)
                                    << ", filter  " << id() << " not applied.";
         return false;
     }
-    float* imgptr;
-    int vKFpos = 0;
-    if (!vKF) {
-        vKF.reset(new std::vector<cv::KalmanFilter>(img->size().area()));
-        for (int row = 0; row < img->rows; ++row) {
-            imgptr = img->ptr<float>(row);
-
-            for (int col = 0; col < img->cols; ++col) {
-                cv::KalmanFilter& kf = vKF->at(vKFpos);
-                // vKFpos = ( ( (row+1)+((img->rows)*row) ) * (col+1) ) -1;
-                kf.init(2, 1, 0);
-                kf.transitionMatrix = (Mat_<float>(2, 2) << 1, 1, 0, 1);
-
-                setIdentity(kf.measurementMatrix);
-                setIdentity(kf.processNoiseCov, Scalar::all(1e-5));
-                setIdentity(kf.measurementNoiseCov, Scalar::all(1e-1));
-                setIdentity(kf.errorCovPost, Scalar::all(1));
-
-                kf.statePost.at<float>(0) = imgptr[col];
-                vKFpos++;
-                // cout << "vKFpos: " << vKFpos << endl;
-                // cout << "imgptr[col]: " << imgptr[col] << endl;
-                // cout << "kf.statePost.at<float>(0): " <<
-                // kf.statePost.at<float>(0) << endl;
-            }
+    if (img->type() != CV_32FC1 || !img->isContinuous()) {
+        BOOST_LOG_TRIVIAL(warning) << "Input " << _in_img
+                                   << " is not a float image, filter  "
+                                   << id() << " not applied.";
+        return false;
+    }
+
+    matPtr res = img;
+    if (out_img != _in_img) {
+        res = out.optMatPtr(out_img, matPtr());
+        if (!res) {
+            res = MatPool::global().acquire(img->size(), CV_32F);
         }
+        res->create(img->size(), CV_32F);
+    }
+
+    if (_pos.size() != img->size()) {
+        // first frame: start from the measurements
+        reset(*img);
+        if (res != img) img->copyTo(*res);
     } else {
-        Mat measurement = Mat::zeros(1, 1, CV_32F);
-        Mat estimated;
-        for (int row = 0; row < img->rows; ++row) {
-            imgptr = img->ptr<float>(row);
-
-            for (int col = 0; col < img->cols; ++col) {
-                cv::KalmanFilter& kf = vKF->at(vKFpos);
-
-                if (std::numeric_limits<float>::quiet_NaN() == imgptr[col] ||
-                    (skipZeros && imgptr[col] <= 0.0)) {
-                    imgptr[col] = imgptr[col];  // nothing to estimate..
-                    vKFpos++;
-
-                    // kf.statePost.at<float>(0) =imgptr[col] ;
-                    continue;
-                }
-                // last state was nan..:
-                if (std::numeric_limits<float>::quiet_NaN() ==
-                    kf.statePost.at<float>(0)) {
-                    // re-init state
-                    setIdentity(kf.measurementMatrix);
-                    setIdentity(kf.processNoiseCov, Scalar::all(1e-5));
-                    setIdentity(kf.measurementNoiseCov, Scalar::all(1e-1));
-                    setIdentity(kf.errorCovPost, Scalar::all(1));
-
-                    kf.statePost.at<float>(0) = imgptr[col];
-                }
-
-                // vKFpos = ( ( (row+1)+((img->rows)*row) ) * (col+1) ) -1;
-                kf.predict();
-
-                // measurement = Mat::zeros(3, 1, CV_32F);
-                measurement.at<float>(0) = imgptr[col];
-
-                estimated = kf.correct(measurement);
-                imgptr[col] = estimated.at<float>(0);
-                vKFpos++;
-            }
-        }
+        kalmanStep(img->ptr<float>(), res->ptr<float>(), _pos.ptr<float>(),
+                   _vel.ptr<float>(), _covA.ptr<float>(), _covB.ptr<float>(),
+                   _covD.ptr<float>(), img->total(), processNoiseCov,
+                   measurementNoiseCov, skipZeros);
     }
+    if (res != img) out.addData(out_img, res);
 
     return true;
 }
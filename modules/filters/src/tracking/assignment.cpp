@@ -0,0 +1,290 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "toffy/tracking/assignment.hpp"
+
+using namespace toffy::tracking;
+
+void SpatialGrid::build(const std::vector<cv::Point2f>& pts, float cellSize)
+{
+    _pts = pts;
+    _start.clear();
+    _index.clear();
+    _w = _h = 0;
+    if (pts.empty()) return;
+
+    float x1 = pts[0].x, y1 = pts[0].y;
+    _x0 = x1;
+    _y0 = y1;
+    for (size_t i = 1; i < pts.size(); i++) {
+        _x0 = std::min(_x0, pts[i].x);
+        _y0 = std::min(_y0, pts[i].y);
+        x1 = std::max(x1, pts[i].x);
+        y1 = std::max(y1, pts[i].y);
+    }
+    // at most about 4 cells per point
+    _cell = std::max(cellSize, 1e-3f);
+    double cells = 4. * pts.size() + 16;
+    while ((double)((x1 - _x0) / _cell + 1) * ((y1 - _y0) / _cell + 1) >
+           cells) {
+        _cell *= 2;
+    }
+    _w = (int)((x1 - _x0) / _cell) + 1;
+    _h = (int)((y1 - _y0) / _cell) + 1;
+
+    // counting sort by cell
+    std::vector<int> cellOf(pts.size());
+    _start.assign(_w * _h + 1, 0);
+    for (size_t i = 0; i < pts.size(); i++) {
+        int cx = std::min(_w - 1, (int)((pts[i].x - _x0) / _cell));
+        int cy = std::min(_h - 1, (int)((pts[i].y - _y0) / _cell));
+        cellOf[i] = cy * _w + cx;
+        _start[cellOf[i] + 1]++;
+    }
+    for (int c = 0; c < _w * _h; c++) _start[c + 1] += _start[c];
+    std::vector<int> fill(_start.begin(), _start.end() - 1);
+    _index.resize(pts.size());
+    for (size_t i = 0; i < pts.size(); i++) _index[fill[cellOf[i]]++] = i;
+}
+
+void SpatialGrid::query(const cv::Point2f& p, float radius,
+                        std::vector<int>& found) const
+{
+    found.clear();
+    if (!_w) return;
+    int cx0 = std::max(0, (int)std::floor((p.x - radius - _x0) / _cell));
+    int cx1 = std::min(_w - 1, (int)std::floor((p.x + radius - _x0) / _cell));
+    int cy0 = std::max(0, (int)std::floor((p.y - radius - _y0) / _cell));
+    int cy1 = std::min(_h - 1, (int)std::floor((p.y + radius - _y0) / _cell));
+    double r2 = (double)radius * radius;
+    for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+            int c = cy * _w + cx;
+            for (int k = _start[c]; k < _start[c + 1]; k++) {
+                const cv::Point2f& q = _pts[_index[k]];
+                double dx = (double)q.x - p.x, dy = (double)q.y - p.y;
+                if (dx * dx + dy * dy <= r2) found.push_back(_index[k]);
+            }
+        }
+    }
+    std::sort(found.begin(), found.end());
+}
+
+namespace {
+
+struct Edge {
+    int track, blob;
+    double cost;
+};
+
+int findRoot(std::vector<int>& parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * Hungarian method (shortest augmenting paths with potentials) for a
+ * rows x cols matrix with rows <= cols, O(rows^2 cols).
+ * @param col set to the column of each row
+ */
+void hungarian(const std::vector<double>& a, int rows, int cols,
+               std::vector<int>& col)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> u(rows + 1, 0.), v(cols + 1, 0.), minv(cols + 1);
+    std::vector<int> p(cols + 1, 0), way(cols + 1, 0);
+    std::vector<char> used(cols + 1);
+    for (int i = 1; i <= rows; i++) {
+        p[0] = i;
+        int j0 = 0;
+        std::fill(minv.begin(), minv.end(), inf);
+        std::fill(used.begin(), used.end(), 0);
+        do {
+            used[j0] = 1;
+            int i0 = p[j0], j1 = 0;
+            double delta = inf;
+            const double* row = &a[(i0 - 1) * cols];
+            for (int j = 1; j <= cols; j++) {
+                if (used[j]) continue;
+                double cur = row[j - 1] - u[i0] - v[j];
+                if (cur < minv[j]) {
+                    minv[j] = cur;
+                    way[j] = j0;
+                }
+                if (minv[j] < delta) {
+                    delta = minv[j];
+                    j1 = j;
+                }
+            }
+            for (int j = 0; j <= cols; j++) {
+                if (used[j]) {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    minv[j] -= delta;
+                }
+            }
+            j0 = j1;
+        } while (p[j0] != 0);
+        do {
+            int j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+    col.assign(rows, -1);
+    for (int j = 1; j <= cols; j++) {
+        if (p[j]) col[p[j] - 1] = j - 1;
+    }
+}
+
+}  // namespace
+
+size_t toffy::tracking::assignOptimal(const std::vector<cv::Point2f>& tracks,
+                                      const std::vector<cv::Point2f>& blobs,
+                                      double maxDistance,
+                                      std::vector<int>& match,
+                                      AssignmentStats* stats)
+{
+    const int nt = tracks.size(), nb = blobs.size();
+    match.assign(nt, -1);
+    if (stats) *stats = AssignmentStats();
+    if (!nt || !nb || maxDistance < 0) return 0;
+
+    // candidate pairs within the gate
+    SpatialGrid grid;
+    grid.build(blobs, (float)maxDistance);
+    std::vector<Edge> edges;
+    std::vector<int> near;
+    const float radius = (float)maxDistance * 1.0001f + 1e-4f;
+    for (int t = 0; t < nt; t++) {
+        grid.query(tracks[t], radius, near);
+        for (size_t k = 0; k < near.size(); k++) {
+            double d = cv::norm(tracks[t] - blobs[near[k]]);
+            if (d > maxDistance) continue;  // the grid searches a bit wider
+            Edge e = {t, near[k], d};
+            edges.push_back(e);
+        }
+    }
+
+    // tracks and blobs connected by candidates form one sub-problem;
+    // nodes are tracks 0..nt-1 and blobs nt..nt+nb-1
+    std::vector<int> parent(nt + nb);
+    for (int i = 0; i < nt + nb; i++) parent[i] = i;
+    for (size_t k = 0; k < edges.size(); k++) {
+        int a = findRoot(parent, edges[k].track),
+            b = findRoot(parent, nt + edges[k].blob);
+        if (a != b) parent[std::max(a, b)] = std::min(a, b);
+    }
+    std::vector<int> comp(nt + nb, -1), local(nt + nb, -1);
+    std::vector<std::vector<int> > compTracks, compBlobs;
+    std::vector<std::vector<Edge> > compEdges;
+    for (size_t k = 0; k < edges.size(); k++) {
+        int root = findRoot(parent, edges[k].track);
+        if (comp[root] < 0) {
+            comp[root] = compEdges.size();
+            compTracks.push_back(std::vector<int>());
+            compBlobs.push_back(std::vector<int>());
+            compEdges.push_back(std::vector<Edge>());
+        }
+        int c = comp[root];
+        Edge e = edges[k];
+        if (local[e.track] < 0) {
+            local[e.track] = compTracks[c].size();
+            compTracks[c].push_back(e.track);
+        }
+        if (local[nt + e.blob] < 0) {
+            local[nt + e.blob] = compBlobs[c].size();
+            compBlobs[c].push_back(e.blob);
+        }
+        e.track = local[e.track];
+        e.blob = local[nt + e.blob];
+        compEdges[c].push_back(e);
+    }
+
+    size_t matched = 0;
+    std::vector<double> cost;
+    std::vector<int> col;
+    for (size_t c = 0; c < compEdges.size(); c++) {
+        const int rows = compTracks[c].size(), nblobs = compBlobs[c].size();
+        if (stats) {
+            stats->largest = std::max(stats->largest, (size_t)(rows + nblobs));
+        }
+        if (compEdges[c].size() == 1) {
+            match[compTracks[c][0]] = compBlobs[c][0];
+            matched++;
+            continue;
+        }
+        // columns: the blobs, then one "unmatched" column per track that
+        // costs maxDistance. Forbidden pairs cost more than leaving all
+        // tracks unmatched, so they are never chosen.
+        const int cols = nblobs + rows;
+        const double forbidden = 2. * (rows + 1) * (maxDistance + 1.);
+        cost.assign((size_t)rows * cols, forbidden);
+        for (int r = 0; r < rows; r++) cost[r * cols + nblobs + r] = maxDistance;
+        for (size_t k = 0; k < compEdges[c].size(); k++) {
+            const Edge& e = compEdges[c][k];
+            cost[e.track * cols + e.blob] = e.cost;
+        }
+        hungarian(cost, rows, cols, col);
+        for (int r = 0; r < rows; r++) {
+            if (col[r] >= 0 && col[r] < nblobs) {
+                match[compTracks[c][r]] = compBlobs[c][col[r]];
+                matched++;
+            }
+        }
+    }
+    if (stats) {
+        stats->candidates = edges.size();
+        stats->components = compEdges.size();
+    }
+    return matched;
+}
+
+size_t toffy::tracking::assignGreedy(const std::vector<cv::Point2f>& tracks,
+                                     const std::vector<cv::Point2f>& blobs,
+                                     double maxDistance,
+                                     std::vector<int>& match)
+{
+    match.assign(tracks.size(), -1);
+    std::vector<char> taken(blobs.size(), 0);
+    size_t matched = 0;
+    for (size_t t = 0; t < tracks.size(); t++) {
+        int candidate = -1;
+        double minDis = maxDistance + .01;
+        for (size_t j = 0; j < blobs.size(); j++) {
+            if (taken[j]) continue;
+            double ndis = cv::norm(tracks[t] - blobs[j]);
+            if (ndis < minDis) {
+                minDis = ndis;
+                candidate = j;
+            }
+        }
+        if (candidate >= 0 && minDis <= maxDistance) {
+            match[t] = candidate;
+            taken[candidate] = 1;
+            matched++;
+        }
+    }
+    return matched;
+}
@@ -22,6 +22,7 @@
 #include <opencv2/imgproc.hpp>
 
 #include "toffy/filter_helpers.hpp"
+#include "toffy/tracking/assignment.hpp"
 #include "toffy/tracking/tracker.hpp"
 
 using namespace toffy;
@@ -46,7 +47,11 @@ Tracker::Tracker()
       _out_img(_in_img),
       _out_objects("objects"),
       _out_count("count"),
+      nextId(0),
       maxMergeDistance(20.),
+      _greedy(false),
+      _predict(true),
+      _assignStats(),
       _render_image(true) {
   _filter_counter++;
 }
@@ -68,6 +73,16 @@ void Tracker::updateConfig(const boost::property_tree::ptree &pt) {
 
   maxMergeDistance =
       pt.get<double>("options.maxMergeDistance", maxMergeDistance);
+  string assignment = pt.get<string>("options.assignment",
+                                     _greedy ? "greedy" : "optimal");
+  if (assignment == "greedy" || assignment == "optimal") {
+    _greedy = assignment == "greedy";
+  } else {
+    BOOST_LOG_TRIVIAL(warning) << id() << " unknown assignment " << assignment
+                               << ", using optimal";
+    _greedy = false;
+  }
+  _predict = pt.get<bool>("options.predict", _predict);
   _render_image = pt.get<bool>("options.renderImage", _render_image);
 }
 
@@ -86,10 +101,25 @@ boost::property_tree::ptree Tracker::getConfig() const {
 
   pt.put("options.renderImage", _render_image);
   pt.put("options.maxMergeDistance", maxMergeDistance);
+  pt.put("options.assignment", _greedy ? "greedy" : "optimal");
+  pt.put("options.predict", _predict);
 
   return pt;
 }
 
+/**
+ * Where obj should be at frame fc, moving on as between its last two
+ * detections. Objects seen once or after a gap stay where they were.
+ */
+static Point2f predictCenter(const detection::DetectedObject &obj, int fc) {
+  if (!obj.record || obj.record->empty()) return obj.massCenter;
+  const detection::DetectedObject *prev = obj.record->front();
+  int dt = obj.fc - prev->fc, ahead = fc - obj.fc;
+  if (dt <= 0 || dt > 5 || ahead <= 0 || ahead > 5) return obj.massCenter;
+  return obj.massCenter +
+         (obj.massCenter - prev->massCenter) * ((float)ahead / dt);
+}
+
 bool Tracker::filter(const Frame &in, Frame &out) {
 
   toffy::Filter::setLoggingLvl();
@@ -151,59 +181,53 @@ bool Tracker::filter(const Frame &in, Frame &out) {
   BOOST_LOG_TRIVIAL(debug) << id() << " detObjs: " << detObjs.size();
   BOOST_LOG_TRIVIAL(debug) << id() << " blobs: " << blobs->size();
 
-  // compare the list of already tracked objects against incoming blobs.
-  // finds the nearest candidate; if it is near enough, consider it as the new position
-  // else we might have found a new blob to track: 
-  vector<detection::DetectedObject *>::iterator objDetIter = detObjs.begin();
-  while (objDetIter != detObjs.end()) {
-    detection::DetectedObject *trackedObj = *objDetIter;
-    detection::DetectedObject *blob = NULL;
-
-    // Compare the object massCenter distances, find best match
-    int candidate = -1;                // Flag for potential match
-    double minDis = maxMergeDistance + .01;  // Distance to merge
-    for (size_t j = 0; j < blobs->size(); j++) {
-      blob = (*blobs)[j];
-      if (!blob) continue;  // For removed blob from input list
-
-      double ndis = norm(trackedObj->massCenter - blob->massCenter);
-
-      // BOOST_LOG_TRIVIAL(debug) << id() << "  (1): " << trackedObj->id << " " << blob->id << " dist " << ndis;
+  // match the already tracked objects against the incoming blobs within
+  // maxMergeDistance, with the least total distance (see assignOptimal).
+  // Unmatched blobs might be new objects to track (step 2).
+  vector<Point2f> trackCenters(detObjs.size()), blobCenters;
+  vector<size_t> blobIdx;
+  for (size_t i = 0; i < detObjs.size(); i++) {
+    trackCenters[i] = _predict ? predictCenter(*detObjs[i], _fc)
+                               : detObjs[i]->massCenter;
+  }
+  for (size_t j = 0; j < blobs->size(); j++) {
+    if (!(*blobs)[j]) continue;  // For removed blob from input list
+    blobCenters.push_back((*blobs)[j]->massCenter);
+    blobIdx.push_back(j);
+  }
+  vector<int> match;
+  if (_greedy) {
+    assignGreedy(trackCenters, blobCenters, maxMergeDistance, match);
+  } else {
+    assignOptimal(trackCenters, blobCenters, maxMergeDistance, match,
+                  &_assignStats);
+    BOOST_LOG_TRIVIAL(debug)
+        << id() << " assignment: " << _assignStats.candidates
+        << " candidates in " << _assignStats.components
+        << " groups, largest " << _assignStats.largest;
+  }
 
-      if (ndis < minDis) {
-        minDis = ndis;
-        candidate = j;
-      }
-    }
-    // if no near candidate has been found assume a new obj (step 2).
-    if (minDis > maxMergeDistance) {
-      candidate = -1;
-      blob = 0;
+  vector<detection::DetectedObject *> unmatched;
+  for (size_t i = 0; i < detObjs.size(); i++) {
+    detection::DetectedObject *trackedObj = detObjs[i];
+    if (match[i] < 0) {
+      unmatched.push_back(trackedObj);
+      continue;
     }
+    size_t candidate = blobIdx[match[i]];
+    detection::DetectedObject *blob = (*blobs)[candidate];
+    blob->size = contourArea(blob->contour);
 
-    if (candidate >= 0) {
-      blob = (*blobs)[candidate];
-      blob->size = contourArea(blob->contour);
-
-      // BOOST_LOG_TRIVIAL(debug)
-      //     << "Found candidate object id = " << blob->id << "\t" << minDis
-      //     << "\t" << blob->size << "\t" << blob->contour.size() << "\t"
-      //     << blob->massCenter << " for " << trackedObj->id;
-
-      // found a match, update obj data:
-      trackedObj->update(*blob);
+    // found a match, update obj data:
+    trackedObj->update(*blob);
 
-      // TODO We destroy the input blob list!!!
-      // remove blob from candidates & delete
-      delete blob;
-      (*blobs)[candidate] = NULL;
+    // TODO We destroy the input blob list!!!
+    // remove blob from candidates & delete
+    delete blob;
+    (*blobs)[candidate] = NULL;
 
-      // move obj to new state
-      newState.push_back(trackedObj);
-      objDetIter = detObjs.erase(objDetIter);
-    } else {
-      objDetIter++;
-    }
+    // move obj to new state
+    newState.push_back(trackedObj);
   }
 
   /////// 2.: add all valid new candidates:
@@ -247,11 +271,11 @@ bool Tracker::filter(const Frame &in, Frame &out) {
   blobs->clear();
 
   /////// 3. eliminate all old detObjs ( not seen >5 frames)
-  while (objDetIter != detObjs.end()) {
-    detection::DetectedObject *obj = *objDetIter;
+  for (size_t i = 0; i < unmatched.size(); i++) {
+    detection::DetectedObject *obj = unmatched[i];
 
     // TODO Parameter!
-    if (abs(_fc - obj->fc) > 5) {
+    if (abs((int)_fc - obj->fc) > 5) {
       // BOOST_LOG_TRIVIAL(debug) << id() << "  (3):       kill " << obj->id;
       delete obj;
     } else {
@@ -0,0 +1,111 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <boost/log/trivial.hpp>
+
+#include "toffy/filter_helpers.hpp"
+#include "toffy/import/snapshot.hpp"
+#include "toffy/viewers/exportSnapshot.hpp"
+
+using namespace toffy;
+
+const std::string ExportSnapshot::id_name = "exportSnapshot";
+
+ExportSnapshot::ExportSnapshot()
+    : Filter(id_name),
+      path("./"),
+      prefix("tofData"),
+      useCounter(true),
+      useFc(false),
+      compress(false),
+      counter(1),
+      _sink(id_name,
+            std::bind(&ExportSnapshot::write, this, std::placeholders::_1))
+{
+}
+
+void ExportSnapshot::updateConfig(const boost::property_tree::ptree &pt)
+{
+    LOG(debug) << __FUNCTION__ << " " << id();
+
+    Filter::updateConfig(pt);
+    _sink.updateConfig(pt);  // waits for queued writes
+
+    path = pt.get("options.path", path);
+    prefix = pt.get("options.prefix", prefix);
+
+    useCounter = pt.get<bool>("options.useCounter", useCounter);
+    useFc = pt.get<bool>("options.useFc", useFc);
+    compress = pt.get<bool>("options.compress", compress);
+}
+
+boost::property_tree::ptree ExportSnapshot::getConfig() const
+{
+    boost::property_tree::ptree pt;
+
+    pt = Filter::getConfig();
+
+    pt.put("options.path", path);
+    pt.put("options.prefix", prefix);
+
+    pt.put("options.useCounter", useCounter);
+    pt.put("options.useFc", useFc);
+    pt.put("options.compress", compress);
+    _sink.getConfig(pt);
+
+    return pt;
+}
+
+bool ExportSnapshot::filter(const Frame &in, Frame &out)
+{
+    UNUSED(out);
+
+    static const char *fields[] = {"x",    "y",          "z",  "depth",
+                                   "ampl", "confidence", "fc", "ts"};
+    static const std::vector<std::string> keys(
+        fields, fields + sizeof(fields) / sizeof(fields[0]));
+    return _sink.submit(in, keys);
+}
+
+bool ExportSnapshot::write(const Frame &in)
+{
+    static const char *fields[] = {"x",          "y",  "z",  "depth",  "ampl",
+                                   "confidence", "fc", "ts", "counter"};
+    static const std::vector<std::string> keys(
+        fields, fields + sizeof(fields) / sizeof(fields[0]));
+
+    // same numbering and frame info as exportYaml
+    char num[80] = "";
+    unsigned int fc = in.optUInt("fc", 1000);
+    if (useCounter) {
+        snprintf(num, sizeof(num), "%04d", counter);
+    }
+    if (useFc) {
+        snprintf(num, sizeof(num), "%04d", fc);
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s/%s_%s.tfs", path.c_str(), prefix.c_str(),
+             num);
+
+    Frame f(in);
+    f.addData("fc", fc);
+    f.addData("ts", in.optUInt("ts", 1000));
+    f.addData("counter", counter);
+
+    LOG(debug) << id() << " writing " << buf;
+    bool ok = snapshot::write(buf, f, keys, compress);
+    counter++;
+    return ok;
+}
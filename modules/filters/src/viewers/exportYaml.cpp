@@ -35,6 +35,7 @@ void ExportYaml::updateConfig(const boost::property_tree::ptree& pt)
     using namespace boost::property_tree;
 
     Filter::updateConfig(pt);
+    _sink.updateConfig(pt);  // waits for queued writes
 
     path = pt.get("options.path", path);
     prefix = pt.get("options.prefix", path);
@@ -56,6 +57,7 @@ boost::property_tree::ptree ExportYaml::getConfig() const
 
     pt.put("options.useCounter", useCounter);
     pt.put("options.useFc", useFc);
+    _sink.getConfig(pt);
 
     pt.put("inputs.cloud", _in_cloud);
 
@@ -65,7 +67,16 @@ boost::property_tree::ptree ExportYaml::getConfig() const
 bool ExportYaml::filter(const Frame& in, Frame& out)
 {
     UNUSED(out);
-    
+
+    static const char* fields[] = {"x",    "y",          "z",  "depth",
+                                   "ampl", "confidence", "fc", "ts"};
+    static const std::vector<std::string> keys(
+        fields, fields + sizeof(fields) / sizeof(fields[0]));
+    return _sink.submit(in, keys);
+}
+
+bool ExportYaml::write(const Frame& in)
+{
     LOG(debug) << " exporting " << _in_cloud;
     char buf[80] = "";
     unsigned int fc = in.optUInt("fc", 1000);
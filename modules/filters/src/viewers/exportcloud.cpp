@@ -34,6 +34,7 @@ void ExportCloud::updateConfig(const boost::property_tree::ptree &pt) {
     using namespace boost::property_tree;
 
     Filter::updateConfig(pt);
+    _sink.updateConfig(pt);  // waits for queued writes
 
     _fileName = pt.get("options.fileName",_fileName);
     _path = pt.get("options.path",_path);
@@ -54,13 +55,23 @@ boost::property_tree::ptree ExportCloud::getConfig() const {
     pt.put("options.path", _path);
     pt.put("options.sequence", _seq);
     pt.put("options.binary", _bin);
+    _sink.getConfig(pt);
 
     pt.put("inputs.cloud", _in_cloud);
 
     return pt;
 }
 
-bool ExportCloud::filter(const Frame &in, Frame& out) {
+bool ExportCloud::filter(const Frame &in, Frame& /*out*/) {
+    if (!in.hasKey(_in_cloud)) {
+	LOG(warning) << "Missing input " << _in_cloud << ", filter  " << id()
+		     << " not applied.";
+	return false;
+    }
+    return _sink.submit(in, std::vector<std::string>(1, _in_cloud));
+}
+
+bool ExportCloud::write(const Frame &in) {
 	LOG(debug) << " exporting " << _in_cloud;
 #if 0
 	pcl::RangeImagePlanar::Ptr planar;
@@ -74,17 +85,17 @@ bool ExportCloud::filter(const Frame &in, Frame& out) {
 	}
 #endif
     if (_xyz) {
-        return exportXyz(in, out);
+        return exportXyz(in);
     } else {
-        return exportPcl2(in, out);
+        return exportPcl2(in);
     }
 }
 
-bool ExportCloud::exportXyz(const Frame &in, Frame& /*out*/) {
+bool ExportCloud::exportXyz(const Frame &/*in*/) {
     return true;
 }
 
-bool ExportCloud::exportPcl2(const Frame &in, Frame& /*out*/) {
+bool ExportCloud::exportPcl2(const Frame &in) {
 	pcl::PCLPointCloud2::Ptr planar;
 	try {
 		planar = boost::any_cast<pcl::PCLPointCloud2::Ptr>(in.getData(_in_cloud));
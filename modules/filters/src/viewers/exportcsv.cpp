@@ -14,14 +14,12 @@
    limitations under the License.
 */
 
-#include <fstream>
-#include <iostream>
-
 #include <boost/any.hpp>
 
 #include <opencv2/core.hpp>
 
 #include "toffy/filter_helpers.hpp"
+#include "toffy/import/csvMat.hpp"
 #include "toffy/viewers/exportcsv.hpp"
 
 using namespace toffy;
@@ -45,6 +43,7 @@ void ExportCSV::updateConfig(const boost::property_tree::ptree &pt) {
   using namespace boost::property_tree;
 
   Filter::updateConfig(pt);
+  _sink.updateConfig(pt);  // waits for queued writes
 
   _filePattern = pt.get("options.pattern", _filePattern);
   _seq = pt.get<bool>("options.sequence", _seq);
@@ -68,25 +67,31 @@ boost::property_tree::ptree ExportCSV::getConfig() const {
   pt.put("options.sequence", _seq);
   pt.put("options.frameCounter", _fc);
   pt.put("options.skipZeroes", _skip0s);
+  _sink.getConfig(pt);
 
   pt.put("inputs.img", _in);
 
   return pt;
 }
 
-static void saveMatCSV(const std::string &fileName, const Mat& mat, bool skipZeroes);
-
 bool ExportCSV::filter(const Frame &in, Frame &) {
   LOG(debug) << __FUNCTION__ << " " << id();
-  matPtr input;
   try {
-    input = boost::any_cast<matPtr>(in.getData(_in));
+    boost::any_cast<matPtr>(in.getData(_in));
   } catch (const boost::bad_any_cast &) {
     LOG(warning) << "Could not cast input " << _in << ", filter  "
                                << id() << " not applied.";
     return false;
   }
 
+  std::vector<std::string> keys(1, _in);
+  if (_fc.length()) keys.push_back(_fc);
+  return _sink.submit(in, keys);
+}
+
+bool ExportCSV::write(const Frame &in) {
+  matPtr input = in.getMatPtr(_in);
+
   char path[_filePattern.length() + 64];
   if (_seq) {
     snprintf(path, _filePattern.length() + 64, _filePattern.c_str(), _cnt);
@@ -105,77 +110,5 @@ bool ExportCSV::filter(const Frame &in, Frame &) {
     }
   }
   LOG(info) << " saving to " << path ;
-  saveMatCSV(std::string(path), *input, _skip0s);
-
-  return true;
-}
-
-static void saveMatCSV(const std::string &fileName, const Mat& mat, bool skipZeroes) {
-  using namespace std;
-  ofstream of(fileName, std::ofstream::out);
-
-  uint32_t j = 0;
-  switch (mat.type()) {
-    case CV_8UC1:
-      for (int y = 0; y < mat.rows; y++) {
-        for (int x = 0; x < mat.cols; x++) {
-          of << mat.at<char>(y, x) << ";";
-          j++;
-        }
-        of << '\n';
-      }
-      break;
-    case CV_16UC1:
-      for (int y = 0; y < mat.rows; y++) {
-        for (int x = 0; x < mat.cols; x++) {
-          of << mat.at<unsigned short>(y, x) << ";";
-          j++;
-        }
-        of << '\n';
-      }
-      break;
-    case CV_16SC1:
-      for (int y = 0; y < mat.rows; y++) {
-        for (int x = 0; x < mat.cols; x++) {
-          of << mat.at<short>(y, x) << ";";
-          j++;
-        }
-        of << '\n';
-      }
-      break;
-    case CV_32SC1:
-      for (int y = 0; y < mat.rows; y++) {
-        for (int x = 0; x < mat.cols; x++) {
-          of << mat.at<int>(y, x) << ";";
-          j++;
-        }
-        of << '\n';
-      }
-      break;
-    case CV_32FC1:
-      for (int y = 0; y < mat.rows; y++) {
-        for (int x = 0; x < mat.cols; x++) {
-          of << mat.at<float>(y, x) << ";";
-          j++;
-        }
-        of << '\n';
-      }
-      break;
-    case CV_64FC1:
-      for (int y = 0; y < mat.rows; y++) {
-        for (int x = 0; x < mat.cols; x++) {
-          of << mat.at<double>(y, x) << ";";
-          j++;
-        }
-        of << '\n';
-      }
-      break;
-    default:
-      BOOST_LOG_TRIVIAL(warning)
-          << "no suitable mat data conversion for " 
-          << mat.type() << " "
-          << " type " << typeToString(mat.type())  
-          << " depth " << depthToString(mat.depth());
-  }
-  of.close();
+  return csv::write(std::string(path), *input);
 }
@@ -16,6 +16,7 @@
 */
 #include <errno.h>
 
+#include <functional>
 #include <iostream>
 
 #include <opencv2/highgui.hpp>
@@ -25,6 +26,7 @@
 
 #include <boost/log/trivial.hpp>
 
+#include "toffy/matPool.hpp"
 #include "toffy/viewers/videoout.hpp"
 
 using namespace toffy;
@@ -33,12 +35,17 @@ using namespace std;
 
 const int ofs=20; // lines ; before that we have text...
 
-VideoOut::VideoOut() : scale(2), saving(false), writer(0)
+VideoOut::VideoOut()
+    : scale(2),
+      saving(false),
+      writer(0),
+      _sink("videoOut", std::bind(&VideoOut::write, this, std::placeholders::_1))
 {
 }
 
 VideoOut::~VideoOut()
 {
+	_sink.close();
 	delete writer;
 	writer = 0;
 }
@@ -60,6 +67,7 @@ void VideoOut::updateConfig(const boost::property_tree::ptree &pt) {
     using namespace boost::property_tree;
 
     Filter::updateConfig(pt);
+    _sink.updateConfig(pt);  // waits for queued writes
 
     minDist = pt.get<double>("options.min_dist" ,minDist);
     maxDist = pt.get<double>("options.max_dist",maxDist);
@@ -80,6 +88,7 @@ boost::property_tree::ptree VideoOut::getConfig() const {
     pt.put("options.min_ampl", minAmpl);
     pt.put("options.max_ampl", maxAmpl);
     pt.put("options.scale", scale);
+    _sink.getConfig(pt);
 
     return pt;
 }
@@ -93,7 +102,10 @@ bool VideoOut::filter(const Frame& in, Frame& /*out*/)
 
 		Mat amp, dis; // todo: keep 
 
-		image = Scalar(0);
+		// a new buffer per frame, the sink may still be encoding the last
+		matPtr canvas = MatPool::global().acquire(image.size(), image.type());
+		Mat& canvasImg = *canvas;
+		canvasImg = Scalar(0);
 
 		amplP->convertTo(amp,CV_8U,255.0/(maxAmpl-minAmpl),-255.0*minAmpl/(maxAmpl-minAmpl));
 		depthP->convertTo(dis,CV_8U,255.0/(maxDist-minDist),-255.0*minDist/(maxDist-minDist));
@@ -106,30 +118,42 @@ bool VideoOut::filter(const Frame& in, Frame& /*out*/)
 		cvtColor(amp, amp, COLOR_GRAY2BGR);
 		cvtColor(dis, dis, COLOR_GRAY2BGR);
 
-		Mat d(image, Rect(       0 , ofs , dis.cols , dis.rows));
-		Mat a(image, Rect(dis.cols , ofs , amp.cols , amp.rows));
+		Mat d(canvasImg, Rect(       0 , ofs , dis.cols , dis.rows));
+		Mat a(canvasImg, Rect(dis.cols , ofs , amp.cols , amp.rows));
 
 		amp.copyTo(a);
 		dis.copyTo(d);
 
 		stringstream t;
 		//t << "F:" << in.fc() << " depth " << setprecision(3)<< minDist << "-" << setprecision(3)<<maxDist;
-		putText(image,t.str(),Point(5,20)
+		putText(canvasImg,t.str(),Point(5,20)
 			, FONT_HERSHEY_PLAIN, 1, Scalar(255,255,255));
 
 		t.str("");
 		t << "ampl " << (int)minAmpl << "-" << (int)maxAmpl;
-		putText(image,t.str(),Point(5+dis.cols,20)
+		putText(canvasImg,t.str(),Point(5+dis.cols,20)
 			, FONT_HERSHEY_PLAIN, 1, Scalar(255,255,128));
 
-		imshow("image", image);
-		*writer << image;
+		imshow("image", canvasImg);
+
+		Frame f;
+		f.addData("image", canvas);
+		// the canvas is only held here, the sink can queue it without a copy
+		return _sink.submit(f, std::vector<std::string>(1, "image"), true);
 	}
 	return true;
 }
 
+bool VideoOut::write(const Frame& in)
+{
+	if (!writer) return false;
+	*writer << *in.getMatPtr("image");
+	return true;
+}
+
 void VideoOut::startSaving(const std::string& file, Frame& in)
   {
+  _sink.flush();
   if (writer)
     delete writer;
   writer = new VideoWriter();
@@ -151,6 +175,7 @@ void VideoOut::startSaving(const std::string& file, Frame& in)
 
 void VideoOut::stopSaving()
 {
+	_sink.flush();
 	delete writer;
 	writer = 0;
   saving = false;
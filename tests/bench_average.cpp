@@ -0,0 +1,161 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Benchmark for the temporal Average filter: running sums (incremental)
+ * against re-summing the whole window, for several window sizes.
+ *
+ * Both modes get the same depth frames (with invalid pixels) and their
+ * outputs are compared; fails if they differ by more than float rounding.
+ * A last run feeds an inf and a NaN pixel, the incremental mode has to
+ * recover as soon as they leave the window.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include <toffy/smoothing/average.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+using namespace toffy::filters::smoothing;
+
+static void randomDepth(cv::Mat& m, mt19937& rng)
+{
+    uniform_real_distribution<float> depth(0.5f, 5.0f);
+    uniform_int_distribution<int> invalid(0, 9);
+    float* p = m.ptr<float>();
+    for (size_t i = 0; i < m.total(); i++) {
+        p[i] = invalid(rng) == 0 ? 0.0f : depth(rng);
+    }
+}
+
+/** relative difference, 0 if both are the same inf, inf for a NaN */
+static double relErr(float a, float b)
+{
+    if (a == b) return 0;
+    double e = fabs(a - b) / max(1.0f, fabs(a));
+    return std::isnan(e) ? INFINITY : e;
+}
+
+static double run(Average& avg, const vector<matPtr>& input, int frames,
+                  vector<matPtr>* results)
+{
+    Frame f;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int n = 0; n < frames; n++) {
+        input[n % input.size()]->copyTo(*f.getSertMatPtr(
+            "depth", input[0]->size(), CV_32F));
+        avg.filter(f, f);
+        if (results) {
+            results->push_back(matPtr(new cv::Mat(f.getMatPtr("avg")->clone())));
+        }
+    }
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - t0)
+               .count() / frames;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 500;
+    if (argc >= 2) {
+        frames = atoi(argv[1]);
+    }
+    const int windows[] = {5, 10, 20, 50};
+    const cv::Size size(160, 120);
+
+    mt19937 rng(42);
+    vector<matPtr> input;
+    for (int i = 0; i < 97; i++) {
+        input.push_back(matPtr(new cv::Mat(size, CV_32F)));
+        randomDepth(*input.back(), rng);
+    }
+
+    bool ok = true;
+    cout << "frames: " << frames << ", image " << size.width << "x"
+         << size.height << endl;
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        boost::property_tree::ptree pt;
+        pt.put("options.size", windows[w]);
+        pt.put("outputs.img", "avg");
+
+        Average full, incr;
+        pt.put("options.incremental", false);
+        full.updateConfig(pt);
+        pt.put("options.incremental", true);
+        incr.updateConfig(pt);
+
+        vector<matPtr> ref, res;
+        double fullUs = run(full, input, frames, &ref);
+        double incrUs = run(incr, input, frames, &res);
+
+        double maxErr = 0;
+        for (size_t n = 0; n < ref.size(); n++) {
+            const float* a = ref[n]->ptr<float>();
+            const float* b = res[n]->ptr<float>();
+            for (size_t i = 0; i < ref[n]->total(); i++) {
+                double e = relErr(a[i], b[i]);
+                if (e > maxErr) maxErr = e;
+            }
+        }
+        // without the comparison copies
+        fullUs = run(full, input, frames, NULL);
+        incrUs = run(incr, input, frames, NULL);
+
+        cout << "window " << windows[w] << ": full " << fullUs
+             << " us/frame, incremental " << incrUs << " us/frame, speedup "
+             << fullUs / incrUs << ", max rel. error " << maxErr << endl;
+        if (maxErr > 1e-5) ok = false;
+    }
+
+    {
+        vector<matPtr> bad;
+        for (int i = 0; i < 20; i++) {
+            bad.push_back(matPtr(new cv::Mat(input[i]->clone())));
+        }
+        bad[3]->ptr<float>()[0] = INFINITY;
+        bad[4]->ptr<float>()[7] = NAN;
+
+        boost::property_tree::ptree pt;
+        pt.put("options.size", 5);
+        pt.put("outputs.img", "avg");
+        Average full, incr;
+        pt.put("options.incremental", false);
+        full.updateConfig(pt);
+        pt.put("options.incremental", true);
+        incr.updateConfig(pt);
+
+        vector<matPtr> ref, res;
+        run(full, bad, bad.size(), &ref);
+        run(incr, bad, bad.size(), &res);
+        double maxErr = 0;
+        for (size_t n = 0; n < ref.size(); n++) {
+            const float* a = ref[n]->ptr<float>();
+            const float* b = res[n]->ptr<float>();
+            for (size_t i = 0; i < ref[n]->total(); i++) {
+                double e = relErr(a[i], b[i]);
+                if (e > maxErr) maxErr = e;
+            }
+        }
+        cout << "inf/NaN pixels: max rel. error " << maxErr << endl;
+        if (maxErr > 1e-5) ok = false;
+    }
+
+    return testResult(ok);
+}
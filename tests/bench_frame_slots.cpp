@@ -0,0 +1,178 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Micro benchmark for Frame slot lookups. Compares the string keyed api
+ * (getData + any_cast, as most filters do it) and interned SlotKeys with
+ * the flat_map storage Frame used before slot keys (21a84d8), which is
+ * reproduced in BaselineFrame below.
+ *
+ * Simulates a filter bank where every filter reads an input and writes an
+ * output slot, once per frame. The string api is also run from several
+ * threads at once, one frame each, like lanes of a ParallelFilter.
+ *
+ * Usage: bench_frame_slots [frames] [threads]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/container/flat_map.hpp>
+
+#include <toffy/frame.hpp>
+
+using namespace std;
+using namespace toffy;
+
+static const int numSlots = 32;
+
+/**
+ * @brief Storage and string lookups of the Frame as of 21a84d8
+ */
+class BaselineFrame
+{
+   public:
+    bool hasKey(std::string key) const
+    {
+        if (data.find(key) != data.end()) return true;
+        return false;
+    }
+
+    boost::any getData(const std::string& key) const
+    {
+        boost::any out;
+        if (data.find(key) != data.end()) {
+            out = data.at(key);
+        }
+        return out;
+    }
+
+    void addData(std::string key, boost::any v,
+                 Frame::SlotDataType dt = Frame::Any)
+    {
+        data[key] = v;
+        meta[key] = dt;
+    }
+
+   private:
+    boost::container::flat_map<std::string, boost::any> data;
+    boost::container::flat_map<std::string, Frame::SlotDataType> meta;
+};
+
+template <class F>
+static long stringLoop(F& f, const vector<string>& names, int frames)
+{
+    long sum = 0;
+    for (int n = 0; n < frames; n++) {
+        for (int i = 0; i < numSlots; i++) {
+            matPtr m;
+            if (f.hasKey(names[i])) {
+                m = boost::any_cast<matPtr>(f.getData(names[i]));
+            }
+            sum += m.use_count();
+            f.addData(names[(i + 1) % numSlots], m);
+        }
+    }
+    return sum;
+}
+
+template <class F>
+static double threadedLoop(const vector<string>& names, int frames,
+                           int threads)
+{
+    vector<thread> pool;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&names, frames]() {
+            F f;
+            for (int i = 0; i < numSlots; i++) {
+                f.addData(names[i], matPtr(new cv::Mat()));
+            }
+            stringLoop(f, names, frames);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(t1 - t0).count() /
+           (double(frames) * numSlots * threads);
+}
+
+static void report(const string& what, double ns)
+{
+    cout << what << ns << " ns/lookup+store, " << ns * numSlots / 1000.0
+         << " us/frame" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 100000;
+    int threads = 4;
+    if (argc >= 2) {
+        frames = atoi(argv[1]);
+    }
+    if (argc >= 3) {
+        threads = atoi(argv[2]);
+    }
+
+    Frame f;
+    BaselineFrame b;
+    vector<string> names;
+    vector<SlotKey> keys;
+    for (int i = 0; i < numSlots; i++) {
+        names.push_back("slot_" + to_string(i));
+        keys.push_back(SlotKey(names.back()));
+        f.addData(names.back(), matPtr(new cv::Mat()));
+        b.addData(names.back(), matPtr(new cv::Mat()));
+    }
+
+    long sum = 0;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    sum += stringLoop(b, names, frames);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    sum += stringLoop(f, names, frames);
+    chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+    for (int n = 0; n < frames; n++) {
+        for (int i = 0; i < numSlots; i++) {
+            const matPtr* m = f.get<matPtr>(keys[i]);
+            if (m) {
+                sum += m->use_count();
+                f.addData(keys[(i + 1) % numSlots], *m);
+            }
+        }
+    }
+    chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+
+    double ops = double(frames) * numSlots;
+    cout << "frames: " << frames << ", slots: " << numSlots << endl;
+    report("baseline string api: ",
+           chrono::duration<double, nano>(t1 - t0).count() / ops);
+    report("string api:          ",
+           chrono::duration<double, nano>(t2 - t1).count() / ops);
+    report("slot keys:           ",
+           chrono::duration<double, nano>(t3 - t2).count() / ops);
+
+    if (threads > 1) {
+        cout << "threads: " << threads << endl;
+        report("baseline string api: ",
+               threadedLoop<BaselineFrame>(names, frames, threads));
+        report("string api:          ",
+               threadedLoop<Frame>(names, frames, threads));
+    }
+    cout << "(" << sum << ")" << endl;
+    return 0;
+}
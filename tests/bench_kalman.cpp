@@ -0,0 +1,147 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Throughput of the KalmanAverage filter against one cv::KalmanFilter per
+ * pixel, the way the filter used to work.
+ *
+ * Both get the same noisy depth frames with invalid (zero) pixels; fails
+ * if the smoothed images differ by more than float rounding.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include <opencv2/video/tracking.hpp>
+
+#include <toffy/smoothing/kalmanaverage.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace toffy;
+using namespace toffy::filters::smoothing;
+
+static const float q = 1e-5f, r = 1e-1f;
+
+/** per pixel cv::KalmanFilter, same model and options as KalmanAverage */
+class Reference
+{
+    vector<KalmanFilter> kfs;
+
+    static void reinit(KalmanFilter& kf, float z)
+    {
+        setIdentity(kf.processNoiseCov, Scalar::all(q));
+        setIdentity(kf.measurementNoiseCov, Scalar::all(r));
+        setIdentity(kf.errorCovPost, Scalar::all(1));
+        kf.statePost.at<float>(0) = z;
+        kf.statePost.at<float>(1) = 0;
+    }
+
+   public:
+    void filter(Mat& img)
+    {
+        float* p = img.ptr<float>();
+        if (kfs.empty()) {
+            kfs.resize(img.total());
+            for (size_t i = 0; i < kfs.size(); i++) {
+                kfs[i].init(2, 1, 0);
+                kfs[i].transitionMatrix = (Mat_<float>(2, 2) << 1, 1, 0, 1);
+                setIdentity(kfs[i].measurementMatrix);
+                reinit(kfs[i], p[i]);
+            }
+            return;
+        }
+        Mat measurement = Mat::zeros(1, 1, CV_32F);
+        for (size_t i = 0; i < kfs.size(); i++) {
+            if (!(p[i] > 0.0f)) continue;
+            if (!(kfs[i].statePost.at<float>(0) > 0.0f)) reinit(kfs[i], p[i]);
+            kfs[i].predict();
+            measurement.at<float>(0) = p[i];
+            p[i] = kfs[i].correct(measurement).at<float>(0);
+        }
+    }
+};
+
+int main(int argc, char** argv)
+{
+    int frames = 200;
+    if (argc >= 2) {
+        frames = atoi(argv[1]);
+    }
+    const cv::Size size(160, 120);
+
+    mt19937 rng(42);
+    normal_distribution<float> noise(0.0f, 0.05f);
+    uniform_int_distribution<int> invalid(0, 19);
+    vector<Mat> input;
+    for (int n = 0; n < frames; n++) {
+        Mat m(size, CV_32F);
+        float* p = m.ptr<float>();
+        for (size_t i = 0; i < m.total(); i++) {
+            float depth = 1.0f + (i % size.width) * 0.02f + n * 0.001f;
+            p[i] = invalid(rng) == 0 ? 0.0f : depth + noise(rng);
+        }
+        input.push_back(m);
+    }
+
+    boost::property_tree::ptree pt;
+    pt.put("options.processNoiseCov", q);
+    pt.put("options.measurementNoiseCov", r);
+    pt.put("options.skipZeros", true);
+    KalmanAverage kalman;
+    kalman.updateConfig(pt);
+    Reference ref;
+
+    Frame f;
+    matPtr depth(new Mat());
+    f.addData("depth", depth);
+    Mat expected;
+    double maxErr = 0, soaUs = 0, refUs = 0;
+    for (int n = 0; n < frames; n++) {
+        input[n].copyTo(*depth);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        kalman.filter(f, f);
+        chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+        input[n].copyTo(expected);
+        ref.filter(expected);
+        chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+        soaUs += chrono::duration<double, micro>(t1 - t0).count();
+        refUs += chrono::duration<double, micro>(t2 - t1).count();
+
+        const float* a = expected.ptr<float>();
+        const float* b = depth->ptr<float>();
+        for (size_t i = 0; i < expected.total(); i++) {
+            double e = fabs(a[i] - b[i]) / max(1.0f, fabs(a[i]));
+            if (e > maxErr) maxErr = e;
+        }
+    }
+
+    cout << "frames: " << frames << ", image " << size.width << "x"
+         << size.height << endl;
+    cout << "cv::KalmanFilter per pixel: " << refUs / frames << " us/frame"
+         << endl;
+    cout << "KalmanAverage planes:       " << soaUs / frames << " us/frame, "
+         << refUs / soaUs << "x" << endl;
+    cout << "max rel. error " << maxErr << endl;
+
+    bool ok = maxErr < 1e-4;
+    return testResult(ok);
+}
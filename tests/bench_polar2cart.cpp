@@ -0,0 +1,143 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Per frame cost of Polar2Cart with its cached correction map against
+ * computing the two cos() per pixel every frame, as the filter used to.
+ *
+ * Both results must be identical, also for an input that is a roi view
+ * into a larger image.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include <toffy/base/polar2cart.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace toffy;
+using namespace toffy::filters;
+
+static const double fovx = 90., fovy = 67.5;
+
+/** the former per pixel implementation */
+static void reference(Mat& new_img)
+{
+    float coef_h = (M_PI * fovx / 180) / new_img.cols,
+          coef_v = (M_PI * fovy / 180) / new_img.rows;
+
+    for (int i = 0; i < new_img.rows; i++) {
+        for (int j = 0; j < new_img.cols; j++) {
+            if (new_img.at<float>(i, j) < 65. && new_img.at<float>(i, j) > 0. &&
+                new_img.at<float>(i, j) == new_img.at<float>(i, j)) {
+                new_img.at<float>(i, j) *=
+                    (cos(coef_h * (abs(j - ((new_img.cols / 2) - 1))))) *
+                    (cos(coef_v * (abs(i - ((new_img.rows / 2) - 1)))));
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 200;
+    if (argc >= 2) {
+        frames = atoi(argv[1]);
+    }
+    const Size sizes[] = {Size(160, 120), Size(352, 287), Size(640, 480)};
+
+    boost::property_tree::ptree pt;
+    pt.put("options.fovx", fovx);
+    pt.put("options.fovy", fovy);
+    Polar2Cart p2c;
+    p2c.updateConfig(pt);
+
+    mt19937 rng(42);
+    uniform_real_distribution<float> depth(-1.0f, 70.0f);
+
+    bool ok = true;
+    cout << "frames: " << frames << endl;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        Mat input(sizes[s], CV_32F), expected;
+        float* p = input.ptr<float>();
+        for (size_t i = 0; i < input.total(); i++) p[i] = depth(rng);
+
+        Frame f;
+        matPtr img(new Mat());
+        f.addData("img", img);
+
+        double refUs = 0, lutUs = 0;
+        for (int n = 0; n < frames; n++) {
+            input.copyTo(expected);
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            reference(expected);
+            chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+            input.copyTo(*img);
+            chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+            p2c.filter(f, f);
+            chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+
+            refUs += chrono::duration<double, micro>(t1 - t0).count();
+            lutUs += chrono::duration<double, micro>(t3 - t2).count();
+        }
+
+        size_t diff = 0;
+        const float* a = expected.ptr<float>();
+        const float* b = img->ptr<float>();
+        for (size_t i = 0; i < expected.total(); i++) {
+            if (a[i] != b[i]) diff++;
+        }
+        cout << sizes[s].width << "x" << sizes[s].height << ": cos per pixel "
+             << refUs / frames << " us/frame, map " << lutUs / frames
+             << " us/frame, " << refUs / lutUs << "x, " << diff
+             << " pixels differ" << endl;
+        if (diff) ok = false;
+    }
+
+    // a view whose rows are apart in memory, pixels around it stay as
+    // they are
+    Mat full(480, 640, CV_32F), expected;
+    float* p = full.ptr<float>();
+    for (size_t i = 0; i < full.total(); i++) p[i] = depth(rng);
+    Mat before = full.clone();
+    Rect r(100, 50, 320, 240);
+    before(r).copyTo(expected);
+    reference(expected);
+    Frame f;
+    f.addData("img", matPtr(new Mat(full(r))));
+    bool view = p2c.filter(f, f);
+    Mat outside = full.clone();
+    before(r).copyTo(outside(r));
+    size_t diff = 0;
+    for (int i = 0; i < r.height; i++) {
+        for (int j = 0; j < r.width; j++) {
+            if (full(r).at<float>(i, j) != expected.at<float>(i, j)) diff++;
+        }
+    }
+    for (size_t i = 0; i < full.total(); i++) {
+        if (outside.ptr<float>()[i] != before.ptr<float>()[i]) diff++;
+    }
+    cout << "roi view: " << (view ? "" : "not applied, ") << diff
+         << " pixels differ" << endl;
+    if (!view || diff) ok = false;
+
+    return testResult(ok);
+}
@@ -0,0 +1,309 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Per frame cost of the per-pixel filters on 640x480 with options.tiled on
+ * a pool of 1, 2, 4 and 8 workers, against the untiled run.
+ *
+ * The tiled results must be identical to the untiled ones. Range, Roi and
+ * OffSet, which were rewritten to run per band, are also checked, untiled
+ * and tiled, against the code they had before.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include <toffy/base/amplitudeRange.hpp>
+#include <toffy/base/offset.hpp>
+#include <toffy/base/polar2cart.hpp>
+#include <toffy/base/range.hpp>
+#include <toffy/base/roi.hpp>
+#include <toffy/workerPool.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace cv;
+using namespace toffy;
+using namespace toffy::filters;
+
+static const Size size(640, 480);
+
+/** runs f on copies of depth and ampl, returns us per frame */
+static double run(PixelFilter& f, const Mat& depth, const Mat& ampl, int frames,
+                  Mat& result)
+{
+    Frame fr;
+    matPtr d(new Mat()), a(new Mat());
+    fr.addData("depth", d);
+    fr.addData("img", d);
+    fr.addData("ampl", a);
+
+    double us = 0;
+    for (int n = 0; n < frames; n++) {
+        depth.copyTo(*d);
+        ampl.copyTo(*a);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        f.filter(fr, fr);
+        chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+        us += chrono::duration<double, micro>(t1 - t0).count();
+    }
+    d->copyTo(result);
+    return us / frames;
+}
+
+static size_t differ(const Mat& a, const Mat& b)
+{
+    size_t diff = 0;
+    const float* pa = a.ptr<float>();
+    const float* pb = b.ptr<float>();
+    for (size_t i = 0; i < a.total(); i++) {
+        if (pa[i] != pb[i] && (pa[i] == pa[i] || pb[i] == pb[i])) diff++;
+    }
+    return diff;
+}
+
+/** the former Range::filter() into a new output */
+static void refRange(const Mat& img, Mat& out, float min, float max)
+{
+    Mat mask = (img >= min) & (img <= max);
+    out.release();
+    img.copyTo(out, mask);
+}
+
+/** the former Roi::filter() in place */
+static void refRoi(Mat& img, const Rect& roi, bool in, bool filter,
+                   bool below, double inValue, double outValue)
+{
+    if (in) {
+        Mat dst_roi = img(roi);
+        if (filter) {
+            Mat fmask = below ? (dst_roi < inValue) : (dst_roi > inValue);
+            dst_roi.setTo(outValue, fmask);
+        } else
+            dst_roi = outValue;
+    } else if (filter) {
+        Mat fmask = below ? (img > inValue) : (img < inValue);
+        Mat copyImg = img.clone();
+        copyImg.setTo(outValue, fmask);
+        img(roi).copyTo(copyImg(roi));
+        img = copyImg.clone();
+    } else {
+        Mat outliers(img.size(), img.type(), outValue);
+        img(roi).copyTo(outliers(roi));
+        img = outliers.clone();
+    }
+}
+
+/** the former OffSet::filter() in place */
+static void refOffset(Mat& img, const vector<Rect>& rois, float sum,
+                      float mul)
+{
+    if (rois.empty()) {
+        img = img + sum;
+        img *= mul;
+    }
+    for (size_t i = 0; i < rois.size(); i++) {
+        Mat roi(img(rois[i]));
+        roi += sum;
+        roi *= mul;
+    }
+}
+
+/** runs f once on copies of depth and ampl, returns a copy of @p slot */
+static Mat once(PixelFilter& f, const Mat& depth, const Mat& ampl,
+                const string& slot)
+{
+    Frame fr;
+    matPtr d(new Mat(depth.clone())), a(new Mat(ampl.clone()));
+    fr.addData("depth", d);
+    fr.addData("ampl", a);
+    f.filter(fr, fr);
+    return fr.hasKey(slot) ? fr.getMatPtr(slot)->clone() : Mat();
+}
+
+/** f untiled and tiled against the result of the former code */
+static bool baseline(PixelFilter& f, const boost::property_tree::ptree& pt,
+                     const string& what, const string& slot, const Mat& depth,
+                     const Mat& ampl, const Mat& expected)
+{
+    f.updateConfig(pt);
+    bool ok = true;
+    for (int tiled = 0; tiled < 2; tiled++) {
+        f.tiled(tiled);
+        Mat result = once(f, depth, ampl, slot);
+        size_t diff = result.size() == expected.size() &&
+                              result.type() == expected.type()
+                          ? differ(expected, result)
+                          : expected.total();
+        cout << what << (tiled ? ", tiled" : "") << ": " << diff
+             << " pixels differ from the former filter" << endl;
+        ok &= !diff;
+    }
+    return ok;
+}
+
+static bool baselines(const Mat& depth, const Mat& ampl)
+{
+    WorkerPool pool(4);
+    WorkerPool::setShared(&pool);
+    bool ok = true;
+    Mat expected;
+
+    boost::property_tree::ptree pt;
+    pt.put("inputs.img", "depth");
+    pt.put("outputs.img", "range");
+    pt.put("options.min", 0.5);
+    pt.put("options.max", 6.0);
+    refRange(depth, expected, 0.5f, 6.0f);
+    filters::Range range;
+    ok &= baseline(range, pt, "range", "range", depth, ampl, expected);
+    // in place the former code cleared the image before its masked copy
+    // from the same image, so everything became 0; the out of place result
+    // is the one intended
+    pt.put("outputs.img", "depth");
+    filters::Range rangeInPlace;
+    ok &= baseline(rangeInPlace, pt, "range in place", "depth", depth, ampl,
+                   expected);
+
+    const Rect r(100, 50, 400, 380);
+    for (int mode = 0; mode < 6; mode++) {
+        bool in = mode & 1, filter = mode < 4, below = mode & 2;
+        pt.clear();
+        pt.put("inputs.img", "depth");
+        pt.put("options.x", r.x);
+        pt.put("options.y", r.y);
+        pt.put("options.width", r.width);
+        pt.put("options.height", r.height);
+        pt.put("options.in", in);
+        pt.put("options.filter", filter);
+        pt.put("options.below", below);
+        pt.put("options.inValue", 3.0);
+        pt.put("options.outValue", -1.0);
+        depth.copyTo(expected);
+        refRoi(expected, r, in, filter, below, 3.0, -1.0);
+        Roi roi;
+        ok &= baseline(roi, pt,
+                       string("roi") + (in ? " in" : " out") +
+                           (filter ? (below ? " below" : " above") : ""),
+                       "depth", depth, ampl, expected);
+    }
+
+    pt.clear();
+    pt.put("inputs.img", "depth");
+    pt.put("outputs.img", "depth");
+    pt.put("options.sumValue", 0.25);
+    pt.put("options.mulValue", 1.5);
+    depth.copyTo(expected);
+    refOffset(expected, vector<Rect>(), 0.25f, 1.5f);
+    OffSet offset;
+    ok &= baseline(offset, pt, "offset", "depth", depth, ampl, expected);
+
+    // two overlapping rois, the second one across several bands
+    vector<Rect> rois = {Rect(10, 20, 200, 100), Rect(150, 60, 300, 400)};
+    for (size_t i = 0; i < rois.size(); i++) {
+        boost::property_tree::ptree roi;
+        roi.put("x", rois[i].x);
+        roi.put("y", rois[i].y);
+        roi.put("width", rois[i].width);
+        roi.put("height", rois[i].height);
+        pt.add_child("options.roi.roi", roi);
+    }
+    depth.copyTo(expected);
+    refOffset(expected, rois, 0.25f, 1.5f);
+    OffSet offsetRois;
+    ok &= baseline(offsetRois, pt, "offset rois", "depth", depth, ampl,
+                   expected);
+
+    WorkerPool::setShared(NULL);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = 200;
+    if (argc >= 2) {
+        frames = atoi(argv[1]);
+    }
+
+    mt19937 rng(42);
+    uniform_real_distribution<float> dist(-1.0f, 8.0f), amp(0.0f, 2000.0f);
+    Mat depth(size, CV_32F), ampl(size, CV_32F);
+    for (size_t i = 0; i < depth.total(); i++) {
+        depth.ptr<float>()[i] = dist(rng);
+        ampl.ptr<float>()[i] = amp(rng);
+    }
+
+    filters::Range range;
+    AmplitudeRange amplRange;
+    Roi roi;
+    OffSet offset;
+    Polar2Cart p2c;
+    boost::property_tree::ptree pt;
+    pt.put("inputs.img", "depth");
+    pt.put("outputs.img", "depth");
+    pt.put("options.min", 0.5);
+    pt.put("options.max", 6.0);
+    pt.put("options.minAmpl", 100);
+    pt.put("options.maxAmpl", 1800);
+    pt.put("options.x", 100);
+    pt.put("options.y", 50);
+    pt.put("options.width", 400);
+    pt.put("options.height", 380);
+    pt.put("options.filter", true);
+    pt.put("options.inValue", 3.0);
+    pt.put("options.outValue", 0);
+    pt.put("options.sumValue", 0.25);
+    pt.put("options.mulValue", 1.5);
+    pt.put("options.fovx", 90.);
+    pt.put("options.fovy", 67.5);
+
+    PixelFilter* filters[] = {&range, &amplRange, &roi, &offset, &p2c};
+    const size_t threads[] = {1, 2, 4, 8};
+
+    bool ok = true;
+    cout << "frames: " << frames << ", " << size.width << "x" << size.height
+         << endl;
+    for (PixelFilter* f : filters) {
+        f->updateConfig(pt);
+        f->tiled(false);
+        Mat expected;
+        double base = run(*f, depth, ampl, frames, expected);
+        cout << f->type() << ": untiled " << base << " us/frame";
+
+        f->tiled(true);
+        for (size_t t : threads) {
+            WorkerPool pool(t);
+            WorkerPool::setShared(&pool);
+            Mat result;
+            double us = run(*f, depth, ampl, frames, result);
+            WorkerPool::setShared(NULL);
+
+            size_t diff = differ(expected, result);
+            cout << ", " << t << " threads " << us << " us/frame ("
+                 << base / us << "x)";
+            if (diff) {
+                cout << " " << diff << " pixels differ";
+                ok = false;
+            }
+        }
+        cout << endl;
+    }
+
+    ok &= baselines(depth, ampl);
+
+    return testResult(ok);
+}
@@ -0,0 +1,33 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <iostream>
+#include <string>
+
+/** Prints what failed unless @p cond holds, returns cond */
+inline bool check(bool cond, const std::string& what)
+{
+    if (!cond) std::cout << "failed: " << what << std::endl;
+    return cond;
+}
+
+/** Prints PASSED or FAILED, returns the exit code of the test */
+inline int testResult(bool ok)
+{
+    std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the asynchronous sink:
+ *
+ * - synchronous mode calls the writer directly.
+ * - block keeps every frame in order, dropOldest keeps the newest and
+ *   dropNewest the oldest ones; the counters add up.
+ * - queued images are copies unless asyncShare is set.
+ * - a writer stall does not stall submit() with a drop policy.
+ */
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <toffy/asyncSink.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+using boost::property_tree::ptree;
+
+/** records the fc of every frame, optionally slow or held at a gate */
+struct Recorder {
+    boost::mutex mtx;
+    vector<unsigned int> fcs;
+    vector<int> pixels;
+    std::atomic<int> delayMs;
+    bool gate, entered;
+
+    Recorder() : delayMs(0), gate(false), entered(false) {}
+
+    bool write(const Frame& f)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mtx);
+            entered = true;
+        }
+        while (true) {
+            {
+                boost::lock_guard<boost::mutex> lock(mtx);
+                if (!gate) break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        if (delayMs) this_thread::sleep_for(chrono::milliseconds(delayMs));
+        if (!f.hasKey("fc")) throw runtime_error("no fc");
+        boost::lock_guard<boost::mutex> lock(mtx);
+        fcs.push_back(f.getUInt("fc"));
+        if (f.hasKey("img")) pixels.push_back(f.getMatPtr("img")->at<int>(0, 0));
+        return fcs.back() != 13;
+    }
+
+    void release()
+    {
+        boost::lock_guard<boost::mutex> lock(mtx);
+        gate = false;
+    }
+};
+
+static AsyncSink::Writer writer(Recorder& r)
+{
+    return std::bind(&Recorder::write, &r, std::placeholders::_1);
+}
+
+static ptree config(bool async, int queue, const string& policy)
+{
+    ptree pt;
+    pt.put("options.async", async);
+    pt.put("options.asyncQueue", queue);
+    pt.put("options.asyncPolicy", policy);
+    return pt;
+}
+
+static const vector<string> keys = {"fc", "img"};
+
+static Frame frame(unsigned int fc)
+{
+    Frame f;
+    f.addData("fc", fc);
+    return f;
+}
+
+static bool balanced(const AsyncSink& s)
+{
+    AsyncSink::Stats st = s.stats();
+    return st.submitted == st.written + st.failed + st.dropped + st.queued;
+}
+
+static bool testSync()
+{
+    bool ok = true;
+    Recorder r;
+    AsyncSink s("sync", writer(r));
+    for (unsigned int i = 10; i < 15; i++) {
+        bool written = s.submit(frame(i), keys);
+        ok = check(written == (i != 13), "sync result") && ok;
+    }
+    ok = check(r.fcs.size() == 5, "sync writes at once") && ok;
+    ok = check(s.submit(Frame(), keys) == false, "writer exception") && ok;
+    AsyncSink::Stats st = s.stats();
+    ok = check(st.written == 4 && st.failed == 2 && balanced(s),
+               "sync counters") &&
+         ok;
+    return ok;
+}
+
+static bool testBlock()
+{
+    bool ok = true;
+    Recorder r;
+    r.delayMs = 2;
+    AsyncSink s("block", writer(r));
+    s.updateConfig(config(true, 2, "block"));
+    for (unsigned int i = 0; i < 20; i++) s.submit(frame(i), keys);
+    s.flush();
+    bool inOrder = r.fcs.size() == 20;
+    for (size_t i = 0; inOrder && i < r.fcs.size(); i++) {
+        inOrder = r.fcs[i] == i;
+    }
+    ok = check(inOrder, "block keeps all frames in order") && ok;
+    AsyncSink::Stats st = s.stats();
+    ok = check(st.dropped == 0 && st.blocked > 0 && st.peak == 2 &&
+                   balanced(s),
+               "block counters") &&
+         ok;
+    return ok;
+}
+
+static bool testDrop(const string& policy)
+{
+    bool ok = true;
+    Recorder r;
+    AsyncSink s(policy, writer(r));
+    s.updateConfig(config(true, 3, policy));
+
+    // the writer takes frame 0 and is held, 3 more fit into the queue
+    r.gate = true;
+    s.submit(frame(0), keys);
+    while (true) {
+        {
+            boost::lock_guard<boost::mutex> lock(r.mtx);
+            if (r.entered) break;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    for (unsigned int i = 1; i < 10; i++) s.submit(frame(i), keys);
+    ok = check(balanced(s) && s.stats().queued == 4,
+               policy + " counters while held") &&
+         ok;
+    r.release();
+    s.flush();
+
+    vector<unsigned int> expect = {0, 1, 2, 3};
+    if (policy == "dropOldest") expect = {0, 7, 8, 9};
+    ok = check(r.fcs == expect, policy + " keeps the right frames") && ok;
+    AsyncSink::Stats st = s.stats();
+    ok = check(st.dropped == 6 && st.written == 4 && balanced(s),
+               policy + " counters") &&
+         ok;
+    return ok;
+}
+
+static bool testSnapshot()
+{
+    bool ok = true;
+    Recorder r;
+    AsyncSink s("snapshot", writer(r));
+    ptree pt = config(true, 4, "block");
+    s.updateConfig(pt);
+
+    matPtr img(new cv::Mat(4, 4, CV_32S));
+    img->at<int>(0, 0) = 1;
+    Frame f = frame(0);
+    f.addData("img", img);
+    r.gate = true;
+    s.submit(f, keys);
+    img->at<int>(0, 0) = 2;  // the next frame, in place
+    r.release();
+    s.flush();
+    ok = check(r.pixels.size() == 1 && r.pixels[0] == 1, "image copied") &&
+         ok;
+
+    AsyncSink::FramePtr shared = AsyncSink::snapshot(f, keys, true);
+    ok = check(shared->getMatPtr("img") == img && !shared->hasKey("x"),
+               "asyncShare keeps the buffer") &&
+         ok;
+
+    r.gate = true;
+    s.submit(f, keys, true);
+    img->at<int>(0, 0) = 3;  // shared, the writer sees the change
+    r.release();
+    s.flush();
+    ok = check(r.pixels.size() == 2 && r.pixels[1] == 3,
+               "submit shares on request") &&
+         ok;
+    return ok;
+}
+
+static bool testStall()
+{
+    bool ok = true;
+    Recorder r;
+    AsyncSink s("stall", writer(r));
+    s.updateConfig(config(true, 16, "dropOldest"));
+
+    double worst = 0;
+    for (unsigned int i = 0; i < 40; i++) {
+        r.delayMs = i == 5 ? 100 : 1;  // a disk hiccup
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        s.submit(frame(i), keys);
+        worst = max(worst, chrono::duration<double, milli>(
+                               chrono::steady_clock::now() - t0)
+                               .count());
+        this_thread::sleep_for(chrono::milliseconds(4));
+    }
+    s.close();
+    AsyncSink::Stats st = s.stats();
+    cout << "100 ms stall: slowest submit " << worst << " ms, " << st.written
+         << " written, " << st.dropped << " dropped, peak queue " << st.peak
+         << endl;
+    ok = check(worst < 20, "submit does not stall") && ok;
+    ok = check(st.queued == 0 && balanced(s), "close writes the queue") && ok;
+    return ok;
+}
+
+int main()
+{
+    bool ok = testSync();
+    ok = testBlock() && ok;
+    ok = testDrop("dropOldest") && ok;
+    ok = testDrop("dropNewest") && ok;
+    ok = testSnapshot() && ok;
+    ok = testStall() && ok;
+
+    AsyncSink::Policy p;
+    ok = check(!AsyncSink::parsePolicy("latest", p) &&
+                   AsyncSink::parsePolicy("dropNewest", p) &&
+                   AsyncSink::policyName(p) == "dropNewest",
+               "policy names") &&
+         ok;
+
+    return testResult(ok);
+}
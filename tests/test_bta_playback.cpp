@@ -0,0 +1,163 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Plays a .trec recording through Bta with options.zeroCopy and runs
+ * AmplitudeRange in place on the outputs:
+ *
+ * - writing to the outputs does not crash on the read only mapping.
+ * - every pass over the recording gets the recorded values, the writes
+ *   of the previous pass do not stick.
+ * - the recording file is not changed.
+ */
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <bta.h>
+
+#include <toffy/base/amplitudeRange.hpp>
+#include <toffy/bta/bta.hpp>
+#include <toffy/bta/recording.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+using namespace toffy::capturers;
+namespace fs = boost::filesystem;
+
+static const int cols = 8, rows = 6;
+static const unsigned short minAmpl = 100;
+/// bytes of a channel header in .r files, the start of a BTA_Channel
+static const size_t channelHeader = 32;
+
+/** every third pixel has an amplitude below minAmpl */
+static unsigned short amplitude(int i) { return i % 3 ? 500 : 50; }
+
+static float distance(int i) { return 1.0f + i * 0.01f; }
+
+static void appendChannel(vector<char>& raw, BTA_ChannelId id,
+                          BTA_DataFormat format, const void* data,
+                          size_t len)
+{
+    BTA_Channel chan;
+    memset(&chan, 0, sizeof(chan));
+    chan.id = id;
+    chan.xRes = cols;
+    chan.yRes = rows;
+    chan.dataFormat = format;
+    chan.dataLen = len;
+    const char* c = (const char*)&chan;
+    raw.insert(raw.end(), c, c + channelHeader);
+    raw.insert(raw.end(), (const char*)data, (const char*)data + len);
+}
+
+/** a frame in the layout of .r files, as BtaWrapper::loadFrame() reads it */
+static vector<char> serialize(const vector<float>& dist,
+                              const vector<unsigned short>& ampl)
+{
+    vector<char> raw(32, 0);
+    raw[28] = 2;  // channelsLen
+    appendChannel(raw, BTA_ChannelIdDistance, BTA_DataFormatFloat32,
+                  dist.data(), dist.size() * sizeof(float));
+    appendChannel(raw, BTA_ChannelIdAmplitude, BTA_DataFormatUInt16,
+                  ampl.data(), ampl.size() * sizeof(unsigned short));
+    return raw;
+}
+
+int main()
+{
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    string path = (dir / "playback.trec").string();
+
+    // a frame with a distance and an amplitude channel
+    vector<float> dist(cols * rows);
+    vector<unsigned short> ampl(cols * rows);
+    for (int i = 0; i < cols * rows; i++) {
+        dist[i] = distance(i);
+        ampl[i] = amplitude(i);
+    }
+    vector<char> recorded = serialize(dist, ampl);
+    size_t size = recorded.size();
+
+    const int frames = 3;
+    {
+        RecordingWriter w;
+        FrameHeader h;
+        h.manufacturer = 1;
+        h.device = 0;
+        h.lenght = size;
+        bool ok = w.open(path);
+        for (int n = 0; ok && n < frames; n++) {
+            ok = w.append(h, recorded.data(), n);
+        }
+        w.close();
+        if (!check(ok, "recording written")) {
+            return testResult(false);
+        }
+    }
+
+    Bta bta;
+    boost::property_tree::ptree pt;
+    pt.put("options.zeroCopy", true);
+    bta.updateConfig(pt);
+    bool ok = check(bta.loadPath(path) == frames, "recording loaded");
+    bta.playback(true);
+
+    filters::AmplitudeRange range;
+    pt.clear();
+    pt.put("options.minAmpl", minAmpl);
+    pt.put("inputs.depth", "distance");
+    pt.put("inputs.ampl", "amplitude");
+    pt.put("outputs.depth", "distance");
+    pt.put("outputs.ampl", "amplitude");
+    range.updateConfig(pt);
+
+    // two passes over the recording
+    Frame f;
+    for (int n = 0; ok && n < 2 * frames; n++) {
+        ok = check(bta.filter(f, f), "played frame " + to_string(n));
+        if (!ok) break;
+        matPtr d = f.getMatPtr("distance");
+        matPtr a = f.getMatPtr("amplitude");
+        for (int i = 0; i < cols * rows; i++) {
+            ok &= check(d->ptr<float>()[i] == distance(i) &&
+                            a->ptr<unsigned short>()[i] == amplitude(i),
+                        "recorded values in frame " + to_string(n));
+        }
+        ok &= check(range.filter(f, f), "in place filter");
+        for (int i = 0; i < cols * rows; i++) {
+            bool keep = amplitude(i) > minAmpl;
+            ok &= check(d->ptr<float>()[i] == (keep ? distance(i) : 0.f),
+                        "filtered frame " + to_string(n));
+        }
+    }
+    f.clearData();
+
+    RecordingReader rec;
+    ok &= check(rec.open(path) && rec.size() == (size_t)frames, "reopened");
+    for (size_t i = 0; i < rec.size(); i++) {
+        ok &= check(!memcmp(rec.payload(i), recorded.data(), size),
+                    "recording unchanged");
+    }
+    rec.close();
+
+    fs::remove_all(dir);
+    return testResult(ok);
+}
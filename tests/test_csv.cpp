@@ -0,0 +1,251 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the csv reader and writer:
+ *
+ * - values are written exactly as an ostream writes them.
+ * - reading gives the same values as strtof/strtol on the text.
+ * - separators, garbage and short files are handled.
+ *
+ * and compares the speed with the ofstream / fscanf code ExportCSV and
+ * CSVSource used before, at several resolutions.
+ */
+#include <stdint.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#include <toffy/import/csvMat.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+template <typename T>
+static string streamed(const cv::Mat& m)
+{
+    ostringstream os;
+    for (int y = 0; y < m.rows; y++) {
+        for (int x = 0; x < m.cols; x++) {
+            T v = m.at<T>(y, x);
+            if (sizeof(T) == 1) {
+                os << (int)v << ";";
+            } else {
+                os << v << ";";
+            }
+        }
+        os << '\n';
+    }
+    return os.str();
+}
+
+static bool testFloatFormat()
+{
+    bool ok = true;
+    mt19937 rnd(42);
+    cv::Mat m(100, 1000, CV_32F);
+    float special[] = {0.f,     -0.f,      1.f,       0.0001f,  0.00009999995f,
+                       999999.f, 999999.5f, 1e6f,      0.1f,     0.15f,
+                       2.5f,     1e-10f,    -3.40282e38f,
+                       numeric_limits<float>::infinity(),
+                       numeric_limits<float>::quiet_NaN()};
+    int n = 0;
+    for (int y = 0; y < m.rows; y++) {
+        for (int x = 0; x < m.cols; x++, n++) {
+            float v;
+            if (n < (int)(sizeof(special) / sizeof(float))) {
+                v = special[n];
+            } else if (n % 2) {
+                // any bit pattern
+                uint32_t bits = rnd();
+                memcpy(&v, &bits, sizeof(v));
+            } else {
+                // depth like values, 1e-5..1e7
+                v = pow(10.f, uniform_real_distribution<float>(-5, 7)(rnd));
+                if (n % 4 == 0) v = -v;
+            }
+            m.at<float>(y, x) = v;
+        }
+    }
+    string text;
+    ok = check(csv::format(m, text), "format float") && ok;
+    string expect = streamed<float>(m);
+    if (!check(text == expect, "float text as ostream")) {
+        size_t i = 0;
+        while (i < text.size() && text[i] == expect[i]) i++;
+        size_t b = i < 20 ? 0 : i - 20;
+        cout << "  got    " << text.substr(b, 40) << endl
+             << "  expect " << expect.substr(b, 40) << endl;
+        ok = false;
+    }
+
+    // read back: the same as strtof on every value
+    cv::Mat back(m.rows, m.cols, CV_32F);
+    size_t count = csv::parse(text.data(), text.data() + text.size(), back);
+    ok = check(count == m.total(), "float count") && ok;
+    istringstream is(text);
+    string token;
+    bool same = true;
+    for (int i = 0; getline(is, token, ';') && i < (int)m.total(); i++) {
+        float v = strtof(token.c_str(), NULL);
+        float r = back.at<float>(i / m.cols, i % m.cols);
+        same = same && (memcmp(&v, &r, sizeof(v)) == 0 ||
+                        (std::isnan(v) && std::isnan(r)));
+    }
+    ok = check(same, "float values as strtof") && ok;
+    return ok;
+}
+
+template <typename T>
+static bool testInt(int type, const string& name)
+{
+    bool ok = true;
+    mt19937 rnd(7);
+    cv::Mat m(50, 200, type);
+    for (int y = 0; y < m.rows; y++) {
+        for (int x = 0; x < m.cols; x++) {
+            m.at<T>(y, x) = (T)rnd();
+        }
+    }
+    m.at<T>(0, 0) = numeric_limits<T>::min();
+    m.at<T>(0, 1) = numeric_limits<T>::max();
+    string text;
+    csv::format(m, text);
+    ok = check(text == streamed<T>(m), name + " text as ostream") && ok;
+
+    cv::Mat back(m.rows, m.cols, type);
+    ok = check(csv::parse(text.data(), text.data() + text.size(), back) ==
+                       m.total() &&
+                   memcmp(back.data, m.data, m.total() * m.elemSize()) == 0,
+               name + " round trip") &&
+         ok;
+    return ok;
+}
+
+static bool testParse()
+{
+    bool ok = true;
+    const char text[] = "1; 2,\r\n-3;x;4.6;\n70000;-5;";
+    cv::Mat m(2, 3, CV_16U);
+    m = cv::Scalar::all(9);
+    size_t n = csv::parse(text, text + strlen(text), m);
+    ok = check(n == 6, "parse count") && ok;
+    uint16_t expect[] = {1, 2, 0, 5, 65535, 0};
+    ok = check(memcmp(m.data, expect, sizeof(expect)) == 0,
+               "parse saturates") &&
+         ok;
+
+    cv::Mat f(1, 4, CV_32F);
+    f = cv::Scalar::all(9);
+    const char floats[] = "1.5e2;-2.5E-1;nan";
+    n = csv::parse(floats, floats + strlen(floats), f);
+    ok = check(n == 3 && f.at<float>(0, 0) == 150.f &&
+                   f.at<float>(0, 1) == -0.25f &&
+                   std::isnan(f.at<float>(0, 2)) && f.at<float>(0, 3) == 9.f,
+               "parse floats, short input") &&
+         ok;
+
+    ok = check(csv::read("/nonexistent/file.csv", f) == 0, "missing file") &&
+         ok;
+    return ok;
+}
+
+// what ExportCSV and CSVSource did before
+static void writeStream(const string& path, const cv::Mat& m)
+{
+    ofstream of(path, std::ofstream::out);
+    for (int y = 0; y < m.rows; y++) {
+        for (int x = 0; x < m.cols; x++) of << m.at<float>(y, x) << ";";
+        of << '\n';
+    }
+}
+
+static void readScanf(const string& path, cv::Mat& m)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    for (int y = 0; y < m.rows; y++) {
+        float val;
+        for (int x = 0; x < m.cols; x++) {
+            if (fscanf(f, "%g;", &val) != 1) val = 0;
+            m.at<float>(y, x) = val;
+        }
+    }
+    fclose(f);
+}
+
+static double ms(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0)
+        .count();
+}
+
+static bool bench(int width, int height)
+{
+    mt19937 rnd(1);
+    cv::Mat m(height, width, CV_32F), back(height, width, CV_32F);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            m.at<float>(y, x) = uniform_real_distribution<float>(0.3f, 8)(rnd);
+        }
+    }
+    const string path = "/tmp/toffy_test_csv.csv";
+    const int runs = 5;
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) writeStream(path, m);
+    double oldWrite = ms(t0) / runs;
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) readScanf(path, back);
+    double oldRead = ms(t0) / runs;
+
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) csv::write(path, m);
+    double newWrite = ms(t0) / runs;
+    size_t n = 0;
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) n = csv::read(path, back);
+    double newRead = ms(t0) / runs;
+
+    cout << width << "x" << height << ": write " << oldWrite << " -> "
+         << newWrite << " ms, read " << oldRead << " -> " << newRead << " ms"
+         << endl;
+    remove(path.c_str());
+    return check(n == m.total(), "bench read");
+}
+
+int main()
+{
+    bool ok = testFloatFormat();
+    ok = testInt<uint8_t>(CV_8U, "8U") && ok;
+    ok = testInt<uint16_t>(CV_16U, "16U") && ok;
+    ok = testInt<int16_t>(CV_16S, "16S") && ok;
+    ok = testInt<int32_t>(CV_32S, "32S") && ok;
+    ok = testParse() && ok;
+
+    ok = bench(160, 120) && ok;
+    ok = bench(320, 240) && ok;
+    ok = bench(640, 480) && ok;
+
+    return testResult(ok);
+}
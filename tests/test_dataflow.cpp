@@ -0,0 +1,303 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the FilterBank dataflow mode:
+ *
+ * - read/write hazards and barriers give the expected deps, without the
+ *   ones implied by others.
+ * - a filter listing inputs and outputs without declaresSlots() is a
+ *   barrier.
+ * - a diamond a -> (b, c) -> d gives the same frame as the sequential
+ *   run, and the two slow branches overlap.
+ * - a failing filter ends the pass, filters after it are not started.
+ * - the report names the critical path.
+ * - concurrent filters adding slots no one used before do not race on the
+ *   frame.
+ * - removing, adding and reconfiguring filters gives a new graph.
+ */
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include <boost/thread/thread.hpp>
+
+#include <toffy/dataflow.hpp>
+#include <toffy/filterbank.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+/** writes 1 + the sum of its inputs to each output, after a sleep */
+class SlotFilter : public Filter
+{
+   public:
+    SlotFilter(const string& type, const vector<string>& reads,
+               const vector<string>& writes, int us = 0)
+        : Filter(type, 1), reads(reads), writes(writes), us(us), fail(false),
+          calls(0)
+    {
+    }
+
+    virtual boost::property_tree::ptree getConfig() const
+    {
+        boost::property_tree::ptree pt = Filter::getConfig();
+        for (size_t i = 0; i < reads.size(); i++) {
+            pt.put("inputs.in" + to_string(i), reads[i]);
+        }
+        for (size_t i = 0; i < writes.size(); i++) {
+            pt.put("outputs.out" + to_string(i), writes[i]);
+        }
+        return pt;
+    }
+
+    virtual bool declaresSlots() const { return true; }
+
+    virtual void updateConfig(const boost::property_tree::ptree& pt)
+    {
+        Filter::updateConfig(pt);
+        for (size_t i = 0; i < reads.size(); i++) {
+            reads[i] = pt.get("inputs.in" + to_string(i), reads[i]);
+        }
+    }
+
+    virtual bool filter(const Frame& in, Frame& out)
+    {
+        calls++;
+        if (us) boost::this_thread::sleep(boost::posix_time::microseconds(us));
+        unsigned int sum = 1;
+        for (size_t i = 0; i < reads.size(); i++) {
+            if (!in.hasKey(reads[i])) return false;
+            sum += in.getUInt(reads[i]);
+        }
+        for (size_t i = 0; i < writes.size(); i++) out.addData(writes[i], sum);
+        return !fail;
+    }
+
+    vector<string> reads, writes;
+    int us;
+    bool fail;
+    atomic<int> calls;
+};
+
+/** lists its slots like SlotFilter, but may touch others, like Bta */
+class UndeclaredFilter : public SlotFilter
+{
+   public:
+    UndeclaredFilter(const string& type, const vector<string>& writes)
+        : SlotFilter(type, {}, writes)
+    {
+    }
+
+    virtual bool declaresSlots() const { return false; }
+};
+
+static DataflowGraph::Node node(const string& id, const vector<string>& reads,
+                                const vector<string>& writes,
+                                bool barrier = false)
+{
+    DataflowGraph::Node n;
+    n.id = id;
+    n.reads = reads;
+    n.writes = writes;
+    n.barrier = barrier;
+    return n;
+}
+
+static bool testGraph()
+{
+    bool ok = true;
+    vector<DataflowGraph::Node> nodes;
+    nodes.push_back(node("a", {}, {"x"}));
+    nodes.push_back(node("b", {"x"}, {"y"}));
+    nodes.push_back(node("c", {"x"}, {"z"}));
+    nodes.push_back(node("d", {"y", "z"}, {"w"}));
+    nodes.push_back(node("e", {}, {"x"}));  // overwrites what b and c read
+    nodes.push_back(node("cam", {}, {}, true));
+    nodes.push_back(node("f", {"q"}, {"r"}));
+    DataflowGraph g;
+    g.build(nodes);
+    const vector<DataflowGraph::Node>& n = g.nodes();
+    ok &= check(n[0].deps.empty(), "a first");
+    ok &= check(n[1].deps == vector<size_t>({0}), "b after a");
+    ok &= check(n[2].deps == vector<size_t>({0}), "c after a");
+    ok &= check(n[3].deps == vector<size_t>({1, 2}), "d after b, c");
+    ok &= check(n[4].deps == vector<size_t>({1, 2}), "e after readers of x");
+    ok &= check(n[5].deps == vector<size_t>({3, 4}), "barrier after all");
+    ok &= check(n[6].deps == vector<size_t>({5}), "f after barrier");
+    ok &= check(n[0].succs == vector<size_t>({1, 2}), "succs of a");
+
+    vector<double> cost = {1, 3, 2, 1, 1, 1, 1};
+    boost::property_tree::ptree pt = g.report(cost);
+    ok &= check(pt.get<string>("criticalPath") == "a b d cam f",
+                "critical path");
+    ok &= check(pt.get<double>("criticalPathCost") == 7, "critical cost");
+    ok &= check(pt.get<double>("totalCost") == 10, "total cost");
+    ok &= check(pt.get<double>("nodes.d.start") == 4, "start of d");
+    ok &= check(pt.get<string>("nodes.d.deps") == "b c", "deps of d");
+    return ok;
+}
+
+static bool testUndeclared()
+{
+    bool ok = true;
+    SlotFilter a("a", {}, {"x"}), c("c", {"q"}, {"r"});
+    UndeclaredFilter b("b", {"y"});
+    vector<Filter*> filters = {&a, &b, &c};
+    DataflowGraph g;
+    g.build(filters);
+    const vector<DataflowGraph::Node>& n = g.nodes();
+    ok &= check(!n[0].barrier && n[1].barrier && !n[2].barrier,
+                "undeclared filter is a barrier");
+    ok &= check(n[1].deps == vector<size_t>({0}), "barrier after a");
+    ok &= check(n[2].deps == vector<size_t>({1}), "c after barrier");
+    return ok;
+}
+
+static bool testBank()
+{
+    bool ok = true;
+    const int us = 30000;
+    SlotFilter a("a", {}, {"x"}), b("b", {"x"}, {"y"}, us),
+        c("c", {"x"}, {"z"}, us), d("d", {"y", "z"}, {"w"});
+    FilterBank bank;
+    bank.add(&a);
+    bank.add(&b);
+    bank.add(&c);
+    bank.add(&d);
+
+    typedef chrono::steady_clock Clock;
+    Frame seq;
+    Clock::time_point t0 = Clock::now();
+    ok &= check(bank.filter(seq, seq), "sequential pass");
+    double msSeq = chrono::duration<double, milli>(Clock::now() - t0).count();
+
+    bank.dataflow(true, 4);
+    ok &= check(bank.dataflow(), "dataflow on");
+    double msFlow = 1e9;
+    for (int run = 0; run < 5; run++) {
+        Frame f;
+        t0 = Clock::now();
+        ok &= check(bank.filter(f, f), "dataflow pass");
+        msFlow = min(msFlow,
+                     chrono::duration<double, milli>(Clock::now() - t0).count());
+        ok &= check(f.hasKey("w") && f.getUInt("w") == seq.getUInt("w") &&
+                        f.getUInt("y") == seq.getUInt("y") &&
+                        f.getUInt("z") == seq.getUInt("z"),
+                    "same frame as sequential");
+    }
+    cout << "sequential " << msSeq << " ms, dataflow " << msFlow << " ms"
+         << endl;
+    ok &= check(msFlow < 0.8 * msSeq, "branches overlap");
+
+    boost::property_tree::ptree pt = bank.getDataflowReport();
+    string path = pt.get<string>("criticalPath");
+    ok &= check(path == a.id() + " " + b.id() + " " + d.id() ||
+                    path == a.id() + " " + c.id() + " " + d.id(),
+                "report critical path");
+    ok &= check(pt.get<double>("parallelism") > 1.5, "report parallelism");
+
+    // a failing branch stops the pass before d
+    c.fail = true;
+    int before = d.calls;
+    Frame f;
+    ok &= check(!bank.filter(f, f), "failure reported");
+    ok &= check(d.calls == before, "no filter after a failure");
+    c.fail = false;
+
+    bank.dataflow(false);
+    ok &= check(!bank.dataflow(), "dataflow off");
+    Frame g;
+    ok &= check(bank.filter(g, g) && g.getUInt("w") == seq.getUInt("w"),
+                "sequential again");
+    return ok;
+}
+
+static bool testFreshSlots()
+{
+    bool ok = true;
+    vector<string> bWrites, cWrites;
+    for (int i = 0; i < 200; i++) {
+        bWrites.push_back("fresh_b" + to_string(i));
+        cWrites.push_back("fresh_c" + to_string(i));
+    }
+    SlotFilter a("a", {}, {"x"}), b("b", {"x"}, bWrites),
+        c("c", {"x"}, cWrites), d("d", {"fresh_b0", "fresh_c199"}, {"w"});
+    FilterBank bank;
+    bank.add(&a);
+    bank.add(&b);
+    bank.add(&c);
+    bank.add(&d);
+    bank.dataflow(true, 4);
+
+    Frame f;
+    ok &= check(bank.filter(f, f), "fresh slots pass");
+    bool all = true;
+    for (int i = 0; i < 200; i++) {
+        all &= f.hasKey(bWrites[i]) && f.hasKey(cWrites[i]);
+    }
+    ok &= check(all, "all fresh slots merged");
+    ok &= check(f.optUInt("w", 0) == 5, "reader of fresh slots");
+    return ok;
+}
+
+static bool testReplan()
+{
+    bool ok = true;
+    const int us = 30000;
+    SlotFilter a("a", {}, {"x"}), b("b", {"x"}, {"y"}, us),
+        c("c", {"x"}, {"z"}), d("d", {"y", "z"}, {"w"}), e("e", {"w"}, {"v"});
+    FilterBank bank;
+    bank.add(&a);
+    bank.add(&b);
+    bank.add(&c);
+    bank.add(&d);
+    bank.dataflow(true, 4);
+
+    // a stale graph would start d after a only, in c's place, before b
+    // wrote y
+    bank.remove(c.name());
+    bank.add(&e);
+    Frame f;
+    f.addData("z", 5u);
+    ok &= check(bank.filter(f, f), "pass after remove and add");
+    ok &= check(f.optUInt("v", 0) == 1 + 1 + 2 + 5, "d after b, e after d");
+
+    // e now reads y, it no longer waits for d
+    e.bank(&bank);
+    boost::property_tree::ptree pt;
+    pt.put("inputs.in0", "y");
+    e.updateConfig(pt);
+    Frame g;
+    g.addData("z", 5u);
+    ok &= check(bank.filter(g, g), "pass after updateConfig");
+    ok &= check(g.optUInt("v", 0) == 1 + 2, "e reads y");
+    ok &= check(bank.getDataflowReport().get<string>("nodes." + e.id() +
+                                                     ".deps") == b.id(),
+                "e after b");
+    return ok;
+}
+
+int main()
+{
+    bool ok = testGraph();
+    ok &= testUndeclared();
+    ok &= testBank();
+    ok &= testFreshSlots();
+    ok &= testReplan();
+    return testResult(ok);
+}
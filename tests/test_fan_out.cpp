@@ -0,0 +1,218 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the ParallelFilter fan-out mode with three lanes on one input:
+ *
+ * - a lane scaling depth in place gets a copy of depth,
+ * - a lane writing ampl, which it reuses from the input, gets a copy of
+ *   ampl but shares depth,
+ * - a lane without declared slots copies all Mats.
+ *
+ * The input frame is left untouched, the barrier sees each lane's result
+ * and the lanes overlap. Deleting the ParallelFilter deletes the lane and
+ * barrier filters.
+ */
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include <boost/thread/thread.hpp>
+
+#include <toffy/filterfactory.hpp>
+#include <toffy/mux.hpp>
+#include <toffy/parallelFilter.hpp>
+#include <toffy/workerPool.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+static const int sleepMs = 30;
+
+/** outputs.img = inputs.img * options.factor, reuses an existing output */
+class Scale : public Filter
+{
+   public:
+    Scale() : Filter("scale"), _in("depth"), _out(_in), _factor(1) {}
+
+    static Filter* create() { return new Scale(); }
+
+    virtual void updateConfig(const boost::property_tree::ptree& pt)
+    {
+        Filter::updateConfig(pt);
+        _in = pt.get<string>("inputs.img", _in);
+        _out = pt.get<string>("outputs.img", _in);
+        _factor = pt.get<float>("options.factor", _factor);
+    }
+
+    virtual boost::property_tree::ptree getConfig() const
+    {
+        boost::property_tree::ptree pt = Filter::getConfig();
+        pt.put("inputs.img", _in);
+        pt.put("outputs.img", _out);
+        pt.put("options.factor", _factor);
+        return pt;
+    }
+
+    virtual bool declaresSlots() const { return true; }
+
+    virtual bool filter(const Frame& in, Frame& out)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(sleepMs));
+        matPtr src = in.getMatPtr(_in);
+        matPtr dst = out.optMatPtr(_out, matPtr());
+        if (!dst) {
+            dst.reset(new cv::Mat(src->rows, src->cols, src->type()));
+            out.addData(_out, dst);
+        }
+        const float* s = src->ptr<float>();
+        float* d = dst->ptr<float>();
+        for (size_t i = 0; i < src->total(); i++) d[i] = s[i] * _factor;
+        return true;
+    }
+
+   private:
+    string _in, _out;
+    float _factor;
+};
+
+/** reads depth without declaring it */
+class Peek : public Filter
+{
+   public:
+    Peek() : Filter("peek") {}
+
+    static Filter* create() { return new Peek(); }
+
+    virtual bool filter(const Frame& in, Frame& out)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(sleepMs));
+        out.addData("peek", (double)in.getMatPtr("depth")->ptr<float>()[0]);
+        return true;
+    }
+};
+
+/** puts depth and ampl of lane i into depth<i> and ampl<i> */
+class Collect : public Mux
+{
+   public:
+    Collect() : Mux("collect") {}
+
+    static Filter* create() { return new Collect(); }
+
+    virtual bool filter(const std::vector<Frame*>& in, Frame& out)
+    {
+        for (size_t i = 0; i < in.size(); i++) {
+            out.addData("depth" + to_string(i), in[i]->getMatPtr("depth"));
+            out.addData("ampl" + to_string(i), in[i]->getMatPtr("ampl"));
+        }
+        return true;
+    }
+};
+
+static boost::property_tree::ptree scale(const string& in, const string& out,
+                                         float factor)
+{
+    boost::property_tree::ptree pt;
+    pt.put("scale.inputs.img", in);
+    pt.put("scale.outputs.img", out);
+    pt.put("scale.options.factor", factor);
+    return pt;
+}
+
+static bool equals(const cv::Mat& m, const cv::Mat& ref, float factor)
+{
+    for (size_t i = 0; i < m.total(); i++) {
+        if (m.ptr<float>()[i] != ref.ptr<float>()[i] * factor) return false;
+    }
+    return true;
+}
+
+int main()
+{
+    FilterFactory::registerCreator("scale", &Scale::create);
+    FilterFactory::registerCreator("peek", &Peek::create);
+    FilterFactory::registerCreator("collect", &Collect::create);
+    WorkerPool pool(3);
+    WorkerPool::setShared(&pool);
+
+    boost::property_tree::ptree pt, peek, collect;
+    pt.add_child("toffy.thread", scale("depth", "depth", 2));
+    pt.add_child("toffy.thread", scale("depth", "ampl", 3));
+    peek.put("peek.name", "peek");
+    pt.add_child("toffy.thread", peek);
+    collect.put("collect.name", "collect");
+    pt.add_child("toffy.barrier", collect);
+    pt.put("toffy.options.fanOut", true);
+
+    ParallelFilter* pf = new ParallelFilter();
+    pf->loadConfig(pt);
+    pf->init();
+    pf->start();
+    vector<string> ids;
+    for (size_t i = 0; i < pf->size(); i++) {
+        ids.push_back(pf->getFilter((int)i)->id());
+    }
+
+    bool ok = check(pf->fanOut(), "fan-out configured");
+    matPtr depth(new cv::Mat(48, 64, CV_32F)), ampl(new cv::Mat(48, 64, CV_32F));
+    for (size_t i = 0; i < depth->total(); i++) {
+        depth->ptr<float>()[i] = i * 0.5f;
+        ampl->ptr<float>()[i] = 1000.f - i;
+    }
+    cv::Mat depthRef = depth->clone(), amplRef = ampl->clone();
+
+    const int frames = 5;
+    double ms = 1e9;
+    for (int n = 0; n < frames; n++) {
+        Frame in, out;
+        in.addData("depth", depth);
+        in.addData("ampl", ampl);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        ok &= check(pf->filter(in, out), "filter");
+        ms = min(ms, chrono::duration<double, milli>(
+                         chrono::steady_clock::now() - t0).count());
+
+        ok &= check(equals(*depth, depthRef, 1) && equals(*ampl, amplRef, 1),
+                    "input untouched");
+        ok &= check(equals(*out.getMatPtr("depth0"), depthRef, 2) &&
+                        out.getMatPtr("depth0") != depth,
+                    "in place lane works on a copy");
+        ok &= check(out.getMatPtr("ampl0") == ampl, "lane 0 shares ampl");
+        ok &= check(equals(*out.getMatPtr("ampl1"), depthRef, 3) &&
+                        out.getMatPtr("ampl1") != ampl,
+                    "reused output is a copy");
+        ok &= check(out.getMatPtr("depth1") == depth, "lane 1 shares depth");
+        ok &= check(out.getMatPtr("depth2") != depth &&
+                        out.getMatPtr("ampl2") != ampl &&
+                        equals(*out.getMatPtr("depth2"), depthRef, 1),
+                    "undeclared lane copies all");
+    }
+    cout << "copies " << pf->copies() << ", " << ms << " ms per frame" << endl;
+    ok &= check(pf->copies() == 4 * frames, "copies per frame");
+    ok &= check(ms < 2 * sleepMs, "lanes overlap");
+
+    pf->stop();
+    delete pf;
+    bool deleted = ids.size() == 4;
+    for (size_t i = 0; i < ids.size(); i++) {
+        deleted &= !FilterFactory::getInstance()->findFilter(ids[i]);
+    }
+    ok &= check(deleted, "lane and barrier filters deleted once");
+    WorkerPool::setShared(NULL);
+    return testResult(ok);
+}
@@ -0,0 +1,169 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the filter instrumentation:
+ *
+ * - LatencyHistogram percentiles are within the bucket resolution.
+ * - FilterBank counts calls and failures per filter, the failing filter
+ *   ends the pass and the remaining ones are not called.
+ * - nested banks show up as a subtree with their own filters.
+ * - resetFilterStats() clears all levels.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <toffy/filterStats.hpp>
+#include <toffy/filterbank.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+/** within the 1/16 resolution of the histogram */
+static bool near(uint64_t v, uint64_t expected)
+{
+    return v >= expected && v <= expected + expected / 16 + 1;
+}
+
+/** sleeps for a while */
+class SleepFilter : public Filter
+{
+   public:
+    explicit SleepFilter(int us) : Filter("sleep"), us(us) {}
+
+    virtual bool filter(const Frame&, Frame&)
+    {
+        boost::this_thread::sleep(boost::posix_time::microseconds(us));
+        return true;
+    }
+
+    int us;
+};
+
+/** fails every third call */
+class FlakyFilter : public Filter
+{
+   public:
+    FlakyFilter() : Filter("flaky"), n(0) {}
+
+    virtual bool filter(const Frame&, Frame&) { return ++n % 3 != 0; }
+
+    int n;
+};
+
+static bool testHistogram()
+{
+    bool ok = true;
+    for (uint64_t v = 0; v < 1000000; v = v * 3 / 2 + 1) {
+        size_t b = LatencyHistogram::bucket(v);
+        ok = check(near(LatencyHistogram::bucketMax(b), v) &&
+                       (b == 0 || LatencyHistogram::bucketMax(b - 1) < v),
+                   "bucket bounds") &&
+             ok;
+    }
+
+    LatencyHistogram h;
+    for (uint64_t v = 1; v <= 100000; v++) h.record(v);
+    ok = check(h.count() == 100000, "count") && ok;
+    ok = check(h.min() == 1 && h.max() == 100000, "min/max") && ok;
+    ok = check(h.mean() == 50000, "mean") && ok;
+    ok = check(near(h.percentile(50), 50000), "p50") && ok;
+    ok = check(near(h.percentile(95), 95000), "p95") && ok;
+    ok = check(near(h.percentile(99), 99000), "p99") && ok;
+    ok = check(h.percentile(100) == 100000, "p100") && ok;
+
+    LatencyHistogram other;
+    other.record(1000000);
+    h.merge(other);
+    ok = check(h.count() == 100001 && h.max() == 1000000, "merge") && ok;
+    h.reset();
+    ok = check(h.count() == 0 && h.percentile(50) == 0, "reset") && ok;
+    return ok;
+}
+
+static bool testBank()
+{
+    bool ok = true;
+    SleepFilter slow(2000), fast(10);
+    FlakyFilter flaky;
+    FilterBank outer, inner;
+    inner.add(&fast);
+    inner.add(&flaky);
+    outer.add(&slow);
+    outer.add(&inner);
+
+    Frame f;
+    const int runs = 30;
+    int passed = 0;
+    for (int i = 0; i < runs; i++) {
+        if (outer.filter(f, f)) passed++;
+    }
+    ok = check(passed == runs - runs / 3, "passes") && ok;
+
+    boost::property_tree::ptree pt = outer.getFilterStats();
+    stringstream json;
+    boost::property_tree::write_json(json, pt);
+    cout << json.str();
+
+    ok = check(pt.get<int>("calls") == runs, "outer calls") && ok;
+    ok = check(pt.get<int>("failures") == runs / 3, "outer failures") && ok;
+
+    const boost::property_tree::ptree& filters = pt.get_child("filters");
+    const boost::property_tree::ptree& s = filters.find(slow.id())->second;
+    ok = check(s.get<int>("calls") == runs && s.get<int>("failures") == 0,
+               "slow counters") &&
+         ok;
+    ok = check(s.get<string>("type") == "sleep", "type") && ok;
+    int p50 = s.get<int>("latencyUs.p50");
+    ok = check(p50 >= 2000 && p50 <= s.get<int>("latencyUs.max"),
+               "slow latency") &&
+         ok;
+
+    const boost::property_tree::ptree& in = filters.find(inner.id())->second;
+    ok = check(in.get<int>("failures") == runs / 3, "inner failures") && ok;
+    const boost::property_tree::ptree& fl =
+        in.get_child("filters").find(flaky.id())->second;
+    ok = check(fl.get<int>("calls") == runs && fl.get<int>("failures") == 10,
+               "flaky counters") &&
+         ok;
+
+    outer.resetFilterStats();
+    ok = check(outer.bankStats().calls == 0 && inner.bankStats().calls == 0,
+               "reset") &&
+         ok;
+    pt = outer.getFilterStats();
+    ok = check(pt.get_child("filters").find(slow.id())->second.get<int>(
+                   "calls") == 0,
+               "reset filters") &&
+         ok;
+
+    outer.clearBank();
+    inner.clearBank();
+    return ok;
+}
+
+int main()
+{
+    bool ok = testHistogram();
+    ok = testBank() && ok;
+
+    return testResult(ok);
+}
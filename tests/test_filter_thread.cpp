@@ -0,0 +1,127 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Stress test for the SpscRing and the FilterThread lanes built on it.
+ *
+ * - pushes a sequence of numbers through a small ring from one thread to
+ *   another and checks that nothing is lost, duplicated or reordered.
+ * - runs a counting filter in a FilterThread lane and cycles frames through
+ *   dequeue()/enqueue() the same way ParallelFilter does.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <toffy/filterThread.hpp>
+#include <toffy/spscRing.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+/** increments slot "n" of every frame it sees */
+class CountFilter : public Filter
+{
+   public:
+    CountFilter() : Filter("count") {}
+
+    virtual bool filter(const Frame& in, Frame& out)
+    {
+        out.addData("n", in.optInt("n", 0) + 1);
+        return true;
+    }
+};
+
+static bool testRing(size_t count)
+{
+    SpscRing<size_t> ring(8);
+    bool ok = true;
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    boost::thread producer([&ring, count]() {
+        for (size_t i = 0; i < count; i++) ring.push(i);
+        ring.close();
+    });
+
+    size_t v, expected = 0;
+    while (ring.pop(v)) {
+        if (v != expected) {
+            cout << "ring: got " << v << ", expected " << expected << endl;
+            ok = false;
+            break;
+        }
+        expected++;
+    }
+    producer.join();
+    double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    if (ok && expected != count) {
+        cout << "ring: received " << expected << " of " << count << endl;
+        ok = false;
+    }
+    cout << "ring: " << count << " items in " << s << " s, " << count / s / 1e6
+         << " M items/s" << endl;
+    return ok;
+}
+
+static bool testLane(size_t count)
+{
+    CountFilter f;
+    FilterThread ft(&f);
+    ft.init(2);
+    ft.start();
+
+    size_t total = 0;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        Frame* fr = ft.dequeue();
+        if (!fr) {
+            cout << "lane: stopped early at " << i << endl;
+            return false;
+        }
+        total += fr->getInt("n");
+        ft.enqueue(fr);
+    }
+    double s = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    ft.stop();
+
+    // every frame is seen count/2 times, its counter runs 1..count/2
+    size_t half = count / 2;
+    size_t expected = half * (half + 1);
+    cout << "lane: " << count << " frames in " << s << " s, " << count / s
+         << " frames/s, lane processed " << ft.processed() << endl;
+    if (total != expected) {
+        cout << "lane: counter sum " << total << ", expected " << expected
+             << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = 2000000;
+    if (argc >= 2) {
+        count = atol(argv[1]);
+    }
+    count &= ~size_t(1);
+
+    bool ok = testRing(count);
+    ok = testLane(count) && ok;
+
+    return testResult(ok);
+}
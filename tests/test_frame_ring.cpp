@@ -0,0 +1,171 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks BtaFrameRing with a thread standing in for the BTA SDK callback
+ * and a consumer slower than the camera, for each policy:
+ *
+ * - received == delivered + dropped + queued.
+ * - frames arrive intact and in order (latest: newer than the last one).
+ * - block never drops, queue and latest do when the consumer lags.
+ * - slot buffers are reused, no channel buffer is allocated per frame.
+ */
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include <toffy/bta/frameRing.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+
+static const int channels = 2, xRes = 32, yRes = 24;
+
+/** frame as handed to frameArrivedEx2 by the SDK */
+class MockFrame
+{
+    BTA_Frame frame;
+    BTA_Channel chan[channels];
+    BTA_Channel* chans[channels];
+    vector<uint16_t> data[channels];
+
+   public:
+    MockFrame()
+    {
+        memset(&frame, 0, sizeof(frame));
+        for (int c = 0; c < channels; c++) {
+            memset(&chan[c], 0, sizeof(chan[c]));
+            data[c].resize(xRes * yRes);
+            chan[c].xRes = xRes;
+            chan[c].yRes = yRes;
+            chan[c].dataFormat = BTA_DataFormatUInt16;
+            chan[c].data = (uint8_t*)data[c].data();
+            chan[c].dataLen = data[c].size() * sizeof(uint16_t);
+            chans[c] = &chan[c];
+        }
+        frame.channels = chans;
+        frame.channelsLen = channels;
+    }
+
+    const BTA_Frame* fill(uint32_t counter)
+    {
+        frame.frameCounter = counter;
+        for (int c = 0; c < channels; c++) {
+            for (size_t i = 0; i < data[c].size(); i++) {
+                data[c][i] = (uint16_t)(counter * 7 + c * 1000 + i);
+            }
+        }
+        return &frame;
+    }
+
+    static bool intact(const BTA_Frame* f)
+    {
+        if (f->channelsLen != channels) return false;
+        for (int c = 0; c < channels; c++) {
+            const uint16_t* d = (const uint16_t*)f->channels[c]->data;
+            for (int i = 0; i < xRes * yRes; i++) {
+                if (d[i] != (uint16_t)(f->frameCounter * 7 + c * 1000 + i)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+static void produce(BtaFrameRing* ring, int frames)
+{
+    MockFrame mock;
+    for (int n = 1; n <= frames; n++) {
+        ring->push(mock.fill(n));
+        boost::this_thread::sleep(boost::posix_time::microseconds(200));
+    }
+}
+
+static bool run(BtaFrameRing::Policy policy)
+{
+    const int frames = 400;
+    const size_t slots = 4;
+    BtaFrameRing ring(slots, policy);
+    string name = BtaFrameRing::policyName(policy);
+    bool ok = true;
+
+    boost::thread camera(produce, &ring, frames);
+    uint32_t last = 0;
+    int delivered = 0;
+    set<const uint8_t*> buffers;
+    for (;;) {
+        BtaFrameRing::FramePtr f = ring.pop(100);
+        if (!f) break;  // producer done and queue drained
+        delivered++;
+        ok = check(MockFrame::intact(f.get()), name + ": frame intact") && ok;
+        if (policy == BtaFrameRing::LatestOnly) {
+            ok = check(f->frameCounter > last, name + ": newer frame") && ok;
+        } else if (policy == BtaFrameRing::Block) {
+            ok = check(f->frameCounter == last + 1, name + ": no gaps") && ok;
+        } else {
+            ok = check(f->frameCounter > last, name + ": in order") && ok;
+        }
+        last = f->frameCounter;
+        for (int c = 0; c < channels; c++) buffers.insert(f->channels[c]->data);
+        // slower than the camera
+        boost::this_thread::sleep(boost::posix_time::microseconds(500));
+    }
+    camera.join();
+
+    BtaFrameRing::Stats s = ring.stats();
+    ok = check(s.received == (uint64_t)frames, name + ": received") && ok;
+    ok = check(s.delivered == (uint64_t)delivered, name + ": delivered") && ok;
+    ok = check(s.received == s.delivered + s.dropped + s.queued,
+               name + ": accounting") &&
+         ok;
+    if (policy == BtaFrameRing::Block) {
+        ok = check(s.dropped == 0, name + ": nothing dropped") && ok;
+    } else {
+        ok = check(s.dropped > 0, name + ": drops counted") && ok;
+    }
+    ok = check(buffers.size() <= slots * channels, name + ": buffers reused") &&
+         ok;
+
+    cout << name << ": received " << s.received << ", delivered "
+         << s.delivered << ", dropped " << s.dropped << ", "
+         << buffers.size() << " channel buffers" << endl;
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    ok = run(BtaFrameRing::LatestOnly) && ok;
+    ok = run(BtaFrameRing::Block) && ok;
+    ok = run(BtaFrameRing::Queue) && ok;
+
+    // close() wakes a waiting consumer
+    BtaFrameRing ring;
+    boost::thread closer([&ring]() {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+        ring.close();
+    });
+    ok = check(!ring.pop(), "close wakes pop") && ok;
+    closer.join();
+    MockFrame mock;
+    ok = check(!ring.push(mock.fill(1)), "closed ring drops") && ok;
+
+    return testResult(ok);
+}
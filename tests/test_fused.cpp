@@ -0,0 +1,285 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Runs range -> amplitudeRange -> roi -> distAmpl once filter by filter and
+ * once as FusedPass, and checks depth, amplitude and mask are bitwise the
+ * same:
+ *
+ * - roi filtering inside and outside, below and above,
+ * - untiled and tiled,
+ * - float amplitudes, which distAmpl refuses, so the bank falls back to
+ *   the single filters,
+ * - roi removed from and added back to both banks, the fused passes have to
+ *   follow.
+ *
+ * Without arguments this runs on random frames and on frames of the
+ * synthetic capturer, recorded with exportSnapshot and played back with
+ * importSnapshot. test_fused <dir> [prefix] plays the snapshot files of
+ * exportSnapshot in <dir> instead (slots depth and ampl).
+ */
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include <toffy/base/amplitudeRange.hpp>
+#include <toffy/base/distAmpl.hpp>
+#include <toffy/base/range.hpp>
+#include <toffy/base/roi.hpp>
+#include <toffy/capture/synthetic.hpp>
+#include <toffy/filterbank.hpp>
+#include <toffy/import/importSnapshot.hpp>
+#include <toffy/viewers/exportSnapshot.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+using namespace toffy::filters;
+
+static bool same(const cv::Mat& a, const cv::Mat& b)
+{
+    if (a.size() != b.size() || a.type() != b.type()) return false;
+    for (int y = 0; y < a.rows; y++) {
+        if (memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize())) return false;
+    }
+    return true;
+}
+
+/** the chain of one bank */
+struct Chain {
+    Range range;
+    AmplitudeRange amplRange;
+    Roi roi;
+    DistAmpl distAmpl;
+    FilterBank bank;  ///< destroyed first, does not own the filters
+
+    Chain(const boost::property_tree::ptree& pt, bool fuse, bool tiled)
+    {
+        PixelFilter* f[] = {&range, &amplRange, &roi, &distAmpl};
+        for (PixelFilter* p : f) {
+            p->updateConfig(pt);
+            p->tiled(tiled);
+            bank.add(p);
+        }
+        bank.fuse(fuse);
+    }
+};
+
+static boost::property_tree::ptree config(bool in, bool below)
+{
+    boost::property_tree::ptree pt;
+    pt.put("inputs.img", "depth");
+    pt.put("outputs.img", "depth");
+    pt.put("inputs.depth", "depth");
+    pt.put("outputs.depth", "depth");
+    pt.put("inputs.ampl", "ampl");
+    pt.put("outputs.ampl", "ampl");
+    pt.put("options.min", 0.3);
+    pt.put("options.max", 7.0);
+    pt.put("options.minAmpl", 300.5);
+    pt.put("options.maxAmpl", 14000);
+    pt.put("options.x", 20);
+    pt.put("options.y", 10);
+    pt.put("options.width", 100);
+    pt.put("options.height", 80);
+    pt.put("options.in", in);
+    pt.put("options.filter", true);
+    pt.put("options.below", below);
+    pt.put("options.inValue", 2.5);
+    pt.put("options.outValue", -1);
+    return pt;
+}
+
+/** up to 20 frames recorded by exportSnapshot in @p dir */
+static vector<Frame> recordedFrames(const string& dir, const string& prefix)
+{
+    vector<Frame> fr;
+    import::ImportSnapshot imp;
+    boost::property_tree::ptree pt;
+    pt.put("options.path", dir);
+    if (!prefix.empty()) pt.put("options.prefix", prefix);
+    imp.updateConfig(pt);
+    for (int i = 0; i < 20; i++) {
+        Frame f;
+        if (!imp.filter(f, f)) break;
+        fr.push_back(f);
+    }
+    return fr;
+}
+
+/** records frames of the synthetic capturer and plays them back */
+static vector<Frame> syntheticFrames()
+{
+    namespace fs = boost::filesystem;
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    boost::property_tree::ptree pt;
+    pt.put("options.width", 160);
+    pt.put("options.height", 120);
+    pt.put("options.people", 3);
+    pt.put("options.dropout", 0.02);
+    pt.put("options.nanDropout", true);
+    capturers::SyntheticCapturer cam;
+    cam.updateConfig(pt);
+    cam.connect();
+
+    pt.clear();
+    pt.put("options.path", dir.string());
+    pt.put("options.prefix", "fused");
+    pt.put("options.compress", true);
+    {
+        ExportSnapshot exp;  // the files are written when it is gone
+        exp.updateConfig(pt);
+        for (int i = 0; i < 10; i++) {
+            Frame f, out;
+            if (!cam.filter(f, f) || !exp.filter(f, out)) break;
+        }
+    }
+
+    vector<Frame> fr = recordedFrames(dir.string(), "fused");
+    fs::remove_all(dir);
+    return fr;
+}
+
+static vector<Frame> randomFrames()
+{
+    vector<Frame> fr;
+    mt19937 rng(7);
+    uniform_real_distribution<float> depth(-1.0f, 9.0f);
+    uniform_int_distribution<int> ampl(0, 16000);
+    for (int i = 0; i < 10; i++) {
+        Frame f;
+        matPtr d(new cv::Mat(120, 160, CV_32F)), a(new cv::Mat(120, 160, CV_16S));
+        for (size_t p = 0; p < d->total(); p++) {
+            d->ptr<float>()[p] = p % 97 ? depth(rng) : NAN;
+            a->ptr<short>()[p] = ampl(rng);
+        }
+        f.addData("depth", d);
+        f.addData("ampl", a);
+        fr.push_back(f);
+    }
+    return fr;
+}
+
+/** a deep copy of depth and ampl of f */
+static Frame copy(const Frame& f, bool floatAmpl)
+{
+    Frame c;
+    matPtr d(new cv::Mat(f.getMatPtr("depth")->clone())), a(new cv::Mat());
+    f.getMatPtr("ampl")->convertTo(*a, floatAmpl ? CV_32F : CV_16S);
+    c.addData("depth", d);
+    c.addData("ampl", a);
+    return c;
+}
+
+/** removes roi from both chains and adds it back at the end */
+static bool testReplan(const vector<Frame>& input)
+{
+    boost::property_tree::ptree pt = config(true, false);
+    Chain single(pt, false, false), fused(pt, true, false);
+    bool ok = true;
+    for (int step = 0; step < 2; step++) {
+        if (step == 0) {
+            single.bank.remove(size_t(2));
+            fused.bank.remove(size_t(2));
+            ok &= check(fused.bank.fusedPasses().size() == 1 &&
+                            fused.bank.fusedPasses()[0].size() == 3,
+                        "three fused without roi");
+        } else {
+            single.bank.add(&single.roi);
+            fused.bank.add(&fused.roi);
+        }
+        for (size_t i = 0; i < input.size(); i++) {
+            Frame a = copy(input[i], false), b = copy(input[i], false);
+            ok &= check(single.bank.filter(a, a), "single");
+            ok &= check(fused.bank.filter(b, b), "fused");
+            string what = " step " + to_string(step);
+            ok &= check(same(*a.getMatPtr("depth"), *b.getMatPtr("depth")),
+                        "depth" + what);
+            ok &= check(same(*a.getMatPtr("mask"), *b.getMatPtr("mask")),
+                        "mask" + what);
+        }
+    }
+    ok &= check(fused.bank.fusedPasses().size() == 1 &&
+                    fused.bank.fusedPasses()[0].size() == 4 &&
+                    fused.bank.fusedPasses()[0].filters()[3] == &fused.roi,
+                "roi fused again at the end");
+    cout << "replan " << (ok ? "ok" : "FAILED") << endl;
+    return ok;
+}
+
+static bool testChains(const vector<Frame>& input, const string& source)
+{
+    bool ok = check(!input.empty(), source + " frames loaded");
+    cout << input.size() << " " << source << " frames" << endl;
+
+    typedef chrono::steady_clock Clock;
+    for (int variant = 0; variant < 6; variant++) {
+        bool in = variant & 1, below = variant & 2, floatAmpl = variant == 4,
+             tiled = variant == 5;
+        boost::property_tree::ptree pt = config(in, below);
+        Chain single(pt, false, tiled), fused(pt, true, tiled);
+        ok &= check(fused.bank.fusedPasses().size() == 1 &&
+                        fused.bank.fusedPasses()[0].size() == 4,
+                    "all four fused");
+
+        double usSingle = 0, usFused = 0;
+        for (size_t i = 0; i < input.size(); i++) {
+            Frame a = copy(input[i], floatAmpl), b = copy(input[i], floatAmpl);
+            Clock::time_point t0 = Clock::now();
+            ok &= check(single.bank.filter(a, a), "single");
+            Clock::time_point t1 = Clock::now();
+            ok &= check(fused.bank.filter(b, b), "fused");
+            Clock::time_point t2 = Clock::now();
+            usSingle += chrono::duration<double, micro>(t1 - t0).count();
+            usFused += chrono::duration<double, micro>(t2 - t1).count();
+
+            string what = " variant " + to_string(variant);
+            ok &= check(same(*a.getMatPtr("depth"), *b.getMatPtr("depth")),
+                        "depth" + what);
+            ok &= check(same(*a.getMatPtr("ampl"), *b.getMatPtr("ampl")),
+                        "ampl" + what);
+            ok &= check(same(*a.getMatPtr("mask"), *b.getMatPtr("mask")),
+                        "mask" + what);
+        }
+        cout << "roi " << (in ? "in" : "out") << (below ? " below" : " above")
+             << (floatAmpl ? ", float ampl" : "") << (tiled ? ", tiled" : "")
+             << ": single " << usSingle / input.size() << " us/frame, fused "
+             << usFused / input.size() << " us/frame" << endl;
+    }
+
+    ok &= testReplan(input);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    bool ok;
+    if (argc >= 2) {
+        ok = testChains(recordedFrames(argv[1], argc >= 3 ? argv[2] : ""),
+                        "recorded");
+    } else {
+        ok = testChains(randomFrames(), "random");
+        ok &= testChains(syntheticFrames(), "synthetic");
+    }
+
+    return testResult(ok);
+}
@@ -0,0 +1,104 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks that MatPool recycles buffers through frame slots:
+ *
+ * - a frame slot that is overwritten or cleared hands its buffer back,
+ *   the next acquire of the same size/type gets it again.
+ * - buffers still shared by a cv::Mat header are not recycled.
+ * - buffers outliving the pool are freed normally.
+ */
+#include <iostream>
+
+#include <toffy/frame.hpp>
+#include <toffy/matPool.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+int main()
+{
+    bool ok = true;
+    MatPool pool(2);
+    Frame f;
+
+    // steady state: one allocation, then the same buffer over and over
+    const uchar* data = NULL;
+    for (int i = 0; i < 100; i++) {
+        matPtr m = pool.acquire(120, 160, CV_32F);
+        if (!data) data = m->data;
+        ok = check(m->data == data, "buffer reused") && ok;
+        f.addData("depth", m);
+        m.reset();
+        f.clearData();
+    }
+    MatPool::Stats s = pool.stats();
+    ok = check(s.allocated == 1, "one allocation") && ok;
+    ok = check(s.reused == 99, "99 reuses") && ok;
+    ok = check(s.idle == 1, "one idle buffer") && ok;
+    ok = check(s.idleBytes == 120 * 160 * 4, "idle bytes") && ok;
+
+    // overwriting a slot returns the previous buffer
+    f.addData("depth", pool.acquire(120, 160, CV_32F));
+    f.addData("depth", pool.acquire(120, 160, CV_32F));
+    ok = check(pool.stats().idle == 1, "overwritten slot returned") && ok;
+    f.clearData();
+
+    // a buffer still referenced by another header stays with its owner
+    cv::Mat keep;
+    {
+        matPtr m = pool.acquire(10, 10, CV_8U);
+        keep = *m;
+    }
+    ok = check(pool.stats().dropped == 1, "shared buffer dropped") && ok;
+
+    // other sizes do not match, capacity per key is honoured
+    {
+        matPtr a = pool.acquire(10, 10, CV_16U);
+        matPtr b = pool.acquire(10, 10, CV_16U);
+        matPtr c = pool.acquire(10, 10, CV_16U);
+    }
+    s = pool.stats();
+    ok = check(s.allocated == 6, "allocations per size") && ok;
+    ok = check(s.dropped == 2, "capacity per key") && ok;
+
+    // writing in place is only safe while nobody else holds the image
+    {
+        matPtr m = pool.acquire(10, 10, CV_8U);
+        f.addData("img", m);
+        ok = check(MatPool::exclusive(m), "slot and caller only") && ok;
+        matPtr queued = m;
+        ok = check(!MatPool::exclusive(m), "queued elsewhere") && ok;
+        queued.reset();
+        cv::Mat view = *m;
+        ok = check(!MatPool::exclusive(m), "data shared") && ok;
+        f.clearData();
+    }
+
+    // outliving the pool
+    matPtr late;
+    {
+        MatPool tmp;
+        late = tmp.acquire(4, 4, CV_8U);
+    }
+    late.reset();
+
+    cout << "allocated " << s.allocated << ", reused " << s.reused
+         << ", returned " << s.returned << ", dropped " << s.dropped << endl;
+    return testResult(ok);
+}
@@ -0,0 +1,108 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the Pipeline mode of FilterBank:
+ *
+ * - a stage reads the slots the stage before it wrote for the same frame,
+ *   frames come out in order.
+ * - after the first round, the stages write into the Mats handed back
+ *   from the output frame instead of allocating new ones.
+ */
+#include <iostream>
+#include <sstream>
+
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <toffy/filterfactory.hpp>
+#include <toffy/pipeline.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+static int allocs = 0;  ///< Mats created by Produce, stage 0 thread only
+
+/** writes the frame number to the Mat "a", reusing the slot if present */
+class Produce : public Filter
+{
+   public:
+    Produce() : Filter("produce"), n(0) {}
+
+    virtual bool filter(const Frame& in, Frame& out)
+    {
+        if (!out.hasKey("a")) allocs++;
+        matPtr a = out.getSertMatPtr("a", cv::Size(4, 4), CV_32S);
+        a->at<int>(0, 0) = ++n;
+        return true;
+    }
+
+    int n;
+};
+
+/** reads "a" of the same frame, writes twice its value to "b" */
+class Consume : public Filter
+{
+   public:
+    Consume() : Filter("consume") {}
+
+    virtual bool filter(const Frame& in, Frame& out)
+    {
+        if (!in.hasKey("a")) return false;
+        out.addData("b", 2 * in.getMatPtr("a")->at<int>(0, 0));
+        return true;
+    }
+};
+
+static Filter* createProduce() { return new Produce(); }
+static Filter* createConsume() { return new Consume(); }
+
+int main()
+{
+    FilterFactory::registerCreator("produce", createProduce);
+    FilterFactory::registerCreator("consume", createConsume);
+
+    stringstream xml(
+        "<toffy><pipeline><options><queue>2</queue></options>"
+        "<stage><produce/></stage><stage><consume/></stage>"
+        "</pipeline></toffy>");
+    boost::property_tree::ptree pt;
+    boost::property_tree::read_xml(xml, pt);
+
+    FilterBank fb;
+    fb.loadConfig(pt);
+    Pipeline* pipe = static_cast<Pipeline*>(fb.getFilter(0));
+
+    bool ok = check(pipe && pipe->stages() == 2, "two stages loaded");
+
+    const int frames = 200;
+    Frame f;
+    for (int i = 1; ok && i <= frames; i++) {
+        ok &= check(fb.filter(f, f), "frame " + to_string(i) + " ok");
+        ok &= check(f.hasKey("a") && f.getMatPtr("a")->at<int>(0, 0) == i,
+                    "frame " + to_string(i) + " in order");
+        ok &= check(f.optInt("b", 0) == 2 * i,
+                    "stage 1 read stage 0's slot in frame " + to_string(i));
+    }
+    pipe->stop();
+
+    // every circulating frame allocates once, later rounds reuse the
+    // Mats that come back from f.
+    ok &= check(allocs < frames / 4,
+                "buffers reused, " + to_string(allocs) + " allocations");
+
+    return testResult(ok);
+}
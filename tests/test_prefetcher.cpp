@@ -0,0 +1,116 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the playback prefetcher:
+ *
+ * - frames come in playback order and wrap around at begin and end.
+ * - changing the direction or seeking continues at the right frame.
+ * - with a slow consumer the frames are ready, decoding and consuming
+ *   overlap.
+ */
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <toffy/capture/prefetcher.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy::capturers;
+
+static int decodeMs = 0;
+static atomic<bool> filtering(false);  ///< the consumer is busy
+static atomic<int> overlapped(0);      ///< decodes while it was
+
+static int decode(int i)
+{
+    if (decodeMs) this_thread::sleep_for(chrono::milliseconds(decodeMs));
+    if (filtering) overlapped++;
+    return i * 10;
+}
+
+static bool testOrder()
+{
+    bool ok = true;
+    Prefetcher<int> p(3);
+    p.start(decode, 2, 5, 3);
+    int expect[] = {4, 5, 2, 3, 4, 5, 2};
+    for (int e : expect) {
+        int i;
+        int v = p.next(false, i);
+        ok = check(i == e && v == e * 10, "forward order") && ok;
+    }
+
+    // backward from 2
+    int back[] = {5, 4, 3, 2, 5};
+    for (int e : back) {
+        int i;
+        int v = p.next(true, i);
+        ok = check(i == e && v == e * 10, "backward order") && ok;
+    }
+
+    p.seek(3);
+    int i;
+    p.next(false, i);
+    ok = check(i == 4 && p.position() == 4, "seek") && ok;
+    p.next(true, i);
+    ok = check(i == 3, "turn after seek") && ok;
+
+    p.stop();
+    ok = check(!p.running(), "stopped") && ok;
+    return ok;
+}
+
+static bool testOverlap()
+{
+    bool ok = true;
+    const int frames = 20, ms = 10;
+    decodeMs = ms / 2;
+    Prefetcher<int> p(4);
+    p.start(decode, 0, 1000, 0);
+
+    for (int n = 0; n < frames; n++) {
+        int i;
+        p.next(false, i);
+        ok = check(i == n + 1, "sequence") && ok;
+        filtering = true;
+        this_thread::sleep_for(chrono::milliseconds(ms));  // the filters
+        filtering = false;
+    }
+    p.stop();
+    cout << frames << " frames, " << decodeMs << " ms decode + " << ms
+         << " ms filter: " << overlapped << " decoded while filtering, ready "
+         << p.ready() << ", waited " << p.waited() << endl;
+    // sequentially no frame would be decoded while the filters run
+    ok = check(overlapped >= frames / 2, "decode overlaps") && ok;
+    ok = check(p.waited() <= 2, "frames ready") && ok;
+    decodeMs = 0;
+    return ok;
+}
+
+int main()
+{
+    bool ok = check(playbackStep(5, false, 2, 5) == 2 &&
+                        playbackStep(2, true, 2, 5) == 5 &&
+                        playbackStep(3, false, 2, 5) == 4,
+                    "playbackStep");
+    ok = testOrder() && ok;
+    ok = testOverlap() && ok;
+
+    return testResult(ok);
+}
@@ -0,0 +1,158 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the .trec recording container:
+ *
+ * - frames written are read back byte for byte, in and out of order.
+ * - payloads point into the mapping and stay valid after close().
+ * - a recording that was never closed is recovered by scanning.
+ * - a directory of .r files converts with its frame numbers.
+ */
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <toffy/bta/recording.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy::capturers;
+namespace fs = boost::filesystem;
+
+/** payload of frame n: n + 3 bytes counting up from n */
+static vector<char> payload(int n)
+{
+    vector<char> p(n + 3);
+    for (size_t i = 0; i < p.size(); i++) p[i] = (char)(n + i);
+    return p;
+}
+
+static FrameHeader header(int len)
+{
+    FrameHeader h;
+    h.manufacturer = 1;
+    h.device = 2;
+    h.lenght = len;
+    return h;
+}
+
+static bool matches(const RecordingReader& rec, size_t i, int n)
+{
+    vector<char> p = payload(n);
+    const FrameHeader* h = rec.frame(i);
+    return rec.number(i) == n && h->device == 2 &&
+           h->lenght == (int)p.size() &&
+           memcmp(rec.payload(i), p.data(), p.size()) == 0;
+}
+
+int main()
+{
+    bool ok = true;
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    string file = (dir / "test.trec").string();
+
+    const int frames = 50;
+    RecordingWriter writer;
+    ok = check(writer.open(file), "open writer") && ok;
+    for (int n = 10; n < 10 + frames; n++) {
+        vector<char> p = payload(n);
+        writer.append(header(p.size()), p.data(), n);
+    }
+    ok = check(writer.close(), "close writer") && ok;
+
+    RecordingReader rec;
+    ok = check(rec.open(file), "open reader") && ok;
+    ok = check(rec.size() == (size_t)frames, "frame count") && ok;
+    for (int i = 0; i < frames; i++) {
+        ok = check(matches(rec, i, 10 + i), "frame contents") && ok;
+    }
+    // backward playback seeks by number
+    for (int n = 10 + frames - 1; n >= 10; n -= 7) {
+        long i = rec.find(n);
+        ok = check(i >= 0 && matches(rec, i, n), "seek") && ok;
+    }
+    ok = check(rec.find(9) < 0 && rec.find(10 + frames) < 0, "not found") &&
+         ok;
+
+    // frames outlive the reader with a mapping reference
+    std::shared_ptr<const void> keep = rec.mapping();
+    const char* p = rec.payload(3);
+    rec.close();
+    ok = check(p[0] == (char)13 && p[15] == (char)28, "mapping kept") && ok;
+    keep.reset();
+
+    // crash while recording: no index, records are scanned
+    string unclosed = (dir / "unclosed.trec").string();
+    {
+        RecordingWriter w;
+        w.open(unclosed);
+        for (int n = 0; n < 5; n++) {
+            vector<char> p = payload(n);
+            w.append(header(p.size()), p.data(), n);
+        }
+        w.close();
+    }
+    {
+        // drop index and header counts like a writer that never closed
+        fstream f(unclosed.c_str(), ios::in | ios::out | ios::binary);
+        RecordingHeader h;
+        f.read((char*)&h, sizeof(h));
+        h.frames = 0;
+        h.indexOffset = 0;
+        f.seekp(0);
+        f.write((const char*)&h, sizeof(h));
+    }
+    ok = check(rec.open(unclosed) && rec.size() == 5, "recovered") && ok;
+    for (int i = 0; i < 5 && i < (int)rec.size(); i++) {
+        ok = check(matches(rec, i, i), "recovered contents") && ok;
+    }
+    rec.close();
+
+    // directory of .r files, numbered with gaps
+    fs::path raw = dir / "raw";
+    fs::create_directories(raw);
+    const int numbers[] = {3, 1, 20, 7};
+    for (size_t k = 0; k < 4; k++) {
+        vector<char> p = payload(numbers[k]);
+        FrameHeader h = header(p.size());
+        string name = (raw / (boost::lexical_cast<string>(numbers[k]) + ".r"))
+                          .string();
+        ofstream f(name.c_str(), ios::binary);
+        f.write((const char*)&h, sizeof(h));
+        f.write(p.data(), p.size());
+    }
+    string converted = (dir / "converted.trec").string();
+    ok = check(convertRawDirectory(raw.string(), converted) == 4, "convert") &&
+         ok;
+    ok = check(rec.open(converted) && rec.size() == 4, "converted count") &&
+         ok;
+    const int sorted[] = {1, 3, 7, 20};
+    for (int i = 0; i < 4 && i < (int)rec.size(); i++) {
+        ok = check(matches(rec, i, sorted[i]), "converted contents") && ok;
+    }
+    ok = check(rec.find(3) == 1 && rec.find(4) < 0, "converted seek") && ok;
+    rec.close();
+
+    fs::remove_all(dir);
+    return testResult(ok);
+}
@@ -0,0 +1,346 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the snapshot format:
+ *
+ * - LZ4 blocks round trip for random, repetitive and short inputs, and
+ *   broken blocks are rejected.
+ * - frames round trip with all slot types, raw and compressed.
+ * - truncated and foreign files and slots claiming more pixels than their
+ *   payload holds are rejected without touching the frame.
+ * - exportSnapshot / importSnapshot number their files like the yaml
+ *   filters, and the importer restarts at options.start.
+ *
+ * and prints file sizes and times for a depth / amplitude frame.
+ */
+#include <stdint.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <toffy/import/importSnapshot.hpp>
+#include <toffy/import/snapshot.hpp>
+#include <toffy/viewers/exportSnapshot.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+static bool roundTrip(const vector<uint8_t>& src, const string& what)
+{
+    vector<uint8_t> lz(snapshot::compressBound(src.size()));
+    size_t n = snapshot::compress(src.data(), src.size(), lz.data(), lz.size());
+    vector<uint8_t> back(src.size() + 1, 0xee);
+    bool ok = check(n > 0, what + " compresses") &&
+              check(snapshot::decompress(lz.data(), n, back.data(),
+                                         src.size()),
+                    what + " decompresses") &&
+              check(!memcmp(back.data(), src.data(), src.size()),
+                    what + " round trip") &&
+              check(back[src.size()] == 0xee, what + " writes out of bounds");
+    return ok;
+}
+
+static bool testLz()
+{
+    bool ok = true;
+    mt19937 rng(7);
+    for (size_t n = 0; n < 40; n++) {
+        vector<uint8_t> v(n);
+        for (size_t i = 0; i < n; i++) v[i] = rng() % 3;
+        ok &= roundTrip(v, "short " + to_string(n));
+    }
+    vector<uint8_t> random(100000);
+    for (size_t i = 0; i < random.size(); i++) random[i] = rng();
+    ok &= roundTrip(random, "random");
+
+    vector<uint8_t> zeros(300000, 0);
+    ok &= roundTrip(zeros, "zeros");
+    vector<uint8_t> lz(snapshot::compressBound(zeros.size()));
+    size_t n = snapshot::compress(zeros.data(), zeros.size(), lz.data(),
+                                  lz.size());
+    ok &= check(n < zeros.size() / 100, "zeros compress well");
+
+    vector<uint8_t> text;
+    const char* words[] = {"depth ", "ampl ", "confidence ", "x ", "y "};
+    while (text.size() < 200000) {
+        const char* w = words[rng() % 5];
+        text.insert(text.end(), w, w + strlen(w));
+    }
+    ok &= roundTrip(text, "words");
+
+    // a too small buffer is reported, not overrun
+    vector<uint8_t> small(random.size() / 2 + 8, 0xee);
+    ok &= check(!snapshot::compress(random.data(), random.size(),
+                                    small.data(), small.size() - 8),
+                "random does not fit half the size");
+    ok &= check(small.back() == 0xee, "compress writes out of bounds");
+
+    // broken blocks
+    n = snapshot::compress(text.data(), text.size(), lz.data(), lz.size());
+    vector<uint8_t> back(text.size());
+    ok &= check(!snapshot::decompress(lz.data(), n / 2, back.data(),
+                                      back.size()),
+                "truncated block rejected");
+    ok &= check(!snapshot::decompress(lz.data(), n, back.data(),
+                                      back.size() - 1),
+                "wrong size rejected");
+    ok &= check(!snapshot::decompress(lz.data(), n, back.data(),
+                                      back.size() + 1),
+                "short output rejected");
+    const uint8_t badOffset[] = {0x10, 'a', 0x40, 0x00};  // 1 literal, far back
+    ok &= check(!snapshot::decompress(badOffset, sizeof(badOffset),
+                                      back.data(), 5),
+                "offset before the start rejected");
+    for (int i = 0; i < 2000; i++) {  // must not crash, result does not matter
+        vector<uint8_t> bad(lz.begin(), lz.begin() + n);
+        for (int j = 0; j < 4; j++) bad[rng() % n] = rng();
+        snapshot::decompress(bad.data(), bad.size(), back.data(),
+                             back.size());
+    }
+    return ok;
+}
+
+/** smooth depth plane with noise, like a camera frame */
+static matPtr depthPlane(int rows, int cols, mt19937& rng)
+{
+    matPtr m(new cv::Mat(rows, cols, CV_32FC1));
+    normal_distribution<float> noise(0.f, 0.002f);
+    for (int y = 0; y < rows; y++) {
+        float* p = m->ptr<float>(y);
+        for (int x = 0; x < cols; x++) {
+            p[x] = 1.5f + 0.001f * x + 0.0005f * y + noise(rng);
+        }
+    }
+    return m;
+}
+
+static matPtr amplPlane(int rows, int cols, mt19937& rng)
+{
+    matPtr m(new cv::Mat(rows, cols, CV_16UC1));
+    for (int y = 0; y < rows; y++) {
+        uint16_t* p = m->ptr<uint16_t>(y);
+        for (int x = 0; x < cols; x++) p[x] = 800 + (x ^ y) % 64 + rng() % 8;
+    }
+    return m;
+}
+
+static bool sameMat(const Frame& a, const Frame& b, const string& key)
+{
+    if (!b.hasKey(key) || b.getDataType(key) != Frame::Mat) return false;
+    matPtr x = a.getMatPtr(key), y = b.getMatPtr(key);
+    return x->rows == y->rows && x->cols == y->cols &&
+           x->type() == y->type() &&
+           !memcmp(x->data, y->data, x->total() * x->elemSize());
+}
+
+static bool testFrame(bool compress)
+{
+    const string tag = compress ? " (compressed)" : " (raw)";
+    const string path = "/tmp/toffy_test_snapshot.tfs";
+    mt19937 rng(3);
+
+    Frame f;
+    f.addData("depth", depthPlane(48, 64, rng));
+    f.addData("ampl", amplPlane(48, 64, rng));
+    matPtr mask(new cv::Mat(48, 64, CV_8UC1));
+    for (size_t i = 0; i < mask->total(); i++) mask->data[i] = i % 7 == 0;
+    f.addData("mask", mask);
+    matPtr xyz(new cv::Mat(3, 5, CV_32FC3));
+    for (size_t i = 0; i < xyz->total() * 3; i++) {
+        ((float*)xyz->data)[i] = i * 0.25f;
+    }
+    f.addData("xyz", xyz);
+    f.addData("empty", matPtr(new cv::Mat(0, 0, CV_32FC1)));
+    f.addData("fc", 1234u);
+    f.addData("counter", -5);
+    f.addData("flag", true);
+    f.addData("gain", 0.1f);
+    f.addData("scale", 1e-300);
+    f.addData("name", string("cam0"), Frame::String);
+    f.addData("unset", boost::any(vector<int>()));  // no slot type
+
+    const char* names[] = {"depth", "ampl", "mask",  "xyz",  "empty", "fc",
+                           "counter", "flag", "gain", "scale", "name",
+                           "unset", "missing"};
+    vector<string> keys(names, names + sizeof(names) / sizeof(names[0]));
+
+    bool ok = check(snapshot::write(path, f, keys, compress), "write" + tag);
+    Frame g;
+    g.addData("keep", 1);
+    ok &= check(snapshot::read(path, g), "read" + tag);
+    for (const char* k : {"depth", "ampl", "mask", "xyz", "empty"}) {
+        ok &= check(sameMat(f, g, k), string(k) + tag);
+    }
+    ok &= check(g.getDataType("fc") == Frame::Uint && g.getUInt("fc") == 1234,
+                "uint" + tag);
+    ok &= check(g.getDataType("counter") == Frame::Int &&
+                    g.getInt("counter") == -5,
+                "int" + tag);
+    ok &= check(g.getBool("flag"), "bool" + tag);
+    ok &= check(g.getFloat("gain") == 0.1f, "float" + tag);
+    ok &= check(g.getDouble("scale") == 1e-300, "double" + tag);
+    ok &= check(g.getString("name") == "cam0", "string" + tag);
+    ok &= check(!g.hasKey("unset") && !g.hasKey("missing"), "skipped" + tag);
+    ok &= check(g.hasKey("keep"), "read keeps other slots" + tag);
+
+    Frame h;
+    ok &= check(snapshot::read(path, h, vector<string>(1, "counter")) &&
+                    !h.hasKey("counter") && h.hasKey("fc"),
+                "skip list" + tag);
+
+    // truncated, grown and foreign files
+    size_t size = boost::filesystem::file_size(path);
+    for (size_t cut : {size - 1, size / 2, (size_t)40, (size_t)3}) {
+        ok &= check(truncate(path.c_str(), cut) == 0, "truncate");
+        Frame t;
+        t.addData("keep", 1);
+        ok &= check(!snapshot::read(path, t) && !t.hasKey("depth") &&
+                        t.hasKey("keep"),
+                    "truncated to " + to_string(cut) + tag);
+        snapshot::write(path, f, keys, compress);
+    }
+    // a depth slot claiming 2^20 x 2^20 pixels, more than its payload holds
+    snapshot::SnapshotSlot slot;
+    FILE* file = fopen(path.c_str(), "r+b");
+    fseek(file, sizeof(snapshot::SnapshotHeader), SEEK_SET);
+    ok &= check(fread(&slot, sizeof(slot), 1, file) == 1, "read slot");
+    slot.rows = slot.cols = 1 << 20;
+    slot.rawSize = (uint64_t)slot.rows * slot.cols * sizeof(float);
+    fseek(file, sizeof(snapshot::SnapshotHeader), SEEK_SET);
+    fwrite(&slot, sizeof(slot), 1, file);
+    fclose(file);
+    Frame big;
+    ok &= check(!snapshot::read(path, big) && !big.hasKey("depth"),
+                "oversized mat" + tag);
+    snapshot::write(path, f, keys, compress);
+
+    file = fopen(path.c_str(), "r+b");
+    fseek(file, 0, SEEK_SET);
+    fputc('X', file);
+    fclose(file);
+    Frame t;
+    ok &= check(!snapshot::read(path, t), "bad magic" + tag);
+    ok &= check(!snapshot::read("/tmp/does/not/exist.tfs", t), "missing");
+    remove(path.c_str());
+    return ok;
+}
+
+static bool testFilters()
+{
+    namespace fs = boost::filesystem;
+    const string dir = "/tmp/toffy_test_snapshot";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    bool ok = true;
+
+    boost::property_tree::ptree pt;
+    pt.put("options.path", dir);
+    pt.put("options.prefix", "dump");
+    pt.put("options.compress", true);
+    ExportSnapshot exp;
+    exp.updateConfig(pt);
+    mt19937 rng(5);
+    for (unsigned int i = 0; i < 3; i++) {
+        Frame in, out;
+        in.addData("depth", depthPlane(12, 16, rng));
+        in.addData("ampl", amplPlane(12, 16, rng));
+        in.addData("fc", 100 + i);
+        if (i) in.addData("ts", 5000 + i);  // the first one gets 1000
+        ok &= check(exp.filter(in, out), "export");
+    }
+    ok &= check(fs::exists(dir + "/dump_0001.tfs") &&
+                    fs::exists(dir + "/dump_0003.tfs") &&
+                    !fs::exists(dir + "/dump_0004.tfs"),
+                "exported file names");
+
+    pt.put("options.start", 1);
+    import::ImportSnapshot imp;
+    imp.updateConfig(pt);
+    const unsigned int fcs[] = {100, 101, 102, 100, 101};
+    const unsigned int tss[] = {1000, 5001, 5002, 1000, 5001};
+    for (int i = 0; i < 5; i++) {
+        Frame in, out;
+        ok &= check(imp.filter(in, out), "import " + to_string(i));
+        ok &= check(out.optUInt("fc", 0) == fcs[i] &&
+                        out.optUInt("ts", 0) == tss[i],
+                    "fc and ts of " + to_string(i));
+        ok &= check(out.hasKey("depth") && out.hasKey("ampl") &&
+                        !out.hasKey("counter"),
+                    "slots of " + to_string(i));
+    }
+
+    pt.put("options.start", 7);
+    imp.updateConfig(pt);
+    Frame in, out;
+    ok &= check(!imp.filter(in, out), "missing start file fails");
+
+    fs::remove_all(dir);
+    return ok;
+}
+
+static double ms(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0)
+        .count();
+}
+
+static void bench()
+{
+    const string path = "/tmp/toffy_bench_snapshot.tfs";
+    mt19937 rng(11);
+    Frame f;
+    f.addData("depth", depthPlane(480, 640, rng));
+    f.addData("ampl", amplPlane(480, 640, rng));
+    f.addData("fc", 1u);
+    vector<string> keys = {"depth", "ampl", "fc"};
+
+    for (bool compress : {false, true}) {
+        const int n = 20;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) snapshot::write(path, f, keys, compress);
+        double w = ms(t0) / n;
+        t0 = chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            Frame g;
+            snapshot::read(path, g);
+        }
+        double r = ms(t0) / n;
+        cout << "640x480 depth+ampl " << (compress ? "lz " : "raw")
+             << ": " << boost::filesystem::file_size(path) / 1024
+             << " KB, write " << w << " ms, read " << r << " ms" << endl;
+    }
+    remove(path.c_str());
+}
+
+int main()
+{
+    bool ok = testLz();
+    ok &= testFrame(false);
+    ok &= testFrame(true);
+    ok &= testFilters();
+    bench();
+    return testResult(ok);
+}
@@ -0,0 +1,234 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the synthetic capturer:
+ *
+ * - an empty scene without noise is the floor at the configured distance,
+ *   in depth as well as in x/y/z.
+ * - a frame only depends on seed and frame counter, not on the frames
+ *   rendered before or on the instance.
+ * - the dropout rate is met, with 0 or NaN.
+ * - with a loop the content repeats, the frame counter does not.
+ * - the outputs and metadata follow the frame mode.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <toffy/capture/synthetic.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+using namespace toffy::capturers;
+using boost::property_tree::ptree;
+
+static bool same(const cv::Mat& a, const cv::Mat& b)
+{
+    return a.size() == b.size() && a.type() == b.type() &&
+           memcmp(a.data, b.data, a.total() * a.elemSize()) == 0;
+}
+
+static ptree config(int boxes, int people, float noise, float dropout)
+{
+    ptree pt;
+    pt.put("options.width", 160);
+    pt.put("options.height", 120);
+    pt.put("options.ground", 3.0);
+    pt.put("options.boxes", boxes);
+    pt.put("options.people", people);
+    pt.put("options.noise", noise);
+    pt.put("options.dropout", dropout);
+    return pt;
+}
+
+static bool testFloor()
+{
+    bool ok = true;
+    SyntheticCapturer s;
+    ptree pt = config(0, 0, 0, 0);
+    pt.put("options.frameMode", "xyzAmp");
+    s.updateConfig(pt);
+
+    Frame f;
+    ok = check(s.filter(f, f), "filter") && ok;
+    ok = check(!f.hasKey("depth") && f.hasKey("ampl") && f.hasKey("x"),
+               "xyzAmp outputs") &&
+         ok;
+    ok = check(f.getUInt("fc") == 0 && s.nextFc() == 1, "fc") && ok;
+    s.filter(f, f);
+    ok = check(f.getUInt("fc") == 1 && f.getUInt("ts") == 40, "ts") && ok;
+
+    const cv::Mat& z = *f.getMatPtr("z");
+    bool flat = true;
+    for (int y = 0; y < z.rows; y++) {
+        for (int x = 0; x < z.cols; x++) {
+            flat = flat && std::abs(z.at<short>(y, x) - 3000) <= 1;
+        }
+    }
+    ok = check(flat, "floor z") && ok;
+    // 90 degrees: the border column sees the floor 3 m to the side
+    ok = check(std::abs(f.getMatPtr("x")->at<short>(60, 159) - 3000) < 40,
+               "floor x") &&
+         ok;
+
+    pt.put("options.frameMode", "distAmp");
+    s.updateConfig(pt);
+    s.filter(f, f);
+    const cv::Mat& d = *f.getMatPtr("depth");
+    ok = check(std::abs(d.at<float>(60, 80) - 3.f) < 0.01f &&
+                   d.at<float>(0, 0) > d.at<float>(60, 80),
+               "floor depth") &&
+         ok;
+    return ok;
+}
+
+static bool testDeterminism()
+{
+    bool ok = true;
+    ptree pt = config(10, 20, 0.02f, 0.05f);
+    SyntheticCapturer a, b;
+    a.updateConfig(pt);
+    b.updateConfig(pt);
+
+    Frame fa, fb, fc;
+    for (int i = 0; i < 5; i++) a.filter(fa, fa);
+    a.render(37, fa);
+    b.render(37, fb);
+    ok = check(same(*fa.getMatPtr("depth"), *fb.getMatPtr("depth")) &&
+                   same(*fa.getMatPtr("ampl"), *fb.getMatPtr("ampl")),
+               "same frame") &&
+         ok;
+    b.render(38, fc);
+    ok = check(!same(*fb.getMatPtr("depth"), *fc.getMatPtr("depth")),
+               "next frame differs") &&
+         ok;
+
+    // the people come closer than the floor
+    const cv::Mat& d = *fb.getMatPtr("depth");
+    float nearest = 10;
+    for (int y = 0; y < d.rows; y++) {
+        for (int x = 0; x < d.cols; x++) {
+            float v = d.at<float>(y, x);
+            if (v > 0) nearest = std::min(nearest, v);
+        }
+    }
+    ok = check(nearest < 2.f, "objects") && ok;
+
+    pt.put("options.seed", 2);
+    b.updateConfig(pt);
+    b.render(37, fb);
+    ok = check(!same(*fa.getMatPtr("depth"), *fb.getMatPtr("depth")),
+               "seed changes the scene") &&
+         ok;
+    return ok;
+}
+
+static bool testDropout()
+{
+    bool ok = true;
+    const float rate = 0.05f;
+    ptree pt = config(2, 3, 0.01f, rate);
+    SyntheticCapturer s;
+    s.updateConfig(pt);
+    Frame f;
+    s.filter(f, f);
+    const cv::Mat& d = *f.getMatPtr("depth");
+    const cv::Mat& a = *f.getMatPtr("ampl");
+    int zeros = 0, consistent = 0;
+    for (int y = 0; y < d.rows; y++) {
+        for (int x = 0; x < d.cols; x++) {
+            bool z = d.at<float>(y, x) == 0;
+            zeros += z;
+            consistent += z == (a.at<uint16_t>(y, x) == 0);
+        }
+    }
+    double measured = (double)zeros / d.total();
+    cout << "dropout " << measured << endl;
+    ok = check(std::abs(measured - rate) < 0.01, "dropout rate") && ok;
+    ok = check(consistent == (int)d.total(), "no amplitude for dropouts") &&
+         ok;
+
+    pt.put("options.nanDropout", true);
+    s.updateConfig(pt);
+    s.filter(f, f);
+    int nans = 0;
+    for (int y = 0; y < d.rows; y++) {
+        for (int x = 0; x < d.cols; x++) {
+            nans += std::isnan(d.at<float>(y, x));
+        }
+    }
+    ok = check(std::abs((double)nans / d.total() - rate) < 0.01, "NaN rate") &&
+         ok;
+    return ok;
+}
+
+static bool testLoop()
+{
+    bool ok = true;
+    ptree pt = config(2, 3, 0.01f, 0.01f);
+    pt.put("options.loop", 4);
+    SyntheticCapturer s;
+    s.updateConfig(pt);
+
+    Frame f;
+    vector<cv::Mat> depth;
+    for (int i = 0; i < 9; i++) {
+        s.filter(f, f);
+        depth.push_back(f.getMatPtr("depth")->clone());
+    }
+    ok = check(same(depth[1], depth[5]) && same(depth[0], depth[8]),
+               "loop repeats") &&
+         ok;
+    ok = check(!same(depth[1], depth[2]), "loop frames differ") && ok;
+    ok = check(f.getUInt("fc") == 8, "fc continues") && ok;
+
+    SyntheticCapturer plain;
+    pt.put("options.loop", 0);
+    plain.updateConfig(pt);
+    plain.render(1, f);
+    ok = check(same(depth[5], *f.getMatPtr("depth")), "loop content") && ok;
+    return ok;
+}
+
+int main()
+{
+    bool ok = testFloor();
+    ok = testDeterminism() && ok;
+    ok = testDropout() && ok;
+    ok = testLoop() && ok;
+
+    // 640x480 with 1000 objects
+    SyntheticCapturer s;
+    ptree pt = config(500, 500, 0.01f, 0.01f);
+    pt.put("options.width", 640);
+    pt.put("options.height", 480);
+    s.updateConfig(pt);
+    Frame f;
+    s.filter(f, f);
+    const int frames = 20;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) s.filter(f, f);
+    cout << "640x480, 1000 objects: "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - t0)
+                    .count() /
+                frames
+         << " ms/frame" << endl;
+
+    return testResult(ok);
+}
@@ -0,0 +1,162 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the Tracer:
+ *
+ * - nothing is recorded while disabled, and a disabled scope is cheap.
+ * - events of several threads end up on their own tracks, in order,
+ *   with the frame numbers set by the threads.
+ * - a full ring keeps the newest events.
+ * - the dump is valid JSON, also while the threads are writing.
+ */
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <toffy/trace.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+namespace fs = boost::filesystem;
+using boost::property_tree::ptree;
+
+static const string outer = "outer", inner = "inner \"quoted\"";
+
+static void work(int thread, int frames)
+{
+    Tracer::setThreadName("worker " + to_string(thread));
+    for (int n = 0; n < frames; n++) {
+        Tracer::setFrame(n);
+        TraceScope a(outer);
+        TraceScope b(inner);
+    }
+}
+
+/** per track: events in time order, balanced, frames ascending */
+static bool checkTrace(const string& file, bool complete, size_t& events,
+                       size_t& tracks)
+{
+    ptree pt;
+    try {
+        boost::property_tree::read_json(file, pt);
+    } catch (std::exception& e) {
+        cout << e.what() << endl;
+        return false;
+    }
+    bool ok = true;
+    map<int, double> lastTs;
+    map<int, int> depth, lastFrame;
+    events = 0;
+    for (const ptree::value_type& v : pt.get_child("traceEvents")) {
+        const ptree& e = v.second;
+        int tid = e.get<int>("tid");
+        string ph = e.get<string>("ph");
+        if (ph == "M") continue;
+        events++;
+        double ts = e.get<double>("ts");
+        int frame = e.get<int>("args.frame");
+        ok = check(ts >= lastTs[tid], "time order") && ok;
+        ok = check(!lastFrame.count(tid) || frame >= lastFrame[tid],
+                   "frame order") &&
+             ok;
+        lastTs[tid] = ts;
+        lastFrame[tid] = frame;
+        depth[tid] += ph == "B" ? 1 : -1;
+    }
+    tracks = lastTs.size();
+    for (map<int, int>::const_iterator it = depth.begin();
+         complete && it != depth.end(); ++it) {
+        ok = check(it->second == 0, "balanced") && ok;
+    }
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    string file =
+        (fs::temp_directory_path() / fs::unique_path("%%%%-trace.json"))
+            .string();
+
+    // off: no events, a scope costs a load
+    const int loops = 10000000;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        TraceScope s(outer);
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0)
+                    .count() /
+                loops;
+    cout << "disabled scope: " << ns << " ns" << endl;
+    ok = check(Tracer::size() == 0, "nothing recorded while off") && ok;
+
+    Tracer::enable(1 << 14);
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i < loops / 100; i++) {
+        TraceScope s(outer);
+    }
+    ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0)
+             .count() /
+         (loops / 100 * 2);
+    cout << "enabled event: " << ns << " ns" << endl;
+    Tracer::clear();
+
+    // 4 threads, 1000 frames each, 4 events per frame
+    const int threads = 4, frames = 1000;
+    boost::thread_group group;
+    for (int t = 0; t < threads; t++) {
+        group.create_thread(boost::bind(work, t, frames));
+    }
+    // dump while writing
+    ok = check(Tracer::saveChromeTrace(file), "save while running") && ok;
+    size_t events, tracks;
+    ok = check(checkTrace(file, false, events, tracks), "valid while running") &&
+         ok;
+    group.join_all();
+
+    ok = check(Tracer::saveChromeTrace(file), "save") && ok;
+    ok = check(checkTrace(file, true, events, tracks), "valid trace") && ok;
+    ok = check(events == (size_t)threads * frames * 4, "all events") && ok;
+    ok = check(tracks == (size_t)threads, "one track per thread") && ok;
+
+    // wrap: a 16 event ring keeps the last 16
+    Tracer::clear();
+    Tracer::enable(16);
+    boost::thread small(work, 9, 100);
+    small.join();
+    Tracer::disable();
+    ok = check(Tracer::size() == 16, "ring keeps newest") && ok;
+    Tracer::saveChromeTrace(file);
+    ptree pt;
+    boost::property_tree::read_json(file, pt);
+    int lastFrame = -1;
+    for (const ptree::value_type& v : pt.get_child("traceEvents")) {
+        if (v.second.get<string>("ph") != "M") {
+            lastFrame = v.second.get<int>("args.frame");
+        }
+    }
+    ok = check(lastFrame == 99, "newest frame kept") && ok;
+
+    fs::remove(file);
+    return testResult(ok);
+}
@@ -0,0 +1,280 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the Tracker assignment:
+ *
+ * - the grid finds the same neighbours as a full search.
+ * - assignOptimal() reaches the least cost of an exhaustive search on small
+ *   random problems, and does not depend on the blob order.
+ * - objects whose paths cross keep their ids, where the greedy match
+ *   loses or swaps them.
+ *
+ * and compares the speed of both on crowds of up to 1000 walkers.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <toffy/tracking/assignment.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy::tracking;
+
+/** total distance, unmatched tracks cost gate */
+static double cost(const vector<cv::Point2f>& tracks,
+                   const vector<cv::Point2f>& blobs, double gate,
+                   const vector<int>& match)
+{
+    double c = 0;
+    for (size_t t = 0; t < tracks.size(); t++) {
+        c += match[t] < 0 ? gate : cv::norm(tracks[t] - blobs[match[t]]);
+    }
+    return c;
+}
+
+/** least cost over all matchings, tracks t.. with blobs not in used */
+static double bruteForce(const vector<cv::Point2f>& tracks,
+                         const vector<cv::Point2f>& blobs, double gate,
+                         size_t t, vector<char>& used)
+{
+    if (t == tracks.size()) return 0;
+    double best = gate + bruteForce(tracks, blobs, gate, t + 1, used);
+    for (size_t b = 0; b < blobs.size(); b++) {
+        double d = cv::norm(tracks[t] - blobs[b]);
+        if (used[b] || d > gate) continue;
+        used[b] = 1;
+        best = min(best, d + bruteForce(tracks, blobs, gate, t + 1, used));
+        used[b] = 0;
+    }
+    return best;
+}
+
+static bool valid(const vector<int>& match, size_t blobs)
+{
+    vector<char> used(blobs, 0);
+    for (size_t t = 0; t < match.size(); t++) {
+        if (match[t] < 0) continue;
+        if (match[t] >= (int)blobs || used[match[t]]) return false;
+        used[match[t]] = 1;
+    }
+    return true;
+}
+
+static bool testGrid()
+{
+    mt19937 rng(1);
+    uniform_real_distribution<float> pos(-50.f, 700.f);
+    bool ok = true;
+    for (int run = 0; run < 20; run++) {
+        vector<cv::Point2f> pts(rng() % 300);
+        for (size_t i = 0; i < pts.size(); i++) {
+            pts[i] = cv::Point2f(pos(rng), pos(rng) * (run % 2 ? 1.f : .01f));
+        }
+        float radius = 1.f + rng() % 40;
+        SpatialGrid grid;
+        grid.build(pts, radius);
+        vector<int> found;
+        for (int q = 0; q < 50; q++) {
+            cv::Point2f p(pos(rng), pos(rng));
+            grid.query(p, radius, found);
+            vector<int> expected;
+            for (size_t i = 0; i < pts.size(); i++) {
+                double dx = (double)pts[i].x - p.x, dy = (double)pts[i].y - p.y;
+                if (dx * dx + dy * dy <= (double)radius * radius) {
+                    expected.push_back(i);
+                }
+            }
+            ok &= check(found == expected, "grid query");
+        }
+    }
+    SpatialGrid empty;
+    vector<int> found(3, 1);
+    empty.build(vector<cv::Point2f>(), 5.f);
+    empty.query(cv::Point2f(0, 0), 5.f, found);
+    return ok && check(found.empty(), "empty grid");
+}
+
+static bool testOptimal()
+{
+    mt19937 rng(2);
+    uniform_real_distribution<float> pos(0.f, 40.f);
+    bool ok = true;
+    for (int run = 0; run < 500; run++) {
+        vector<cv::Point2f> tracks(rng() % 7), blobs(rng() % 7);
+        for (size_t i = 0; i < tracks.size(); i++) {
+            tracks[i] = cv::Point2f(pos(rng), pos(rng));
+        }
+        for (size_t i = 0; i < blobs.size(); i++) {
+            blobs[i] = cv::Point2f(pos(rng), pos(rng));
+        }
+        double gate = 3. + rng() % 20;
+        vector<int> match;
+        assignOptimal(tracks, blobs, gate, match);
+        vector<char> used(blobs.size(), 0);
+        double best = bruteForce(tracks, blobs, gate, 0, used);
+        ok &= check(valid(match, blobs.size()), "valid matching");
+        ok &= check(fabs(cost(tracks, blobs, gate, match) - best) < 1e-6,
+                    "optimal cost, run " + to_string(run));
+        for (size_t t = 0; t < match.size(); t++) {
+            ok &= check(match[t] < 0 ||
+                            cv::norm(tracks[t] - blobs[match[t]]) <= gate,
+                        "gate");
+        }
+
+        // the same pairs with the blobs in another order
+        vector<int> perm(blobs.size());
+        for (size_t i = 0; i < perm.size(); i++) perm[i] = i;
+        shuffle(perm.begin(), perm.end(), rng);
+        vector<cv::Point2f> shuffled(blobs.size());
+        for (size_t i = 0; i < perm.size(); i++) shuffled[i] = blobs[perm[i]];
+        vector<int> match2;
+        assignOptimal(tracks, shuffled, gate, match2);
+        for (size_t t = 0; t < match.size(); t++) {
+            ok &= check((match[t] < 0 && match2[t] < 0) ||
+                            (match[t] >= 0 && match2[t] >= 0 &&
+                             perm[match2[t]] == match[t]),
+                        "independent of blob order");
+        }
+    }
+    return ok;
+}
+
+static bool testCrossing()
+{
+    bool ok = true;
+    vector<int> match;
+
+    // A is nearest to B's blob: greedy leaves B without a blob
+    vector<cv::Point2f> tracks = {cv::Point2f(0, 0), cv::Point2f(1, 0)};
+    vector<cv::Point2f> blobs = {cv::Point2f(.6f, 0), cv::Point2f(-1.5f, 0)};
+    ok &= check(assignGreedy(tracks, blobs, 2., match) == 1,
+                "greedy loses a track");
+    ok &= check(assignOptimal(tracks, blobs, 2., match) == 2 &&
+                    match[0] == 1 && match[1] == 0,
+                "optimal keeps both tracks");
+
+    // two people walking towards each other on close lanes, 5 px per
+    // frame. Matching last positions swaps them where they meet; matched
+    // at the predicted positions both keep their ids.
+    cv::Point2f a(0, 0), b(57, 3), va(5, 0), vb(-5, 0);
+    vector<cv::Point2f> last = {a, b}, prev = {a - va, b - vb};
+    int swapsLast = 0, swapsPredicted = 0;
+    for (int frame = 0; frame < 12; frame++) {
+        a = a + va;
+        b = b + vb;
+        vector<cv::Point2f> now = {b, a};  // blobs come in any order
+        vector<cv::Point2f> predicted = {last[0] + (last[0] - prev[0]),
+                                         last[1] + (last[1] - prev[1])};
+        assignOptimal(last, now, 8., match);
+        swapsLast += match[0] != 1 || match[1] != 0;
+        assignOptimal(predicted, now, 8., match);
+        swapsPredicted += match[0] != 1 || match[1] != 0;
+        prev = last;
+        last = {a, b};
+    }
+    ok &= check(swapsLast > 0, "last positions swap crossing tracks");
+    ok &= check(swapsPredicted == 0, "predicted positions keep ids");
+    return ok;
+}
+
+struct Walker {
+    cv::Point2f pos, vel;
+};
+
+/**
+ * @p n walkers with constant speed bouncing in 640x480; tracks are matched
+ * at their predicted position. Counts frames where a track got the blob
+ * of another walker.
+ */
+static int crowd(int n, bool optimal, double* ms, AssignmentStats* stats)
+{
+    mt19937 rng(n);
+    uniform_real_distribution<float> px(0.f, 640.f), py(0.f, 480.f),
+        angle(0.f, 6.2832f), speed(1.f, 4.f);
+    normal_distribution<float> noise(0.f, .3f);
+    vector<Walker> walkers(n);
+    for (int i = 0; i < n; i++) {
+        float a = angle(rng), s = speed(rng);
+        walkers[i].pos = cv::Point2f(px(rng), py(rng));
+        walkers[i].vel = cv::Point2f(s * cos(a), s * sin(a));
+    }
+    vector<cv::Point2f> last(n), prev(n), predicted(n), blobs(n);
+    for (int i = 0; i < n; i++) last[i] = prev[i] = walkers[i].pos;
+
+    int wrong = 0;
+    double total = 0;
+    vector<int> match, order(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    for (int frame = 0; frame < 50; frame++) {
+        for (int i = 0; i < n; i++) {
+            Walker& w = walkers[i];
+            w.pos = w.pos + w.vel;
+            if (w.pos.x < 0 || w.pos.x > 640) w.vel.x = -w.vel.x;
+            if (w.pos.y < 0 || w.pos.y > 480) w.vel.y = -w.vel.y;
+            predicted[i] = last[i] + (last[i] - prev[i]);
+        }
+        shuffle(order.begin(), order.end(), rng);
+        for (int k = 0; k < n; k++) {
+            blobs[k] = walkers[order[k]].pos +
+                       cv::Point2f(noise(rng), noise(rng));
+        }
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        if (optimal) {
+            assignOptimal(predicted, blobs, 10., match, stats);
+        } else {
+            assignGreedy(predicted, blobs, 10., match);
+        }
+        total += chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                 t0)
+                     .count();
+        for (int i = 0; i < n; i++) {
+            if (match[i] < 0 || order[match[i]] != i) wrong++;
+            prev[i] = last[i];
+            // the tracker would continue a wrong match; reset to the
+            // truth so every frame counts on its own
+            last[i] = walkers[i].pos;
+        }
+    }
+    *ms = total / 50;
+    return wrong;
+}
+
+int main()
+{
+    bool ok = testGrid();
+    ok &= testOptimal();
+    ok &= testCrossing();
+
+    int sizes[] = {10, 100, 300, 1000};
+    for (int n : sizes) {
+        double msGreedy, msOptimal;
+        AssignmentStats stats;
+        int wrongGreedy = crowd(n, false, &msGreedy, NULL);
+        int wrongOptimal = crowd(n, true, &msOptimal, &stats);
+        cout << n << " walkers: greedy " << msGreedy << " ms, " << wrongGreedy
+             << " wrong; optimal " << msOptimal << " ms, " << wrongOptimal
+             << " wrong, " << stats.candidates << " candidates, "
+             << stats.components << " groups, largest " << stats.largest
+             << endl;
+        ok &= check(wrongOptimal <= wrongGreedy, "optimal not worse");
+    }
+    return testResult(ok);
+}
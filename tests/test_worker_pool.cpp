@@ -0,0 +1,282 @@
+/*
+   Copyright 2023 Simon Vogl <svogl@voxel.at>
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/**
+ * Checks the shared WorkerPool:
+ *
+ * - the threads start with the first task.
+ * - all submitted tasks run, also those submitted from tasks, and idle
+ *   workers steal them.
+ * - parallelFor covers each index once for any grain, nests without
+ *   deadlock and rethrows the exception of a chunk.
+ * - per worker counters and pinning to a cpu.
+ * - a FilterThread lane on the pool processes frames in order, never
+ *   enters its filter twice at once and stops cleanly.
+ * - a task of a single worker pool waiting for a lane on the same pool
+ *   runs the lane itself.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#include <boost/thread/thread.hpp>
+
+#include <toffy/filterThread.hpp>
+#include <toffy/workerPool.hpp>
+
+#include "testUtil.hpp"
+
+using namespace std;
+using namespace toffy;
+
+#ifdef __linux__
+/** threads of this process */
+static int threads()
+{
+    int n = 0;
+    DIR* d = opendir("/proc/self/task");
+    if (!d) return -1;
+    while (dirent* e = readdir(d)) n += e->d_name[0] != '.';
+    closedir(d);
+    return n;
+}
+#endif
+
+static bool testLazy()
+{
+    bool ok = true;
+#ifdef __linux__
+    int before = threads();
+    WorkerPool pool(4);
+    ok &= check(pool.size() == 4, "lazy size");
+    ok &= check(threads() == before, "no threads before the first task");
+    atomic<int> count(0);
+    pool.submit([&count] { count++; });
+    ok &= check(threads() >= before + 4, "threads after the first task");
+    while (!count) boost::this_thread::yield();
+#endif
+    return ok;
+}
+
+static void spawn(WorkerPool* pool, atomic<int>* count, int depth)
+{
+    (*count)++;
+    if (!depth) return;
+    for (int i = 0; i < 4; i++) {
+        pool->submit(std::bind(&spawn, pool, count, depth - 1));
+    }
+}
+
+static bool testSubmit()
+{
+    bool ok = true;
+    atomic<int> count(0);
+    {
+        WorkerPool pool(4);
+        ok &= check(pool.size() == 4, "size");
+        pool.submit(std::bind(&spawn, &pool, &count, 5));
+        pool.submit([] { throw runtime_error("dropped"); });
+    }  // drains
+    ok &= check(count == 1 + 4 + 16 + 64 + 256 + 1024, "all tasks ran");
+    return ok;
+}
+
+static bool testParallelFor()
+{
+    bool ok = true;
+    WorkerPool pool(4);
+    size_t grains[] = {0, 1, 7, 1000, 5000};
+    for (size_t grain : grains) {
+        vector<atomic<int> > hits(3001);
+        for (auto& h : hits) h = 0;
+        pool.parallelFor(1, 3001, grain, [&](size_t b, size_t e) {
+            for (size_t i = b; i < e; i++) hits[i]++;
+        });
+        bool once = hits[0] == 0;
+        for (size_t i = 1; i < hits.size(); i++) once &= hits[i] == 1;
+        ok &= check(once, "each index once, grain " + to_string(grain));
+    }
+
+    int calls = 0;
+    pool.parallelFor(5, 5, 1, [&](size_t, size_t) { calls++; });
+    ok &= check(calls == 0, "empty range");
+
+    // nested loops on all workers at once
+    atomic<long> sum(0);
+    pool.parallelFor(0, 16, 1, [&](size_t b, size_t) {
+        pool.parallelFor(0, 100, 3, [&](size_t b2, size_t e2) {
+            for (size_t i = b2; i < e2; i++) sum += b * 100 + i;
+        });
+    });
+    ok &= check(sum == 1600 * 1599 / 2, "nested");
+
+    bool thrown = false;
+    try {
+        pool.parallelFor(0, 100, 1, [](size_t b, size_t) {
+            if (b == 42) throw runtime_error("chunk 42");
+        });
+    } catch (const runtime_error& e) {
+        thrown = string(e.what()) == "chunk 42";
+    }
+    ok &= check(thrown, "exception rethrown");
+    return ok;
+}
+
+static bool testStats()
+{
+    bool ok = true;
+    WorkerPool pool(4);
+    // one worker fills its own queue, the others have to steal
+    pool.submit([&pool] {
+        for (int i = 0; i < 200; i++) {
+            pool.submit([] {
+                boost::this_thread::sleep(
+                    boost::posix_time::microseconds(200));
+            });
+        }
+    });
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    vector<WorkerPool::WorkerStats> s = pool.stats();
+    uint64_t tasks = 0, steals = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        tasks += s[i].tasks;
+        steals += s[i].steals;
+        ok &= check(s[i].utilization >= 0 && s[i].utilization <= 1,
+                    "utilization range");
+    }
+    ok &= check(tasks == 201, "task count");
+    ok &= check(steals > 0, "idle workers steal");
+    boost::property_tree::ptree pt = pool.getStats();
+    ok &= check(pt.get<int>("threads") == 4 &&
+                    pt.get_child("workers").size() == 4,
+                "stats ptree");
+    cout << "steals " << steals << ", utilization "
+         << pt.get<double>("utilization") << endl;
+    pool.resetStats();
+    ok &= check(pool.stats()[0].tasks == 0, "reset");
+
+#ifdef __linux__
+    WorkerPool pinned(2, {0});
+    atomic<int> elsewhere(0);
+    for (int i = 0; i < 64; i++) {
+        pinned.submit([&elsewhere] {
+            if (sched_getcpu() != 0) elsewhere++;
+        });
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    ok &= check(pinned.stats()[0].cpu == 0 && pinned.stats()[1].cpu == 0,
+                "pinned");
+    ok &= check(elsewhere == 0, "tasks run on the pinned cpu");
+#endif
+    return ok;
+}
+
+/** appends the frame counter, fails if entered twice at once */
+class CountFilter : public Filter
+{
+   public:
+    CountFilter() : Filter("count"), n(0), inside(0), overlap(false) {}
+
+    virtual bool filter(const Frame&, Frame& out)
+    {
+        if (inside++) overlap = true;
+        boost::this_thread::sleep(boost::posix_time::microseconds(100));
+        out.addData("n", ++n);
+        inside--;
+        return true;
+    }
+
+    unsigned int n;
+    atomic<int> inside;
+    bool overlap;
+};
+
+static bool testLane()
+{
+    bool ok = true;
+    WorkerPool pool(3);
+    CountFilter filter;
+    CountFilter* f = &filter;
+    {
+        FilterThread lane(f);
+        lane.init(2);
+        lane.start(&pool);
+        unsigned int last = 0;
+        bool ordered = true;
+        for (int i = 0; i < 200; i++) {
+            Frame* fr = lane.dequeue();
+            if (!fr) break;
+            ordered &= fr->getUInt("n") == last + 1;
+            last = fr->getUInt("n");
+            lane.enqueue(fr);
+        }
+        ok &= check(last == 200, "lane frames");
+        ok &= check(ordered, "lane order");
+        ok &= check(!f->overlap, "filter not entered twice");
+        lane.stop();
+        size_t processed = lane.processed();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        ok &= check(lane.processed() == processed, "stopped");
+        ok &= check(lane.dequeue() == NULL, "dequeue after stop");
+    }
+    return ok;
+}
+
+static bool testNestedLane()
+{
+    WorkerPool pool(1);
+    CountFilter f;
+    FilterThread lane(&f);
+    lane.init(1);
+    lane.start(&pool, false);
+
+    // the only worker waits for the lane, which needs a worker as well
+    Frame fr;
+    atomic<bool> done(false);
+    pool.submit([&] {
+        for (int i = 0; i < 10; i++) {
+            lane.enqueue(&fr);
+            if (lane.dequeue() != &fr) return;
+        }
+        done = true;
+    });
+    for (int i = 0; i < 500 && !done; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    if (!check(done, "nested lane")) {
+        // the worker is stuck, the pool cannot be joined
+        std::_Exit(testResult(false));
+    }
+    lane.stop();
+    return check(fr.getUInt("n") == 10, "nested lane frames");
+}
+
+int main()
+{
+    bool ok = testLazy();
+    ok &= testSubmit();
+    ok &= testParallelFor();
+    ok &= testStats();
+    ok &= testLane();
+    ok &= testNestedLane();
+    return testResult(ok);
+}